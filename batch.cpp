@@ -0,0 +1,458 @@
+#include "core/batchrunner.h"
+#include "core/joypad.h"
+#include "core/ppmwriter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    struct Options
+    {
+        unsigned int nbThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        unsigned int nbRepeats = 1;
+        Emulator::ExecutionMode executionMode = Emulator::ExecutionMode::Interpreter;
+        bool isScalingBenchmark = false;
+        std::string outputDirectory = ".";
+        std::string jobListFilePath;
+    };
+
+    void PrintUsage()
+    {
+        std::cout << "Usage: gb-batch [options] [job list file path]\n"
+                  << "Options:\n"
+                  << "  --threads N        Run the jobs on N threads (default: number of cores)\n"
+                  << "  --repeat N         Run every job of the list N times\n"
+                  << "  --block-cache      Execute cached blocks of pre-decoded instructions\n"
+                  << "  --jit              Translate hot blocks to native code\n"
+                  << "  --output-dir DIR   Directory of the screenshots (default: current directory)\n"
+                  << "  --scaling          Run the batch on 1, 2, 4... up to N threads, compare the speed and the results\n"
+                  << "\n"
+                  << "One job per line of the list, blank lines and lines starting with # are skipped:\n"
+                  << "  FRAMES OUTPUTS INPUTS ROM\n"
+                  << "  FRAMES   Number of emulated frames\n"
+                  << "  OUTPUTS  serial, screenshot or both separated by a comma, - for none\n"
+                  << "  INPUTS   FRAME:KEYS pairs separated by commas, - for none. KEYS are right, left, up, down,\n"
+                  << "           a, b, select and start joined by +, or - to release everything.\n"
+                  << "  ROM      Rest of the line, relative to the job list\n"
+                  << "The final state hash is always reported.\n";
+    }
+
+    bool ParseCount(int argc, char** argv, int& i, unsigned int& value)
+    {
+        const std::string arg{argv[i]};
+        if(i + 1 >= argc)
+        {
+            std::cout << "Missing value for " << arg << "\n";
+            return false;
+        }
+
+        char* end{};
+        const unsigned long parsedValue = std::strtoul(argv[++i], &end, 10);
+        if(*end != '\0' || parsedValue == 0)
+        {
+            std::cout << "Invalid value for " << arg << ": " << argv[i] << "\n";
+            return false;
+        }
+
+        value = static_cast<unsigned int>(parsedValue);
+        return true;
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; ++i)
+        {
+            const std::string arg{argv[i]};
+
+            if(arg == "--threads")
+            {
+                if(!ParseCount(argc, argv, i, options.nbThreads))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--repeat")
+            {
+                if(!ParseCount(argc, argv, i, options.nbRepeats))
+                {
+                    return false;
+                }
+            }
+            else if(arg == "--block-cache")
+            {
+                options.executionMode = Emulator::ExecutionMode::BlockCache;
+            }
+            else if(arg == "--jit")
+            {
+                options.executionMode = Emulator::ExecutionMode::JIT;
+            }
+            else if(arg == "--scaling")
+            {
+                options.isScalingBenchmark = true;
+            }
+            else if(arg == "--output-dir")
+            {
+                if(i + 1 >= argc)
+                {
+                    std::cout << "Missing value for " << arg << "\n";
+                    return false;
+                }
+
+                options.outputDirectory = argv[++i];
+            }
+            else if(!arg.empty() && arg[0] == '-')
+            {
+                std::cout << "Unknown option: " << arg << "\n";
+                return false;
+            }
+            else
+            {
+                options.jobListFilePath = arg;
+            }
+        }
+
+        return !options.jobListFilePath.empty();
+    }
+
+    bool ParseKeys(const std::string& text, uint8_t& keys)
+    {
+        static constexpr std::pair<const char*, Joypad::Key> s_KEY_NAMES[]
+        {
+            { "right", Joypad::Right }, { "left", Joypad::Left }, { "up", Joypad::Up }, { "down", Joypad::Down },
+            { "a", Joypad::A }, { "b", Joypad::B }, { "select", Joypad::Select }, { "start", Joypad::Start }
+        };
+
+        keys = 0;
+        if(text == "-")
+        {
+            return true;
+        }
+
+        std::istringstream stream{text};
+        std::string name;
+        while(std::getline(stream, name, '+'))
+        {
+            const auto key = std::find_if(std::begin(s_KEY_NAMES), std::end(s_KEY_NAMES),
+                                          [&name](const auto& keyName){ return name == keyName.first; });
+            if(key == std::end(s_KEY_NAMES))
+            {
+                return false;
+            }
+
+            keys |= key->second;
+        }
+
+        return true;
+    }
+
+    bool ParseInputs(const std::string& text, std::vector<BatchInput>& inputs)
+    {
+        if(text == "-")
+        {
+            return true;
+        }
+
+        std::istringstream stream{text};
+        std::string item;
+        while(std::getline(stream, item, ','))
+        {
+            const size_t separator = item.find(':');
+            if(separator == std::string::npos)
+            {
+                return false;
+            }
+
+            char* end{};
+            const std::string frameText = item.substr(0, separator);
+            const unsigned long long frame = std::strtoull(frameText.c_str(), &end, 10);
+            if(frameText.empty() || *end != '\0' || (!inputs.empty() && frame <= inputs.back().frame))
+            {
+                return false;
+            }
+
+            uint8_t keys;
+            if(!ParseKeys(item.substr(separator + 1), keys))
+            {
+                return false;
+            }
+
+            inputs.push_back({ frame, keys });
+        }
+
+        return true;
+    }
+
+    bool ParseOutputs(const std::string& text, BatchJob& job)
+    {
+        if(text == "-")
+        {
+            return true;
+        }
+
+        std::istringstream stream{text};
+        std::string output;
+        while(std::getline(stream, output, ','))
+        {
+            if(output == "serial")
+            {
+                job.isSerialOutputEnabled = true;
+            }
+            else if(output == "screenshot")
+            {
+                job.isScreenshotEnabled = true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool LoadJobList(const std::string& filePath, std::vector<BatchJob>& jobs)
+    {
+        std::ifstream file{filePath};
+        if(!file)
+        {
+            std::cout << "Unable to open job list: " << filePath << "\n";
+            return false;
+        }
+
+        const std::filesystem::path directory = std::filesystem::path{filePath}.parent_path();
+
+        std::string line;
+        for(unsigned int lineNumber = 1; std::getline(file, line); ++lineNumber)
+        {
+            std::istringstream stream{line};
+            std::string framesText;
+            if(!(stream >> framesText) || framesText[0] == '#')
+            {
+                continue;
+            }
+
+            // The ROM path takes the rest of the line, it may contain spaces
+            BatchJob job;
+            std::string outputsText;
+            std::string inputsText;
+            std::string romFilePath;
+            char* end{};
+            job.nbFrames = std::strtoull(framesText.c_str(), &end, 10);
+            stream >> outputsText >> inputsText >> std::ws;
+            std::getline(stream, romFilePath);
+            if(*end != '\0' || job.nbFrames == 0 || romFilePath.empty() || !ParseOutputs(outputsText, job) ||
+               !ParseInputs(inputsText, job.inputs))
+            {
+                std::cout << filePath << ":" << lineNumber << ": invalid job\n";
+                return false;
+            }
+
+            job.romFilePath = (directory / romFilePath).string();
+            jobs.push_back(std::move(job));
+        }
+
+        return true;
+    }
+
+    // Serial output on a single line
+    std::string Escape(const std::string& text)
+    {
+        std::ostringstream escaped;
+        for(const char c : text)
+        {
+            if(c == '\n')
+            {
+                escaped << "\\n";
+            }
+            else if(c == '\\')
+            {
+                escaped << "\\\\";
+            }
+            else if(c < 0x20 || c > 0x7E)
+            {
+                escaped << "\\x" << std::hex << std::setw(2) << std::setfill('0')
+                        << static_cast<unsigned int>(static_cast<uint8_t>(c)) << std::dec << std::setfill(' ');
+            }
+            else
+            {
+                escaped << c;
+            }
+        }
+
+        return escaped.str();
+    }
+
+    double ToSeconds(std::chrono::nanoseconds duration)
+    {
+        return std::chrono::duration<double>(duration).count();
+    }
+
+    // One tab separated line per job, then the totals
+    bool PrintResults(const std::vector<BatchJob>& jobs, const std::vector<BatchResult>& results, double seconds,
+                      unsigned int nbThreads, const std::string& outputDirectory)
+    {
+        bool isSuccessful = true;
+        uint64_t nbFrames{};
+        uint64_t nbInstructions{};
+        double jobSeconds{};
+        double longestJobSeconds{};
+
+        std::cout << "Job\tResult\tFrames\tInstructions\tTime (ms)\tState hash\tSerial\tROM\n";
+        for(size_t i = 0; i < jobs.size(); ++i)
+        {
+            const BatchJob& job = jobs[i];
+            const BatchResult& result = results[i];
+
+            std::cout << i << "\t" << (result.isLoaded ? "done" : "not loaded") << "\t" << job.nbFrames << "\t"
+                      << result.nbInstructions << "\t" << std::fixed << std::setprecision(2)
+                      << ToSeconds(result.duration) * 1000 << "\t"
+                      << std::hex << std::setfill('0') << std::setw(16) << result.stateHash << std::dec << std::setfill(' ')
+                      << "\t" << Escape(result.serialOutput) << "\t" << job.romFilePath << "\n";
+
+            if(!result.isLoaded)
+            {
+                isSuccessful = false;
+                continue;
+            }
+
+            if(result.screenshot != nullptr)
+            {
+                const std::string filePath = (std::filesystem::path{outputDirectory} / ("job-" + std::to_string(i) + ".ppm")).string();
+                if(!WritePPM(*result.screenshot, filePath))
+                {
+                    std::cout << "Unable to save screenshot: " << filePath << "\n";
+                    isSuccessful = false;
+                }
+            }
+
+            nbFrames += job.nbFrames;
+            nbInstructions += result.nbInstructions;
+            jobSeconds += ToSeconds(result.duration);
+            longestJobSeconds = std::max(longestJobSeconds, ToSeconds(result.duration));
+        }
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << "Jobs:             " << jobs.size() << "\n"
+                  << "Threads:          " << nbThreads << "\n"
+                  << "Wall time:        " << seconds << " s\n"
+                  << "Job time:         " << jobSeconds << " s, longest " << longestJobSeconds << " s\n"
+                  << "Frames:           " << nbFrames << "\n"
+                  << "Frames/sec:       " << nbFrames / seconds << "\n"
+                  << "Instructions/sec: " << nbInstructions / seconds << "\n";
+
+        return isSuccessful;
+    }
+
+    bool IsSameResult(const BatchResult& result, const BatchResult& reference)
+    {
+        return result.isLoaded == reference.isLoaded && result.stateHash == reference.stateHash &&
+               result.serialOutput == reference.serialOutput &&
+               (result.screenshot == nullptr || *result.screenshot == *reference.screenshot);
+    }
+
+    // The same batch on more and more threads: the results must not change, the speed should grow with the threads
+    bool RunScalingBenchmark(const std::vector<BatchJob>& jobs, const Options& options)
+    {
+        std::vector<unsigned int> threadCounts;
+        for(unsigned int nbThreads = 1; nbThreads < options.nbThreads; nbThreads *= 2)
+        {
+            threadCounts.push_back(nbThreads);
+        }
+        threadCounts.push_back(options.nbThreads);
+
+        std::cout << "Threads\tWall time (s)\tJobs/sec\tSpeedup\tEfficiency\n";
+
+        bool isSuccessful = true;
+        std::vector<BatchResult> referenceResults;
+        double referenceSeconds{};
+        for(unsigned int nbThreads : threadCounts)
+        {
+            BatchRunner runner{nbThreads};
+            runner.SetExecutionMode(options.executionMode);
+
+            using Clock = std::chrono::steady_clock;
+            const Clock::time_point start = Clock::now();
+            std::vector<BatchResult> results = runner.Run(jobs);
+            const double seconds = ToSeconds(Clock::now() - start);
+
+            if(referenceResults.empty())
+            {
+                referenceResults = std::move(results);
+                referenceSeconds = seconds;
+            }
+            else
+            {
+                for(size_t i = 0; i < jobs.size(); ++i)
+                {
+                    if(!IsSameResult(results[i], referenceResults[i]))
+                    {
+                        std::cout << "Job " << i << " ended differently on " << nbThreads << " threads\n";
+                        isSuccessful = false;
+                    }
+                }
+            }
+
+            const double speedup = referenceSeconds / seconds;
+            std::cout << std::fixed << std::setprecision(2) << nbThreads << "\t" << seconds << "\t" << jobs.size() / seconds
+                      << "\t" << speedup << "x\t" << speedup / nbThreads * 100 << "%\n";
+        }
+
+        for(const BatchResult& result : referenceResults)
+        {
+            isSuccessful = isSuccessful && result.isLoaded;
+        }
+
+        std::cout << "Hardware threads: " << std::thread::hardware_concurrency() << "\n"
+                  << "Results:          " << (isSuccessful ? "identical" : "different") << "\n";
+        return isSuccessful;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<BatchJob> jobs;
+    if(!LoadJobList(options.jobListFilePath, jobs))
+    {
+        return 1;
+    }
+
+    const size_t nbListedJobs = jobs.size();
+    jobs.reserve(nbListedJobs * options.nbRepeats);
+    for(unsigned int i = 1; i < options.nbRepeats; ++i)
+    {
+        jobs.insert(jobs.end(), jobs.begin(), jobs.begin() + static_cast<std::ptrdiff_t>(nbListedJobs));
+    }
+
+    if(options.isScalingBenchmark)
+    {
+        return RunScalingBenchmark(jobs, options) ? 0 : 1;
+    }
+
+    BatchRunner runner{options.nbThreads};
+    runner.SetExecutionMode(options.executionMode);
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    const std::vector<BatchResult> results = runner.Run(jobs);
+    const double seconds = ToSeconds(Clock::now() - start);
+
+    return PrintResults(jobs, results, seconds, runner.GetNbThreads(), options.outputDirectory) ? 0 : 1;
+}
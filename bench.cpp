@@ -0,0 +1,618 @@
+#include "core/cartridge.h"
+#include "core/cpu.h"
+#include "core/emulator.h"
+#include "core/memory.h"
+#include "core/ppu.h"
+#include "core/scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Where the synthetic streams start, past the cartridge header, and the end of the fixed ROM bank they fill
+    constexpr uint16_t s_CODE_START = 0x0150;
+    constexpr uint16_t s_CODE_END = 0x3FF0;
+
+    // Subroutine of the control flow stream, also the target of RST $38
+    constexpr uint16_t s_SUBROUTINE = 0x0038;
+
+    // Work area of the streams accessing memory through HL, and the top of their stack
+    constexpr uint16_t s_DATA_ADDR = 0xC800;
+    constexpr uint16_t s_STACK_TOP = 0xDFF0;
+
+    // Reads of the benchmarks are summed up here, so that the compiler cannot drop them
+    volatile unsigned int s_sink;
+
+    struct Options
+    {
+        unsigned int nbRepeats = 5;
+        bool isQuick = false;
+        std::string filter;
+        std::string outputFilePath;
+        std::string baselineFilePath;
+    };
+
+    struct Benchmark
+    {
+        std::string name;
+
+        // What one operation is, and how many a run does at full length
+        std::string unit;
+        uint64_t nbOperations;
+
+        // Runs the given number of operations, returns the time they took. Set up outside of the timing.
+        std::function<Clock::duration(uint64_t)> run;
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::string unit;
+        uint64_t nbOperations;
+
+        // Nanoseconds per operation of every repeat, sorted
+        std::vector<double> nsPerOperation;
+
+        double GetMedian() const { return nsPerOperation[nsPerOperation.size() / 2]; }
+    };
+
+    void PrintUsage()
+    {
+        std::cout << "Usage: gb-bench [options]\n"
+                  << "Measures the time per operation of the CPU opcode families, the memory accesses of each region,\n"
+                  << "frame rendering and save states, on synthetic cartridges. Writes the results as JSON.\n"
+                  << "Options:\n"
+                  << "  --repeat N         Run every benchmark N times, the median is reported (default: 5)\n"
+                  << "  --filter TEXT      Only run the benchmarks whose name contains TEXT\n"
+                  << "  --quick            Run 20 times fewer operations, to check that everything runs\n"
+                  << "  --output FILE      Write the JSON results to FILE and a table to the standard output,\n"
+                  << "                     instead of the JSON to the standard output\n"
+                  << "  --compare FILE     With --output, compare the medians to the results of a previous run\n";
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; ++i)
+        {
+            const std::string arg{argv[i]};
+
+            if(arg == "--quick")
+            {
+                options.isQuick = true;
+                continue;
+            }
+
+            if(arg != "--repeat" && arg != "--filter" && arg != "--output" && arg != "--compare")
+            {
+                std::cout << "Unknown option: " << arg << "\n";
+                return false;
+            }
+
+            if(i + 1 >= argc)
+            {
+                std::cout << "Missing value for " << arg << "\n";
+                return false;
+            }
+            const std::string value{argv[++i]};
+
+            if(arg == "--repeat")
+            {
+                char* end{};
+                options.nbRepeats = static_cast<unsigned int>(std::strtoul(value.c_str(), &end, 10));
+                if(*end != '\0' || options.nbRepeats == 0)
+                {
+                    std::cout << "Invalid value for " << arg << ": " << value << "\n";
+                    return false;
+                }
+            }
+            else if(arg == "--filter")
+            {
+                options.filter = value;
+            }
+            else if(arg == "--output")
+            {
+                options.outputFilePath = value;
+            }
+            else
+            {
+                options.baselineFilePath = value;
+            }
+        }
+
+        if(!options.baselineFilePath.empty() && options.outputFilePath.empty())
+        {
+            std::cout << "--compare needs --output\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    // 32KB image with a valid header, a controller of the given type, and code jumping to the stream at
+    // s_CODE_START. The stream sets itself up once and loops over the given unit until the end of the fixed bank.
+    // Units are made for the address they start at, the control flow ones jump to the next one.
+    std::shared_ptr<const Cartridge> MakeCartridge(const std::vector<uint8_t>& prologue,
+                                                   const std::function<std::vector<uint8_t>(uint16_t)>& makeUnit,
+                                                   uint8_t type = 0x00, uint8_t ramSizeCode = 0x00)
+    {
+        std::vector<uint8_t> rom(0x8000, 0x00);
+
+        // NOP, JP s_CODE_START
+        rom[0x100] = 0x00;
+        rom[0x101] = 0xC3;
+        rom[0x102] = s_CODE_START & 0xFF;
+        rom[0x103] = s_CODE_START >> 8;
+
+        const std::string title = "GB-BENCH";
+        std::copy(title.begin(), title.end(), rom.begin() + 0x134);
+        rom[0x147] = type;
+        rom[0x148] = 0x00;
+        rom[0x149] = ramSizeCode;
+
+        uint8_t checksum{};
+        for(size_t i = 0x134; i <= 0x14C; ++i)
+        {
+            checksum = static_cast<uint8_t>(checksum - rom[i] - 1);
+        }
+        rom[0x14D] = checksum;
+
+        rom[s_SUBROUTINE] = 0xC9;
+
+        size_t addr = s_CODE_START;
+        for(uint8_t byte : prologue)
+        {
+            rom[addr++] = byte;
+        }
+
+        const size_t loopAddr = addr;
+        for(;;)
+        {
+            const std::vector<uint8_t> unit = makeUnit(static_cast<uint16_t>(addr));
+            if(addr + unit.size() > s_CODE_END)
+            {
+                break;
+            }
+            std::copy(unit.begin(), unit.end(), rom.begin() + static_cast<std::ptrdiff_t>(addr));
+            addr += unit.size();
+        }
+
+        // JP loop
+        rom[addr++] = 0xC3;
+        rom[addr++] = loopAddr & 0xFF;
+        rom[addr++] = static_cast<uint8_t>(loopAddr >> 8);
+
+        return Cartridge::Create(std::move(rom), "synthetic cartridge");
+    }
+
+    // HL on the work area, SP on the top of the stack, A to 1 and the flags cleared: Z, N, H and C all reset
+    std::vector<uint8_t> MakePrologue()
+    {
+        return {0x21, s_DATA_ADDR & 0xFF, s_DATA_ADDR >> 8,
+                0x31, s_STACK_TOP & 0xFF, s_STACK_TOP >> 8,
+                0x3E, 0x01,
+                0xB7};
+    }
+
+    std::vector<uint8_t> MakeFixedUnit(std::vector<uint8_t> unit)
+    {
+        return unit;
+    }
+
+    // Instructions of the families, in streams of the same unit over and over
+    Benchmark MakeCPUBenchmark(const std::string& name, const std::function<std::vector<uint8_t>(uint16_t)>& makeUnit)
+    {
+        std::shared_ptr<const Cartridge> cartridge = MakeCartridge(MakePrologue(), makeUnit);
+
+        auto run = [cartridge](uint64_t nbOperations)
+        {
+            // The CPU and memory alone, nothing else schedules events
+            Scheduler scheduler;
+            Memory mem;
+            CPU cpu{mem, scheduler};
+            mem.LoadCartridge(cartridge);
+            cpu.Reset();
+
+            uint64_t nbInstructions{};
+            const Clock::time_point start = Clock::now();
+            while(nbInstructions < nbOperations)
+            {
+                cpu.ExecuteNextInstruction(nbInstructions);
+            }
+            return Clock::now() - start;
+        };
+
+        return {name, "instruction", 4000000, run};
+    }
+
+    std::vector<Benchmark> MakeCPUBenchmarks()
+    {
+        std::vector<Benchmark> benchmarks;
+
+        // LD B,C - LD D,E - LD A,B - LD (HL),A - LD E,(HL) - LD C,$12 - LD A,(HL)
+        benchmarks.push_back(MakeCPUBenchmark("cpu.load8", [](uint16_t)
+        {
+            return MakeFixedUnit({0x41, 0x53, 0x78, 0x77, 0x5E, 0x0E, 0x12, 0x7E});
+        }));
+
+        // ADD A,B - ADC A,C - SUB D - AND E - OR B - CP $40 - ADD A,(HL) - XOR (HL) - INC B - DEC C
+        benchmarks.push_back(MakeCPUBenchmark("cpu.alu8", [](uint16_t)
+        {
+            return MakeFixedUnit({0x80, 0x89, 0x92, 0xA3, 0xB0, 0xFE, 0x40, 0x86, 0xAE, 0x04, 0x0D});
+        }));
+
+        // BIT 0,B - SET 1,C - RES 2,D - SWAP E - RLC A - SRL A - BIT 7,(HL) - SET 3,(HL)
+        benchmarks.push_back(MakeCPUBenchmark("cpu.cb", [](uint16_t)
+        {
+            return MakeFixedUnit({0xCB, 0x40, 0xCB, 0xC9, 0xCB, 0x92, 0xCB, 0x33,
+                                  0xCB, 0x07, 0xCB, 0x3F, 0xCB, 0x7E, 0xCB, 0xDE});
+        }));
+
+        // PUSH BC - PUSH DE - PUSH HL - PUSH AF - POP AF - POP HL - POP DE - POP BC
+        benchmarks.push_back(MakeCPUBenchmark("cpu.stack", [](uint16_t)
+        {
+            return MakeFixedUnit({0xC5, 0xD5, 0xE5, 0xF5, 0xF1, 0xE1, 0xD1, 0xC1});
+        }));
+
+        // JR +0 - JP next - CALL and RET - JR NZ taken - JR Z not taken - JP NZ taken - CALL Z not taken - RST $38 and
+        // RET. The flags stay as the prologue left them, zero reset.
+        benchmarks.push_back(MakeCPUBenchmark("cpu.control", [](uint16_t addr)
+        {
+            const uint16_t jpNext = static_cast<uint16_t>(addr + 5);
+            const uint16_t jpNZNext = static_cast<uint16_t>(addr + 16);
+            return std::vector<uint8_t>{0x18, 0x00,
+                                        0xC3, static_cast<uint8_t>(jpNext), static_cast<uint8_t>(jpNext >> 8),
+                                        0xCD, s_SUBROUTINE & 0xFF, s_SUBROUTINE >> 8,
+                                        0x20, 0x00,
+                                        0x28, 0x00,
+                                        0xC2, static_cast<uint8_t>(jpNZNext), static_cast<uint8_t>(jpNZNext >> 8),
+                                        0xCC, s_SUBROUTINE & 0xFF, s_SUBROUTINE >> 8,
+                                        0xFF};
+        }));
+
+        return benchmarks;
+    }
+
+    // Reads or writes of every address of a region in turn
+    Benchmark MakeMemoryBenchmark(const std::string& region, uint16_t firstAddr, unsigned int size, bool isWrite)
+    {
+        // MBC1 with 8KB of RAM, enabled before the run
+        std::shared_ptr<const Cartridge> cartridge = MakeCartridge(MakePrologue(), [](uint16_t){ return MakeFixedUnit({0x00}); },
+                                                                   0x03, 0x02);
+
+        auto run = [cartridge, firstAddr, size, isWrite](uint64_t nbOperations)
+        {
+            Memory mem;
+            mem.LoadCartridge(cartridge);
+            mem.Write(0x0000, 0x0A);
+
+            unsigned int sum{};
+            unsigned int offset{};
+            const Clock::time_point start = Clock::now();
+            for(uint64_t i = 0; i < nbOperations; ++i)
+            {
+                const uint16_t addr = static_cast<uint16_t>(firstAddr + offset);
+                if(isWrite)
+                {
+                    mem.Write(addr, static_cast<uint8_t>(i));
+                }
+                else
+                {
+                    sum += mem.Read(addr);
+                }
+
+                offset = offset + 1 == size ? 0 : offset + 1;
+            }
+            const Clock::duration duration = Clock::now() - start;
+
+            s_sink = s_sink + sum;
+            return duration;
+        };
+
+        return {std::string{"memory."} + (isWrite ? "write." : "read.") + region, isWrite ? "write" : "read", 8000000, run};
+    }
+
+    std::vector<Benchmark> MakeMemoryBenchmarks()
+    {
+        struct Region
+        {
+            const char* name;
+            uint16_t firstAddr;
+            unsigned int size;
+            bool isWritable;
+        };
+
+        // ROM writes go to the bank controller, those of the bank number area switch banks, always to bank 1 of the
+        // 32KB cartridge.
+        // I/O registers are left out of the writes, some start transfers.
+        const std::vector<Region> regions{
+            {"rom0", 0x0000, 0x4000, false},
+            {"romx", 0x4000, 0x4000, false},
+            {"mbc", 0x2000, 0x2000, true},
+            {"vram", 0x8000, 0x2000, true},
+            {"sram", 0xA000, 0x2000, true},
+            {"wram", 0xC000, 0x2000, true},
+            {"echo", 0xE000, 0x1E00, true},
+            {"oam", 0xFE00, 0x00A0, true},
+            {"io", 0xFF00, 0x0080, false},
+            {"hram", 0xFF80, 0x007F, true}
+        };
+
+        std::vector<Benchmark> benchmarks;
+        for(const Region& region : regions)
+        {
+            if(region.name != std::string{"mbc"})
+            {
+                benchmarks.push_back(MakeMemoryBenchmark(region.name, region.firstAddr, region.size, false));
+            }
+            if(region.isWritable)
+            {
+                benchmarks.push_back(MakeMemoryBenchmark(region.name, region.firstAddr, region.size, true));
+            }
+        }
+        return benchmarks;
+    }
+
+    // Frames of a screen using everything the PPU draws: background, window and 40 sprites, some flipped or behind
+    // the background. Only the PPU runs, time goes from one of its events to the next.
+    Benchmark MakeRenderBenchmark(const std::string& name, bool isBestKernels, bool isSkipped)
+    {
+        std::shared_ptr<const Cartridge> cartridge = MakeCartridge(MakePrologue(), [](uint16_t){ return MakeFixedUnit({0x00}); });
+
+        auto run = [cartridge, isBestKernels, isSkipped](uint64_t nbOperations)
+        {
+            Scheduler scheduler;
+            Memory mem;
+            PPU ppu{mem, scheduler};
+            mem.SetIOSyncHandler([&scheduler](){ scheduler.RunDueEvents(); });
+            mem.LoadCartridge(cartridge);
+            ppu.Reset();
+            ppu.SetPixelKernels(isBestKernels ? PixelKernels::GetBestSupported() : PixelKernels::InstructionSet::Scalar);
+            ppu.SetFrameSkip(isSkipped ? 0 : 1);
+
+            // LCD off while filling VRAM and OAM
+            mem.Write(0xFF40, 0x00);
+            for(unsigned int addr = 0x8000; addr < 0x9800; ++addr)
+            {
+                mem.Write(static_cast<uint16_t>(addr), static_cast<uint8_t>(addr * 37 + 11));
+            }
+            for(unsigned int i = 0; i < 0x400; ++i)
+            {
+                mem.Write(static_cast<uint16_t>(0x9800 + i), static_cast<uint8_t>(i));
+                mem.Write(static_cast<uint16_t>(0x9C00 + i), static_cast<uint8_t>(i * 7));
+            }
+            for(unsigned int i = 0; i < 40; ++i)
+            {
+                mem.Write(static_cast<uint16_t>(0xFE00 + 4 * i), static_cast<uint8_t>(16 + (i * 4) % 144));
+                mem.Write(static_cast<uint16_t>(0xFE01 + 4 * i), static_cast<uint8_t>(8 + (i * 17) % 160));
+                mem.Write(static_cast<uint16_t>(0xFE02 + 4 * i), static_cast<uint8_t>(i));
+                mem.Write(static_cast<uint16_t>(0xFE03 + 4 * i), static_cast<uint8_t>((i & 0x07) << 4));
+            }
+
+            // SCY, SCX, BGP, OBP0, OBP1, WY, WX, then the LCD on with the window map at 0x9C00 and tiles at 0x8000
+            const std::vector<std::pair<uint16_t, uint8_t>> registers{
+                {0xFF42, 0x13}, {0xFF43, 0x05}, {0xFF47, 0xE4}, {0xFF48, 0xD2}, {0xFF49, 0xE4},
+                {0xFF4A, 0x40}, {0xFF4B, 0x37}, {0xFF40, 0xF3}
+            };
+            for(const auto& reg : registers)
+            {
+                mem.Write(reg.first, reg.second);
+            }
+
+            const Clock::time_point start = Clock::now();
+            const uint64_t endTime = scheduler.GetTime() + nbOperations * Emulator::m_CYCLES_PER_FRAME;
+            while(scheduler.GetTime() < endTime)
+            {
+                scheduler.SetTime(std::min(scheduler.GetNextEventTime(), endTime));
+                scheduler.RunDueEvents();
+            }
+            const Clock::duration duration = Clock::now() - start;
+
+            s_sink = s_sink + ppu.GetFramebuffer()[0];
+            return duration;
+        };
+
+        return {name, "frame", 300, run};
+    }
+
+    // Whole machine states of a cartridge with RAM, after a few frames of running
+    Benchmark MakeStateBenchmark(const std::string& name, bool isLoad)
+    {
+        std::shared_ptr<const Cartridge> cartridge = MakeCartridge(MakePrologue(), [](uint16_t)
+        {
+            return MakeFixedUnit({0x80, 0x77, 0x2C});
+        }, 0x03, 0x02);
+
+        auto run = [cartridge, isLoad](uint64_t nbOperations)
+        {
+            Emulator emu;
+            emu.LoadCartridge(cartridge);
+            emu.Reset();
+            emu.RunFrames(10);
+
+            std::vector<uint8_t> data;
+            emu.SaveState(data);
+
+            const Clock::time_point start = Clock::now();
+            for(uint64_t i = 0; i < nbOperations; ++i)
+            {
+                if(isLoad)
+                {
+                    emu.LoadState(data.data(), data.size());
+                }
+                else
+                {
+                    emu.SaveState(data);
+                }
+            }
+            const Clock::duration duration = Clock::now() - start;
+
+            s_sink = s_sink + static_cast<unsigned int>(data.size());
+            return duration;
+        };
+
+        return {name, isLoad ? "load" : "save", 20000, run};
+    }
+
+    std::vector<Benchmark> MakeBenchmarks()
+    {
+        std::vector<Benchmark> benchmarks = MakeCPUBenchmarks();
+
+        std::vector<Benchmark> memoryBenchmarks = MakeMemoryBenchmarks();
+        benchmarks.insert(benchmarks.end(), memoryBenchmarks.begin(), memoryBenchmarks.end());
+
+        benchmarks.push_back(MakeRenderBenchmark("render.frame.scalar", false, false));
+        benchmarks.push_back(MakeRenderBenchmark("render.frame.best", true, false));
+        benchmarks.push_back(MakeRenderBenchmark("render.frame.skipped", true, true));
+
+        benchmarks.push_back(MakeStateBenchmark("state.save", false));
+        benchmarks.push_back(MakeStateBenchmark("state.load", true));
+        return benchmarks;
+    }
+
+    Result RunBenchmark(const Benchmark& benchmark, const Options& options)
+    {
+        const uint64_t nbOperations = std::max<uint64_t>(benchmark.nbOperations / (options.isQuick ? 20 : 1), 1);
+
+        // A short run first, for the caches and the lazily mapped pages
+        benchmark.run(std::max<uint64_t>(nbOperations / 10, 1));
+
+        Result result{benchmark.name, benchmark.unit, nbOperations, {}};
+        for(unsigned int i = 0; i < options.nbRepeats; ++i)
+        {
+            const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(benchmark.run(nbOperations)).count());
+            result.nsPerOperation.push_back(ns / static_cast<double>(nbOperations));
+        }
+        std::sort(result.nsPerOperation.begin(), result.nsPerOperation.end());
+        return result;
+    }
+
+    void WriteJSON(std::ostream& stream, const std::vector<Result>& results, const Options& options)
+    {
+        stream << "{\n"
+               << "  \"tool\": \"gb-bench\",\n"
+               << "  \"version\": 1,\n"
+               << "  \"build\": {\"lazy_flags\": " << (GB_LAZY_FLAGS ? "true" : "false")
+               << ", \"profiler\": " << (GB_PROFILER ? "true" : "false") << "},\n"
+               << "  \"repeats\": " << options.nbRepeats << ",\n"
+               << "  \"quick\": " << (options.isQuick ? "true" : "false") << ",\n"
+               << "  \"results\": [";
+
+        stream << std::fixed << std::setprecision(3);
+        for(size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& result = results[i];
+            stream << (i == 0 ? "\n" : ",\n")
+                   << "    {\"name\": \"" << result.name << "\", \"unit\": \"" << result.unit
+                   << "\", \"operations\": " << result.nbOperations
+                   << ", \"ns_per_op\": " << result.GetMedian()
+                   << ", \"min_ns_per_op\": " << result.nsPerOperation.front()
+                   << ", \"max_ns_per_op\": " << result.nsPerOperation.back() << "}";
+        }
+        stream << "\n  ]\n}\n";
+    }
+
+    // Medians by name of a file written by WriteJSON
+    bool ReadBaseline(const std::string& filePath, std::map<std::string, double>& medians)
+    {
+        std::ifstream stream{filePath};
+        if(!stream)
+        {
+            return false;
+        }
+
+        const std::regex pattern{"\"name\": \"([^\"]+)\".*\"ns_per_op\": ([0-9.]+)"};
+        std::string line;
+        while(std::getline(stream, line))
+        {
+            std::smatch match;
+            if(std::regex_search(line, match, pattern))
+            {
+                medians[match[1]] = std::stod(match[2]);
+            }
+        }
+        return true;
+    }
+
+    void PrintTable(const std::vector<Result>& results, const std::map<std::string, double>& baseline)
+    {
+        std::cout << std::left << std::setw(26) << "Benchmark" << std::right << std::setw(14) << "ns/op"
+                  << std::setw(12) << "min" << std::setw(12) << "max" << (baseline.empty() ? "" : "   vs baseline") << "\n"
+                  << std::fixed << std::setprecision(2);
+        for(const Result& result : results)
+        {
+            std::cout << std::left << std::setw(26) << result.name << std::right << std::setw(14) << result.GetMedian()
+                      << std::setw(12) << result.nsPerOperation.front() << std::setw(12) << result.nsPerOperation.back();
+
+            // Above 1 is slower than the baseline
+            const auto it = baseline.find(result.name);
+            if(it != baseline.end() && it->second > 0)
+            {
+                std::cout << std::setw(15) << result.GetMedian() / it->second << "x";
+            }
+            std::cout << "  per " << result.unit << "\n";
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::map<std::string, double> baseline;
+    if(!options.baselineFilePath.empty() && !ReadBaseline(options.baselineFilePath, baseline))
+    {
+        std::cout << "Unable to read baseline: " << options.baselineFilePath << "\n";
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for(const Benchmark& benchmark : MakeBenchmarks())
+    {
+        if(benchmark.name.find(options.filter) != std::string::npos)
+        {
+            results.push_back(RunBenchmark(benchmark, options));
+        }
+    }
+
+    if(results.empty())
+    {
+        std::cout << "No benchmark matches: " << options.filter << "\n";
+        return 1;
+    }
+
+    if(options.outputFilePath.empty())
+    {
+        WriteJSON(std::cout, results, options);
+        return 0;
+    }
+
+    std::ofstream stream{options.outputFilePath};
+    WriteJSON(stream, results, options);
+    if(!stream)
+    {
+        std::cout << "Unable to write results: " << options.outputFilePath << "\n";
+        return 1;
+    }
+
+    PrintTable(results, baseline);
+    return 0;
+}
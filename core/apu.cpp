@@ -0,0 +1,800 @@
+#include "apu.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Registers, as offsets from NR10
+    constexpr uint8_t s_FIRST_PORT = 0x10;
+    constexpr uint8_t s_NR10 = 0x00;
+    constexpr uint8_t s_NR30 = 0x0A;
+    constexpr uint8_t s_NR32 = 0x0C;
+    constexpr uint8_t s_NR43 = 0x12;
+    constexpr uint8_t s_NR50 = 0x14;
+    constexpr uint8_t s_NR51 = 0x15;
+    constexpr uint8_t s_NR52 = 0x16;
+    constexpr uint8_t s_FIRST_WAVE_PORT = 0x30;
+    constexpr uint8_t s_LAST_WAVE_PORT = 0x3F;
+
+    constexpr unsigned int s_SQUARE1 = 0;
+    constexpr unsigned int s_SQUARE2 = 1;
+    constexpr unsigned int s_WAVE = 2;
+    constexpr unsigned int s_NOISE = 3;
+
+    // Bits always set when reading each register
+    constexpr std::array<uint8_t, 0x17> s_READ_MASKS{
+        0x80, 0x3F, 0x00, 0xFF, 0xBF,
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+        0xFF, 0xFF, 0x00, 0x00, 0xBF,
+        0x00, 0x00, 0x70
+    };
+
+    constexpr std::array<uint8_t, 0x17> s_BOOT_REGISTERS{
+        0x80, 0xBF, 0xF3, 0xFF, 0xBF,
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+        0xFF, 0xFF, 0x00, 0x00, 0xBF,
+        0x77, 0xF3, 0xF1
+    };
+
+    // Waveforms of the 4 duty cycles, from the first step in the highest bit
+    constexpr std::array<uint8_t, 4> s_DUTY_WAVEFORMS{ 0x01, 0x81, 0x87, 0x7E };
+
+    constexpr uint32_t s_STATE_VERSION = 1;
+
+    // DIV bit 12 clocks the frame sequencer
+    constexpr uint64_t s_FRAME_SEQUENCER_PERIOD = 8192;
+
+    // The first wave sample is read a few cycles later than a full period after a trigger
+    constexpr uint64_t s_WAVE_TRIGGER_DELAY = 6;
+
+    // Retriggering the wave channel on the DMG corrupts wave RAM when the channel is about to read a sample
+    constexpr uint64_t s_WAVE_CORRUPTION_DELAY = 2;
+
+    // Output position of a cycle, in 1/65536 samples: 48000 * 65536 / 4194304
+    constexpr uint64_t s_POSITION_PER_CYCLE = 750;
+
+    // Band-limited steps are windowed sinc impulses, integrated when the samples are flushed
+    constexpr unsigned int s_KERNEL_WIDTH = 16;
+    constexpr unsigned int s_KERNEL_PHASE_BITS = 5;
+    constexpr unsigned int s_NB_KERNEL_PHASES = 1 << s_KERNEL_PHASE_BITS;
+    constexpr unsigned int s_KERNEL_UNIT_BITS = 15;
+
+    // Channel output levels go up to 15 * 8 * 4 on each side, leaving room for the overshoot
+    constexpr int s_OUTPUT_GAIN = 32;
+
+    using StepKernels = std::array<std::array<int32_t, s_KERNEL_WIDTH>, s_NB_KERNEL_PHASES>;
+
+    const StepKernels& GetStepKernels()
+    {
+        static const StepKernels kernels = []()
+        {
+            constexpr double pi = 3.14159265358979323846;
+            constexpr double cutoff = 0.9;
+
+            StepKernels result{};
+            for(unsigned int phase = 0; phase < s_NB_KERNEL_PHASES; ++phase)
+            {
+                std::array<double, s_KERNEL_WIDTH> impulse;
+                double sum{};
+                for(unsigned int i = 0; i < s_KERNEL_WIDTH; ++i)
+                {
+                    // Blackman windowed sinc centered between the middle taps
+                    const double x = i - (s_KERNEL_WIDTH / 2 - 1) - static_cast<double>(phase) / s_NB_KERNEL_PHASES;
+                    const double sinc = x == 0 ? 1.0 : std::sin(pi * cutoff * x) / (pi * cutoff * x);
+                    const double window = 0.42 + 0.5 * std::cos(pi * x / (s_KERNEL_WIDTH / 2)) +
+                                          0.08 * std::cos(2 * pi * x / (s_KERNEL_WIDTH / 2));
+                    impulse[i] = sinc * window;
+                    sum += impulse[i];
+                }
+
+                // Each kernel adds up to exactly one unit, rounding must not leave any drift in the integrated output
+                int32_t total{};
+                for(unsigned int i = 0; i < s_KERNEL_WIDTH; ++i)
+                {
+                    result[phase][i] = static_cast<int32_t>(std::lround(impulse[i] / sum * (1 << s_KERNEL_UNIT_BITS)));
+                    total += result[phase][i];
+                }
+                result[phase][s_KERNEL_WIDTH / 2 - 1] += (1 << s_KERNEL_UNIT_BITS) - total;
+            }
+
+            return result;
+        }();
+
+        return kernels;
+    }
+
+    // First register of each channel, NRx0
+    constexpr uint8_t GetChannelBase(unsigned int channelIdx)
+    {
+        return static_cast<uint8_t>(channelIdx * 5);
+    }
+}
+
+APU::APU(Memory& mem, Scheduler& scheduler)
+    : m_mem{mem}
+    , m_scheduler{scheduler}
+    , m_isOutputEnabled{false}
+{
+    for(uint8_t port = s_FIRST_PORT; port <= s_LAST_WAVE_PORT; ++port)
+    {
+        m_mem.SetIOHandlers(port, [this](uint16_t addr){ return ReadRegister(addr); },
+                                  [this](uint16_t addr, uint8_t value){ WriteRegister(addr, value); });
+    }
+
+    m_scheduler.SetEventHandler(Scheduler::EventType::FrameSequencer, [this](uint64_t time)
+    {
+        Update(time);
+        StepFrameSequencer(time);
+        m_scheduler.Schedule(Scheduler::EventType::FrameSequencer, time + s_FRAME_SEQUENCER_PERIOD);
+    });
+
+    Reset();
+}
+
+void APU::Reset()
+{
+    m_time = m_scheduler.GetTime();
+    m_registers = s_BOOT_REGISTERS;
+    m_waveRAM.fill(0);
+
+    m_channels = {};
+    m_channels[s_NOISE].position = 0x7FFF;
+
+    // The boot sound has faded out on square 1, which is still on
+    m_channels[s_SQUARE1].isEnabled = true;
+
+    m_sweep = {};
+    m_sweep.timer = 8;
+
+    m_waveSampleBuffer = 0;
+    m_waveReadTime = 0;
+    m_frameSequencerStep = 0;
+
+    m_scheduler.Schedule(Scheduler::EventType::FrameSequencer, m_time + s_FRAME_SEQUENCER_PERIOD);
+    RestartSynthesis(m_time);
+}
+
+void APU::EnableOutput(bool isEnabled)
+{
+    const uint64_t time = m_scheduler.GetTime();
+    Update(time);
+
+    if(m_isOutputEnabled)
+    {
+        FlushSamples(time);
+    }
+
+    m_isOutputEnabled = isEnabled;
+    RestartSynthesis(time);
+}
+
+void APU::RestartSynthesis(uint64_t time)
+{
+    m_stepBuffers = {};
+    m_bufferStartTime = time;
+    m_bufferStartOffset = 0;
+    m_integrators = {};
+    m_dcLevels = {};
+    for(Channel& channel : m_channels)
+    {
+        channel.output = {};
+    }
+
+    UpdateOutputs(time);
+}
+
+void APU::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::APU, s_STATE_VERSION);
+    writer.Write(m_time);
+    writer.Write(m_registers);
+    writer.Write(m_waveRAM);
+    writer.Write(m_channels);
+    writer.Write(m_sweep);
+    writer.Write(m_waveSampleBuffer);
+    writer.Write(m_waveReadTime);
+    writer.Write(m_frameSequencerStep);
+    writer.EndChunk();
+}
+
+bool APU::Load(SaveStateReader& reader)
+{
+    if(!reader.OpenChunk(SaveStateChunk::APU, s_STATE_VERSION) || !reader.Read(m_time) || !reader.Read(m_registers) ||
+       !reader.Read(m_waveRAM) || !reader.Read(m_channels) || !reader.Read(m_sweep) || !reader.Read(m_waveSampleBuffer) ||
+       !reader.Read(m_waveReadTime) || !reader.Read(m_frameSequencerStep) || !reader.CloseChunk())
+    {
+        return false;
+    }
+
+    RestartSynthesis(m_time);
+    return true;
+}
+
+uint8_t APU::ReadRegister(uint16_t addr)
+{
+    const uint64_t time = m_scheduler.GetTime();
+    Update(time);
+
+    const uint8_t port = addr & 0x7F;
+    if(port >= s_FIRST_WAVE_PORT)
+    {
+        // While the wave channel plays, any access goes to the byte it reads, and only
+        // reaches it on the DMG on the cycle the channel reads it
+        if(m_channels[s_WAVE].isEnabled)
+        {
+            return time == m_waveReadTime ? m_waveRAM[m_channels[s_WAVE].position / 2] : 0xFF;
+        }
+
+        return m_waveRAM[port - s_FIRST_WAVE_PORT];
+    }
+
+    const uint8_t reg = port - s_FIRST_PORT;
+    if(reg >= m_registers.size())
+    {
+        return 0xFF;
+    }
+
+    if(reg == s_NR52)
+    {
+        uint8_t value = (m_registers[s_NR52] & 0x80) | s_READ_MASKS[s_NR52];
+        for(unsigned int channelIdx = 0; channelIdx < m_channels.size(); ++channelIdx)
+        {
+            value |= m_channels[channelIdx].isEnabled ? 1 << channelIdx : 0;
+        }
+
+        return value;
+    }
+
+    return m_registers[reg] | s_READ_MASKS[reg];
+}
+
+void APU::WriteRegister(uint16_t addr, uint8_t value)
+{
+    const uint64_t time = m_scheduler.GetTime();
+    Update(time);
+
+    const uint8_t port = addr & 0x7F;
+    if(port >= s_FIRST_WAVE_PORT)
+    {
+        if(!m_channels[s_WAVE].isEnabled)
+        {
+            m_waveRAM[port - s_FIRST_WAVE_PORT] = value;
+        }
+        else if(time == m_waveReadTime)
+        {
+            m_waveRAM[m_channels[s_WAVE].position / 2] = value;
+        }
+        return;
+    }
+
+    const uint8_t reg = port - s_FIRST_PORT;
+    if(reg >= m_registers.size())
+    {
+        return;
+    }
+
+    const bool isPoweredOn = m_registers[s_NR52] & 0x80;
+    if(reg == s_NR52)
+    {
+        if(isPoweredOn && !(value & 0x80))
+        {
+            PowerOff();
+        }
+        else if(!isPoweredOn && (value & 0x80))
+        {
+            // The next step is the first one, and the waveforms start over
+            m_frameSequencerStep = 0;
+            m_channels[s_SQUARE1].position = 0;
+            m_channels[s_SQUARE2].position = 0;
+            m_waveSampleBuffer = 0;
+        }
+
+        m_registers[s_NR52] = value & 0x80;
+        return;
+    }
+
+    const unsigned int channelIdx = reg / 5;
+    Channel& channel = m_channels[channelIdx];
+    const uint8_t channelReg = reg % 5;
+
+    // Only the length counters can be loaded while powered off
+    if(!isPoweredOn)
+    {
+        if(channelReg == 1 && reg < s_NR50)
+        {
+            channel.length = channelIdx == s_WAVE ? 256 - value : 64 - (value & 0x3F);
+        }
+        return;
+    }
+
+    const uint8_t oldValue = m_registers[reg];
+    m_registers[reg] = value;
+
+    if(reg >= s_NR50)
+    {
+        UpdateOutputs(time);
+        return;
+    }
+
+    switch(channelReg)
+    {
+        case 0:
+            // Clearing the sweep negate bit after it was used disables square 1
+            if(reg == s_NR10 && m_sweep.hasSubtracted && (oldValue & 0x08) && !(value & 0x08))
+            {
+                channel.isEnabled = false;
+            }
+            break;
+        case 1:
+            channel.length = channelIdx == s_WAVE ? 256 - value : 64 - (value & 0x3F);
+            break;
+        case 4:
+            WriteControl(channelIdx, value);
+            break;
+        default:
+            break;
+    }
+
+    if(!IsDACEnabled(channelIdx))
+    {
+        channel.isEnabled = false;
+    }
+
+    UpdateOutputs(time);
+}
+
+void APU::WriteControl(unsigned int channelIdx, uint8_t value)
+{
+    Channel& channel = m_channels[channelIdx];
+    const bool wasLengthEnabled = channel.isLengthEnabled;
+    channel.isLengthEnabled = value & 0x40;
+
+    // When the next frame sequencer step does not clock the lengths, enabling a length clocks it once more
+    const bool isLengthClockSkipped = m_frameSequencerStep & 1;
+    if(isLengthClockSkipped && !wasLengthEnabled && channel.isLengthEnabled && channel.length != 0)
+    {
+        if(--channel.length == 0 && !(value & 0x80))
+        {
+            channel.isEnabled = false;
+        }
+    }
+
+    if(value & 0x80)
+    {
+        Trigger(channelIdx);
+    }
+}
+
+void APU::Trigger(unsigned int channelIdx)
+{
+    Channel& channel = m_channels[channelIdx];
+
+    if(channel.length == 0)
+    {
+        channel.length = channelIdx == s_WAVE ? 256 : 64;
+        if(channel.isLengthEnabled && (m_frameSequencerStep & 1))
+        {
+            --channel.length;
+        }
+    }
+
+    const uint8_t envelope = m_registers[GetChannelBase(channelIdx) + 2];
+    channel.envelope.volume = envelope >> 4;
+    channel.envelope.timer = (envelope & 0x07) != 0 ? envelope & 0x07 : 8;
+
+    const uint64_t previousStepTime = channel.nextStepTime;
+    channel.nextStepTime = m_time + GetStepPeriod(channelIdx);
+
+    switch(channelIdx)
+    {
+        case s_SQUARE1:
+        {
+            const uint8_t sweep = m_registers[s_NR10];
+            const uint8_t period = (sweep >> 4) & 0x07;
+            const uint8_t shift = sweep & 0x07;
+
+            m_sweep.shadowFrequency = GetFrequency(s_SQUARE1);
+            m_sweep.timer = period != 0 ? period : 8;
+            m_sweep.isEnabled = period != 0 || shift != 0;
+            m_sweep.hasSubtracted = false;
+
+            channel.isEnabled = true;
+            if(shift != 0)
+            {
+                ComputeSweepFrequency();
+            }
+            break;
+        }
+        case s_WAVE:
+            // Retriggering on the DMG right before a sample is read copies the bytes around it to the start of wave RAM
+            if(channel.isEnabled && previousStepTime == m_time + s_WAVE_CORRUPTION_DELAY)
+            {
+                const unsigned int byteIdx = ((channel.position + 1) / 2) % m_waveRAM.size();
+                if(byteIdx < 4)
+                {
+                    m_waveRAM[0] = m_waveRAM[byteIdx];
+                }
+                else
+                {
+                    std::copy_n(&m_waveRAM[byteIdx & ~3u], 4, m_waveRAM.begin());
+                }
+            }
+
+            channel.isEnabled = true;
+            channel.position = 0;
+            channel.nextStepTime = m_time + GetStepPeriod(s_WAVE) + s_WAVE_TRIGGER_DELAY;
+            break;
+        case s_NOISE:
+            channel.isEnabled = true;
+            channel.position = 0x7FFF;
+            break;
+        default:
+            channel.isEnabled = true;
+            break;
+    }
+
+    if(!IsDACEnabled(channelIdx))
+    {
+        channel.isEnabled = false;
+    }
+}
+
+void APU::PowerOff()
+{
+    // Every register is cleared, but the DMG keeps its length counters
+    std::fill(m_registers.begin(), m_registers.begin() + s_NR52, 0);
+    for(Channel& channel : m_channels)
+    {
+        channel.isEnabled = false;
+        channel.isLengthEnabled = false;
+        channel.envelope = {};
+    }
+
+    m_sweep = {};
+    m_sweep.timer = 8;
+
+    UpdateOutputs(m_time);
+}
+
+void APU::Update(uint64_t time)
+{
+    if(time <= m_time)
+    {
+        return;
+    }
+
+    for(unsigned int channelIdx = 0; channelIdx < m_channels.size(); ++channelIdx)
+    {
+        AdvanceChannel(channelIdx, time);
+    }
+
+    m_time = time;
+}
+
+void APU::AdvanceChannel(unsigned int channelIdx, uint64_t time)
+{
+    Channel& channel = m_channels[channelIdx];
+    if(!channel.isEnabled || channel.nextStepTime > time)
+    {
+        return;
+    }
+
+    const uint64_t period = GetStepPeriod(channelIdx);
+
+    // Without output, jump straight to the last step, only the wave position can be observed
+    if(!m_isOutputEnabled)
+    {
+        const uint64_t nbSteps = (time - channel.nextStepTime) / period + 1;
+        const uint64_t lastStepTime = channel.nextStepTime + (nbSteps - 1) * period;
+        channel.nextStepTime = lastStepTime + period;
+
+        if(channelIdx == s_WAVE)
+        {
+            channel.position = (channel.position + nbSteps) % 32;
+            m_waveSampleBuffer = m_waveRAM[channel.position / 2];
+            m_waveReadTime = lastStepTime;
+        }
+        else if(channelIdx != s_NOISE)
+        {
+            channel.position = (channel.position + nbSteps) % 8;
+        }
+        return;
+    }
+
+    while(channel.nextStepTime <= time)
+    {
+        const uint64_t stepTime = channel.nextStepTime;
+        switch(channelIdx)
+        {
+            case s_WAVE:
+                channel.position = (channel.position + 1) % 32;
+                m_waveSampleBuffer = m_waveRAM[channel.position / 2];
+                m_waveReadTime = stepTime;
+                break;
+            case s_NOISE:
+            {
+                // 15-bit LFSR, or 7-bit when NR43 bit 3 is set
+                const unsigned int feedback = (channel.position ^ (channel.position >> 1)) & 1;
+                channel.position = (channel.position >> 1) | (feedback << 14);
+                if(m_registers[s_NR43] & 0x08)
+                {
+                    channel.position = (channel.position & ~0x40u) | (feedback << 6);
+                }
+                break;
+            }
+            default:
+                channel.position = (channel.position + 1) % 8;
+                break;
+        }
+
+        UpdateOutput(channelIdx, stepTime);
+        channel.nextStepTime += period;
+    }
+}
+
+void APU::StepFrameSequencer(uint64_t time)
+{
+    if(m_registers[s_NR52] & 0x80)
+    {
+        // Lengths on even steps, sweep on steps 2 and 6, envelopes on step 7
+        if((m_frameSequencerStep & 1) == 0)
+        {
+            ClockLengths();
+        }
+        if(m_frameSequencerStep == 2 || m_frameSequencerStep == 6)
+        {
+            ClockSweep();
+        }
+        if(m_frameSequencerStep == 7)
+        {
+            ClockEnvelopes();
+        }
+
+        m_frameSequencerStep = (m_frameSequencerStep + 1) % 8;
+        UpdateOutputs(time);
+    }
+
+    if(m_isOutputEnabled)
+    {
+        FlushSamples(time);
+    }
+}
+
+void APU::ClockLengths()
+{
+    for(Channel& channel : m_channels)
+    {
+        if(channel.isLengthEnabled && channel.length != 0 && --channel.length == 0)
+        {
+            channel.isEnabled = false;
+        }
+    }
+}
+
+void APU::ClockSweep()
+{
+    if(--m_sweep.timer != 0)
+    {
+        return;
+    }
+
+    const uint8_t period = (m_registers[s_NR10] >> 4) & 0x07;
+    m_sweep.timer = period != 0 ? period : 8;
+    if(!m_sweep.isEnabled || period == 0)
+    {
+        return;
+    }
+
+    // The new frequency is checked for overflow a second time, without being used
+    const uint16_t frequency = ComputeSweepFrequency();
+    if(frequency <= 0x7FF && (m_registers[s_NR10] & 0x07) != 0)
+    {
+        m_sweep.shadowFrequency = frequency;
+        SetFrequency(s_SQUARE1, frequency);
+        ComputeSweepFrequency();
+    }
+}
+
+void APU::ClockEnvelopes()
+{
+    for(unsigned int channelIdx : { s_SQUARE1, s_SQUARE2, s_NOISE })
+    {
+        Envelope& envelope = m_channels[channelIdx].envelope;
+        const uint8_t settings = m_registers[GetChannelBase(channelIdx) + 2];
+        const uint8_t period = settings & 0x07;
+        if(period == 0 || --envelope.timer != 0)
+        {
+            continue;
+        }
+
+        envelope.timer = period;
+        if((settings & 0x08) && envelope.volume < 15)
+        {
+            ++envelope.volume;
+        }
+        else if(!(settings & 0x08) && envelope.volume > 0)
+        {
+            --envelope.volume;
+        }
+    }
+}
+
+uint16_t APU::ComputeSweepFrequency()
+{
+    const uint8_t sweep = m_registers[s_NR10];
+    const uint16_t delta = m_sweep.shadowFrequency >> (sweep & 0x07);
+
+    uint16_t frequency = m_sweep.shadowFrequency + delta;
+    if(sweep & 0x08)
+    {
+        frequency = m_sweep.shadowFrequency - delta;
+        m_sweep.hasSubtracted = true;
+    }
+
+    if(frequency > 0x7FF)
+    {
+        m_channels[s_SQUARE1].isEnabled = false;
+    }
+
+    return frequency;
+}
+
+uint16_t APU::GetFrequency(unsigned int channelIdx) const
+{
+    const uint8_t base = GetChannelBase(channelIdx);
+    return static_cast<uint16_t>(((m_registers[base + 4] & 0x07) << 8) | m_registers[base + 3]);
+}
+
+void APU::SetFrequency(unsigned int channelIdx, uint16_t frequency)
+{
+    const uint8_t base = GetChannelBase(channelIdx);
+    m_registers[base + 3] = frequency & 0xFF;
+    m_registers[base + 4] = static_cast<uint8_t>((m_registers[base + 4] & ~0x07) | (frequency >> 8));
+}
+
+uint64_t APU::GetStepPeriod(unsigned int channelIdx) const
+{
+    switch(channelIdx)
+    {
+        case s_WAVE:
+            return (0x800 - GetFrequency(channelIdx)) * 2;
+        case s_NOISE:
+        {
+            const uint8_t settings = m_registers[s_NR43];
+            const uint64_t divisor = (settings & 0x07) != 0 ? (settings & 0x07) * 16 : 8;
+            return divisor << (settings >> 4);
+        }
+        default:
+            return (0x800 - GetFrequency(channelIdx)) * 4;
+    }
+}
+
+bool APU::IsDACEnabled(unsigned int channelIdx) const
+{
+    if(channelIdx == s_WAVE)
+    {
+        return m_registers[s_NR30] & 0x80;
+    }
+
+    return (m_registers[GetChannelBase(channelIdx) + 2] & 0xF8) != 0;
+}
+
+unsigned int APU::GetLevel(unsigned int channelIdx) const
+{
+    const Channel& channel = m_channels[channelIdx];
+    if(!channel.isEnabled)
+    {
+        return 0;
+    }
+
+    switch(channelIdx)
+    {
+        case s_WAVE:
+        {
+            // Muted, full, half or quarter volume
+            constexpr std::array<unsigned int, 4> shifts{ 4, 0, 1, 2 };
+            const unsigned int sample = (channel.position & 1) ? m_waveSampleBuffer & 0x0F : m_waveSampleBuffer >> 4;
+            return sample >> shifts[(m_registers[s_NR32] >> 5) & 0x03];
+        }
+        case s_NOISE:
+            return (channel.position & 1) ? 0 : channel.envelope.volume;
+        default:
+        {
+            const uint8_t waveform = s_DUTY_WAVEFORMS[m_registers[GetChannelBase(channelIdx) + 1] >> 6];
+            return ((waveform >> (7 - channel.position)) & 1) ? channel.envelope.volume : 0;
+        }
+    }
+}
+
+void APU::UpdateOutputs(uint64_t time)
+{
+    for(unsigned int channelIdx = 0; channelIdx < m_channels.size(); ++channelIdx)
+    {
+        UpdateOutput(channelIdx, time);
+    }
+}
+
+void APU::UpdateOutput(unsigned int channelIdx, uint64_t time)
+{
+    if(!m_isOutputEnabled)
+    {
+        return;
+    }
+
+    // The DAC maps levels 0-15 around 0, and outputs nothing when off
+    const int level = IsDACEnabled(channelIdx) ? static_cast<int>(GetLevel(channelIdx)) * 2 - 15 : 0;
+
+    const uint8_t volumes = m_registers[s_NR50];
+    const uint8_t panning = m_registers[s_NR51];
+    const std::array<int, NbSides> gains{
+        (panning >> (channelIdx + 4)) & 1 ? ((volumes >> 4) & 0x07) + 1 : 0,
+        (panning >> channelIdx) & 1 ? (volumes & 0x07) + 1 : 0
+    };
+
+    Channel& channel = m_channels[channelIdx];
+    for(unsigned int side = 0; side < NbSides; ++side)
+    {
+        const int output = level * gains[side];
+        if(output != channel.output[side])
+        {
+            AddStep(static_cast<Side>(side), time, output - channel.output[side]);
+            channel.output[side] = output;
+        }
+    }
+}
+
+void APU::AddStep(Side side, uint64_t time, int delta)
+{
+    const uint64_t position = m_bufferStartOffset + (time - m_bufferStartTime) * s_POSITION_PER_CYCLE;
+    const size_t sampleIdx = position >> 16;
+    if(sampleIdx + s_KERNEL_WIDTH > m_STEP_BUFFER_SIZE)
+    {
+        return;
+    }
+
+    const std::array<int32_t, s_KERNEL_WIDTH>& kernel = GetStepKernels()[(position >> (16 - s_KERNEL_PHASE_BITS)) % s_NB_KERNEL_PHASES];
+    int32_t* steps = &m_stepBuffers[side][sampleIdx];
+    for(unsigned int i = 0; i < s_KERNEL_WIDTH; ++i)
+    {
+        steps[i] += delta * kernel[i];
+    }
+}
+
+void APU::FlushSamples(uint64_t time)
+{
+    const uint64_t endPosition = m_bufferStartOffset + (time - m_bufferStartTime) * s_POSITION_PER_CYCLE;
+    const size_t nbSamples = std::min<size_t>(endPosition >> 16, m_STEP_BUFFER_SIZE - s_KERNEL_WIDTH);
+
+    std::array<Sample, m_STEP_BUFFER_SIZE> samples;
+    for(size_t i = 0; i < nbSamples; ++i)
+    {
+        std::array<int16_t, NbSides> values;
+        for(unsigned int side = 0; side < NbSides; ++side)
+        {
+            m_integrators[side] += m_stepBuffers[side][i];
+            const int64_t level = m_integrators[side] >> s_KERNEL_UNIT_BITS;
+
+            // Like the capacitor on the output, slowly remove any constant level
+            m_dcLevels[side] += ((level << 16) - m_dcLevels[side]) >> 10;
+            const int64_t value = (level - (m_dcLevels[side] >> 16)) * s_OUTPUT_GAIN;
+            values[side] = static_cast<int16_t>(std::clamp<int64_t>(value, INT16_MIN, INT16_MAX));
+        }
+
+        samples[i] = { values[Left], values[Right] };
+    }
+
+    m_output.Push(samples.data(), nbSamples);
+
+    // Steps still being added to the next samples move to the start of the buffers
+    for(std::array<int32_t, m_STEP_BUFFER_SIZE>& steps : m_stepBuffers)
+    {
+        std::copy(steps.begin() + nbSamples, steps.begin() + nbSamples + s_KERNEL_WIDTH, steps.begin());
+        std::fill(steps.begin() + s_KERNEL_WIDTH, steps.begin() + nbSamples + s_KERNEL_WIDTH, 0);
+    }
+
+    m_bufferStartTime = time;
+    m_bufferStartOffset = static_cast<uint32_t>(endPosition - (static_cast<uint64_t>(nbSamples) << 16));
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "memory.h"
+#include "ringbuffer.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#include <array>
+#include <cstdint>
+
+// Audio unit: two square channels, one of them with a frequency sweep, a wave channel and a noise channel.
+//
+// Nothing runs per cycle. The channels are brought up to date in batches, when
+// the CPU accesses a sound register and on each step of the frame sequencer, an
+// event at 512 Hz. While output is enabled, every change of a channel's level is
+// added as a band-limited step to 48 kHz stereo buffers, which are then queued to
+// the output ring buffer. While it is disabled, the channels only keep up the
+// state the CPU can observe.
+class APU
+{
+public:
+    static constexpr unsigned int m_SAMPLE_RATE = 48000;
+
+    struct Sample
+    {
+        int16_t left;
+        int16_t right;
+    };
+
+    // About 340 ms of audio, new samples are dropped while it is full
+    using Output = RingBuffer<Sample, 16384>;
+
+public:
+    APU(Memory& mem, Scheduler& scheduler);
+    APU(const APU&) = delete;
+    APU& operator=(const APU&) = delete;
+
+    // State left by the boot ROM, powered on with every channel silent
+    void Reset();
+
+    // Registers and channels. Synthesis starts over from silence after a load, the output is left as it is.
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+    // Samples are only synthesized while output is enabled, disabled by default
+    void EnableOutput(bool isEnabled);
+    Output& GetOutput() { return m_output; }
+
+private:
+    enum Side
+    {
+        Left,
+        Right,
+
+        NbSides
+    };
+
+    // Volume envelope of the square and noise channels, configured by NRx2
+    struct Envelope
+    {
+        uint8_t volume;
+        uint8_t timer;
+    };
+
+    struct Channel
+    {
+        bool isEnabled;
+
+        // Counts down to 0 at 256 Hz when enabled by NRx4, then disables the channel
+        unsigned int length;
+        bool isLengthEnabled;
+
+        // Time of the next step of the waveform
+        uint64_t nextStepTime;
+
+        // Position in the waveform: duty step, wave sample or noise LFSR
+        unsigned int position;
+
+        Envelope envelope;
+
+        // Last level added to each side of the output
+        std::array<int, NbSides> output;
+    };
+
+    // Square 1 frequency sweep
+    struct Sweep
+    {
+        uint16_t shadowFrequency;
+        uint8_t timer;
+        bool isEnabled;
+
+        // Clearing the negate bit after a subtraction disables the channel
+        bool hasSubtracted;
+    };
+
+    uint8_t ReadRegister(uint16_t addr);
+    void WriteRegister(uint16_t addr, uint8_t value);
+    void WriteControl(unsigned int channelIdx, uint8_t value);
+    void Trigger(unsigned int channelIdx);
+    void PowerOff();
+
+    // Brings the channels up to the given time, adding their level changes to the output
+    void Update(uint64_t time);
+    void AdvanceChannel(unsigned int channelIdx, uint64_t time);
+    void StepFrameSequencer(uint64_t time);
+
+    void ClockLengths();
+    void ClockSweep();
+    void ClockEnvelopes();
+
+    // Sweep calculation, disables square 1 when the result overflows
+    uint16_t ComputeSweepFrequency();
+
+    uint16_t GetFrequency(unsigned int channelIdx) const;
+    void SetFrequency(unsigned int channelIdx, uint16_t frequency);
+    uint64_t GetStepPeriod(unsigned int channelIdx) const;
+    bool IsDACEnabled(unsigned int channelIdx) const;
+
+    // Level of the channel at its current position, 0-15
+    unsigned int GetLevel(unsigned int channelIdx) const;
+
+    // Adds the change of level of every channel since the last call to the output
+    void UpdateOutputs(uint64_t time);
+    void UpdateOutput(unsigned int channelIdx, uint64_t time);
+
+    // Band-limited synthesis, restarted from silence
+    void RestartSynthesis(uint64_t time);
+    void AddStep(Side side, uint64_t time, int delta);
+    void FlushSamples(uint64_t time);
+
+private:
+    Memory& m_mem;
+    Scheduler& m_scheduler;
+
+    bool m_isOutputEnabled;
+    Output m_output;
+
+    // Time the channels are up to date with
+    uint64_t m_time;
+
+    // NR10 to NR52, as written
+    std::array<uint8_t, 0x17> m_registers;
+    std::array<uint8_t, 0x10> m_waveRAM;
+
+    std::array<Channel, 4> m_channels;
+    Sweep m_sweep;
+
+    // Last sample byte read by the wave channel, it keeps playing it until the next read
+    uint8_t m_waveSampleBuffer;
+    uint64_t m_waveReadTime;
+
+    // Step of the frame sequencer that runs next, 0-7
+    unsigned int m_frameSequencerStep;
+
+    // Step deltas of each side, integrated into samples when flushed. The output position of
+    // a time is counted in 1/65536 samples from the first sample of the buffers.
+    static constexpr unsigned int m_STEP_BUFFER_SIZE = 1024;
+    std::array<std::array<int32_t, m_STEP_BUFFER_SIZE>, NbSides> m_stepBuffers;
+    uint64_t m_bufferStartTime;
+    uint32_t m_bufferStartOffset;
+
+    std::array<int32_t, NbSides> m_integrators;
+    std::array<int64_t, NbSides> m_dcLevels;
+};
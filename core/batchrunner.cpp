@@ -0,0 +1,86 @@
+#include "batchrunner.h"
+
+#include "utils.h"
+
+#include <algorithm>
+
+BatchRunner::BatchRunner(unsigned int nbThreads)
+    : m_pool{nbThreads}
+{
+}
+
+std::vector<BatchResult> BatchRunner::Run(const std::vector<BatchJob>& jobs)
+{
+    // Each task writes only its own result
+    std::vector<BatchResult> results(jobs.size());
+    m_pool.Run(jobs.size(), [this, &jobs, &results](size_t jobIdx){ results[jobIdx] = RunJob(jobs[jobIdx]); });
+    return results;
+}
+
+BatchResult BatchRunner::RunJob(const BatchJob& job) const
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    BatchResult result;
+
+    // Too large for the stack of a worker
+    std::unique_ptr<Emulator> emu = std::make_unique<Emulator>();
+    if(!emu->LoadCartridge(job.romFilePath))
+    {
+        return result;
+    }
+
+    result.isLoaded = true;
+    emu->Reset();
+    emu->SetExecutionMode(m_executionMode);
+
+    if(job.isSerialOutputEnabled)
+    {
+        emu->SetSerialOutputHandler([&result](uint8_t byte){ result.serialOutput += static_cast<char>(byte); });
+    }
+
+    // Only the jobs asking for a screenshot draw anything, from the frame before the last one in case the
+    // LCD was turned off at some point and its frames are not aligned with the emulated ones
+    const uint64_t firstDrawnFrame = job.isScreenshotEnabled ? std::max<uint64_t>(job.nbFrames, 2) - 2 : job.nbFrames;
+    bool isDrawing = firstDrawnFrame == 0;
+    emu->SetFrameSkip(isDrawing ? 1 : 0);
+
+    const auto runUntilFrame = [&emu, &isDrawing, firstDrawnFrame](uint64_t frame)
+    {
+        if(!isDrawing && frame > firstDrawnFrame)
+        {
+            emu->RunFrames(firstDrawnFrame - emu->GetFrameCount());
+            emu->SetFrameSkip(1);
+            isDrawing = true;
+        }
+
+        emu->RunFrames(frame - emu->GetFrameCount());
+    };
+
+    for(const BatchInput& input : job.inputs)
+    {
+        if(input.frame >= job.nbFrames)
+        {
+            break;
+        }
+
+        runUntilFrame(input.frame);
+        emu->SetPressedKeys(input.keys);
+    }
+
+    runUntilFrame(job.nbFrames);
+
+    std::vector<uint8_t> state;
+    emu->SaveState(state);
+    result.stateHash = HashBytes(state.data(), state.size());
+    result.nbInstructions = emu->GetInstructionCount();
+
+    if(job.isScreenshotEnabled)
+    {
+        result.screenshot = std::make_unique<PPU::Framebuffer>(emu->GetFramebuffer());
+    }
+
+    result.duration = Clock::now() - start;
+    return result;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "emulator.h"
+#include "workstealingpool.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Keys held down from the start of a frame until the next input of the script
+struct BatchInput
+{
+    uint64_t frame;
+    uint8_t keys;
+};
+
+// One independent run: a ROM from its boot state for a number of frames, with scripted input
+struct BatchJob
+{
+    std::string romFilePath;
+    uint64_t nbFrames = 0;
+
+    // In frame order
+    std::vector<BatchInput> inputs;
+
+    bool isSerialOutputEnabled = false;
+
+    // Frames are only drawn for the jobs asking for the last one
+    bool isScreenshotEnabled = false;
+};
+
+struct BatchResult
+{
+    bool isLoaded = false;
+
+    // Hash of the save state of the whole machine at the end of the run
+    uint64_t stateHash = 0;
+    uint64_t nbInstructions = 0;
+
+    // Only filled for the jobs asking for them
+    std::string serialOutput;
+    std::unique_ptr<PPU::Framebuffer> screenshot;
+
+    // Wall-clock time of the run, loading the ROM included
+    std::chrono::nanoseconds duration{};
+};
+
+// Runs batches of jobs on a work-stealing pool, one emulator per job.
+//
+// Emulators share nothing mutable but the cache of cartridge images, which is
+// locked only while loading a ROM, so jobs scale with the number of cores.
+class BatchRunner
+{
+public:
+    explicit BatchRunner(unsigned int nbThreads);
+    BatchRunner(const BatchRunner&) = delete;
+    BatchRunner& operator=(const BatchRunner&) = delete;
+
+    unsigned int GetNbThreads() const { return m_pool.GetNbThreads(); }
+    void SetExecutionMode(Emulator::ExecutionMode mode) { m_executionMode = mode; }
+
+    // Results in the order of the jobs
+    std::vector<BatchResult> Run(const std::vector<BatchJob>& jobs);
+
+private:
+    BatchResult RunJob(const BatchJob& job) const;
+
+private:
+    WorkStealingPool m_pool;
+    Emulator::ExecutionMode m_executionMode = Emulator::ExecutionMode::Interpreter;
+};
@@ -0,0 +1,209 @@
+#include "cartridge.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define GB_MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define GB_MMAP_SUPPORTED 0
+#include <fstream>
+#endif
+
+#include <array>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace
+{
+    // The header ends at 0x150
+    constexpr size_t s_HEADER_END = 0x150;
+
+    constexpr size_t s_MAX_ROM_SIZE_CODE = 0x08;
+
+    // External RAM size per header code
+    constexpr std::array<unsigned int, 6> s_RAM_SIZES{ 0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000 };
+
+    // ROM size declared in the header, 32KB doubled per code
+    size_t GetDeclaredROMSize(const uint8_t* data)
+    {
+        return size_t{0x8000} << data[0x148];
+    }
+
+    bool ValidateHeader(const uint8_t* data, size_t size, const std::string& filePath)
+    {
+        if(size < s_HEADER_END)
+        {
+            std::cerr << filePath << ": too small to hold a cartridge header\n";
+            return false;
+        }
+
+        if(data[0x148] > s_MAX_ROM_SIZE_CODE || data[0x149] >= s_RAM_SIZES.size())
+        {
+            std::cerr << filePath << ": invalid ROM or RAM size in the header\n";
+            return false;
+        }
+
+        if(size < GetDeclaredROMSize(data))
+        {
+            std::cerr << filePath << ": truncated, the header declares " << GetDeclaredROMSize(data) << " bytes\n";
+            return false;
+        }
+
+        // The boot ROM refuses to start a cartridge with a bad header checksum.
+        // The global checksum is not verified: the hardware ignores it, some test ROMs get it wrong, 
+        // and summing the whole image would read every page of the file up front.
+        uint8_t checksum{};
+        for(size_t i = 0x134; i <= 0x14C; ++i)
+        {
+            checksum = static_cast<uint8_t>(checksum - data[i] - 1);
+        }
+        if(checksum != data[0x14D])
+        {
+            std::cerr << filePath << ": invalid header checksum\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    // Images currently loaded, by file identity
+    std::mutex s_cacheMutex;
+    std::map<std::string, std::weak_ptr<const Cartridge>> s_cache;
+}
+
+std::shared_ptr<const Cartridge> Cartridge::Load(const std::string& filePath)
+{
+#if GB_MMAP_SUPPORTED
+    const int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        std::cerr << filePath << ": unable to open\n";
+        return nullptr;
+    }
+
+    struct stat fileStat{};
+    if(fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        std::cerr << filePath << ": unable to read\n";
+        close(fd);
+        return nullptr;
+    }
+
+    // Any path to the same unmodified file shares its image
+    const std::string key = std::to_string(fileStat.st_dev) + ":" + std::to_string(fileStat.st_ino) + ":" + 
+                            std::to_string(fileStat.st_size) + ":" + std::to_string(fileStat.st_mtime);
+#else
+    const std::string& key = filePath;
+#endif
+
+    std::lock_guard<std::mutex> lock{s_cacheMutex};
+
+    std::shared_ptr<const Cartridge> cartridge = s_cache[key].lock();
+    if(cartridge != nullptr)
+    {
+#if GB_MMAP_SUPPORTED
+        close(fd);
+#endif
+        return cartridge;
+    }
+
+#if GB_MMAP_SUPPORTED
+    const size_t size = static_cast<size_t>(fileStat.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(mapping == MAP_FAILED)
+    {
+        std::cerr << filePath << ": unable to map\n";
+        return nullptr;
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>(mapping);
+    if(!ValidateHeader(data, size, filePath))
+    {
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    cartridge.reset(new Cartridge(data, size, {}));
+#else
+    std::ifstream inputStream{filePath, std::ios::binary};
+    if(!inputStream)
+    {
+        std::cerr << filePath << ": unable to open\n";
+        return nullptr;
+    }
+
+    std::vector<uint8_t> fileData{std::istreambuf_iterator<char>(inputStream), std::istreambuf_iterator<char>()};
+    if(!ValidateHeader(fileData.data(), fileData.size(), filePath))
+    {
+        return nullptr;
+    }
+
+    cartridge.reset(new Cartridge(nullptr, 0, std::move(fileData)));
+#endif
+
+    // Forget the images nobody holds anymore
+    for(auto it = s_cache.begin(); it != s_cache.end();)
+    {
+        it = it->second.expired() ? s_cache.erase(it) : std::next(it);
+    }
+
+    s_cache[key] = cartridge;
+    return cartridge;
+}
+
+std::shared_ptr<const Cartridge> Cartridge::Create(std::vector<uint8_t> data, const std::string& name)
+{
+    if(!ValidateHeader(data.data(), data.size(), name))
+    {
+        return nullptr;
+    }
+
+    return std::shared_ptr<const Cartridge>{new Cartridge(nullptr, 0, std::move(data))};
+}
+
+Cartridge::Cartridge(const uint8_t* data, size_t mappingSize, std::vector<uint8_t> fallbackData)
+    : m_rom{data}
+    , m_romSize{}
+    , m_mappingSize{mappingSize}
+    , m_fallbackData{std::move(fallbackData)}
+{
+    if(m_rom == nullptr)
+    {
+        m_rom = m_fallbackData.data();
+    }
+
+    m_romSize = GetDeclaredROMSize(m_rom);
+}
+
+Cartridge::~Cartridge()
+{
+#if GB_MMAP_SUPPORTED
+    if(m_mappingSize != 0)
+    {
+        munmap(const_cast<uint8_t*>(m_rom), m_mappingSize);
+    }
+#endif
+}
+
+std::string Cartridge::GetTitle() const
+{
+    std::string title;
+    for(size_t i = 0x134; i < 0x144 && m_rom[i] != 0; ++i)
+    {
+        title += static_cast<char>(m_rom[i]);
+    }
+
+    return title;
+}
+
+unsigned int Cartridge::GetRAMSize() const
+{
+    return s_RAM_SIZES[m_rom[0x149]];
+}
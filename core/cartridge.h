@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Cartridge ROM image, mapped read-only from its file.
+//
+// Images are shared: every emulator of the process loading the same file gets
+// the same mapping, which lives as long as one of them holds it. Pages of the
+// file are only read from disk when the emulated program first touches them.
+class Cartridge
+{
+public:
+    // Returns nullptr, after reporting why on stderr, when the file cannot be mapped or its header is invalid
+    static std::shared_ptr<const Cartridge> Load(const std::string& filePath);
+
+    // Same for an image already in memory, such as the synthetic cartridges of tools. The name is used in the reports.
+    static std::shared_ptr<const Cartridge> Create(std::vector<uint8_t> data, const std::string& name);
+
+    Cartridge(const Cartridge&) = delete;
+    Cartridge& operator=(const Cartridge&) = delete;
+    ~Cartridge();
+
+    // ROM contents, as large as the size declared in the header
+    const uint8_t* GetROM() const { return m_rom; }
+    size_t GetROMSize() const { return m_romSize; }
+
+    // Header fields
+    std::string GetTitle() const;
+    uint8_t GetType() const { return m_rom[0x147]; }
+    unsigned int GetRAMSize() const;
+
+private:
+    Cartridge(const uint8_t* data, size_t mappingSize, std::vector<uint8_t> fallbackData);
+
+private:
+    const uint8_t* m_rom;
+    size_t m_romSize;
+
+    // Size of the file mapping, 0 when the file was read into fallbackData instead
+    size_t m_mappingSize;
+    std::vector<uint8_t> m_fallbackData;
+};
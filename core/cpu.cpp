@@ -1,380 +1,1449 @@
 #include "cpu.h"
 
+#include "jit.h"
+#include "profiler.h"
+
+#include <algorithm>
 #include <cassert>
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+    // Fields of the opcode table the interpreter reads for every instruction, packed apart
+    template <typename GetField>
+    constexpr std::array<uint8_t, 256> MakeOpcodeFieldTable(GetField getField)
+    {
+        std::array<uint8_t, 256> values{};
+        for(unsigned int opcode = 0; opcode < values.size(); ++opcode)
+        {
+            values[opcode] = getField(Opcodes::Get(static_cast<uint8_t>(opcode)));
+        }
+        return values;
+    }
+
+    constexpr std::array<uint8_t, 256> s_OPCODE_LENGTHS = MakeOpcodeFieldTable([](const OpcodeInfo& info){ return info.length; });
+    constexpr std::array<uint8_t, 256> s_OPCODE_CYCLES = MakeOpcodeFieldTable([](const OpcodeInfo& info){ return info.cycles; });
+#if GB_PROFILER
+    // The only instructions the call graph follows, the others are not looked at after running
+    constexpr std::array<uint8_t, 256> s_OPCODE_CALLS_OR_RETURNS = MakeOpcodeFieldTable([](const OpcodeInfo& info)
+    {
+        return info.flow == Flow::Call || info.flow == Flow::Return;
+    });
+#endif
+
+    // Upper bound on the size of a block, so that straight-line code does not produce huge blocks
+    constexpr unsigned int s_MAX_BLOCK_INSTRUCTIONS = 64;
+
+    // Number of executions after which a block is translated to native code
+    constexpr unsigned int s_JIT_THRESHOLD = 16;
+
+    // Instructions idle loops are made of, unprefixed or following 0xCB. They write nothing but A and F, the
+    // addresses they read through the other registers are the same in every iteration.
+    constexpr std::array<bool, 256> MakeIdleLoopOpcodeTable(bool isPrefixed)
+    {
+        std::array<bool, 256> isIdle{};
+        for(unsigned int opcode = 0; opcode < isIdle.size(); ++opcode)
+        {
+            const unsigned int z = opcode & 0x07;
+            if(isPrefixed)
+            {
+                // BIT, and the others on A
+                isIdle[opcode] = (opcode >> 6) == 1 || z == 7;
+            }
+            else if(opcode >= 0x78 && opcode < 0xC0)
+            {
+                // LD A,r and the arithmetic on A
+                isIdle[opcode] = true;
+            }
+            else if(opcode >= 0xC0)
+            {
+                // Arithmetic with an immediate, LDH A,(a8), LD A,(C) and LD A,(a16)
+                isIdle[opcode] = z == 6 || opcode == 0xF0 || opcode == 0xF2 || opcode == 0xFA;
+            }
+            else
+            {
+                // NOP, LD A,(BC), LD A,(DE), INC A, DEC A, LD A,d8, the rotations of A and the flag instructions.
+                // Past 0x40, the same column holds LD r,A and LD (HL),A.
+                isIdle[opcode] = opcode == 0x00 || opcode == 0x0A || opcode == 0x1A || (opcode >= 0x3C && opcode <= 0x3E) ||
+                                 (opcode < 0x40 && z == 7);
+            }
+        }
+        return isIdle;
+    }
+
+    constexpr std::array<bool, 256> s_IDLE_LOOP_OPCODES = MakeIdleLoopOpcodeTable(false);
+    constexpr std::array<bool, 256> s_IDLE_LOOP_CB_OPCODES = MakeIdleLoopOpcodeTable(true);
+
+    // Instructions of an idle loop, the jump closing it excluded, and the bytes they may take with it
+    constexpr unsigned int s_MAX_IDLE_LOOP_INSTRUCTIONS = 8;
+    constexpr unsigned int s_MAX_IDLE_LOOP_SIZE = 3 * (s_MAX_IDLE_LOOP_INSTRUCTIONS + 1);
+
+    // Events between two looks for an idle loop after one was not found, idle loops last for many events
+    constexpr unsigned int s_IDLE_LOOP_SEARCH_INTERVAL = 32;
+
+    constexpr uint32_t s_STATE_VERSION = 1;
+}
+
+// Operands encoded in the lower 3 bits of an opcode: B, C, D, E, H, L, (HL), A
+#define OPERAND(idx) (std::array<uint8_t, 8>{ REG(RegisterMask::B), REG(RegisterMask::C), \
+                                              REG(RegisterMask::D), REG(RegisterMask::E), \
+                                              REG(RegisterMask::H), REG(RegisterMask::L), \
+                                              REG(RegisterMask::HL), REG(RegisterMask::A) }[(idx)])
+
+// Register pairs pushed and popped by the stack instructions: BC, DE, HL, AF
+#define STACK_PAIR(idx) (std::array<uint8_t, 4>{ REG(RegisterMask::BC), REG(RegisterMask::DE), \
+                                                 REG(RegisterMask::HL), REG(RegisterMask::AF) }[(idx)])
+
+const std::array<CPU::OpcodeHandler, 256> CPU::m_OPCODE_HANDLERS = 
+    CPU::MakeOpcodeTable(std::make_index_sequence<256>{});
 
-CPU::CPU()
+const std::array<CPU::OpcodeHandler, 256> CPU::m_CB_OPCODE_HANDLERS = 
+    CPU::MakeCBOpcodeTable(std::make_index_sequence<256>{});
+
+CPU::CPU(Memory& mem, Scheduler& scheduler)
+    : m_mem{mem}
+    , m_scheduler{scheduler}
+    , m_blocks(0x10000)
+    , m_currentBlock{}
+    , m_isJITLockstepEnabled{}
+    , m_isJITPerfMapEnabled{}
+    , m_nbJITMismatches{}
+    , m_nativeHelperCycles{}
+    , m_nativeBlockStartTime{}
+    , m_nativeCycles{}
 {
+    m_mem.SetCodeWriteHandler([this](uint16_t firstAddr, uint16_t lastAddr){ InvalidateBlocks(firstAddr, lastAddr); });
     Reset();
 }
 
-void CPU::ExecuteNextInstruction()
-{
-#define FLAG(a) static_cast<std::underlying_type_t<FlagMask>>(FlagMask::a)
-#define REG(a) static_cast<std::underlying_type_t<RegisterMask>>(RegisterMask::a)
-#define ALU_OP(opcode, execALU, op, flagSet, ...) \
-        case opcode:       execALU(RegisterMask::B,  op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 1): execALU(RegisterMask::C,  op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 2): execALU(RegisterMask::D,  op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 3): execALU(RegisterMask::E,  op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 4): execALU(RegisterMask::H,  op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 5): execALU(RegisterMask::L,  op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 6): execALU(RegisterMask::HL, op, flagSet, ##__VA_ARGS__); break; \
-        case (opcode + 7): execALU(RegisterMask::A,  op, flagSet, ##__VA_ARGS__); break;
-
-#define LD_OP(opcode, r)                                 \
-        case (opcode):     LD<REG(r), REG(B)>();  break; \
-        case (opcode + 1): LD<REG(r), REG(C)>();  break; \
-        case (opcode + 2): LD<REG(r), REG(D)>();  break; \
-        case (opcode + 3): LD<REG(r), REG(E)>();  break; \
-        case (opcode + 4): LD<REG(r), REG(H)>();  break; \
-        case (opcode + 5): LD<REG(r), REG(L)>();  break; \
-        case (opcode + 6): LD<REG(r), REG(HL)>(); break; \
-        case (opcode + 7): LD<REG(r), REG(A)>();  break;
-
-    auto resetBits = [this](uint8_t reg, uint8_t mask) { return [this, mask, reg](){ ResetBits(reg, mask); }; };
-    auto setBits   = [this](uint8_t reg, uint8_t mask) { return [this, mask, reg](){ SetBits(reg, mask); }; };
-
-    auto setCarryFlags = [this](uint8_t lhs, uint8_t rhs)
-    {
-        const bool isSub = m_GPRegs[m_FLAG_REGISTER_IDX] & FLAG(N);
-        const uint32_t res = isSub ? (lhs - rhs) : (lhs + rhs);
-        const uint32_t carryBits = lhs ^ rhs ^ res;
-        m_GPRegs[m_FLAG_REGISTER_IDX] |= (carryBits & 0x10) ? FLAG(H) : 0;
-        m_GPRegs[m_FLAG_REGISTER_IDX] |= (carryBits & 0x100) ? FLAG(C) : 0;
-    };
-
-    auto ADC = [this](uint8_t lhs, uint8_t rhs) { return lhs + rhs + m_GPRegs[m_FLAG_REGISTER_IDX]; };
-    auto SBC = [this](uint8_t lhs, uint8_t rhs) { return lhs - (rhs + m_GPRegs[m_FLAG_REGISTER_IDX]); };
-
-    auto DEC = [](uint8_t val){ return --val; };
-    auto INC = [](uint8_t val){ return ++val; };
-
-    auto RST = [this](uint16_t addr){ m_mem.Write(m_SP--, m_PC); m_PC = addr; };
-
-    auto SWAP = [](uint8_t val) 
-    {
-        const uint8_t lowerNibble = val & 0x0F;
-        val >>= 4;
-        return (lowerNibble << 4) | val;
-    };
-
-    uint8_t opcode = m_mem.Read(m_PC++);
-    
-    switch(opcode)
-    {
-        case 0x00: [](){}; break;
-        case 0x01: [](){}; break;
-        case 0x02: LD<REG(BC), REG(A)>(); break;
-        case 0x03: [](){}; break;
-        case 0x04: ExecuteUnaryALU(RegisterMask::B, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x05: ExecuteUnaryALU(RegisterMask::B, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x06: LD<REG(B)>(); break;
-        case 0x07: [](){}; break;
-        case 0x08: [](){}; break;
-        case 0x09: [](){}; break;
-        case 0x0A: LD<REG(A), REG(BC)>(); break;
-        case 0x0B: [](){}; break;
-        case 0x0C: ExecuteUnaryALU(RegisterMask::C, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x0D: ExecuteUnaryALU(RegisterMask::C, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x0E: LD<REG(C)>(); break;
-        case 0x0F: [](){}; break;
-
-        case 0x10: [](){}; break;
-        case 0x11: [](){}; break;
-        case 0x12: LD<REG(DE), REG(A)>(); break;
-        case 0x13: [](){}; break;
-        case 0x14: ExecuteUnaryALU(RegisterMask::D, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x15: ExecuteUnaryALU(RegisterMask::D, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x16: LD<REG(D)>(); break;
-        case 0x17: [](){}; break;
-        case 0x18: [](){}; break;
-        case 0x19: [](){}; break;
-        case 0x1A: LD<REG(A), REG(DE)>(); break;
-        case 0x1B: [](){}; break;
-        case 0x1C: ExecuteUnaryALU(RegisterMask::E, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x1D: ExecuteUnaryALU(RegisterMask::E, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x1E: LD<REG(E)>(); break;
-        case 0x1F: [](){}; break;
-
-        case 0x20: [](){}; break;
-        case 0x21: [](){}; break;
-        case 0x22: [](){}; break;
-        case 0x23: [](){}; break;
-        case 0x24: ExecuteUnaryALU(RegisterMask::H, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x25: ExecuteUnaryALU(RegisterMask::H, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x26: LD<REG(H)>(); break;
-        case 0x27: [](){}; break;
-        case 0x28: [](){}; break;
-        case 0x29: [](){}; break;
-        case 0x2A: [](){}; break;
-        case 0x2B: [](){}; break;
-        case 0x2C: ExecuteUnaryALU(RegisterMask::L, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x2D: ExecuteUnaryALU(RegisterMask::L, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x2E: LD<REG(L)>(); break;
-        case 0x2F: [](){}; break;
-
-        case 0x30: [](){}; break;
-        case 0x31: [](){}; break;
-        case 0x32: [](){}; break;
-        case 0x33: ++m_SP; break;
-        case 0x34: [](){}; break;
-        case 0x35: [](){}; break;
-        case 0x36: [](){}; break;
-        case 0x37: [](){}; break;
-        case 0x38: [](){}; break;
-        case 0x39: [](){}; break;
-        case 0x3A: [](){}; break;
-        case 0x3B: --m_SP; break;
-        case 0x3C: ExecuteUnaryALU(RegisterMask::A, INC, resetBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x3D: ExecuteUnaryALU(RegisterMask::A, DEC, setBits(REG(F), FLAG(N)), setCarryFlags); break;
-        case 0x3E: LD<REG(A)>(); break;
-        case 0x3F:  
-            resetBits(REG(F), FLAG(N) | FLAG(H));
-            // TODO
-            break;
+CPU::~CPU() = default;
+
+template <typename Policy>
+unsigned int CPU::ExecuteNextInstruction(uint64_t& nbInstructions)
+{
+    const uint64_t startTime = m_scheduler.GetTime();
 
-        // LD B, #
-        LD_OP(0x40, B)
-
-        // LD C, #
-        LD_OP(0x48, C)
-
-        // LD D, #
-        LD_OP(0x50, D)
-
-        // LD E, #
-        LD_OP(0x58, B)
-        
-        // LD H, #
-        LD_OP(0x60, H)
-
-        // LD L, #
-        LD_OP(0x68, L)
-
-        // LD (HL), #
-        case 0x70: LD<REG(HL), REG(B)>(); break;
-        case 0x71: LD<REG(HL), REG(C)>(); break;
-        case 0x72: LD<REG(HL), REG(D)>(); break;
-        case 0x73: LD<REG(HL), REG(E)>(); break;
-        case 0x74: LD<REG(HL), REG(H)>(); break;
-        case 0x75: LD<REG(HL), REG(L)>(); break;
-        case 0x76: [](){}; break;
-        case 0x77: LD<REG(HL), REG(A)>(); break;
-
-        // LD A, #
-        LD_OP(0x78, A)
-    
-        // ADD
-        ALU_OP(0x80, ExecuteBinaryALU, std::plus<uint8_t>{}, resetBits(REG(F), FLAG(N)), setCarryFlags)
-        
-        // ADC
-        ALU_OP(0x88, ExecuteBinaryALU, ADC, resetBits(REG(F), FLAG(N)), setCarryFlags)
-    
-        // SUB
-        ALU_OP(0x90, ExecuteBinaryALU, std::minus<uint8_t>{}, setBits(REG(F), FLAG(N)), setCarryFlags)
-
-        // SBC
-        ALU_OP(0x98, ExecuteBinaryALU, SBC, setBits(REG(F), FLAG(N)), setCarryFlags)
-
-        // AND
-        ALU_OP(0xA0, ExecuteBinaryALU, std::bit_and<uint8_t>{}, resetBits(REG(F), FLAG(N) | ~FLAG(H) | FLAG(C)))
-        
-        // XOR
-        ALU_OP(0xA8, ExecuteBinaryALU, std::bit_xor<uint8_t>{}, resetBits(REG(F), FLAG(N) | FLAG(H) | FLAG(C)))
-
-        // OR
-        ALU_OP(0xB0, ExecuteBinaryALU, std::bit_or<uint8_t>{}, resetBits(REG(F), FLAG(N) | FLAG(H) | FLAG(C)))
-
-        case 0xB8: [](){}; break;
-        case 0xB9: [](){}; break;
-        case 0xBA: [](){}; break;
-        case 0xBB: [](){}; break;
-        case 0xBC: [](){}; break;
-        case 0xBD: [](){}; break;
-        case 0xBE: [](){}; break;
-        case 0xBF: [](){}; break;
-
-        case 0xC0: [](){}; break;
-        case 0xC1: POP<REG(BC)>(); break;
-        case 0xC2: [](){}; break;
-        case 0xC3: [](){}; break;
-        case 0xC4: [](){}; break;
-        case 0xC5: PUSH<REG(BC)>(); break;
-        case 0xC6: [](){}; break;
-        case 0xC7: RST(0x00); break;
-        case 0xC8: [](){}; break;
-        case 0xC9: [](){}; break;
-        case 0xCA: [](){}; break;
-        case 0xCB: 
-            switch(m_mem.Read(m_PC++))
+    if(!HandleInterrupts())
+    {
+        if(m_isHalted)
+        {
+            m_scheduler.AdvanceTime(4);
+#if GB_PROFILER
+            if(m_profiler != nullptr)
             {
-                #define BIT_OP(opcode, op, mask)                          \
-                    case (opcode):     op(REG(B),  mask); break; \
-                    case (opcode + 1): op(REG(C),  mask); break; \
-                    case (opcode + 2): op(REG(D),  mask); break; \
-                    case (opcode + 3): op(REG(E),  mask); break; \
-                    case (opcode + 4): op(REG(H),  mask); break; \
-                    case (opcode + 5): op(REG(L),  mask); break; \
-                    case (opcode + 6): op(REG(HL), mask); break; \
-                    case (opcode + 7): op(REG(A),  mask); break;
-
-                #define BIT_OP_FOR_ALL_BITS(opcode, op) \
-                    BIT_OP(opcode,      op, 1)          \
-                    BIT_OP(opcode + 8,  op, 1 << 1)     \
-                    BIT_OP(opcode + 16, op, 1 << 2)     \
-                    BIT_OP(opcode + 24, op, 1 << 3)     \
-                    BIT_OP(opcode + 32, op, 1 << 4)     \
-                    BIT_OP(opcode + 40, op, 1 << 5)     \
-                    BIT_OP(opcode + 48, op, 1 << 6)     \
-                    BIT_OP(opcode + 56, op, 1 << 7)
-
-                // SWAP R
-                ALU_OP(0x30, ExecuteUnaryALU, SWAP, resetBits(REG(F), FLAG(N) | FLAG(H) | FLAG(C)))
-
-                // BIT b, R
-                BIT_OP_FOR_ALL_BITS(0x40, [this](uint8_t reg, uint8_t mask){ TestBit(reg, mask); });
-
-                // RES b, R
-                BIT_OP_FOR_ALL_BITS(0x80, [this](uint8_t reg, uint8_t mask){ ResetBits(reg, mask); });
-
-                // SET b, R
-                BIT_OP_FOR_ALL_BITS(0xC0, [this](uint8_t reg, uint8_t mask){ SetBits(reg, mask); });
-
-                #undef BIT_OP_FOR_ALL_BITS
-                #undef BIT_OP             
+                m_profiler->RecordHalt(4);
             }
-            break;
-        case 0xCC: [](){}; break;
-        case 0xCD: [](){}; break;
-        case 0xCE: [](){}; break;
-        case 0xCF: RST(0x08); break;
-
-        case 0xD0: [](){}; break;
-        case 0xD1: POP<REG(DE)>(); break;
-        case 0xD2: [](){}; break;
-        case 0xD3: assert("Invalid opcode"); break;
-        case 0xD4: [](){}; break;
-        case 0xD5: PUSH<REG(DE)>(); break;
-        case 0xD6: [](){}; break;
-        case 0xD7: RST(0x10); break;
-        case 0xD8: [](){}; break;
-        case 0xD9: [](){}; break;
-        case 0xDA: [](){}; break;
-        case 0xDB: assert("Invalid opcode"); break;
-        case 0xDC: [](){}; break;
-        case 0xDD: assert("Invalid opcode"); break;
-        case 0xDE: [](){}; break;
-        case 0xDF: RST(0x18); break;
-
-        case 0xE0: [](){}; break;
-        case 0xE1: POP<REG(HL)>(); break;
-        case 0xE2: [](){}; break;
-        case 0xE3: assert("Invalid opcode"); break;
-        case 0xE4: assert("Invalid opcode"); break;
-        case 0xE5: PUSH<REG(HL)>(); break;
-        case 0xE6: [](){}; break;
-        case 0xE7: RST(0x20); break;
-        case 0xE8: [](){}; break;
-        case 0xE9: [](){}; break;
-        case 0xEA: [](){}; break;
-        case 0xEB: assert("Invalid opcode"); break;
-        case 0xEC: assert("Invalid opcode"); break;
-        case 0xED: assert("Invalid opcode"); break;
-        case 0xEE: [](){}; break;
-        case 0xEF: RST(0x28); break;
-
-        case 0xF0: [](){}; break;
-        case 0xF1: POP<REG(AF)>(); break;
-        case 0xF2: [](){}; break;
-        case 0xF3: [](){}; break;
-        case 0xF4: assert("Invalid opcode"); break;
-        case 0xF5: PUSH<REG(AF)>(); break;
-        case 0xF6: [](){}; break;
-        case 0xF7: RST(0x30); break;
-        case 0xF8: [](){}; break;
-        case 0xF9: [](){}; break;
-        case 0xFA: [](){}; break;
-        case 0xFB: [](){}; break;
-        case 0xFC: assert("Invalid opcode"); break;
-        case 0xFD: assert("Invalid opcode"); break;
-        case 0xFE: [](){}; break;
-        case 0xFF: RST(0x38); break;
-        default: assert("Unimplemented opcode"); break;
-    }
-
-#undef LD_OP
-#undef ALU_OP
-#undef FLAG
-#undef REG
+#endif
+        }
+        else
+        {
+            ExecuteInstruction<Policy>();
+            ++nbInstructions;
+        }
+    }
+
+    return static_cast<unsigned int>(m_scheduler.GetTime() - startTime);
 }
 
-void CPU::Reset()
+template <typename Policy>
+unsigned int CPU::ExecuteInstruction()
 {
-    m_PC = 0x100;
-    m_SP = 0xFFFE;
-    m_GPRegs.fill(0);
+    const uint64_t startTime = m_scheduler.GetTime();
+#if GB_PROFILER
+    const uint16_t startPC = m_PC;
+#endif
+    if constexpr(Policy::m_IS_DEBUG)
+    {
+        m_mem.SuspendWatchpoints(true);
+    }
+
+    const uint8_t opcode = m_mem.Read(m_PC);
+    const unsigned int length = s_OPCODE_LENGTHS[opcode];
+
+    // The HALT bug reads the byte following the opcode from the opcode address again
+    const uint16_t operandAddr = static_cast<uint16_t>(m_isHaltBugTriggered ? m_PC : m_PC + 1);
+
+    m_immediate = 0;
+    if(length > 1)
+    {
+        m_immediate = m_mem.Read(operandAddr);
+    }
+    if(length > 2)
+    {
+        m_immediate |= m_mem.Read(static_cast<uint16_t>(operandAddr + 1)) << 8;
+    }
+
+    if constexpr(Policy::m_IS_DEBUG)
+    {
+        m_mem.SuspendWatchpoints(false);
+    }
+
+    m_PC = static_cast<uint16_t>(operandAddr + length - 1);
+    m_isHaltBugTriggered = false;
+    m_instructionCycles = s_OPCODE_CYCLES[opcode];
+
+    // Data accesses happen after the opcode and its immediates are fetched
+    m_scheduler.AdvanceTime(4 * length);
+    (this->*m_OPCODE_HANDLERS[opcode])();
+    m_scheduler.SetTime(startTime + m_instructionCycles);
+
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        m_profiler->RecordInstruction(startPC, opcode, GetImmediateByte(), m_instructionCycles);
+
+        // Calls and returns are only followed where they leave the block, as the block cache does
+        const uint16_t fallThroughPC = static_cast<uint16_t>(operandAddr + length - 1);
+        if(s_OPCODE_CALLS_OR_RETURNS[opcode] && m_PC != fallThroughPC)
+        {
+            m_profiler->RecordBranch(opcode, fallThroughPC, m_PC, m_SP);
+        }
+    }
+#endif
+
+    return m_instructionCycles;
 }
 
-void CPU::ResetBits(uint8_t reg, uint8_t bitMask)
+// The emulator picks the policy of each run
+template unsigned int CPU::ExecuteNextInstruction<PlainExecution>(uint64_t& nbInstructions);
+template unsigned int CPU::ExecuteNextInstruction<DebugExecution>(uint64_t& nbInstructions);
+
+bool CPU::HandleInterrupts()
 {
-    m_GPRegs[GetSetBitPosition(reg)] &= ~bitMask;
+    const uint8_t pendingInterrupts = m_mem.GetPendingInterrupts();
+
+    // HALT ends as soon as an interrupt is pending, even with interrupts disabled
+    if(pendingInterrupts != 0)
+    {
+        m_isHalted = false;
+    }
+
+    // EI takes effect after the instruction following it
+    const bool isEnabled = m_IME;
+    if(m_isIMEScheduled)
+    {
+        m_IME = true;
+        m_isIMEScheduled = false;
+    }
+
+    if(!isEnabled || pendingInterrupts == 0)
+    {
+        return false;
+    }
+
+    // The lowest bit has the highest priority
+    const uint8_t interrupt = pendingInterrupts & static_cast<uint8_t>(~pendingInterrupts + 1);
+    m_mem.AcknowledgeInterrupts(interrupt);
+    m_IME = false;
+
+    // Two internal M-cycles, pushing PC and jumping to the vector
+    const uint64_t startTime = m_scheduler.GetTime();
+    m_scheduler.AdvanceTime(4);
+    PushWord(m_PC);
+    m_PC = static_cast<uint16_t>(0x40 + 8 * GetSetBitPosition(interrupt));
+    m_scheduler.SetTime(startTime + 20);
+
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        m_profiler->RecordInterrupt(m_PC, 20, m_SP);
+    }
+#endif
+
+    return true;
 }
 
-void CPU::SetBits(uint8_t reg, uint8_t bitMask)
+bool CPU::IsSteppingRequired() const
 {
-    m_GPRegs[GetSetBitPosition(reg)] |= bitMask;
+    return m_isHalted || m_isIMEScheduled || m_isHaltBugTriggered || (m_IME && m_mem.GetPendingInterrupts() != 0);
 }
 
-void CPU::TestBit(uint8_t reg, uint8_t bitMask)
+void CPU::SkipHaltedTime(uint64_t deadline)
 {
-    assert((bitMask & (bitMask - 1)) == 0 && "More than one bit set");
+    // Steps servicing an interrupt or enabling them come first
+    const uint64_t time = m_scheduler.GetTime();
+    if(m_isIMEScheduled || m_mem.GetPendingInterrupts() != 0 || time >= deadline)
+    {
+        return;
+    }
 
-    const unsigned int nbBitsSet = GetNbSetBits(reg);
+    // Steps of 4 cycles, the last one may end past the deadline
+    const uint64_t cycles = (deadline - time + 3) & ~uint64_t{3};
+    m_scheduler.AdvanceTime(cycles);
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        m_profiler->RecordHalt(cycles);
+    }
+#endif
+}
 
-    uint8_t val{};
-    if (nbBitsSet == 1)
+bool CPU::LookForIdleTime()
+{
+    m_idleLoop.startAddr = m_NO_IDLE_LOOP;
+    m_idleLoop.nbIterations = 0;
+    if(!m_isHalted)
     {
-        const uint8_t regIdx = GetSetBitPosition(reg);
-        assert(regIdx < m_NB_REGISTERS && "Invalid register");
+        FindIdleLoop();
+    }
+
+    return m_isHalted || m_idleLoop.startAddr != m_NO_IDLE_LOOP;
+}
 
-        val = m_GPRegs[regIdx];
+void CPU::FindIdleLoop()
+{
+    // PC stays within the loop from one look to the next, busy code is not looked at
+    const uint16_t searchPC = m_idleLoop.searchPC;
+    m_idleLoop.searchPC = m_PC;
+    m_idleLoop.nbEventsBeforeSearch = s_IDLE_LOOP_SEARCH_INTERVAL - 1;
+    if(static_cast<uint16_t>(m_PC - searchPC + s_MAX_IDLE_LOOP_SIZE) > 2 * s_MAX_IDLE_LOOP_SIZE ||
+       (m_PC >= m_idleLoop.rejectedStartAddr && m_PC <= m_idleLoop.rejectedEndAddr))
+    {
+        return;
     }
-    else
+
+    // From PC to the jump closing the loop, then the whole loop from its start. Any loop going through the
+    // instructions looked at would end with the same jump, they are not looked at again for a while.
+    uint16_t jumpAddr = m_PC;
+    unsigned int length = 0;
+    for(unsigned int i = 0; i < s_MAX_IDLE_LOOP_INSTRUCTIONS && IsIdleLoopInstruction(jumpAddr, length); ++i)
+    {
+        jumpAddr = static_cast<uint16_t>(jumpAddr + length);
+    }
+
+    m_idleLoop.rejectedStartAddr = m_PC;
+    m_idleLoop.rejectedEndAddr = jumpAddr;
+
+    uint16_t startAddr = 0;
+    if(!GetJumpTarget(jumpAddr, startAddr) || startAddr > m_PC || jumpAddr < m_PC)
+    {
+        return;
+    }
+
+    uint16_t addr = startAddr;
+    for(unsigned int i = 0; addr != jumpAddr; ++i)
+    {
+        if(i == s_MAX_IDLE_LOOP_INSTRUCTIONS || addr > jumpAddr || !IsIdleLoopInstruction(addr, length))
+        {
+            m_idleLoop.rejectedStartAddr = startAddr;
+            return;
+        }
+        addr = static_cast<uint16_t>(addr + length);
+    }
+
+    // Rejected once its iterations turn out to differ
+    m_idleLoop.rejectedStartAddr = 0xFFFF;
+    m_idleLoop.rejectedEndAddr = 0;
+    m_idleLoop.nbEventsBeforeSearch = 0;
+    m_idleLoop.startAddr = startAddr;
+    m_idleLoop.endAddr = jumpAddr;
+}
+
+void CPU::SkipIdleIterations(uint64_t deadline, uint64_t& nbInstructions)
+{
+    // Interrupts serviced in the middle of an iteration would make it differ from the others, and I/O reads past the
+    // deadline may have run the event
+    const uint64_t time = m_scheduler.GetTime();
+    if(IsSteppingRequired() || time >= deadline)
+    {
+        m_idleLoop.nbIterations = 0;
+        return;
+    }
+
+    const State state = GetState();
+    const uint8_t a = state.regs[m_ACC_REGISTER_IDX];
+    const uint8_t f = state.regs[m_FLAG_REGISTER_IDX];
+    const bool isSameIteration = m_idleLoop.nbIterations != 0 && a == m_idleLoop.a && f == m_idleLoop.f;
+    if(!isSameIteration && m_idleLoop.nbIterations == 2)
+    {
+        // The first iteration may have started in the middle with what was read before the event, the two
+        // following differing is a loop such as a delay counting down in A
+        m_idleLoop.rejectedStartAddr = static_cast<uint16_t>(m_idleLoop.startAddr);
+        m_idleLoop.rejectedEndAddr = m_idleLoop.endAddr;
+        m_idleLoop.nbEventsBeforeSearch = s_IDLE_LOOP_SEARCH_INTERVAL - 1;
+        m_idleLoop.startAddr = m_NO_IDLE_LOOP;
+        return;
+    }
+
+    if(isSameIteration)
+    {
+        // Whole iterations only, the last one before the deadline is stepped. The loop is watched again after the
+        // event.
+        const uint64_t cycles = time - m_idleLoop.iterationTime;
+        const uint64_t nbIterations = (deadline - time) / cycles;
+        m_scheduler.AdvanceTime(nbIterations * cycles);
+        nbInstructions += nbIterations * (nbInstructions - m_idleLoop.iterationInstructions);
+#if GB_PROFILER
+        if(m_profiler != nullptr)
+        {
+            ProfileIdleIterations(nbIterations, cycles);
+        }
+#endif
+        m_idleLoop.startAddr = m_NO_IDLE_LOOP;
+        return;
+    }
+
+    ++m_idleLoop.nbIterations;
+    m_idleLoop.iterationTime = time;
+    m_idleLoop.iterationInstructions = nbInstructions;
+    m_idleLoop.a = a;
+    m_idleLoop.f = f;
+}
+
+bool CPU::IsIdleLoopOpcode(uint8_t opcode, bool isPrefixed)
+{
+    return isPrefixed ? s_IDLE_LOOP_CB_OPCODES[opcode] : s_IDLE_LOOP_OPCODES[opcode];
+}
+
+bool CPU::IsIdleLoopInstruction(uint16_t addr, unsigned int& length) const
+{
+    const uint8_t opcode = m_mem.Peek(addr);
+    const bool isPrefixed = opcode == Opcodes::m_CB_PREFIX;
+    const uint8_t cbOpcode = isPrefixed ? m_mem.Peek(static_cast<uint16_t>(addr + 1)) : 0;
+    if(isPrefixed ? !s_IDLE_LOOP_CB_OPCODES[cbOpcode] : !s_IDLE_LOOP_OPCODES[opcode])
+    {
+        return false;
+    }
+
+    const OpcodeInfo& info = isPrefixed ? Opcodes::GetCB(cbOpcode) : Opcodes::Get(opcode);
+    length = info.length;
+
+    // What it reads must not change before the next event
+    for(Operand operand : info.operands)
+    {
+        uint16_t readAddr = 0;
+        switch(operand)
+        {
+            case Operand::AtBC:
+                readAddr = GetRegisterPair<REG(RegisterMask::BC)>();
+                break;
+            case Operand::AtDE:
+                readAddr = GetRegisterPair<REG(RegisterMask::DE)>();
+                break;
+            case Operand::AtHL:
+                readAddr = GetRegisterPair<REG(RegisterMask::HL)>();
+                break;
+            case Operand::AtC:
+                readAddr = static_cast<uint16_t>(0xFF00 | m_GPRegs[GetRegisterIndex<REG(RegisterMask::C)>()]);
+                break;
+            case Operand::AtImmediate16:
+                readAddr = static_cast<uint16_t>(m_mem.Peek(static_cast<uint16_t>(addr + 1)) |
+                                                 (m_mem.Peek(static_cast<uint16_t>(addr + 2)) << 8));
+                break;
+            case Operand::AtHighImmediate8:
+                readAddr = static_cast<uint16_t>(0xFF00 | m_mem.Peek(static_cast<uint16_t>(addr + 1)));
+                break;
+            default:
+                continue;
+        }
+
+        if(!m_mem.IsReadEventDriven(readAddr))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CPU::GetJumpTarget(uint16_t addr, uint16_t& target) const
+{
+    // JR and JP, JP HL excluded
+    const OpcodeInfo& info = Opcodes::Get(m_mem.Peek(addr));
+    if(info.flow != Flow::Jump)
+    {
+        return false;
+    }
+
+    for(Operand operand : info.operands)
+    {
+        if(operand == Operand::Relative8)
+        {
+            const int8_t offset = static_cast<int8_t>(m_mem.Peek(static_cast<uint16_t>(addr + 1)));
+            target = static_cast<uint16_t>(addr + info.length + offset);
+            return true;
+        }
+        if(operand == Operand::Immediate16)
+        {
+            target = static_cast<uint16_t>(m_mem.Peek(static_cast<uint16_t>(addr + 1)) |
+                                           (m_mem.Peek(static_cast<uint16_t>(addr + 2)) << 8));
+            return true;
+        }
+    }
+    return false;
+}
+
+unsigned int CPU::ExecuteNextBlock(uint64_t& nbInstructions)
+{
+    if(IsSteppingRequired())
+    {
+        return ExecuteNextInstruction(nbInstructions);
+    }
+
+    m_invalidatedBlocks.clear();
+    return ExecuteBlock(*GetBlock(m_PC), nbInstructions);
+}
+
+unsigned int CPU::ExecuteNextNativeBlock(uint64_t& nbInstructions)
+{
+    if(!JIT::IsSupported())
+    {
+        return ExecuteNextBlock(nbInstructions);
+    }
+
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        return ExecuteNextBlock(nbInstructions);
+    }
+#endif
+
+    if(m_jit == nullptr)
+    {
+        m_jit = std::make_unique<JIT>(*this);
+        m_jit->EnablePerfMap(m_isJITPerfMapEnabled);
+    }
+
+    if(IsSteppingRequired())
+    {
+        return ExecuteNextInstruction(nbInstructions);
+    }
+
+    m_invalidatedBlocks.clear();
+    Block& block = *GetBlock(m_PC);
+
+    if(block.nativeCode == nullptr && ++block.nbExecutions >= s_JIT_THRESHOLD)
+    {
+        block.nativeCode = m_jit->Compile(block);
+        if(block.nativeCode == nullptr)
+        {
+            // Out of space for native code, start over
+            FlushNativeCode();
+            block.nativeCode = m_jit->Compile(block);
+        }
+    }
+
+    if(block.nativeCode == nullptr)
+    {
+        return ExecuteBlock(block, nbInstructions);
+    }
+
+    // Native code keeps the flags in a host register loaded from F
+    MaterializeFlags();
+
+    return m_isJITLockstepEnabled ? ExecuteNativeBlockInLockstep(block, nbInstructions)
+                                  : ExecuteNativeBlock(block, nbInstructions);
+}
+
+void CPU::EnableJITLockstep(bool isEnabled)
+{
+    m_isJITLockstepEnabled = isEnabled;
+}
+
+void CPU::SetLockstepHandlers(LockstepHandler save, LockstepHandler restore)
+{
+    m_saveLockstepState = std::move(save);
+    m_restoreLockstepState = std::move(restore);
+}
+
+bool CPU::EnableProfiler(bool isEnabled)
+{
+#if GB_PROFILER
+    if(isEnabled && m_profiler == nullptr)
     {
-        const uint16_t memAddr = GetMemAddr(reg);
-        val = m_mem.Read(memAddr);
+        m_profiler = std::make_unique<Profiler>(m_mem, m_scheduler);
     }
+    else if(!isEnabled && m_profiler != nullptr)
+    {
+        // Blocks must not keep runs counted for this profiler
+        FlushBlockProfiles();
+        m_profiler.reset();
+    }
+
+    return true;
+#else
+    return !isEnabled;
+#endif
+}
+
+const Profiler* CPU::GetProfiler()
+{
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        FlushBlockProfiles();
+        m_profiler->FlushPendingCounts();
+    }
+#endif
+
+    return m_profiler.get();
+}
+
+void CPU::EnableJITPerfMap(bool isEnabled)
+{
+    m_isJITPerfMapEnabled = isEnabled;
+    if(m_jit != nullptr)
+    {
+        m_jit->EnablePerfMap(isEnabled);
+    }
+}
+
+CPU::State CPU::GetState() const
+{
+    State state{m_GPRegs, m_SP, m_PC, m_IME};
+    if(m_pendingFlags.operation != FlagOperation::None)
+    {
+        state.regs[m_FLAG_REGISTER_IDX] = ComputeFlags(m_pendingFlags);
+    }
+
+    return state;
+}
+
+void CPU::Reset()
+{
+    // Values left by the boot ROM
+    m_PC = 0x100;
+    m_SP = 0xFFFE;
+    m_GPRegs = { 0x01, 0xB0, 0x00, 0x13, 0x00, 0xD8, 0x01, 0x4D };
 
-    const bool bitIsZero = ((bitMask & val) != bitMask);
+    m_IME = false;
+    m_isIMEScheduled = false;
+    m_isHalted = false;
+    m_isHaltBugTriggered = false;
+    m_idleLoop = {};
+    m_idleLoop.startAddr = m_NO_IDLE_LOOP;
+    m_idleLoop.rejectedStartAddr = 0xFFFF;
+    m_pendingFlags = {};
+    m_instructionCycles = 0;
+    m_immediate = 0;
 
-    // Set zero flag if bit is 0
-    m_GPRegs[m_FLAG_REGISTER_IDX] |= (bitIsZero ? 0b10000000 : 0);
+    for(std::unique_ptr<Block>& block : m_blocks)
+    {
+        block.reset();
+    }
+    for(std::vector<uint16_t>& pageBlocks : m_pageBlocks)
+    {
+        pageBlocks.clear();
+    }
+    m_mem.ClearCodePages();
 
-    // Reset N flag
-    m_GPRegs[m_FLAG_REGISTER_IDX] &= ~(static_cast<std::underlying_type_t<FlagMask>>(FlagMask::N));
+    if(m_jit != nullptr)
+    {
+        m_jit->Flush();
+    }
 
-    // Set H flag
-    m_GPRegs[m_FLAG_REGISTER_IDX] |= (static_cast<std::underlying_type_t<FlagMask>>(FlagMask::H));
+    if(m_profiler != nullptr)
+    {
+        m_profiler->Reset();
+    }
 }
 
-constexpr uint16_t CPU::GetMemAddr(uint8_t reg) const
+CPU::Block* CPU::GetBlock(uint16_t startAddr)
 {
-    assert(GetNbSetBits(reg) <= 2);
+    Block* block = m_blocks[startAddr].get();
+    if(block != nullptr && (startAddr >= 0x8000 || block->romBank == m_mem.GetROMBank(startAddr)))
+    {
+        return block;
+    }
+
+    // Another ROM bank is mapped where the block was decoded, decode it again from the current one
+    if(block != nullptr)
+    {
+        InvalidateBlocks(startAddr, startAddr);
+    }
+
+    return DecodeBlock(startAddr);
+}
 
-    uint16_t addr{};
-    uint8_t pos{};
+unsigned int CPU::ExecuteBlock(Block& block, uint64_t& nbInstructions)
+{
+    m_currentBlock = &block;
+#if GB_PROFILER
+    const uint64_t firstInstruction = nbInstructions;
+#endif
 
-    while(reg != 0)
+    unsigned int cycles{};
+    for(const DecodedInstruction& instruction : block.instructions)
     {
-        if(reg & 1)
+        const uint64_t startTime = m_scheduler.GetTime();
+        m_immediate = instruction.immediate;
+        m_PC = static_cast<uint16_t>(m_PC + instruction.length);
+        m_instructionCycles = instruction.cycles;
+
+        m_scheduler.AdvanceTime(4 * instruction.length);
+        (this->*instruction.handler)();
+        m_scheduler.SetTime(startTime + m_instructionCycles);
+
+        cycles += m_instructionCycles;
+        ++nbInstructions;
+
+        // The block overwrote itself, what follows must be decoded again
+        if(!block.isValid)
+        {
+            break;
+        }
+
+        // An interrupt became pending, it is serviced before the next instruction
+        if(IsSteppingRequired())
         {
-            addr <<= 8;
-            addr |= m_GPRegs[pos];
+            break;
         }
+    }
+
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        ProfileBlockRun(block, static_cast<size_t>(nbInstructions - firstInstruction));
+    }
+#endif
+
+    return cycles;
+}
 
-        ++pos;
-        reg >>= 1;
+#if GB_PROFILER
+void CPU::ProfileBlockRun(Block& block, size_t nbExecuted)
+{
+    if(block.profiledRuns.empty())
+    {
+        block.profiledRuns.resize(block.instructions.size());
+    }
+
+    // Only the last instruction of a block can take more cycles than decoded, or call or return
+    const DecodedInstruction& lastInstruction = block.instructions[nbExecuted - 1];
+    Block::ProfiledRuns& runs = block.profiledRuns[nbExecuted - 1];
+    runs.nbRuns++;
+    runs.extraCycles += m_instructionCycles - lastInstruction.cycles;
+
+    m_profiler->RecordBranch(lastInstruction.opcode, static_cast<uint16_t>(block.endAddr + 1), m_PC, m_SP);
+
+    // The block was flushed when it overwrote itself, this run comes after
+    if(!block.isValid)
+    {
+        FlushBlockProfile(block);
     }
+}
 
-    return addr;
+void CPU::FlushBlockProfile(Block& block)
+{
+    if(block.profiledRuns.empty())
+    {
+        return;
+    }
+
+    // Each instruction ran in every run ending at it or after it
+    std::vector<uint16_t> addresses(block.instructions.size());
+    uint16_t pc = block.startAddr;
+    for(size_t i = 0; i < block.instructions.size(); ++i)
+    {
+        addresses[i] = pc;
+        pc = static_cast<uint16_t>(pc + block.instructions[i].length);
+    }
+
+    uint64_t nbExecutions{};
+    for(size_t i = block.instructions.size(); i-- > 0;)
+    {
+        const DecodedInstruction& instruction = block.instructions[i];
+        nbExecutions += block.profiledRuns[i].nbRuns;
+        if(nbExecutions != 0)
+        {
+            const uint64_t cycles = nbExecutions * instruction.cycles + block.profiledRuns[i].extraCycles;
+            m_profiler->AddInstructionCounts(addresses[i], block.romBank, instruction.opcode, instruction.immediate & 0xFF,
+                                             nbExecutions, cycles);
+        }
+    }
+
+    block.profiledRuns.clear();
+}
+
+void CPU::FlushBlockProfiles()
+{
+    for(const std::unique_ptr<Block>& block : m_blocks)
+    {
+        if(block != nullptr)
+        {
+            FlushBlockProfile(*block);
+        }
+    }
+}
+
+void CPU::ProfileIdleIterations(uint64_t nbIterations, uint64_t iterationCycles)
+{
+    // Each instruction of the loop ran once per iteration, the jump closing it took the rest of the cycles
+    uint64_t jumpCycles = iterationCycles;
+    for(uint16_t addr = static_cast<uint16_t>(m_idleLoop.startAddr);;)
+    {
+        const uint8_t opcode = m_mem.Peek(addr);
+        const uint8_t nextByte = m_mem.Peek(static_cast<uint16_t>(addr + 1));
+        const OpcodeInfo& info = opcode == Opcodes::m_CB_PREFIX ? Opcodes::GetCB(nextByte) : Opcodes::Get(opcode);
+        const uint8_t operand = info.length > 1 ? nextByte : 0;
+
+        const bool isJump = addr == m_idleLoop.endAddr;
+        const uint64_t cycles = isJump ? jumpCycles : info.cycles;
+        m_profiler->RecordInstruction(addr, opcode, operand, nbIterations * cycles, nbIterations);
+        if(isJump)
+        {
+            break;
+        }
+
+        jumpCycles -= info.cycles;
+        addr = static_cast<uint16_t>(addr + info.length);
+    }
+}
+#endif
+
+unsigned int CPU::ExecuteNativeBlock(Block& block, uint64_t& nbInstructions)
+{
+    m_currentBlock = &block;
+    m_nativeHelperCycles = 0;
+    m_nativeBlockStartTime = m_scheduler.GetTime();
+
+    const uint64_t result = block.nativeCode();
+    const unsigned int cycles = static_cast<unsigned int>(result & 0xFFFFFFFF) + m_nativeHelperCycles;
+    m_scheduler.SetTime(m_nativeBlockStartTime + cycles);
+
+    nbInstructions += result >> 32;
+    return cycles;
+}
+
+unsigned int CPU::ExecuteNativeBlockInLockstep(Block& block, uint64_t& nbInstructions)
+{
+    const std::array<uint8_t, m_NB_REGISTERS> regsBefore = m_GPRegs;
+    const uint16_t spBefore = m_SP;
+    const uint16_t pcBefore = m_PC;
+    const bool imeBefore = m_IME;
+    const bool isIMEScheduledBefore = m_isIMEScheduled;
+
+    // Memory, the clock and the other components, whatever the block did to them through I/O must not happen twice
+    if(m_saveLockstepState)
+    {
+        m_saveLockstepState();
+    }
+
+    uint64_t nbNativeInstructions{};
+    const unsigned int nativeCycles = ExecuteNativeBlock(block, nbNativeInstructions);
+
+    const std::array<uint8_t, m_NB_REGISTERS> nativeRegs = m_GPRegs;
+    const uint16_t nativeSP = m_SP;
+    const uint16_t nativePC = m_PC;
+
+    // Run the same instructions again through the interpreter, which remains the reference
+    m_GPRegs = regsBefore;
+    m_SP = spBefore;
+    m_PC = pcBefore;
+    m_IME = imeBefore;
+    m_isIMEScheduled = isIMEScheduledBefore;
+    m_isHalted = false;
+    if(m_restoreLockstepState)
+    {
+        m_restoreLockstepState();
+    }
+
+    unsigned int cycles{};
+    for(uint64_t i = 0; i < nbNativeInstructions; ++i)
+    {
+        cycles += ExecuteInstruction();
+    }
+    MaterializeFlags();
+
+    if(nativeRegs != m_GPRegs || nativeSP != m_SP || nativePC != m_PC || nativeCycles != cycles)
+    {
+        ++m_nbJITMismatches;
+
+        auto printState = [](const char* name, const std::array<uint8_t, m_NB_REGISTERS>& regs, 
+                             uint16_t sp, uint16_t pc, unsigned int nbCycles)
+        {
+            std::cerr << std::hex << std::setfill('0') << "  " << name << ":";
+            for(uint8_t reg : regs)
+            {
+                std::cerr << " " << std::setw(2) << static_cast<unsigned int>(reg);
+            }
+            std::cerr << " SP=" << std::setw(4) << sp << " PC=" << std::setw(4) << pc
+                      << std::dec << " cycles=" << nbCycles << "\n";
+        };
+
+        std::cerr << "JIT mismatch in block at 0x" << std::hex << pcBefore << std::dec << " (AFBCDEHL)\n";
+        printState("native     ", nativeRegs, nativeSP, nativePC, nativeCycles);
+        printState("interpreter", m_GPRegs, m_SP, m_PC, cycles);
+    }
+
+    nbInstructions += nbNativeInstructions;
+    return cycles;
+}
+
+void CPU::FlushNativeCode()
+{
+    for(std::unique_ptr<Block>& block : m_blocks)
+    {
+        if(block != nullptr)
+        {
+            block->nativeCode = nullptr;
+            block->nbExecutions = 0;
+        }
+    }
+
+    m_jit->Flush();
+}
+
+bool CPU::ExecuteFromNativeCode(CPU* cpu, const DecodedInstruction* instruction)
+{
+    const uint64_t startTime = cpu->m_nativeBlockStartTime + cpu->m_nativeCycles + cpu->m_nativeHelperCycles;
+    cpu->m_immediate = instruction->immediate;
+    cpu->m_instructionCycles = instruction->cycles;
+
+    cpu->m_scheduler.SetTime(startTime + 4 * instruction->length);
+    (cpu->*instruction->handler)();
+    cpu->MaterializeFlags();
+
+    cpu->m_nativeHelperCycles += cpu->m_instructionCycles;
+    return !cpu->m_currentBlock->isValid || cpu->IsSteppingRequired();
+}
+
+uint8_t CPU::ReadFromNativeCode(CPU* cpu, uint16_t addr)
+{
+    cpu->m_scheduler.SetTime(cpu->m_nativeBlockStartTime + cpu->m_nativeCycles + cpu->m_nativeHelperCycles);
+    return cpu->m_mem.Read(addr);
+}
+
+bool CPU::WriteFromNativeCode(CPU* cpu, uint16_t addr, uint8_t value)
+{
+    cpu->m_scheduler.SetTime(cpu->m_nativeBlockStartTime + cpu->m_nativeCycles + cpu->m_nativeHelperCycles);
+    cpu->m_mem.Write(addr, value);
+    return !cpu->m_currentBlock->isValid || cpu->IsSteppingRequired();
+}
+
+CPU::Block* CPU::DecodeBlock(uint16_t startAddr)
+{
+    auto block = std::make_unique<Block>();
+    block->startAddr = startAddr;
+    block->isValid = true;
+    block->romBank = m_mem.GetROMBank(startAddr);
+    block->nativeCode = nullptr;
+    block->nbExecutions = 0;
+
+    // Decoding is not an access of the emulated CPU, it must neither sync the components nor hit watchpoints
+    uint16_t addr = startAddr;
+    for(;;)
+    {
+        const uint8_t opcode = m_mem.Peek(addr);
+        const unsigned int length = s_OPCODE_LENGTHS[opcode];
+
+        DecodedInstruction instruction{m_OPCODE_HANDLERS[opcode], 0, static_cast<uint8_t>(length), s_OPCODE_CYCLES[opcode], opcode};
+        if(length > 1)
+        {
+            instruction.immediate = m_mem.Peek(static_cast<uint16_t>(addr + 1));
+        }
+        if(length > 2)
+        {
+            instruction.immediate |= m_mem.Peek(static_cast<uint16_t>(addr + 2)) << 8;
+        }
+
+        // Resolve the prefixed opcode now rather than going through the prefix handler on every run
+        if(opcode == 0xCB)
+        {
+            const uint8_t cbOpcode = instruction.immediate & 0xFF;
+            instruction.handler = m_CB_OPCODE_HANDLERS[cbOpcode];
+            instruction.cycles = Opcodes::GetCB(cbOpcode).cycles;
+        }
+
+        block->instructions.push_back(instruction);
+
+        // Stop at the end of the address space rather than wrapping around, 
+        // and at the end of a ROM bank since the next one can be switched independently
+        const unsigned int nextAddr = addr + length;
+        block->endAddr = static_cast<uint16_t>(std::min(nextAddr - 1, 0xFFFFu));
+
+        const bool isBankBoundary = nextAddr <= 0x8000 && (nextAddr & 0x3FFF) == 0;
+        if(Opcodes::Get(opcode).flow != Flow::Next || nextAddr > 0xFFFF || isBankBoundary || 
+           block->instructions.size() == s_MAX_BLOCK_INSTRUCTIONS)
+        {
+            break;
+        }
+
+        addr = static_cast<uint16_t>(nextAddr);
+    }
+
+    // Writes to any page covered by the block must invalidate it, 
+    // ROM cannot be written and bank switches are caught by GetBlock
+    for(unsigned int page = startAddr >> 8; page <= static_cast<unsigned int>(block->endAddr >> 8); ++page)
+    {
+        m_pageBlocks[page].push_back(startAddr);
+        if(page >= 0x80)
+        {
+            m_mem.MarkCodePage(static_cast<uint8_t>(page));
+        }
+    }
+
+    m_blocks[startAddr] = std::move(block);
+    return m_blocks[startAddr].get();
+}
+
+void CPU::InvalidateBlocks(uint16_t firstAddr, uint16_t lastAddr)
+{
+    for(unsigned int page = firstAddr >> 8; page <= static_cast<unsigned int>(lastAddr >> 8); ++page)
+    {
+        std::vector<uint16_t>& pageBlocks = m_pageBlocks[page];
+
+        auto isOverwritten = [this, firstAddr, lastAddr](uint16_t startAddr)
+        {
+            const Block* block = m_blocks[startAddr].get();
+            return block == nullptr || (block->startAddr <= lastAddr && firstAddr <= block->endAddr);
+        };
+
+        for(uint16_t startAddr : pageBlocks)
+        {
+            if(isOverwritten(startAddr) && m_blocks[startAddr] != nullptr)
+            {
+#if GB_PROFILER
+                if(m_profiler != nullptr)
+                {
+                    FlushBlockProfile(*m_blocks[startAddr]);
+                }
+#endif
+                m_blocks[startAddr]->isValid = false;
+                m_invalidatedBlocks.push_back(std::move(m_blocks[startAddr]));
+            }
+        }
+
+        pageBlocks.erase(std::remove_if(pageBlocks.begin(), pageBlocks.end(), isOverwritten), pageBlocks.end());
+
+        if(pageBlocks.empty() && page >= 0x80)
+        {
+            m_mem.UnmarkCodePage(static_cast<uint8_t>(page));
+        }
+    }
+}
+
+template <uint8_t Opcode>
+void CPU::ExecuteOpcode()
+{
+    // Opcode fields, as laid out in the opcode table
+    constexpr uint8_t x = Opcode >> 6;
+    constexpr uint8_t y = (Opcode >> 3) & 0x07;
+    constexpr uint8_t z = Opcode & 0x07;
+    constexpr uint8_t p = y >> 1;
+    constexpr bool q = y & 0x01;
+
+    constexpr uint8_t HL = REG(RegisterMask::HL);
+    constexpr uint8_t A = REG(RegisterMask::A);
+
+    if constexpr(x == 0)
+    {
+        // Register pairs used by the 16-bit operations: BC, DE, HL and SP
+        constexpr uint8_t pair = (p == 3) ? 0 : STACK_PAIR(p);
+
+        if constexpr(z == 0)
+        {
+            if constexpr(y == 0)
+            {
+                // NOP
+            }
+            else if constexpr(y == 1)
+            {
+                const uint16_t addr = GetImmediateWord();
+                WriteMemory(addr, m_SP & 0xFF);
+                WriteMemory(static_cast<uint16_t>(addr + 1), m_SP >> 8);
+            }
+            else if constexpr(y == 2)
+            {
+                // STOP, its padding byte is skipped as an immediate
+            }
+            else if constexpr(y == 3)
+            {
+                JR<Opcode, Condition::Always>();
+            }
+            else
+            {
+                JR<Opcode, static_cast<Condition>(y - 4)>();
+            }
+        }
+        else if constexpr(z == 1)
+        {
+            if constexpr(!q)
+            {
+                const uint16_t val = GetImmediateWord();
+                if constexpr(p == 3)
+                {
+                    m_SP = val;
+                }
+                else
+                {
+                    SetRegisterPair<pair>(val);
+                }
+            }
+            else if constexpr(p == 3)
+            {
+                AddToHL(m_SP);
+            }
+            else
+            {
+                AddToHL(GetRegisterPair<pair>());
+            }
+        }
+        else if constexpr(z == 2)
+        {
+            // Register pair used as address: (BC), (DE), (HL+) and (HL-)
+            constexpr uint8_t addrPair = (p < 2) ? STACK_PAIR(p) : HL;
+
+            if constexpr(!q)
+            {
+                LD<addrPair, A>();
+            }
+            else
+            {
+                LD<A, addrPair>();
+            }
+
+            if constexpr(p == 2)
+            {
+                SetRegisterPair<HL>(static_cast<uint16_t>(GetRegisterPair<HL>() + 1));
+            }
+            else if constexpr(p == 3)
+            {
+                SetRegisterPair<HL>(static_cast<uint16_t>(GetRegisterPair<HL>() - 1));
+            }
+        }
+        else if constexpr(z == 3)
+        {
+            constexpr int delta = q ? -1 : 1;
+            if constexpr(p == 3)
+            {
+                m_SP = static_cast<uint16_t>(m_SP + delta);
+            }
+            else
+            {
+                SetRegisterPair<pair>(static_cast<uint16_t>(GetRegisterPair<pair>() + delta));
+            }
+        }
+        else if constexpr(z == 4)
+        {
+            ExecuteUnaryALU<UnaryOperation::INC, OPERAND(y)>();
+        }
+        else if constexpr(z == 5)
+        {
+            ExecuteUnaryALU<UnaryOperation::DEC, OPERAND(y)>();
+        }
+        else if constexpr(z == 6)
+        {
+            LD<OPERAND(y)>();
+        }
+        else if constexpr(y < 4)
+        {
+            // RLCA, RRCA, RLA and RRA always reset the zero flag
+            ExecuteUnaryALU<static_cast<UnaryOperation>(y), A>();
+            SetFlag(FlagMask::Z, false);
+        }
+        else if constexpr(y == 4)
+        {
+            DecimalAdjust();
+        }
+        else if constexpr(y == 5)
+        {
+            m_GPRegs[m_ACC_REGISTER_IDX] = ~m_GPRegs[m_ACC_REGISTER_IDX];
+            SetFlag(FlagMask::N, true);
+            SetFlag(FlagMask::H, true);
+        }
+        else
+        {
+            // SCF and CCF
+            const bool carry = (y == 6) ? true : !IsFlagSet(FlagMask::C);
+            SetFlag(FlagMask::N, false);
+            SetFlag(FlagMask::H, false);
+            SetFlag(FlagMask::C, carry);
+        }
+    }
+    else if constexpr(x == 1)
+    {
+        if constexpr(y == 6 && z == 6)
+        {
+            // HALT. With interrupts disabled and one already pending, the CPU does not halt 
+            // but fails to move PC past the next opcode.
+            if(!m_IME && m_mem.GetPendingInterrupts() != 0)
+            {
+                m_isHaltBugTriggered = true;
+            }
+            else
+            {
+                m_isHalted = true;
+            }
+        }
+        else
+        {
+            LD<OPERAND(y), OPERAND(z)>();
+        }
+    }
+    else if constexpr(x == 2)
+    {
+        ExecuteBinaryALU<static_cast<BinaryOperation>(y), OPERAND(z)>();
+    }
+    else if constexpr(z == 0)
+    {
+        if constexpr(y < 4)
+        {
+            RET<Opcode, static_cast<Condition>(y)>();
+        }
+        else if constexpr(y == 4)
+        {
+            WriteMemory(0xFF00 + GetImmediateByte(), m_GPRegs[m_ACC_REGISTER_IDX]);
+        }
+        else if constexpr(y == 5)
+        {
+            m_SP = AddSignedToSP();
+        }
+        else if constexpr(y == 6)
+        {
+            m_GPRegs[m_ACC_REGISTER_IDX] = ReadMemory(0xFF00 + GetImmediateByte());
+        }
+        else
+        {
+            SetRegisterPair<HL>(AddSignedToSP());
+        }
+    }
+    else if constexpr(z == 1)
+    {
+        if constexpr(!q)
+        {
+            POP<STACK_PAIR(p)>();
+        }
+        else if constexpr(p == 0)
+        {
+            RET<Opcode, Condition::Always>();
+        }
+        else if constexpr(p == 1)
+        {
+            // RETI
+            RET<Opcode, Condition::Always>();
+            m_IME = true;
+        }
+        else if constexpr(p == 2)
+        {
+            m_PC = GetRegisterPair<HL>();
+        }
+        else
+        {
+            m_SP = GetRegisterPair<HL>();
+        }
+    }
+    else if constexpr(z == 2)
+    {
+        if constexpr(y < 4)
+        {
+            JP<Opcode, static_cast<Condition>(y)>();
+        }
+        else if constexpr(y == 4)
+        {
+            WriteMemory(0xFF00 + m_GPRegs[GetRegisterIndex<REG(RegisterMask::C)>()], m_GPRegs[m_ACC_REGISTER_IDX]);
+        }
+        else if constexpr(y == 5)
+        {
+            WriteMemory(GetImmediateWord(), m_GPRegs[m_ACC_REGISTER_IDX]);
+        }
+        else if constexpr(y == 6)
+        {
+            m_GPRegs[m_ACC_REGISTER_IDX] = ReadMemory(0xFF00 + m_GPRegs[GetRegisterIndex<REG(RegisterMask::C)>()]);
+        }
+        else
+        {
+            m_GPRegs[m_ACC_REGISTER_IDX] = ReadMemory(GetImmediateWord());
+        }
+    }
+    else if constexpr(z == 3)
+    {
+        if constexpr(y == 0)
+        {
+            JP<Opcode, Condition::Always>();
+        }
+        else if constexpr(y == 1)
+        {
+            const uint8_t cbOpcode = GetImmediateByte();
+            m_instructionCycles = Opcodes::GetCB(cbOpcode).cycles;
+            (this->*m_CB_OPCODE_HANDLERS[cbOpcode])();
+        }
+        else if constexpr(y == 6)
+        {
+            // DI
+            m_IME = false;
+            m_isIMEScheduled = false;
+        }
+        else if constexpr(y == 7)
+        {
+            // EI
+            m_isIMEScheduled = true;
+        }
+        else
+        {
+            // Invalid opcode, the hardware locks up
+        }
+    }
+    else if constexpr(z == 4)
+    {
+        if constexpr(y < 4)
+        {
+            CALL<Opcode, static_cast<Condition>(y)>();
+        }
+        else
+        {
+            // Invalid opcode, the hardware locks up
+        }
+    }
+    else if constexpr(z == 5)
+    {
+        if constexpr(!q)
+        {
+            PUSH<STACK_PAIR(p)>();
+        }
+        else if constexpr(p == 0)
+        {
+            CALL<Opcode, Condition::Always>();
+        }
+        else
+        {
+            // Invalid opcode, the hardware locks up
+        }
+    }
+    else if constexpr(z == 6)
+    {
+        ExecuteBinaryALU<static_cast<BinaryOperation>(y)>();
+    }
+    else
+    {
+        RST<y * 8>();
+    }
+}
+
+template <uint8_t Opcode>
+void CPU::ExecuteCBOpcode()
+{
+    constexpr uint8_t x = Opcode >> 6;
+    constexpr uint8_t y = (Opcode >> 3) & 0x07;
+    constexpr uint8_t z = Opcode & 0x07;
+
+    if constexpr(x == 0)
+    {
+        // RLC, RRC, RL, RR, SLA, SRA, SWAP and SRL
+        ExecuteUnaryALU<static_cast<UnaryOperation>(y), OPERAND(z)>();
+    }
+    else if constexpr(x == 1)
+    {
+        TestBit<OPERAND(z), (1 << y)>();
+    }
+    else if constexpr(x == 2)
+    {
+        ResetBits<OPERAND(z), (1 << y)>();
+    }
+    else
+    {
+        SetBits<OPERAND(z), (1 << y)>();
+    }
+}
+
+#undef STACK_PAIR
+#undef OPERAND
+
+void CPU::AddToHL(uint16_t val)
+{
+    const uint16_t hl = GetRegisterPair<REG(RegisterMask::HL)>();
+    const uint32_t result = hl + val;
+
+    SetFlag(FlagMask::N, false);
+    SetFlag(FlagMask::H, ((hl & 0x0FFF) + (val & 0x0FFF)) > 0x0FFF);
+    SetFlag(FlagMask::C, result > 0xFFFF);
+
+    SetRegisterPair<REG(RegisterMask::HL)>(static_cast<uint16_t>(result));
+}
+
+uint16_t CPU::AddSignedToSP()
+{
+    const uint8_t offset = GetImmediateByte();
+
+    // Flags are computed from the unsigned addition of the lower byte
+    uint8_t flags{};
+    flags |= ((m_SP & 0x0F) + (offset & 0x0F)) > 0x0F ? FLAG(FlagMask::H) : 0;
+    flags |= ((m_SP & 0xFF) + offset) > 0xFF ? FLAG(FlagMask::C) : 0;
+    SetFlags(flags);
+
+    return static_cast<uint16_t>(m_SP + static_cast<int8_t>(offset));
+}
+
+void CPU::DecimalAdjust()
+{
+    uint8_t acc = m_GPRegs[m_ACC_REGISTER_IDX];
+    bool carry = IsFlagSet(FlagMask::C);
+
+    if(IsFlagSet(FlagMask::N))
+    {
+        if(carry)
+        {
+            acc -= 0x60;
+        }
+        if(IsFlagSet(FlagMask::H))
+        {
+            acc -= 0x06;
+        }
+    }
+    else
+    {
+        if(carry || acc > 0x99)
+        {
+            acc += 0x60;
+            carry = true;
+        }
+        if(IsFlagSet(FlagMask::H) || (acc & 0x0F) > 0x09)
+        {
+            acc += 0x06;
+        }
+    }
+
+    m_GPRegs[m_ACC_REGISTER_IDX] = acc;
+    SetFlag(FlagMask::Z, acc == 0);
+    SetFlag(FlagMask::H, false);
+    SetFlag(FlagMask::C, carry);
+}
+
+void CPU::PushWord(uint16_t val)
+{
+    // An internal M-cycle comes before the writes
+    m_scheduler.AdvanceTime(4);
+    WriteMemory(--m_SP, val >> 8);
+    WriteMemory(--m_SP, val & 0xFF);
+}
+
+uint16_t CPU::PopWord()
+{
+    const uint8_t low = ReadMemory(m_SP++);
+    const uint8_t high = ReadMemory(m_SP++);
+    return static_cast<uint16_t>((high << 8) | low);
+}
+
+void CPU::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::CPU, s_STATE_VERSION);
+    writer.Write(m_GPRegs);
+    writer.Write(m_SP);
+    writer.Write(m_PC);
+    writer.Write(m_IME);
+    writer.Write(m_isIMEScheduled);
+    writer.Write(m_isHalted);
+    writer.Write(m_isHaltBugTriggered);
+    writer.Write(m_pendingFlags);
+    writer.EndChunk();
+}
+
+bool CPU::Load(SaveStateReader& reader)
+{
+    if(!reader.OpenChunk(SaveStateChunk::CPU, s_STATE_VERSION) || !reader.Read(m_GPRegs) || !reader.Read(m_SP) ||
+       !reader.Read(m_PC) || !reader.Read(m_IME) || !reader.Read(m_isIMEScheduled) || !reader.Read(m_isHalted) ||
+       !reader.Read(m_isHaltBugTriggered) || !reader.Read(m_pendingFlags) || !reader.CloseChunk())
+    {
+        return false;
+    }
+
+    // The ROM cannot have changed, its blocks and their native code stay valid, while RAM was replaced as a whole
+    InvalidateBlocks(0x8000, 0xFFFF);
+#if GB_PROFILER
+    if(m_profiler != nullptr)
+    {
+        m_profiler->FlushPendingCounts(0x8000, 0xFFFF);
+    }
+#endif
+    return true;
 }
@@ -1,20 +1,103 @@
 #pragma once
 
+#include "debugger.h"
 #include "memory.h"
+#include "opcodes.h"
+#include "savestate.h"
+#include "scheduler.h"
 #include "utils.h"
 
+#include <array>
+#include <cstddef>
 #include <functional>
+#include <memory>
 #include <type_traits>
+#include <utility>
+#include <vector>
+
+class JIT;
+class Profiler;
 
 class CPU
 {
 public:
-    CPU();
+    // Register values, as the debugger and the tools see them
+    struct State
+    {
+        // In register file order: A, F, B, C, D, E, H, L
+        std::array<uint8_t, 8> regs;
+        uint16_t sp;
+        uint16_t pc;
+        bool ime;
+    };
+
+public:
+    CPU(Memory& mem, Scheduler& scheduler);
+    CPU(const CPU&) = delete;
+    CPU& operator=(const CPU&) = delete;
+    ~CPU();
+
+    // Executes one instruction, services an interrupt, or waits while halted.
+    // Each one advances the scheduler time and returns the number of clock cycles it took,
+    // the executed instructions are added to nbInstructions.
+    // With the debug policy, instruction fetches are kept out of the watchpoints, see Debugger.
+    template <typename Policy = PlainExecution>
+    unsigned int ExecuteNextInstruction(uint64_t& nbInstructions);
+
+    // Executes the basic block starting at PC, decoding and caching it on its first visit.
+    // Interrupts are only serviced between blocks.
+    unsigned int ExecuteNextBlock(uint64_t& nbInstructions);
+
+    // Same as ExecuteNextBlock, but hot blocks are translated to native code when the host supports it
+    unsigned int ExecuteNextNativeBlock(uint64_t& nbInstructions);
+
+    // Idle time, skipped between the steps of a run up to a deadline no later than the next scheduler event. Only
+    // events raise interrupts and change what idle loops read, skipping ends in the state stepping would.
+    //
+    // A halted CPU waits until the deadline at once. Idle loops are a few instructions polling memory, such as LY
+    // until VBlank or a flag set by an interrupt handler: they only write A and F, and read memory that only changes
+    // at events. WatchIdleLoop looks for one around PC after each event, and returns whether the CPU is halted or in
+    // one. Once an iteration of the loop leaves A and F as they were, the following ones until the deadline are the
+    // same and are skipped.
+    bool IsHalted() const { return m_isHalted; }
+    void SkipHalt(uint64_t deadline);
+    bool WatchIdleLoop();
+    void SkipIdleTime(uint64_t deadline, uint64_t& nbInstructions);
+
+    // Whether idle loops may contain the opcode, following 0xCB when prefixed
+    static bool IsIdleLoopOpcode(uint8_t opcode, bool isPrefixed);
+
+    // Called before and after the native run of a block checked in lockstep, to save the rest of the machine and
+    // bring it back before the interpreter replays the block
+    using LockstepHandler = std::function<void()>;
+
+    // Replays every native block with the interpreter and reports register mismatches on stderr. The rest of the
+    // machine is saved and restored through the lockstep handlers.
+    void EnableJITLockstep(bool isEnabled);
+    void SetLockstepHandlers(LockstepHandler save, LockstepHandler restore);
+    void EnableJITPerfMap(bool isEnabled);
+    uint64_t GetJITMismatchCount() const { return m_nbJITMismatches; }
+
+    // Statistics of the executed guest code, returns false when built without GB_PROFILER.
+    // Native blocks are not instrumented, they are not used while the profiler is enabled.
+    // Getting the profiler adds the runs of the cached blocks to it first, nullptr when disabled.
+    bool EnableProfiler(bool isEnabled);
+    const Profiler* GetProfiler();
+
+    // Flags still pending are computed, the CPU itself is left untouched
+    State GetState() const;
+    uint16_t GetPC() const { return m_PC; }
+    uint16_t GetSP() const { return m_SP; }
 
-    void ExecuteNextInstruction();
     void Reset();
 
+    // Registers and interrupt state, loading drops the blocks cached from RAM
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
 private:
+    friend class JIT;
+
     enum class RegisterMask : uint8_t
     {
         // 8-bits registers mask
@@ -42,7 +125,174 @@ private:
         C = 0b00010000,
     };
 
+    // Operations of the 0x80-0xBF block, in opcode order
+    enum class BinaryOperation : uint8_t
+    {
+        ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+    };
+
+    // Rotations and shifts of the 0xCB block in opcode order, followed by increment and decrement
+    enum class UnaryOperation : uint8_t
+    {
+        RLC, RRC, RL, RR, SLA, SRA, SWAP, SRL, INC, DEC
+    };
+
+    // Branch conditions in opcode order
+    enum class Condition : uint8_t
+    {
+        NZ, Z, NC, C, Always
+    };
+
+    // How to compute the flags of the last flag-setting operation
+    enum class FlagOperation : uint8_t
+    {
+        // F is up to date
+        None,
+
+        // Half-carry out of bit 3
+        Add,
+
+        // Subtraction flag and half-borrow from bit 4
+        Sub,
+
+        // Half-carry always set
+        And,
+
+        // Only zero and carry
+        Other
+    };
+
+    // Operands and result of the last flag-setting operation.
+    // The zero flag comes from the lower 8 bits of the result and the carry flag from the upper bits.
+    struct PendingFlags
+    {
+        FlagOperation operation;
+        uint8_t lhs;
+        uint8_t rhs;
+        uint8_t carryIn;
+        unsigned int result;
+    };
+
+    using OpcodeHandler = void (CPU::*)();
+
+    // Block translated by the JIT, see JIT::NativeBlock
+    using NativeBlock = uint64_t (*)();
+
+    // Instruction decoded once and replayed from the block cache
+    struct DecodedInstruction
+    {
+        OpcodeHandler handler;
+        uint16_t immediate;
+        uint8_t length;
+        uint8_t cycles;
+        uint8_t opcode;
+    };
+
+    // Straight-line run of instructions ending with a control flow instruction
+    struct Block
+    {
+        std::vector<DecodedInstruction> instructions;
+        uint16_t startAddr;
+        uint16_t endAddr;
+        bool isValid;
+
+        // ROM bank the block was decoded from, blocks never cross a bank boundary
+        uint16_t romBank;
+
+        NativeBlock nativeCode;
+        unsigned int nbExecutions;
+
+#if GB_PROFILER
+        // Runs ending at each instruction while profiling, and the cycles their last instruction took beyond
+        // the decoded ones, added to the profiler when the block is dropped or the profiler is read
+        struct ProfiledRuns
+        {
+            uint64_t nbRuns;
+            uint64_t extraCycles;
+        };
+        std::vector<ProfiledRuns> profiledRuns;
+#endif
+    };
+
+    static constexpr uint8_t REG(RegisterMask reg) { return static_cast<std::underlying_type_t<RegisterMask>>(reg); }
+    static constexpr uint8_t FLAG(FlagMask flag) { return static_cast<std::underlying_type_t<FlagMask>>(flag); }
+
 private:
+    // Opcode handlers, one instantiation per opcode
+    template <uint8_t Opcode>
+    void ExecuteOpcode();
+
+    template <uint8_t Opcode>
+    void ExecuteCBOpcode();
+
+    template <std::size_t... Opcodes>
+    static constexpr std::array<OpcodeHandler, sizeof...(Opcodes)> MakeOpcodeTable(std::index_sequence<Opcodes...>);
+
+    template <std::size_t... Opcodes>
+    static constexpr std::array<OpcodeHandler, sizeof...(Opcodes)> MakeCBOpcodeTable(std::index_sequence<Opcodes...>);
+
+    // Instruction stream, immediates are read by the dispatcher before calling the handler
+    uint8_t GetImmediateByte() const;
+    uint16_t GetImmediateWord() const;
+
+    // Executes the instruction at PC, regardless of interrupts
+    template <typename Policy = PlainExecution>
+    unsigned int ExecuteInstruction();
+
+    // Interrupts, HALT and the instruction following EI
+    bool HandleInterrupts();
+    bool IsSteppingRequired() const;
+
+    // Idle time
+    void SkipHaltedTime(uint64_t deadline);
+    bool LookForIdleTime();
+    void FindIdleLoop();
+    void SkipIdleIterations(uint64_t deadline, uint64_t& nbInstructions);
+    bool IsIdleLoopInstruction(uint16_t addr, unsigned int& length) const;
+    bool GetJumpTarget(uint16_t addr, uint16_t& target) const;
+
+    // Data accesses of the instruction being executed, one M-cycle each
+    uint8_t ReadMemory(uint16_t addr);
+    void WriteMemory(uint16_t addr, uint8_t value);
+
+    // Block cache
+    Block* GetBlock(uint16_t startAddr);
+    Block* DecodeBlock(uint16_t startAddr);
+    void InvalidateBlocks(uint16_t firstAddr, uint16_t lastAddr);
+    unsigned int ExecuteBlock(Block& block, uint64_t& nbInstructions);
+
+#if GB_PROFILER
+    // Counted per block run, the profiler only sees each instruction when the block is flushed
+    void ProfileBlockRun(Block& block, size_t nbExecuted);
+    void FlushBlockProfile(Block& block);
+    void FlushBlockProfiles();
+
+    // Adds the skipped iterations of the idle loop, see SkipIdleTime
+    void ProfileIdleIterations(uint64_t nbIterations, uint64_t iterationCycles);
+#endif
+
+    // Native code
+    unsigned int ExecuteNativeBlock(Block& block, uint64_t& nbInstructions);
+    unsigned int ExecuteNativeBlockInLockstep(Block& block, uint64_t& nbInstructions);
+    void FlushNativeCode();
+
+    // Called by native code for instructions that have no translation.
+    // Returns whether native code must leave the block, because the instruction
+    // invalidated it or an interrupt must be serviced before the next one.
+    static bool ExecuteFromNativeCode(CPU* cpu, const DecodedInstruction* instruction);
+
+    // Called by native code for memory accesses outside of directly mapped pages.
+    // Writes return whether native code must leave the block, like ExecuteFromNativeCode.
+    static uint8_t ReadFromNativeCode(CPU* cpu, uint16_t addr);
+    static bool WriteFromNativeCode(CPU* cpu, uint16_t addr, uint8_t value);
+
+    // Operand access, (HL) when given a register pair
+    template <uint8_t Reg>
+    uint8_t ReadOperand();
+
+    template <uint8_t Reg>
+    void WriteOperand(uint8_t value);
+
     // Loads
     template <uint8_t Reg>
     void LD();
@@ -51,33 +301,81 @@ private:
     void LD();
 
     // ALU operations
-    template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-    void ExecuteBinaryALU(uint8_t val, TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers);
+    template <BinaryOperation Op>
+    void ExecuteBinaryALU(uint8_t val);
+
+    template <BinaryOperation Op, uint8_t Reg>
+    void ExecuteBinaryALU();
 
-    template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-    void ExecuteBinaryALU(RegisterMask reg, TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers);
+    template <BinaryOperation Op>
+    void ExecuteBinaryALU();
 
-    template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-    void ExecuteBinaryALU(TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers);
+    template <UnaryOperation Op, uint8_t Reg>
+    void ExecuteUnaryALU();
 
-    template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-    void ExecuteUnaryALU(RegisterMask reg, TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers);
+    void AddToHL(uint16_t val);
+    uint16_t AddSignedToSP();
+    void DecimalAdjust();
 
     // Bit operations
-    void ResetBits(uint8_t reg, uint8_t bitMask);
-    void SetBits(uint8_t reg, uint8_t bitMask);
-    void TestBit(uint8_t reg, uint8_t bitMask);
+    template <uint8_t Reg, uint8_t BitMask>
+    void ResetBits();
+
+    template <uint8_t Reg, uint8_t BitMask>
+    void SetBits();
+
+    template <uint8_t Reg, uint8_t BitMask>
+    void TestBit();
 
     // Stack pointer manipulation
-    template <uint16_t Reg>
+    template <uint8_t Reg>
     void PUSH();
 
-    template <uint16_t Reg>
+    template <uint8_t Reg>
     void POP();
 
+    void PushWord(uint16_t val);
+    uint16_t PopWord();
+
+    // Control flow. A conditional branch taken takes the cycles the opcode table gives its opcode.
+    template <Condition Cond>
+    bool IsConditionMet() const;
+
+    template <uint8_t Opcode, Condition Cond>
+    void JR();
+
+    template <uint8_t Opcode, Condition Cond>
+    void JP();
+
+    template <uint8_t Opcode, Condition Cond>
+    void CALL();
+
+    template <uint8_t Opcode, Condition Cond>
+    void RET();
+
+    template <uint16_t Addr>
+    void RST();
+
+    // Register file accesses, decoded at compile time from the register masks. Pairs are AF, BC, DE and HL, with
+    // their high register first in the register file.
+    template <uint8_t Reg>
+    static constexpr unsigned int GetRegisterIndex();
+    template <uint8_t Pair>
+    static constexpr unsigned int GetPairIndex();
+    template <uint8_t Pair>
+    uint16_t GetRegisterPair() const;
+    template <uint8_t Pair>
+    void SetRegisterPair(uint16_t val);
+
     // Utility
-    constexpr uint16_t GetMemAddr(uint8_t reg) const;
-    
+    void SetFlag(FlagMask flag, bool isSet);
+    bool IsFlagSet(FlagMask flag) const;
+
+    // Flags are either set at once or, with GB_LAZY_FLAGS, computed when something reads them
+    void SetFlags(uint8_t flags);
+    void SetPendingFlags(const PendingFlags& flags);
+    void MaterializeFlags();
+    static constexpr uint8_t ComputeFlags(const PendingFlags& flags);
 
 private:
     static constexpr int m_NB_REGISTERS = 8;
@@ -88,18 +386,176 @@ private:
     uint16_t m_SP;
     uint16_t m_PC;
 
-    Memory m_mem;
+    // Interrupt master enable, and whether EI will set it after the next instruction
+    bool m_IME;
+    bool m_isIMEScheduled;
+
+    // HALT state, and the HALT bug making the next opcode byte be read twice
+    bool m_isHalted;
+    bool m_isHaltBugTriggered;
+
+    // Idle loop watched since the last event, starting at m_NO_IDLE_LOOP when there is none, the iterations
+    // started since, and the time, instruction count, A and F where the last one started. After not finding one the
+    // next events are not looked at, PC at the last look tells where to look, and the code last found not to be an
+    // idle loop where not to.
+    struct IdleLoop
+    {
+        uint32_t startAddr;
+        uint16_t endAddr;
+        uint16_t searchPC;
+        unsigned int nbEventsBeforeSearch;
+        uint16_t rejectedStartAddr;
+        uint16_t rejectedEndAddr;
+        unsigned int nbIterations;
+        uint64_t iterationTime;
+        uint64_t iterationInstructions;
+        uint8_t a;
+        uint8_t f;
+    };
+
+    static constexpr uint32_t m_NO_IDLE_LOOP = 0x10000;
+    IdleLoop m_idleLoop;
+
+    // Flags not written to F yet, if any
+    PendingFlags m_pendingFlags;
+
+    // Cycles taken by the instruction being executed
+    unsigned int m_instructionCycles;
+
+    // Immediate operand of the instruction being executed
+    uint16_t m_immediate;
+
+    Memory& m_mem;
+    Scheduler& m_scheduler;
+
+    // Cached blocks indexed by start address, and the blocks overlapping each 256 bytes page
+    std::vector<std::unique_ptr<Block>> m_blocks;
+    std::array<std::vector<uint16_t>, 256> m_pageBlocks;
+
+    // Blocks invalidated while executing, kept alive until the executing block is done
+    std::vector<std::unique_ptr<Block>> m_invalidatedBlocks;
+    Block* m_currentBlock;
+
+    std::unique_ptr<JIT> m_jit;
+    bool m_isJITLockstepEnabled;
+    LockstepHandler m_saveLockstepState;
+    LockstepHandler m_restoreLockstepState;
+    bool m_isJITPerfMapEnabled;
+    uint64_t m_nbJITMismatches;
+
+    // Cycles taken by the instructions native code handed back to the interpreter
+    unsigned int m_nativeHelperCycles;
+
+    // Time the executing native block started at, and cycles taken by its translated instructions 
+    // up to the memory access or instruction it is calling back for
+    uint64_t m_nativeBlockStartTime;
+    uint32_t m_nativeCycles;
+
+    std::unique_ptr<Profiler> m_profiler;
+
+    static const std::array<OpcodeHandler, 256> m_OPCODE_HANDLERS;
+    static const std::array<OpcodeHandler, 256> m_CB_OPCODE_HANDLERS;
 };
 
+template <std::size_t... Opcodes>
+constexpr std::array<CPU::OpcodeHandler, sizeof...(Opcodes)> CPU::MakeOpcodeTable(std::index_sequence<Opcodes...>)
+{
+    return { &CPU::ExecuteOpcode<Opcodes>... };
+}
+
+template <std::size_t... Opcodes>
+constexpr std::array<CPU::OpcodeHandler, sizeof...(Opcodes)> CPU::MakeCBOpcodeTable(std::index_sequence<Opcodes...>)
+{
+    return { &CPU::ExecuteCBOpcode<Opcodes>... };
+}
+
+inline bool CPU::WatchIdleLoop()
+{
+    if(m_idleLoop.nbEventsBeforeSearch != 0 && !m_isHalted)
+    {
+        --m_idleLoop.nbEventsBeforeSearch;
+        return false;
+    }
+
+    return LookForIdleTime();
+}
+
+inline void CPU::SkipHalt(uint64_t deadline)
+{
+    if(m_isHalted)
+    {
+        SkipHaltedTime(deadline);
+    }
+}
+
+inline void CPU::SkipIdleTime(uint64_t deadline, uint64_t& nbInstructions)
+{
+    if(m_isHalted)
+    {
+        SkipHaltedTime(deadline);
+    }
+    else if(m_PC == m_idleLoop.startAddr)
+    {
+        SkipIdleIterations(deadline, nbInstructions);
+    }
+}
+
+inline uint8_t CPU::ReadMemory(uint16_t addr)
+{
+    const uint8_t value = m_mem.Read(addr);
+    m_scheduler.AdvanceTime(4);
+    return value;
+}
+
+inline void CPU::WriteMemory(uint16_t addr, uint8_t value)
+{
+    m_mem.Write(addr, value);
+    m_scheduler.AdvanceTime(4);
+}
+
+inline uint8_t CPU::GetImmediateByte() const
+{
+    return m_immediate & 0xFF;
+}
+
+inline uint16_t CPU::GetImmediateWord() const
+{
+    return m_immediate;
+}
+
+template <uint8_t Reg>
+uint8_t CPU::ReadOperand()
+{
+    if constexpr(GetNbSetBits(Reg) == 1)
+    {
+        return m_GPRegs[GetRegisterIndex<Reg>()];
+    }
+    else
+    {
+        return ReadMemory(GetRegisterPair<Reg>());
+    }
+}
+
+template <uint8_t Reg>
+void CPU::WriteOperand(uint8_t value)
+{
+    if constexpr(GetNbSetBits(Reg) == 1)
+    {
+        m_GPRegs[GetRegisterIndex<Reg>()] = value;
+    }
+    else
+    {
+        WriteMemory(GetRegisterPair<Reg>(), value);
+    }
+}
+
 template <uint8_t Reg>
 void CPU::LD()
 {
-    static_assert(GetNbSetBits(Reg) == 1, "Immediate load only works with 8-bit registers");
+    static_assert(GetNbSetBits(Reg) == 1 || Reg == REG(RegisterMask::HL), "Immediate load only works with 8-bit registers or (HL)");
+    static_assert(Reg != REG(RegisterMask::F), "Loading into flag register is forbidden");
     
-    constexpr unsigned int regIdx = GetSetBitPosition(Reg);
-    static_assert(regIdx != m_FLAG_REGISTER_IDX, "Loading into flag register is forbidden");
-    
-    m_GPRegs[regIdx] = m_mem.Read(m_PC++);
+    WriteOperand<Reg>(GetImmediateByte());
 }
 
 template <uint8_t LHS, uint8_t RHS>
@@ -107,133 +563,407 @@ void CPU::LD()
 {
     constexpr unsigned int nbBitsSetLHS = GetNbSetBits(LHS);
     constexpr unsigned int nbBitsSetRHS = GetNbSetBits(RHS);
+    static_assert(nbBitsSetLHS == 1 || nbBitsSetRHS == 1, "Memory to memory loads are forbidden");
 
     if constexpr(nbBitsSetLHS == 1)
     {
-        constexpr unsigned int idx = GetSetBitPosition(LHS);
+        constexpr unsigned int idx = GetRegisterIndex<LHS>();
 
         if constexpr(nbBitsSetRHS == 1)
         {
-            m_GPRegs[idx] = m_GPRegs[GetSetBitPosition(RHS)];
+            m_GPRegs[idx] = m_GPRegs[GetRegisterIndex<RHS>()];
         }
         else if constexpr(nbBitsSetRHS == 2)
         {
-
-            m_GPRegs[idx] = m_mem.Read(GetMemAddr(RHS));
+            m_GPRegs[idx] = ReadMemory(GetRegisterPair<RHS>());
         }
     }
     else if constexpr(nbBitsSetLHS == 2)
     {
         if constexpr(nbBitsSetRHS == 1)
         {
-            m_mem.Write(GetMemAddr(LHS), m_GPRegs[GetSetBitPosition(RHS)]);
+            WriteMemory(GetRegisterPair<LHS>(), m_GPRegs[GetRegisterIndex<RHS>()]);
         }
     }
 }
 
-template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-void CPU::ExecuteBinaryALU(uint8_t val, TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers)
+template <CPU::BinaryOperation Op>
+void CPU::ExecuteBinaryALU(uint8_t val)
 {
-    static_assert(std::is_invocable_v<TOp, uint8_t, uint8_t>, "Incorrect ALU operation");
-    static_assert(std::is_invocable_v<TFlagSetter>, "Incorrect flag setter");
-    //(static_assert(std::is_invocable_v<decltype(handlers), uint8_t, uint8_t>, "TODO"), ...);
-
     const uint8_t lhsVal = m_GPRegs[m_ACC_REGISTER_IDX];
-    const uint8_t result = op(lhsVal, val);
-    m_GPRegs[m_ACC_REGISTER_IDX] = result;
 
-    // Set zero flag if result is 0
-    m_GPRegs[m_FLAG_REGISTER_IDX] |= (result == 0 ? 0b10000000 : 0);
+    unsigned int result{};
+    uint8_t carryIn{};
+    FlagOperation operation{};
 
-    // Unconditional flag setting
-    flagSet();
+    if constexpr(Op == BinaryOperation::ADD || Op == BinaryOperation::ADC)
+    {
+        carryIn = (Op == BinaryOperation::ADC && IsFlagSet(FlagMask::C)) ? 1 : 0;
+        result = lhsVal + val + carryIn;
+        operation = FlagOperation::Add;
+    }
+    else if constexpr(Op == BinaryOperation::SUB || Op == BinaryOperation::SBC || Op == BinaryOperation::CP)
+    {
+        // A borrow wraps the result around, setting its upper bits
+        carryIn = (Op == BinaryOperation::SBC && IsFlagSet(FlagMask::C)) ? 1 : 0;
+        result = lhsVal - val - carryIn;
+        operation = FlagOperation::Sub;
+    }
+    else if constexpr(Op == BinaryOperation::AND)
+    {
+        result = lhsVal & val;
+        operation = FlagOperation::And;
+    }
+    else if constexpr(Op == BinaryOperation::XOR)
+    {
+        result = lhsVal ^ val;
+        operation = FlagOperation::Other;
+    }
+    else if constexpr(Op == BinaryOperation::OR)
+    {
+        result = lhsVal | val;
+        operation = FlagOperation::Other;
+    }
 
-    // Conditional flag setting
-    (handlers(lhsVal, val), ...);
+    SetPendingFlags({operation, lhsVal, val, carryIn, result});
+
+    // Compare only sets the flags
+    if constexpr(Op != BinaryOperation::CP)
+    {
+        m_GPRegs[m_ACC_REGISTER_IDX] = static_cast<uint8_t>(result);
+    }
 }
 
-template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-void CPU::ExecuteBinaryALU(RegisterMask reg, TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers)
+template <CPU::BinaryOperation Op, uint8_t Reg>
+void CPU::ExecuteBinaryALU()
 {
-    const uint8_t regBits = static_cast<std::underlying_type_t<RegisterMask>>(reg);
-    const unsigned int nbBitsSet = GetNbSetBits(regBits);
-    
-    if (nbBitsSet == 1)
+    ExecuteBinaryALU<Op>(ReadOperand<Reg>());
+}
+
+template <CPU::BinaryOperation Op>
+void CPU::ExecuteBinaryALU()
+{
+    ExecuteBinaryALU<Op>(GetImmediateByte());
+}
+
+template <CPU::UnaryOperation Op, uint8_t Reg>
+void CPU::ExecuteUnaryALU()
+{
+    const uint8_t val = ReadOperand<Reg>();
+    const bool carry = IsFlagSet(FlagMask::C);
+
+    // Carry out in bit 8
+    unsigned int result{};
+    FlagOperation operation = FlagOperation::Other;
+
+    if constexpr(Op == UnaryOperation::INC || Op == UnaryOperation::DEC)
+    {
+        // Same flags as adding or subtracting 1, except for the carry which is left untouched
+        result = static_cast<uint8_t>(Op == UnaryOperation::INC ? val + 1 : val - 1);
+        result |= carry ? 0x100 : 0;
+        operation = (Op == UnaryOperation::INC) ? FlagOperation::Add : FlagOperation::Sub;
+    }
+    else if constexpr(Op == UnaryOperation::SWAP)
     {
-        const uint8_t regIdx = GetSetBitPosition(regBits);
-        assert(regIdx < m_NB_REGISTERS && "Invalid register");
+        result = static_cast<uint8_t>((val << 4) | (val >> 4));
+    }
+    else if constexpr(Op == UnaryOperation::RLC)
+    {
+        result = (val << 1) | (val >> 7);
+    }
+    else if constexpr(Op == UnaryOperation::RRC)
+    {
+        result = (val >> 1) | ((val & 0x01) << 7) | ((val & 0x01) << 8);
+    }
+    else if constexpr(Op == UnaryOperation::RL)
+    {
+        result = (val << 1) | (carry ? 1 : 0);
+    }
+    else if constexpr(Op == UnaryOperation::RR)
+    {
+        result = (val >> 1) | (carry ? 0x80 : 0) | ((val & 0x01) << 8);
+    }
+    else if constexpr(Op == UnaryOperation::SLA)
+    {
+        result = val << 1;
+    }
+    else if constexpr(Op == UnaryOperation::SRA)
+    {
+        result = (val >> 1) | (val & 0x80) | ((val & 0x01) << 8);
+    }
+    else if constexpr(Op == UnaryOperation::SRL)
+    {
+        result = (val >> 1) | ((val & 0x01) << 8);
+    }
+
+    WriteOperand<Reg>(static_cast<uint8_t>(result));
+    SetPendingFlags({operation, val, 1, 0, result});
+}
 
-        ExecuteBinaryALU(m_GPRegs[regIdx], op, flagSet, handlers...);
+template <uint8_t Reg, uint8_t BitMask>
+void CPU::ResetBits()
+{
+    WriteOperand<Reg>(ReadOperand<Reg>() & ~BitMask);
+}
+
+template <uint8_t Reg, uint8_t BitMask>
+void CPU::SetBits()
+{
+    WriteOperand<Reg>(ReadOperand<Reg>() | BitMask);
+}
+
+template <uint8_t Reg, uint8_t BitMask>
+void CPU::TestBit()
+{
+    static_assert(GetNbSetBits(BitMask) == 1, "More than one bit set");
+
+    const bool bitIsZero = (ReadOperand<Reg>() & BitMask) == 0;
+
+    // Set zero flag if bit is 0, reset N flag and set H flag
+    uint8_t flags = IsFlagSet(FlagMask::C) ? FLAG(FlagMask::C) : 0;
+    flags |= bitIsZero ? FLAG(FlagMask::Z) : 0;
+    flags |= FLAG(FlagMask::H);
+    SetFlags(flags);
+}
+
+template <uint8_t Reg>
+void CPU::PUSH()
+{
+    if constexpr(Reg == REG(RegisterMask::AF))
+    {
+        MaterializeFlags();
+    }
+
+    PushWord(GetRegisterPair<Reg>());
+}
+
+template <uint8_t Reg>
+void CPU::POP()
+{
+    uint16_t val = PopWord();
+
+    // The lower nibble of the flag register is always 0
+    if constexpr(Reg == REG(RegisterMask::AF))
+    {
+        val &= 0xFFF0;
+        SetFlags(val & 0xFF);
+    }
+
+    SetRegisterPair<Reg>(val);
+}
+
+template <CPU::Condition Cond>
+bool CPU::IsConditionMet() const
+{
+    if constexpr(Cond == Condition::NZ)
+    {
+        return !IsFlagSet(FlagMask::Z);
+    }
+    else if constexpr(Cond == Condition::Z)
+    {
+        return IsFlagSet(FlagMask::Z);
+    }
+    else if constexpr(Cond == Condition::NC)
+    {
+        return !IsFlagSet(FlagMask::C);
+    }
+    else if constexpr(Cond == Condition::C)
+    {
+        return IsFlagSet(FlagMask::C);
     }
     else
     {
-        ExecuteBinaryALU(m_mem.Read(GetMemAddr(regBits)), op, flagSet, handlers...);
+        return true;
     }
 }
 
-template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-void CPU::ExecuteBinaryALU(TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers)
+template <uint8_t Opcode, CPU::Condition Cond>
+void CPU::JR()
 {
-    ExecuteBinaryALU(m_mem.Read(m_PC++), op, flagSet, handlers...);
+    const int8_t offset = static_cast<int8_t>(GetImmediateByte());
+    if(IsConditionMet<Cond>())
+    {
+        m_PC = static_cast<uint16_t>(m_PC + offset);
+
+        if constexpr(Cond != Condition::Always)
+        {
+            m_instructionCycles = Opcodes::Get(Opcode).takenCycles;
+        }
+    }
 }
 
-template <typename TOp, typename TFlagSetter, typename... TFlagHandlers>
-void CPU::ExecuteUnaryALU(RegisterMask reg, TOp&& op, TFlagSetter&& flagSet, TFlagHandlers&&... handlers)
+template <uint8_t Opcode, CPU::Condition Cond>
+void CPU::JP()
 {
-    static_assert(std::is_invocable_v<TOp, uint8_t>, "Incorrect ALU operation");
-    static_assert(std::is_invocable_v<TFlagSetter>, "Incorrect flag setter");
+    const uint16_t addr = GetImmediateWord();
+    if(IsConditionMet<Cond>())
+    {
+        m_PC = addr;
 
-    const uint8_t regBits = static_cast<std::underlying_type_t<RegisterMask>>(reg);
-    const unsigned int nbBitsSet = GetNbSetBits(regBits);
+        if constexpr(Cond != Condition::Always)
+        {
+            m_instructionCycles = Opcodes::Get(Opcode).takenCycles;
+        }
+    }
+}
 
-    uint8_t result{};
-    if (nbBitsSet == 1)
+template <uint8_t Opcode, CPU::Condition Cond>
+void CPU::CALL()
+{
+    const uint16_t addr = GetImmediateWord();
+    if(IsConditionMet<Cond>())
     {
-        const uint8_t regIdx = GetSetBitPosition(regBits);
-        assert(regIdx < m_NB_REGISTERS && "Invalid register");
+        PushWord(m_PC);
+        m_PC = addr;
 
-        result = op(m_GPRegs[regIdx]);
-        m_GPRegs[regIdx] = result;
+        if constexpr(Cond != Condition::Always)
+        {
+            m_instructionCycles = Opcodes::Get(Opcode).takenCycles;
+        }
     }
-    else
+}
+
+template <uint8_t Opcode, CPU::Condition Cond>
+void CPU::RET()
+{
+    // Checking the condition takes an M-cycle of its own
+    if constexpr(Cond != Condition::Always)
     {
-        const uint16_t memAddr = GetMemAddr(regBits);
-        result = op(m_mem.Read(memAddr));
-        m_mem.Write(memAddr, result);
+        m_scheduler.AdvanceTime(4);
     }
-    
-    // Set zero flag if result is 0
-    m_GPRegs[m_FLAG_REGISTER_IDX] |= (result == 0 ? 0b10000000 : 0);
 
-    // Unconditional flag setting
-    flagSet();
+    if(IsConditionMet<Cond>())
+    {
+        m_PC = PopWord();
 
-    // Conditional flag setting
-    //(handlers(lhsVal, val), ...);
+        if constexpr(Cond != Condition::Always)
+        {
+            m_instructionCycles = Opcodes::Get(Opcode).takenCycles;
+        }
+    }
 }
 
-template <uint16_t Reg>
-void CPU::PUSH()
+template <uint16_t Addr>
+void CPU::RST()
 {
-    const uint8_t regBits = static_cast<std::underlying_type_t<RegisterMask>>(Reg);
-    unsigned int nbBitsSet = GetNbSetBits(regBits);
-    assert(nbBitsSet == 2 && "Push only works with register pairs");
+    PushWord(m_PC);
+    m_PC = Addr;
+}
 
-    for(auto pos : GetSetBitPositions(Reg))
+inline bool CPU::IsFlagSet(FlagMask flag) const
+{
+#if GB_LAZY_FLAGS
+    if(m_pendingFlags.operation != FlagOperation::None)
     {
-        m_mem.Write(m_SP--, m_GPRegs[pos]);
+        // Zero and carry, by far the most read, come straight from the result
+        if(flag == FlagMask::Z)
+        {
+            return (m_pendingFlags.result & 0xFF) == 0;
+        }
+        if(flag == FlagMask::C)
+        {
+            return (m_pendingFlags.result >> 8) != 0;
+        }
+
+        return (ComputeFlags(m_pendingFlags) & FLAG(flag)) != 0;
     }
+#endif
+
+    return (m_GPRegs[m_FLAG_REGISTER_IDX] & FLAG(flag)) != 0;
 }
 
-template <uint16_t Reg>
-void CPU::POP()
+inline void CPU::SetFlag(FlagMask flag, bool isSet)
 {
-    const uint8_t regBits = static_cast<std::underlying_type_t<RegisterMask>>(Reg);
-    unsigned int nbBitsSet = GetNbSetBits(regBits);
-    assert(nbBitsSet == 2 && "Push only works with register pairs");
+    MaterializeFlags();
 
-    for(auto pos : GetSetBitPositions(Reg))
+    if(isSet)
     {
-        m_GPRegs[pos] = m_mem.Read(++m_SP);
+        m_GPRegs[m_FLAG_REGISTER_IDX] |= FLAG(flag);
     }
+    else
+    {
+        m_GPRegs[m_FLAG_REGISTER_IDX] &= ~FLAG(flag);
+    }
+}
+
+inline void CPU::SetFlags(uint8_t flags)
+{
+    m_pendingFlags.operation = FlagOperation::None;
+    m_GPRegs[m_FLAG_REGISTER_IDX] = flags;
+}
+
+inline void CPU::SetPendingFlags(const PendingFlags& flags)
+{
+#if GB_LAZY_FLAGS
+    m_pendingFlags = flags;
+#else
+    m_GPRegs[m_FLAG_REGISTER_IDX] = ComputeFlags(flags);
+#endif
+}
+
+inline void CPU::MaterializeFlags()
+{
+#if GB_LAZY_FLAGS
+    if(m_pendingFlags.operation != FlagOperation::None)
+    {
+        m_GPRegs[m_FLAG_REGISTER_IDX] = ComputeFlags(m_pendingFlags);
+        m_pendingFlags.operation = FlagOperation::None;
+    }
+#endif
+}
+
+constexpr uint8_t CPU::ComputeFlags(const PendingFlags& flags)
+{
+    uint8_t result{};
+    result |= (flags.result & 0xFF) == 0 ? FLAG(FlagMask::Z) : 0;
+    result |= (flags.result >> 8) != 0 ? FLAG(FlagMask::C) : 0;
+
+    switch(flags.operation)
+    {
+        case FlagOperation::Add:
+            result |= ((flags.lhs & 0x0F) + (flags.rhs & 0x0F) + flags.carryIn) > 0x0F ? FLAG(FlagMask::H) : 0;
+            break;
+        case FlagOperation::Sub:
+            result |= FLAG(FlagMask::N);
+            result |= (flags.lhs & 0x0F) < (flags.rhs & 0x0F) + flags.carryIn ? FLAG(FlagMask::H) : 0;
+            break;
+        case FlagOperation::And:
+            result |= FLAG(FlagMask::H);
+            break;
+        case FlagOperation::None:
+        case FlagOperation::Other:
+            break;
+    }
+
+    return result;
+}
+
+template <uint8_t Reg>
+constexpr unsigned int CPU::GetRegisterIndex()
+{
+    static_assert(GetNbSetBits(Reg) == 1, "Not an 8-bit register");
+    return GetSetBitPosition(Reg);
+}
+
+template <uint8_t Pair>
+constexpr unsigned int CPU::GetPairIndex()
+{
+    static_assert(Pair == REG(RegisterMask::AF) || Pair == REG(RegisterMask::BC) || Pair == REG(RegisterMask::DE) ||
+                  Pair == REG(RegisterMask::HL), "Not a register pair");
+    return GetSetBitPosition(Pair & -Pair);
+}
+
+template <uint8_t Pair>
+uint16_t CPU::GetRegisterPair() const
+{
+    constexpr unsigned int idx = GetPairIndex<Pair>();
+    return static_cast<uint16_t>(m_GPRegs[idx] << 8 | m_GPRegs[idx + 1]);
+}
+
+template <uint8_t Pair>
+void CPU::SetRegisterPair(uint16_t val)
+{
+    constexpr unsigned int idx = GetPairIndex<Pair>();
+    m_GPRegs[idx] = static_cast<uint8_t>(val >> 8);
+    m_GPRegs[idx + 1] = static_cast<uint8_t>(val);
 }
@@ -0,0 +1,198 @@
+#include "debugger.h"
+
+#include "opcodes.h"
+
+Debugger::Debugger(Memory& mem)
+    : m_mem{mem}
+    , m_nbBreakpoints{}
+    , m_stepMode{StepMode::None}
+    , m_stepTargetPC{}
+    , m_stepTargetSP{}
+    , m_isWatchpointHit{}
+    , m_stop{}
+{
+    m_mem.SetWatchHandler([this](uint16_t addr, uint8_t value, bool isWrite, uint8_t previousValue)
+    {
+        OnAccess(addr, value, isWrite, previousValue);
+    });
+}
+
+Debugger::~Debugger()
+{
+    m_mem.WatchPages(Memory::PageSet{}, Memory::PageSet{});
+    m_mem.SetWatchHandler(nullptr);
+}
+
+void Debugger::Reset()
+{
+    m_stepMode = StepMode::None;
+    m_isWatchpointHit = false;
+    m_stop = Stop{};
+}
+
+void Debugger::SetBreakpoint(uint16_t addr, bool isSet)
+{
+    if(m_breakpoints[addr] != isSet)
+    {
+        m_breakpoints[addr] = isSet;
+        m_nbBreakpoints = isSet ? m_nbBreakpoints + 1 : m_nbBreakpoints - 1;
+    }
+}
+
+std::vector<uint16_t> Debugger::GetBreakpoints() const
+{
+    std::vector<uint16_t> breakpoints;
+    for(unsigned int addr = 0; addr < m_breakpoints.size() && breakpoints.size() < m_nbBreakpoints; ++addr)
+    {
+        if(m_breakpoints[addr])
+        {
+            breakpoints.push_back(static_cast<uint16_t>(addr));
+        }
+    }
+    return breakpoints;
+}
+
+void Debugger::AddWatchpoint(const Watchpoint& watchpoint)
+{
+    m_watchpoints.push_back(watchpoint);
+    UpdateWatchedPages();
+}
+
+void Debugger::RemoveWatchpoint(size_t index)
+{
+    if(index < m_watchpoints.size())
+    {
+        m_watchpoints.erase(m_watchpoints.begin() + static_cast<ptrdiff_t>(index));
+        UpdateWatchedPages();
+    }
+}
+
+void Debugger::Step()
+{
+    m_stepMode = StepMode::Step;
+}
+
+void Debugger::StepOver(uint16_t pc, uint16_t sp)
+{
+    // CALL and RST are run through
+    const OpcodeInfo& info = Opcodes::Get(m_mem.Peek(pc));
+    if(info.flow != Flow::Call)
+    {
+        Step();
+        return;
+    }
+
+    // Recursive calls get back to the same address deeper in the stack
+    m_stepMode = StepMode::RunTo;
+    m_stepTargetPC = static_cast<uint16_t>(pc + info.length);
+    m_stepTargetSP = sp;
+}
+
+void Debugger::RunTo(uint16_t addr)
+{
+    m_stepMode = StepMode::RunTo;
+    m_stepTargetPC = addr;
+    m_stepTargetSP = 0;
+}
+
+bool Debugger::CheckStop(uint16_t pc, uint16_t sp, bool hasMoved)
+{
+    StopReason reason = StopReason::None;
+    if(m_isWatchpointHit)
+    {
+        reason = StopReason::Watchpoint;
+    }
+    else if(!hasMoved)
+    {
+        return false;
+    }
+    else if(m_stepMode == StepMode::Step || (m_stepMode == StepMode::RunTo && pc == m_stepTargetPC && sp >= m_stepTargetSP))
+    {
+        reason = StopReason::Step;
+    }
+    else if(m_breakpoints[pc])
+    {
+        reason = StopReason::Breakpoint;
+    }
+    else
+    {
+        return false;
+    }
+
+    // Any stop ends the step in progress
+    m_stepMode = StepMode::None;
+    m_isWatchpointHit = false;
+    m_stop.reason = reason;
+    m_stop.pc = pc;
+    return true;
+}
+
+void Debugger::OnAccess(uint16_t addr, uint8_t value, bool isWrite, uint8_t previousValue)
+{
+    // Only the first hit of an instruction is kept
+    const bool isWatched = isWrite ? m_watchedWrites[addr] : m_watchedReads[addr];
+    if(!isWatched || m_isWatchpointHit)
+    {
+        return;
+    }
+
+    const Access access = isWrite ? Access::Write : Access::Read;
+    for(const Watchpoint& watchpoint : m_watchpoints)
+    {
+        const bool isInRange = addr >= watchpoint.firstAddr && addr <= watchpoint.lastAddr;
+        const bool isAccessWatched = (static_cast<uint8_t>(watchpoint.access) & static_cast<uint8_t>(access)) != 0;
+        if(!isInRange || !isAccessWatched)
+        {
+            continue;
+        }
+
+        bool isMet = false;
+        switch(watchpoint.condition)
+        {
+            case Condition::Any:
+                isMet = true;
+                break;
+            case Condition::Equal:
+                isMet = value == watchpoint.value;
+                break;
+            case Condition::NotEqual:
+                isMet = value != watchpoint.value;
+                break;
+            case Condition::Changed:
+                isMet = isWrite && value != previousValue;
+                break;
+        }
+
+        if(isMet)
+        {
+            m_isWatchpointHit = true;
+            m_stop.addr = addr;
+            m_stop.value = value;
+            m_stop.isWrite = isWrite;
+            return;
+        }
+    }
+}
+
+void Debugger::UpdateWatchedPages()
+{
+    m_watchedReads.reset();
+    m_watchedWrites.reset();
+
+    Memory::PageSet readPages;
+    Memory::PageSet writePages;
+    for(const Watchpoint& watchpoint : m_watchpoints)
+    {
+        const bool isRead = (static_cast<uint8_t>(watchpoint.access) & static_cast<uint8_t>(Access::Read)) != 0;
+        const bool isWrite = (static_cast<uint8_t>(watchpoint.access) & static_cast<uint8_t>(Access::Write)) != 0;
+        for(unsigned int addr = watchpoint.firstAddr; addr <= watchpoint.lastAddr; ++addr)
+        {
+            m_watchedReads[addr] = m_watchedReads[addr] || isRead;
+            m_watchedWrites[addr] = m_watchedWrites[addr] || isWrite;
+            readPages[addr >> 8] = readPages[addr >> 8] || isRead;
+            writePages[addr >> 8] = writePages[addr >> 8] || isWrite;
+        }
+    }
+
+    m_mem.WatchPages(readPages, writePages);
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "memory.h"
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Execution policies of the emulator loop and the CPU, chosen once per run. The plain one has no debug checks at
+// all, the debug one stops at breakpoints, watchpoints and the end of steps. The traced one is the plain one with
+// the state recorded after every step of the emulator loop, see TraceWriter.
+struct PlainExecution
+{
+    static constexpr bool m_IS_DEBUG = false;
+    static constexpr bool m_IS_TRACED = false;
+};
+
+struct DebugExecution
+{
+    static constexpr bool m_IS_DEBUG = true;
+    static constexpr bool m_IS_TRACED = false;
+};
+
+struct TracedExecution
+{
+    static constexpr bool m_IS_DEBUG = false;
+    static constexpr bool m_IS_TRACED = true;
+};
+
+// Breakpoints, watchpoints and stepping.
+//
+// The emulator runs with the debug policy only while there is something to stop at, one instruction at a time
+// whatever the execution mode. Breakpoints are a bitmap over the address space, looked up at every instruction.
+// Watchpoints are checked by Memory: the pages holding watched addresses go through its slow path, which reports
+// their data accesses here, instruction fetches excluded. The other pages cost nothing more.
+//
+// Runs stop on the instruction following the one that ended a step, hit a watchpoint, or led to a breakpoint
+// address, before executing it. Breakpoints are not checked where a run starts, resuming from one runs past it.
+class Debugger
+{
+public:
+    // Accesses a watchpoint stops at, as a mask
+    enum class Access : uint8_t
+    {
+        Read = 0x01,
+        Write = 0x02,
+        ReadWrite = 0x03
+    };
+
+    // Values a watchpoint stops at, the value read or written compared with its value
+    enum class Condition : uint8_t
+    {
+        Any,
+        Equal,
+        NotEqual,
+
+        // Writes replacing a different value, never reads
+        Changed
+    };
+
+    struct Watchpoint
+    {
+        uint16_t firstAddr;
+        uint16_t lastAddr;
+        Access access;
+        Condition condition;
+        uint8_t value;
+    };
+
+    enum class StopReason : uint8_t
+    {
+        // The run went to its end
+        None,
+        Breakpoint,
+        Watchpoint,
+        Step,
+
+        Count
+    };
+
+    struct Stop
+    {
+        StopReason reason;
+        uint16_t pc;
+
+        // Access of a watchpoint, the first one when the instruction hit several
+        uint16_t addr;
+        uint8_t value;
+        bool isWrite;
+    };
+
+public:
+    explicit Debugger(Memory& mem);
+    ~Debugger();
+
+    Debugger(const Debugger&) = delete;
+    Debugger& operator=(const Debugger&) = delete;
+
+    // Drops the step in progress and the last stop, breakpoints and watchpoints are kept
+    void Reset();
+
+    void SetBreakpoint(uint16_t addr, bool isSet);
+    bool HasBreakpoint(uint16_t addr) const { return m_breakpoints[addr]; }
+    std::vector<uint16_t> GetBreakpoints() const;
+
+    void AddWatchpoint(const Watchpoint& watchpoint);
+    void RemoveWatchpoint(size_t index);
+    const std::vector<Watchpoint>& GetWatchpoints() const { return m_watchpoints; }
+
+    // The next run stops after one instruction, or on entering an interrupt handler
+    void Step();
+
+    // Same, except that calls and RST run until they return
+    void StepOver(uint16_t pc, uint16_t sp);
+
+    // The next runs stop when PC gets to an address, unless they stop elsewhere first
+    void RunTo(uint16_t addr);
+
+    // Whether runs need the debug policy
+    bool IsActive() const { return m_nbBreakpoints != 0 || !m_watchpoints.empty() || m_stepMode != StepMode::None; }
+
+    // Why the last run stopped early, StopReason::None when it did not
+    const Stop& GetStop() const { return m_stop; }
+
+    // Called by the emulator at the start of each run, and after each of its steps with the debug policy.
+    // The step moved when it executed an instruction or entered an interrupt handler, not while halted.
+    // Returns whether the run must stop.
+    void BeginRun() { m_stop.reason = StopReason::None; }
+    bool CheckStop(uint16_t pc, uint16_t sp, bool hasMoved);
+
+private:
+    enum class StepMode : uint8_t
+    {
+        None,
+        Step,
+
+        // Until PC gets to the target with the stack back to where it was, or above
+        RunTo
+    };
+
+    void OnAccess(uint16_t addr, uint8_t value, bool isWrite, uint8_t previousValue);
+    void UpdateWatchedPages();
+
+private:
+    Memory& m_mem;
+
+    std::bitset<0x10000> m_breakpoints;
+    size_t m_nbBreakpoints;
+
+    // Addresses of all the watchpoints by access, the conditions are only evaluated on these
+    std::vector<Watchpoint> m_watchpoints;
+    std::bitset<0x10000> m_watchedReads;
+    std::bitset<0x10000> m_watchedWrites;
+
+    StepMode m_stepMode;
+    uint16_t m_stepTargetPC;
+    uint16_t m_stepTargetSP;
+
+    // Watchpoint hit by the instruction being executed
+    bool m_isWatchpointHit;
+
+    Stop m_stop;
+};
@@ -0,0 +1,73 @@
+#include "debugsession.h"
+
+#include <iomanip>
+
+DebugSession::DebugSession(Emulator& emu, bool isStepping, bool isSteppingOver)
+    : m_emu{emu}
+    , m_debugger{emu.GetDebugger()}
+    , m_isStepping{isStepping}
+    , m_isSteppingOver{isSteppingOver}
+    , m_nbTotalStops{}
+    , m_nbStops{}
+    , m_firstStop{}
+{
+    Step();
+}
+
+void DebugSession::RunFrames(uint64_t nbFrames)
+{
+    const uint64_t targetFrame = m_emu.GetFrameCount() + nbFrames;
+    while(m_emu.GetFrameCount() < targetFrame)
+    {
+        m_emu.RunFrames(targetFrame - m_emu.GetFrameCount());
+
+        const Debugger::Stop& stop = m_debugger.GetStop();
+        if(stop.reason != Debugger::StopReason::None)
+        {
+            if(m_nbTotalStops++ == 0)
+            {
+                m_firstStop = stop;
+            }
+            ++m_nbStops[static_cast<size_t>(stop.reason)];
+            Step();
+        }
+    }
+}
+
+void DebugSession::WriteStops(std::ostream& stream) const
+{
+    stream << "Debugger stops:   " << m_nbTotalStops
+           << " (" << m_nbStops[static_cast<size_t>(Debugger::StopReason::Breakpoint)] << " breakpoint, "
+           << m_nbStops[static_cast<size_t>(Debugger::StopReason::Watchpoint)] << " watchpoint, "
+           << m_nbStops[static_cast<size_t>(Debugger::StopReason::Step)] << " step)\n";
+
+    if(m_nbTotalStops == 0)
+    {
+        return;
+    }
+
+    static constexpr std::array<const char*, static_cast<size_t>(Debugger::StopReason::Count)> s_REASONS{
+        "", "breakpoint", "watchpoint", "step"};
+    stream << std::hex << std::uppercase << std::setfill('0')
+           << "First stop:       " << s_REASONS[static_cast<size_t>(m_firstStop.reason)]
+           << " at PC=" << std::setw(4) << m_firstStop.pc;
+    if(m_firstStop.reason == Debugger::StopReason::Watchpoint)
+    {
+        stream << (m_firstStop.isWrite ? ", write of $" : ", read of $")
+               << std::setw(2) << static_cast<unsigned int>(m_firstStop.value)
+               << (m_firstStop.isWrite ? " to $" : " from $") << std::setw(4) << m_firstStop.addr;
+    }
+    stream << "\n" << std::dec << std::nouppercase << std::setfill(' ');
+}
+
+void DebugSession::Step()
+{
+    if(m_isSteppingOver)
+    {
+        m_debugger.StepOver(m_emu.GetCPUState().pc, m_emu.GetCPUState().sp);
+    }
+    else if(m_isStepping)
+    {
+        m_debugger.Step();
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "debugger.h"
+#include "emulator.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Runs frames the way a debugger user does, going on after each stop, and counts the stops. The breakpoints,
+// watchpoints and run-to address are those set on the debugger of the emulator, the session only steps.
+class DebugSession
+{
+public:
+    DebugSession(Emulator& emu, bool isStepping, bool isSteppingOver);
+    DebugSession(const DebugSession&) = delete;
+    DebugSession& operator=(const DebugSession&) = delete;
+
+    // A stopped run goes on to the end of the frames it was given
+    void RunFrames(uint64_t nbFrames);
+
+    // Counts by reason, then where the first stop was
+    void WriteStops(std::ostream& stream) const;
+
+private:
+    void Step();
+
+private:
+    Emulator& m_emu;
+    Debugger& m_debugger;
+    bool m_isStepping;
+    bool m_isSteppingOver;
+
+    // In all and by reason, StopReason::None is never counted
+    uint64_t m_nbTotalStops;
+    std::array<uint64_t, static_cast<size_t>(Debugger::StopReason::Count)> m_nbStops;
+    Debugger::Stop m_firstStop;
+};
@@ -0,0 +1,89 @@
+#include "disassembler.h"
+
+#include "opcodes.h"
+
+#include <array>
+#include <cstdio>
+
+namespace
+{
+    // Operands written as they are, in the order of Operand, empty for those made from the bytes
+    constexpr std::array<const char*, 32> s_OPERAND_NAMES{
+        "",
+        "A", "B", "C", "D", "E", "H", "L",
+        "AF", "BC", "DE", "HL", "SP",
+        "(BC)", "(DE)", "(HL)", "(HL+)", "(HL-)", "(C)",
+        "", "", "", "",
+        "", "", "",
+        "NZ", "Z", "NC", "C",
+        "", ""
+    };
+
+    static_assert(s_OPERAND_NAMES.size() == static_cast<size_t>(Operand::Bit) + 1, "Operand without a name");
+
+    std::string FormatHex(unsigned int value, int nbDigits)
+    {
+        char text[8];
+        std::snprintf(text, sizeof(text), "$%0*X", nbDigits, value);
+        return text;
+    }
+
+    std::string FormatOffset(int8_t offset)
+    {
+        return (offset < 0 ? "-" : "+") + FormatHex(static_cast<unsigned int>(offset < 0 ? -offset : offset), 2);
+    }
+
+    // Immediates follow the opcode, and the prefix for the prefixed instructions
+    std::string FormatOperand(Operand operand, uint16_t addr, uint8_t opcode, const uint8_t* immediates)
+    {
+        switch(operand)
+        {
+            case Operand::Immediate8:
+                return FormatHex(immediates[0], 2);
+            case Operand::Immediate16:
+                return FormatHex(immediates[0] | immediates[1] << 8, 4);
+            case Operand::AtImmediate16:
+                return "(" + FormatHex(immediates[0] | immediates[1] << 8, 4) + ")";
+            case Operand::AtHighImmediate8:
+                return "(" + FormatHex(0xFF00 | immediates[0], 4) + ")";
+            case Operand::Relative8:
+                return FormatHex(static_cast<uint16_t>(addr + 2 + static_cast<int8_t>(immediates[0])), 4);
+            case Operand::Offset8:
+                return FormatOffset(static_cast<int8_t>(immediates[0]));
+            case Operand::SPOffset8:
+                return "SP" + FormatOffset(static_cast<int8_t>(immediates[0]));
+            case Operand::Vector:
+                return FormatHex(opcode & 0x38, 2);
+            case Operand::Bit:
+                return std::to_string((opcode >> 3) & 0x07);
+            default:
+                return s_OPERAND_NAMES[static_cast<size_t>(operand)];
+        }
+    }
+}
+
+std::string Disassembler::Disassemble(uint16_t addr, const uint8_t* bytes)
+{
+    const bool isPrefixed = bytes[0] == Opcodes::m_CB_PREFIX;
+    const uint8_t opcode = isPrefixed ? bytes[1] : bytes[0];
+    const OpcodeInfo& info = isPrefixed ? Opcodes::GetCB(opcode) : Opcodes::Get(opcode);
+    if(!info.IsValid())
+    {
+        return DisassembleData(opcode);
+    }
+
+    std::string text = info.mnemonic;
+    const uint8_t* immediates = bytes + (isPrefixed ? 2 : 1);
+    for(size_t i = 0; i < info.operands.size() && info.operands[i] != Operand::None; ++i)
+    {
+        text += i == 0 ? " " : ",";
+        text += FormatOperand(info.operands[i], addr, opcode, immediates);
+    }
+
+    return text;
+}
+
+std::string Disassembler::DisassembleData(uint8_t value)
+{
+    return "DB " + FormatHex(value, 2);
+}
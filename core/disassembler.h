@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Text of the instructions, in the usual assembler syntax: "LD A,($FF44)", "JR NZ,$0150", "BIT 7,H".
+// Relative jumps show their target, invalid opcodes show as data, "DB $D3".
+class Disassembler
+{
+public:
+    // Instruction at an address, bytes holds at least the length of its opcode, see Opcodes
+    static std::string Disassemble(uint16_t addr, const uint8_t* bytes);
+
+    // A byte that is not an instruction
+    static std::string DisassembleData(uint8_t value);
+};
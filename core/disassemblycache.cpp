@@ -0,0 +1,236 @@
+#include "disassemblycache.h"
+
+#include "opcodes.h"
+
+#include <algorithm>
+
+namespace
+{
+    constexpr unsigned int s_ROM_BANK_SIZE = 0x4000;
+
+    // Adds the line starting at an address and returns the address following it. An instruction that would run past
+    // the end of its area is listed as data.
+    template<typename ReadByte>
+    unsigned int AddLine(unsigned int addr, unsigned int areaEnd, ReadByte readByte, std::vector<DisassemblyCache::Line>& lines)
+    {
+        const unsigned int size = Opcodes::Get(readByte(addr)).length;
+        if(addr + size > areaEnd)
+        {
+            lines.push_back({static_cast<uint16_t>(addr), 1, true});
+            return addr + 1;
+        }
+
+        lines.push_back({static_cast<uint16_t>(addr), static_cast<uint8_t>(size), false});
+        return addr + size;
+    }
+
+    unsigned int GetAreaEnd(uint16_t addr)
+    {
+        return addr < 0x4000 ? 0x4000 : addr < 0x8000 ? 0x8000 : 0x10000;
+    }
+}
+
+DisassemblyCache::DisassemblyCache(Memory& mem)
+    : m_mem{mem}
+    , m_ramPages{}
+    , m_isValid{}
+    , m_pc{}
+    , m_lowBank{}
+    , m_highBank{}
+    , m_mappedBank{}
+    , m_version{}
+{
+    m_mem.SetCodeWriteHandler([this](uint16_t firstAddr, uint16_t lastAddr){ Invalidate(firstAddr, lastAddr); },
+                              Memory::CodeCache::Disassembly);
+}
+
+DisassemblyCache::~DisassemblyCache()
+{
+    m_mem.ClearCodePages(Memory::CodeCache::Disassembly);
+    m_mem.SetCodeWriteHandler(nullptr, Memory::CodeCache::Disassembly);
+}
+
+void DisassemblyCache::Reset()
+{
+    m_mem.ClearCodePages(Memory::CodeCache::Disassembly);
+
+    m_lowBanks.clear();
+    m_highBanks.clear();
+    for(RAMPage& ramPage : m_ramPages)
+    {
+        ramPage.isValid = false;
+    }
+    m_isValid = false;
+}
+
+const std::vector<DisassemblyCache::Line>& DisassemblyCache::GetLines(uint16_t pc, int highROMBank)
+{
+    const uint16_t lowBank = m_mem.GetROMBank(0x0000);
+    const uint16_t mappedBank = m_mem.GetROMBank(0x4000);
+    const bool isBankValid = highROMBank >= 0 && static_cast<unsigned int>(highROMBank) < m_mem.GetNbROMBanks();
+    const uint16_t shownBank = isBankValid ? static_cast<uint16_t>(highROMBank) : mappedBank;
+
+    // Nothing to do until RAM is written, a bank switched or the PC moved
+    const bool areRAMPagesChanged = UpdateRAMPages();
+    if(!areRAMPagesChanged && m_isValid && pc == m_pc && lowBank == m_lowBank && shownBank == m_highBank &&
+       mappedBank == m_mappedBank)
+    {
+        return m_lines;
+    }
+
+    m_isValid = true;
+    m_pc = pc;
+    m_lowBank = lowBank;
+    m_highBank = shownBank;
+    m_mappedBank = mappedBank;
+
+    m_previousLines.swap(m_lines);
+    m_lines = GetBankLines(m_lowBanks, lowBank, 0x0000);
+
+    const std::vector<Line>& highLines = GetBankLines(m_highBanks, shownBank, s_ROM_BANK_SIZE);
+    m_lines.insert(m_lines.end(), highLines.begin(), highLines.end());
+
+    for(const RAMPage& ramPage : m_ramPages)
+    {
+        m_lines.insert(m_lines.end(), ramPage.lines.begin(), ramPage.lines.end());
+    }
+
+    // The PC only says where the instructions of the mapped bank start
+    if(shownBank == mappedBank || pc < 0x4000 || pc >= 0x8000)
+    {
+        SyncTo(pc);
+    }
+
+    if(m_lines != m_previousLines)
+    {
+        ++m_version;
+    }
+    return m_lines;
+}
+
+const std::vector<DisassemblyCache::Line>& DisassemblyCache::GetBankLines(BankLines& banks, unsigned int bank,
+                                                                           unsigned int areaStart)
+{
+    if(bank >= banks.size())
+    {
+        banks.resize(std::max<size_t>(bank + 1, m_mem.GetNbROMBanks()));
+    }
+
+    std::unique_ptr<std::vector<Line>>& lines = banks[bank];
+    if(lines == nullptr)
+    {
+        // Without a cartridge the ROM area reads as open bus
+        const uint8_t* data = m_mem.GetROMBankData(bank);
+        auto readByte = [data](unsigned int offset){ return data != nullptr ? data[offset] : static_cast<uint8_t>(0xFF); };
+
+        auto readAreaByte = [&readByte, areaStart](unsigned int addr){ return readByte(addr - areaStart); };
+
+        lines = std::make_unique<std::vector<Line>>();
+        for(unsigned int addr = areaStart; addr < areaStart + s_ROM_BANK_SIZE;)
+        {
+            addr = AddLine(addr, areaStart + s_ROM_BANK_SIZE, readAreaByte, *lines);
+        }
+    }
+
+    return *lines;
+}
+
+bool DisassemblyCache::UpdateRAMPages()
+{
+    auto readByte = [this](unsigned int addr){ return m_mem.Peek(static_cast<uint16_t>(addr)); };
+
+    bool isChanged = false;
+    unsigned int addr = m_RAM_START;
+    for(unsigned int page = m_RAM_START >> 8; page < Memory::m_NB_PAGES; ++page)
+    {
+        RAMPage& ramPage = m_ramPages[page - (m_RAM_START >> 8)];
+        const unsigned int pageEnd = (page + 1) * Memory::m_PAGE_SIZE;
+
+        // A page starting where the previous one ends is still in step. The I/O pages are not watched, they are
+        // decoded every time and only count as changed when their lines do.
+        const bool isIOPage = page >= m_FIRST_IO_PAGE;
+        if(isIOPage || !ramPage.isValid || ramPage.firstAddr != addr)
+        {
+            m_syncLines.clear();
+            const unsigned int firstAddr = addr;
+            while(addr < pageEnd)
+            {
+                addr = AddLine(addr, 0x10000, readByte, m_syncLines);
+            }
+
+            if(!isIOPage || ramPage.firstAddr != firstAddr || ramPage.lines != m_syncLines)
+            {
+                ramPage.lines.swap(m_syncLines);
+                ramPage.firstAddr = static_cast<uint16_t>(firstAddr);
+                isChanged = true;
+            }
+
+            if(!isIOPage)
+            {
+                ramPage.isValid = true;
+                m_mem.MarkCodePage(static_cast<uint8_t>(page), Memory::CodeCache::Disassembly);
+            }
+        }
+
+        const Line& lastLine = ramPage.lines.back();
+        addr = lastLine.addr + lastLine.size;
+    }
+
+    return isChanged;
+}
+
+void DisassemblyCache::Invalidate(uint16_t firstAddr, uint16_t lastAddr)
+{
+    for(unsigned int page = firstAddr >> 8; page <= static_cast<unsigned int>(lastAddr >> 8); ++page)
+    {
+        if(page >= (m_RAM_START >> 8) && page < m_FIRST_IO_PAGE)
+        {
+            m_ramPages[page - (m_RAM_START >> 8)].isValid = false;
+            m_mem.UnmarkCodePage(static_cast<uint8_t>(page), Memory::CodeCache::Disassembly);
+        }
+    }
+}
+
+void DisassemblyCache::SyncTo(uint16_t addr)
+{
+    // The lines cover the whole address space, the first one starts at 0
+    auto isBefore = [](uint16_t addr, const Line& line){ return addr < line.addr; };
+    auto first = std::upper_bound(m_lines.begin(), m_lines.end(), addr, isBefore) - 1;
+    if(first->addr == addr)
+    {
+        return;
+    }
+
+    m_syncLines.clear();
+    for(unsigned int dataAddr = first->addr; dataAddr < addr; ++dataAddr)
+    {
+        m_syncLines.push_back({static_cast<uint16_t>(dataAddr), 1, true});
+    }
+
+    auto readByte = [this](unsigned int addr){ return m_mem.Peek(static_cast<uint16_t>(addr)); };
+    const unsigned int areaEnd = GetAreaEnd(addr);
+
+    // Back in step as soon as the sweep lands on the start of a line
+    auto last = first + 1;
+    unsigned int syncAddr = addr;
+    while(syncAddr < areaEnd)
+    {
+        while(last != m_lines.end() && last->addr < syncAddr)
+        {
+            ++last;
+        }
+        if(last != m_lines.end() && last->addr == syncAddr)
+        {
+            break;
+        }
+
+        syncAddr = AddLine(syncAddr, areaEnd, readByte, m_syncLines);
+    }
+    while(last != m_lines.end() && last->addr < syncAddr)
+    {
+        ++last;
+    }
+
+    const auto insertPos = m_lines.erase(first, last);
+    m_lines.insert(insertPos, m_syncLines.begin(), m_syncLines.end());
+}
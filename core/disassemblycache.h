@@ -0,0 +1,97 @@
+#pragma once
+
+#include "memory.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Instruction boundaries of the whole address space, for debuggers listing its disassembly. Only the boundaries are
+// kept, the text of the few lines on screen is made from the memory contents when they are drawn, see Disassembler.
+//
+// ROM is decoded a whole bank at a time, the first time the bank is listed, and never again since it cannot change.
+// RAM is decoded a page at a time. Its decoded pages are marked as code pages of the disassembly cache, so the first
+// write to one drops it, and it is decoded again the next time the listing is made. Pages written to but not listed
+// since only cost their first write. The I/O page is always decoded again, it changes all the time.
+//
+// Instructions are found by a linear sweep from the start of each area, which may take data for code and fall out
+// of step with the code that runs. The listing is brought back in step at the next instruction to run, the bytes
+// skipped to get there are listed as data.
+//
+// Only used from the thread running the emulator, the handler of the code writes runs there.
+class DisassemblyCache
+{
+public:
+    struct Line
+    {
+        uint16_t addr;
+        uint8_t size;
+        bool isData;
+
+        bool operator==(const Line& other) const
+        {
+            return addr == other.addr && size == other.size && isData == other.isData;
+        }
+    };
+
+public:
+    explicit DisassemblyCache(Memory& mem);
+    ~DisassemblyCache();
+
+    DisassemblyCache(const DisassemblyCache&) = delete;
+    DisassemblyCache& operator=(const DisassemblyCache&) = delete;
+
+    // Drops everything, for a new cartridge or memory replaced as a whole
+    void Reset();
+
+    // Lines of the address space, in step with the instruction at pc. The switchable ROM area shows the given
+    // bank instead of the mapped one when it is a valid bank. The lines stay valid until the next call.
+    const std::vector<Line>& GetLines(uint16_t pc, int highROMBank = -1);
+
+    // Incremented whenever the last lines returned differ from the previous ones
+    uint64_t GetVersion() const { return m_version; }
+
+private:
+    // Lines of ROM banks by bank, decoded when first needed. Most banks are only ever seen in one of the two areas,
+    // each area has its own lines so that they can be listed as they are.
+    using BankLines = std::vector<std::unique_ptr<std::vector<Line>>>;
+    const std::vector<Line>& GetBankLines(BankLines& banks, unsigned int bank, unsigned int areaStart);
+
+    // RAM pages are decoded in order, an instruction crossing a page boundary moves the start of the next page
+    struct RAMPage
+    {
+        std::vector<Line> lines;
+        uint16_t firstAddr;
+        bool isValid;
+    };
+
+    // Returns whether any page changed
+    bool UpdateRAMPages();
+    void Invalidate(uint16_t firstAddr, uint16_t lastAddr);
+
+    // Brings the lines back in step at the given address, when it is in the middle of a line
+    void SyncTo(uint16_t addr);
+
+private:
+    static constexpr uint16_t m_RAM_START = 0x8000;
+    static constexpr uint8_t m_FIRST_IO_PAGE = 0xFE;
+
+    Memory& m_mem;
+
+    BankLines m_lowBanks;
+    BankLines m_highBanks;
+    std::array<RAMPage, 0x80> m_ramPages;
+
+    // What the last lines were made for
+    bool m_isValid;
+    uint16_t m_pc;
+    uint16_t m_lowBank;
+    uint16_t m_highBank;
+    uint16_t m_mappedBank;
+
+    std::vector<Line> m_lines;
+    std::vector<Line> m_previousLines;
+    std::vector<Line> m_syncLines;
+    uint64_t m_version;
+};
@@ -0,0 +1,299 @@
+#include "emulationthread.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::chrono::nanoseconds s_FRAME_DURATION{Emulator::m_CYCLES_PER_FRAME * 1000000000 / Emulator::m_CLOCK_RATE};
+
+    // How often a paused thread checks whether it must resume
+    constexpr std::chrono::milliseconds s_PAUSE_POLL_PERIOD{5};
+
+    // Debuggers refresh with the display, faster snapshots would be dropped when running unthrottled
+    constexpr std::chrono::milliseconds s_DEBUG_SNAPSHOT_PERIOD{16};
+}
+
+EmulationThread::EmulationThread(Emulator& emu)
+    : m_emu{emu}
+    , m_isStopRequested{false}
+    , m_isPaused{false}
+    , m_isThrottled{true}
+    , m_fastForwardInterval{0}
+    , m_isDebugEnabled{false}
+    , m_isDebugSnapshotRequested{false}
+    , m_debugROMBank{-1}
+    , m_hasDebugCommands{false}
+    , m_debugPageVersions{}
+    , m_debugSnapshotROMBank{-1}
+    , m_debugStop{}
+{
+}
+
+EmulationThread::~EmulationThread()
+{
+    Stop();
+}
+
+void EmulationThread::Start()
+{
+    Stop();
+
+    // Called on the emulation thread, the display only sees published frames
+    m_emu.SetFrameHandler([this](const PPU::Framebuffer& frame)
+    {
+        m_frames.GetBackBuffer() = frame;
+        m_frames.Publish();
+    });
+
+    m_emu.Reset();
+    m_debugStop = Debugger::Stop{};
+    m_isStopRequested.store(false, std::memory_order_relaxed);
+    m_isPaused.store(false, std::memory_order_relaxed);
+    m_thread = std::thread{[this](){ Run(); }};
+}
+
+void EmulationThread::Stop()
+{
+    if(!m_thread.joinable())
+    {
+        return;
+    }
+
+    m_isStopRequested.store(true, std::memory_order_relaxed);
+    m_thread.join();
+}
+
+void EmulationThread::SetFastForward(bool isEnabled, unsigned int drawInterval)
+{
+    m_fastForwardInterval.store(isEnabled ? std::max(drawInterval, 1u) : 0, std::memory_order_relaxed);
+}
+
+void EmulationThread::EnableDebugSnapshots(bool isEnabled)
+{
+    m_isDebugEnabled.store(isEnabled, std::memory_order_relaxed);
+    m_isDebugSnapshotRequested.store(isEnabled, std::memory_order_relaxed);
+}
+
+void EmulationThread::SetDebugROMBank(int bank)
+{
+    m_debugROMBank.store(bank, std::memory_order_relaxed);
+    m_isDebugSnapshotRequested.store(true, std::memory_order_relaxed);
+}
+
+void EmulationThread::SetBreakpoint(uint16_t addr, bool isSet)
+{
+    PushDebugCommand([addr, isSet](Debugger& debugger){ debugger.SetBreakpoint(addr, isSet); }, false);
+}
+
+void EmulationThread::AddWatchpoint(const Debugger::Watchpoint& watchpoint)
+{
+    PushDebugCommand([watchpoint](Debugger& debugger){ debugger.AddWatchpoint(watchpoint); }, false);
+}
+
+void EmulationThread::RemoveWatchpoint(size_t index)
+{
+    PushDebugCommand([index](Debugger& debugger){ debugger.RemoveWatchpoint(index); }, false);
+}
+
+void EmulationThread::Step()
+{
+    PushDebugCommand([](Debugger& debugger){ debugger.Step(); }, true);
+}
+
+void EmulationThread::StepOver()
+{
+    // From where the thread is when it gets the command
+    PushDebugCommand([this](Debugger& debugger)
+    {
+        debugger.StepOver(m_emu.GetCPUState().pc, m_emu.GetCPUState().sp);
+    }, true);
+}
+
+void EmulationThread::RunTo(uint16_t addr)
+{
+    PushDebugCommand([addr](Debugger& debugger){ debugger.RunTo(addr); }, true);
+}
+
+void EmulationThread::PushDebugCommand(DebugCommand command, bool isResuming)
+{
+    {
+        std::lock_guard<std::mutex> lock{m_debugCommandsMutex};
+        m_debugCommands.push_back(std::move(command));
+        m_hasDebugCommands.store(true, std::memory_order_release);
+    }
+
+    if(isResuming)
+    {
+        m_isPaused.store(false, std::memory_order_release);
+    }
+}
+
+void EmulationThread::ApplyDebugCommands()
+{
+    std::vector<DebugCommand> commands;
+    {
+        std::lock_guard<std::mutex> lock{m_debugCommandsMutex};
+        commands.swap(m_debugCommands);
+        m_hasDebugCommands.store(false, std::memory_order_relaxed);
+    }
+
+    for(const DebugCommand& command : commands)
+    {
+        command(m_emu.GetDebugger());
+    }
+}
+
+void EmulationThread::Run()
+{
+    Clock::time_point nextFrameTime = Clock::now();
+    Clock::time_point nextDebugSnapshotTime = nextFrameTime;
+    bool isDebugSnapshotStale = false;
+
+    // Written pages are only tracked while a debugger shows them
+    bool isDirtyTrackingEnabled = false;
+
+    // The frame skip of the PPU is only changed from this thread, between frames
+    unsigned int frameSkipInterval = 1;
+    m_emu.SetFrameSkip(frameSkipInterval);
+
+    while(!m_isStopRequested.load(std::memory_order_relaxed))
+    {
+        if(m_isDebugEnabled.load(std::memory_order_relaxed) != isDirtyTrackingEnabled)
+        {
+            isDirtyTrackingEnabled = !isDirtyTrackingEnabled;
+            m_emu.EnableDirtyTracking(isDirtyTrackingEnabled);
+        }
+
+        // Commands resuming the thread are queued before, they are seen here
+        if(m_isPaused.load(std::memory_order_acquire))
+        {
+            // The debugger sees where the machine stopped
+            const bool isDebugSnapshotRequested = m_isDebugSnapshotRequested.exchange(false, std::memory_order_relaxed);
+            if((isDebugSnapshotRequested || isDebugSnapshotStale) && isDirtyTrackingEnabled)
+            {
+                PublishDebugSnapshot();
+                isDebugSnapshotStale = false;
+            }
+
+            std::this_thread::sleep_for(s_PAUSE_POLL_PERIOD);
+            nextFrameTime = Clock::now();
+            continue;
+        }
+
+        if(m_hasDebugCommands.load(std::memory_order_acquire))
+        {
+            ApplyDebugCommands();
+        }
+
+        const unsigned int fastForwardInterval = m_fastForwardInterval.load(std::memory_order_relaxed);
+        if(std::max(fastForwardInterval, 1u) != frameSkipInterval)
+        {
+            frameSkipInterval = std::max(fastForwardInterval, 1u);
+            m_emu.SetFrameSkip(frameSkipInterval);
+        }
+
+        m_emu.RunFrames(1);
+        m_debugStop = m_emu.GetDebugger().GetStop();
+
+        // The debugger sees where the run stopped right away, the rest of the frame runs on resuming
+        if(m_debugStop.reason != Debugger::StopReason::None)
+        {
+            Pause();
+            nextDebugSnapshotTime = Clock::now();
+        }
+
+        isDebugSnapshotStale = true;
+        if(isDirtyTrackingEnabled && Clock::now() >= nextDebugSnapshotTime)
+        {
+            PublishDebugSnapshot();
+            nextDebugSnapshotTime = Clock::now() + s_DEBUG_SNAPSHOT_PERIOD;
+            isDebugSnapshotStale = false;
+        }
+
+        if(fastForwardInterval != 0 || !m_isThrottled.load(std::memory_order_relaxed))
+        {
+            nextFrameTime = Clock::now();
+            continue;
+        }
+
+        // Start over from now when too far behind, rather than running fast to catch up
+        nextFrameTime += s_FRAME_DURATION;
+        const Clock::time_point now = Clock::now();
+        if(nextFrameTime + s_FRAME_DURATION < now)
+        {
+            nextFrameTime = now;
+        }
+        else
+        {
+            std::this_thread::sleep_until(nextFrameTime);
+        }
+    }
+
+    m_emu.EnableDirtyTracking(false);
+}
+
+void EmulationThread::PublishDebugSnapshot()
+{
+    DebugSnapshot& snapshot = m_debugSnapshots.GetBackBuffer();
+    const Memory& mem = m_emu.GetMemory();
+    const int requestedBank = m_debugROMBank.load(std::memory_order_relaxed);
+
+    snapshot.cpu = m_emu.GetCPUState();
+    snapshot.stop = m_debugStop;
+    snapshot.lowROMBank = mem.GetROMBank(0x0000);
+    snapshot.highROMBank = mem.GetROMBank(0x4000);
+
+    const uint8_t* bankData = requestedBank >= 0 ? mem.GetROMBankData(static_cast<unsigned int>(requestedBank)) : nullptr;
+    if(bankData != nullptr)
+    {
+        snapshot.highROMBank = static_cast<uint16_t>(requestedBank);
+    }
+
+    // The I/O registers change without being written
+    const Memory::PageSet dirtyPages = m_emu.TakeDirtyPages();
+    for(unsigned int page = 0; page < Memory::m_NB_PAGES; ++page)
+    {
+        if(dirtyPages[page] || page == 0xFF)
+        {
+            ++m_debugPageVersions[page];
+        }
+    }
+    if(requestedBank != m_debugSnapshotROMBank)
+    {
+        m_debugSnapshotROMBank = requestedBank;
+        for(unsigned int page = 0x40; page < 0x80; ++page)
+        {
+            ++m_debugPageVersions[page];
+        }
+    }
+
+    // The back buffer was last filled a few snapshots ago, only its pages changed since then are read again
+    for(unsigned int page = 0; page < Memory::m_NB_PAGES; ++page)
+    {
+        if(snapshot.pageVersions[page] == m_debugPageVersions[page])
+        {
+            continue;
+        }
+
+        uint8_t* pageData = &snapshot.memory[page * Memory::m_PAGE_SIZE];
+        if(bankData != nullptr && page >= 0x40 && page < 0x80)
+        {
+            std::copy_n(bankData + (page - 0x40) * Memory::m_PAGE_SIZE, Memory::m_PAGE_SIZE, pageData);
+        }
+        else
+        {
+            mem.Peek(static_cast<uint16_t>(page * Memory::m_PAGE_SIZE), pageData, Memory::m_PAGE_SIZE);
+        }
+        snapshot.pageVersions[page] = m_debugPageVersions[page];
+    }
+
+    // Only the RAM pages written since the last snapshot are decoded again
+    DisassemblyCache& disassembly = m_emu.GetDisassembly();
+    snapshot.lines = disassembly.GetLines(snapshot.cpu.pc, requestedBank);
+    snapshot.linesVersion = disassembly.GetVersion();
+
+    m_debugSnapshots.Publish();
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "emulator.h"
+#include "triplebuffer.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs an emulator on a thread of its own, paced to the speed of the original
+// hardware or as fast as the host allows.
+//
+// Completed frames are published through a triple buffer, the display picks up
+// the latest one whenever it refreshes. Control goes through atomic flags that
+// the emulation thread checks between frames. Debuggers get snapshots of the
+// machine the same way, taken between frames. Their commands are queued and
+// applied by the emulation thread before it runs again, a run stopped by the
+// debugger pauses the thread.
+class EmulationThread
+{
+public:
+    using Frames = TripleBuffer<PPU::Framebuffer>;
+
+    // What a debugger shows of the machine
+    struct DebugSnapshot
+    {
+        CPU::State cpu;
+
+        // Address space as the CPU sees it, with the requested ROM bank in the switchable area
+        std::array<uint8_t, 0x10000> memory;
+        uint16_t lowROMBank;
+        uint16_t highROMBank;
+
+        // Incremented whenever a page changes, only the pages that changed since a buffer was last filled are read
+        // again, and only those a debugger shows need to be drawn again
+        std::array<uint32_t, Memory::m_NB_PAGES> pageVersions;
+
+        // See DisassemblyCache, the version changes with the lines
+        std::vector<DisassemblyCache::Line> lines;
+        uint64_t linesVersion;
+
+        // Why the thread paused, StopReason::None when it was not the debugger
+        Debugger::Stop stop;
+    };
+
+    using DebugSnapshots = TripleBuffer<DebugSnapshot>;
+
+    // Frames drawn while fast-forwarding, 1 of this many
+    static constexpr unsigned int m_DEFAULT_FAST_FORWARD_INTERVAL = 8;
+
+public:
+    explicit EmulationThread(Emulator& emu);
+    ~EmulationThread();
+
+    EmulationThread(const EmulationThread&) = delete;
+    EmulationThread& operator=(const EmulationThread&) = delete;
+
+    // Resets the emulator and starts running it, after stopping a previous run
+    void Start();
+
+    // Waits for the emulation thread to finish its current frame
+    void Stop();
+
+    void Pause() { m_isPaused.store(true, std::memory_order_relaxed); }
+    void Resume() { m_isPaused.store(false, std::memory_order_relaxed); }
+    bool IsRunning() const { return m_thread.joinable(); }
+    bool IsPaused() const { return m_isPaused.load(std::memory_order_relaxed); }
+
+    // Runs at the speed of the original hardware when throttled, the default
+    void SetThrottled(bool isThrottled) { m_isThrottled.store(isThrottled, std::memory_order_relaxed); }
+
+    // Runs as fast as the host allows and only draws 1 of every given number of frames, whatever the throttling
+    void SetFastForward(bool isEnabled, unsigned int drawInterval = m_DEFAULT_FAST_FORWARD_INTERVAL);
+    bool IsFastForwarding() const { return m_fastForwardInterval.load(std::memory_order_relaxed) != 0; }
+
+    // Consumer side of the frames, for a single display thread
+    Frames& GetFrames() { return m_frames; }
+
+    // Snapshots are published after each frame while enabled, and on request while paused
+    void EnableDebugSnapshots(bool isEnabled);
+
+    // ROM bank shown in the switchable area of the snapshots, the mapped one when negative
+    void SetDebugROMBank(int bank);
+
+    // Consumer side of the snapshots, for a single debugger thread
+    DebugSnapshots& GetDebugSnapshots() { return m_debugSnapshots; }
+
+    // See Debugger, the steps and RunTo resume a paused thread
+    void SetBreakpoint(uint16_t addr, bool isSet);
+    void AddWatchpoint(const Debugger::Watchpoint& watchpoint);
+    void RemoveWatchpoint(size_t index);
+    void Step();
+    void StepOver();
+    void RunTo(uint16_t addr);
+
+private:
+    using DebugCommand = std::function<void(Debugger&)>;
+
+    void Run();
+    void PublishDebugSnapshot();
+
+    void PushDebugCommand(DebugCommand command, bool isResuming);
+    void ApplyDebugCommands();
+
+private:
+    Emulator& m_emu;
+    std::thread m_thread;
+
+    std::atomic<bool> m_isStopRequested;
+    std::atomic<bool> m_isPaused;
+    std::atomic<bool> m_isThrottled;
+
+    // Draw interval while fast-forwarding, 0 when not fast-forwarding
+    std::atomic<unsigned int> m_fastForwardInterval;
+
+    Frames m_frames;
+
+    std::atomic<bool> m_isDebugEnabled;
+    std::atomic<bool> m_isDebugSnapshotRequested;
+    std::atomic<int> m_debugROMBank;
+
+    DebugSnapshots m_debugSnapshots;
+
+    std::mutex m_debugCommandsMutex;
+    std::vector<DebugCommand> m_debugCommands;
+    std::atomic<bool> m_hasDebugCommands;
+
+    // Only used on the emulation thread
+    std::array<uint32_t, Memory::m_NB_PAGES> m_debugPageVersions;
+    int m_debugSnapshotROMBank;
+    Debugger::Stop m_debugStop;
+};
@@ -1,29 +1,357 @@
 #include "emulator.h"
 
-#include <fstream>
-#include <iterator>
+#include <algorithm>
+#include <iostream>
+#include <utility>
 
-bool Emulator::LoadCartridge(const std::string& filePath)
+namespace
+{
+    constexpr uint32_t s_STATE_VERSION = 1;
+}
+
+Emulator::Emulator()
 {
-    std::ifstream inputStream{filePath, std::ios::binary};
-    if(inputStream)
+    // Events due in the middle of an instruction must be visible to its I/O accesses
+    m_mem.SetIOSyncHandler([this](){ m_scheduler.RunDueEvents(); });
+
+    m_serial.SetOutputHandler([this](uint8_t value)
+    {
+        if(m_serialOutputHandler && !m_areOutputsHeld)
+        {
+            m_serialOutputHandler(value);
+        }
+    });
+    m_ppu.SetFrameHandler([this](const PPU::Framebuffer& framebuffer)
     {
-        std::vector<uint8_t> gameData{std::istreambuf_iterator<char>(inputStream),
-                                      std::istreambuf_iterator<char>()};
+        if(m_frameHandler && !m_areOutputsHeld)
+        {
+            m_frameHandler(framebuffer);
+        }
+    });
 
-        m_mem.LoadROMBank(gameData);
-        return true;
+    m_cpu.SetLockstepHandlers([this](){ SaveLockstepState(); }, [this](){ RestoreLockstepState(); });
+}
+
+bool Emulator::LoadCartridge(const std::string& filePath)
+{
+    return LoadCartridge(Cartridge::Load(filePath));
+}
+
+bool Emulator::LoadCartridge(std::shared_ptr<const Cartridge> cartridge)
+{
+    if(cartridge == nullptr || !m_mem.LoadCartridge(std::move(cartridge)))
+    {
+        return false;
     }
 
-    return false;
+    m_disassembly.Reset();
+    return true;
 }
 
 void Emulator::Play()
 {
-    m_cpu.Reset();
+    Reset();
 
     for(;;)
     {
-        m_cpu.ExecuteNextInstruction();
+        RunFrames(1);
     }
-}
\ No newline at end of file
+}
+
+void Emulator::Reset()
+{
+    m_scheduler.Reset();
+    m_mem.Reset();
+    m_timer.Reset();
+    m_serial.Reset();
+    m_ppu.Reset();
+    m_apu.Reset();
+    m_joypad.Reset();
+    m_cpu.Reset();
+    m_disassembly.Reset();
+    m_debugger.Reset();
+    m_nbInstructions = 0;
+}
+
+void Emulator::SaveState(std::vector<uint8_t>& data) const
+{
+    SaveStateWriter writer{data};
+
+    writer.BeginChunk(SaveStateChunk::Emulator, s_STATE_VERSION);
+    writer.Write(m_nbInstructions);
+    writer.EndChunk();
+
+    m_scheduler.Save(writer);
+    m_cpu.Save(writer);
+    m_mem.Save(writer);
+    m_timer.Save(writer);
+    m_serial.Save(writer);
+    m_ppu.Save(writer);
+    m_apu.Save(writer);
+    m_joypad.Save(writer);
+
+    writer.Finish();
+}
+
+bool Emulator::LoadState(const uint8_t* data, size_t size)
+{
+    SaveStateReader reader{data, size};
+    const bool isLoaded = reader.IsValid() &&
+                          reader.OpenChunk(SaveStateChunk::Emulator, s_STATE_VERSION) && reader.Read(m_nbInstructions) &&
+                          reader.CloseChunk() &&
+                          m_scheduler.Load(reader) && m_cpu.Load(reader) && m_mem.Load(reader) && m_timer.Load(reader) &&
+                          m_serial.Load(reader) && m_ppu.Load(reader) && m_apu.Load(reader) &&
+                          m_joypad.Load(reader);
+
+    // Never leave a machine half loaded
+    if(!isLoaded)
+    {
+        Reset();
+    }
+
+    // RAM was replaced as a whole, without writes
+    m_disassembly.Reset();
+    m_debugger.Reset();
+    return isLoaded;
+}
+
+void Emulator::SaveLockstepState()
+{
+    // Same chunks as a save state, without the CPU, which keeps its blocks
+    SaveStateWriter writer{m_lockstepState};
+    m_scheduler.Save(writer);
+    m_mem.Save(writer);
+    m_timer.Save(writer);
+    m_serial.Save(writer);
+    m_ppu.Save(writer);
+    m_apu.Save(writer);
+    m_joypad.Save(writer);
+    writer.Finish();
+
+    m_areOutputsHeld = true;
+}
+
+void Emulator::RestoreLockstepState()
+{
+    SaveStateReader reader{m_lockstepState.data(), m_lockstepState.size()};
+    const bool isLoaded = reader.IsValid() && m_scheduler.Load(reader) && m_mem.Load(reader) && m_timer.Load(reader) &&
+                          m_serial.Load(reader) && m_ppu.Load(reader) && m_apu.Load(reader) && m_joypad.Load(reader);
+    if(!isLoaded)
+    {
+        std::cerr << "Unable to restore the machine before a replay in lockstep\n";
+    }
+
+    m_areOutputsHeld = false;
+}
+
+void Emulator::RunInstructions(uint64_t nbInstructions)
+{
+    m_debugger.BeginRun();
+    if(m_debugger.IsActive())
+    {
+        ExecuteInstructions<DebugExecution>(m_nbInstructions + nbInstructions);
+    }
+    else if(m_traceWriter != nullptr)
+    {
+        ExecuteInstructions<TracedExecution>(m_nbInstructions + nbInstructions);
+    }
+    else
+    {
+        ExecuteInstructions<PlainExecution>(m_nbInstructions + nbInstructions);
+    }
+}
+
+template <typename Policy>
+void Emulator::ExecuteInstructions(uint64_t targetInstructions)
+{
+    while(m_nbInstructions < targetInstructions)
+    {
+        const bool isStopped = !Step<Policy>();
+        m_scheduler.RunDueEvents();
+        if(isStopped)
+        {
+            return;
+        }
+    }
+}
+
+void Emulator::RunCycles(uint64_t nbCycles)
+{
+    RunUntil(m_scheduler.GetTime() + nbCycles);
+}
+
+void Emulator::RunFrames(uint64_t nbFrames)
+{
+    // Frames start at multiples of the frame duration, the last instruction of a run may have gone past the end of its frame
+    RunUntil((GetFrameCount() + nbFrames) * m_CYCLES_PER_FRAME);
+}
+
+void Emulator::RunFor(std::chrono::nanoseconds duration)
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Only look at the clock once per emulated frame to keep it out of the profile
+    const Clock::time_point deadline = Clock::now() + duration;
+    while(Clock::now() < deadline)
+    {
+        RunFrames(1);
+    }
+}
+
+void Emulator::RunUntil(uint64_t time)
+{
+    // Checked once per run, the plain runs have no debug checks at all
+    m_debugger.BeginRun();
+    if(m_debugger.IsActive())
+    {
+        ExecuteUntil<DebugExecution>(time);
+    }
+    else if(m_traceWriter != nullptr)
+    {
+        ExecuteUntil<TracedExecution>(time);
+    }
+    else
+    {
+        ExecuteUntil<PlainExecution>(time);
+    }
+}
+
+template <typename Policy>
+void Emulator::ExecuteUntil(uint64_t time)
+{
+    while(m_scheduler.GetTime() < time)
+    {
+        // Nothing but the CPU can change anything before the next event
+        const uint64_t deadline = std::min(time, m_scheduler.GetNextEventTime());
+
+        // Idle time is only looked for where the intervals between events start, the steps of the others have
+        // nothing more to do. Debug runs step through it, traces record every instruction and only skip halts.
+        bool isCompleted = true;
+        if constexpr(Policy::m_IS_DEBUG)
+        {
+            isCompleted = ExecuteSteps<Policy, IdleSkipping::None>(deadline);
+        }
+        else if constexpr(Policy::m_IS_TRACED)
+        {
+            isCompleted = m_cpu.IsHalted() ? ExecuteSteps<Policy, IdleSkipping::Halt>(deadline)
+                                           : ExecuteSteps<Policy, IdleSkipping::None>(deadline);
+        }
+        else
+        {
+            isCompleted = m_cpu.WatchIdleLoop() ? ExecuteSteps<Policy, IdleSkipping::HaltAndLoops>(deadline)
+                                                : ExecuteSteps<Policy, IdleSkipping::None>(deadline);
+        }
+
+        if(!isCompleted)
+        {
+            return;
+        }
+
+        m_scheduler.RunDueEvents();
+    }
+}
+
+template <typename Policy, Emulator::IdleSkipping Skipping>
+bool Emulator::ExecuteSteps(uint64_t deadline)
+{
+    while(m_scheduler.GetTime() < deadline)
+    {
+        // Events already due are handled when the run resumes, before the next step
+        if(!Step<Policy>())
+        {
+            return false;
+        }
+
+        if constexpr(Skipping == IdleSkipping::Halt)
+        {
+            m_cpu.SkipHalt(deadline);
+        }
+        else if constexpr(Skipping == IdleSkipping::HaltAndLoops)
+        {
+            m_cpu.SkipIdleTime(deadline, m_nbInstructions);
+        }
+    }
+    return true;
+}
+
+template <typename Policy>
+bool Emulator::Step()
+{
+    if constexpr(Policy::m_IS_DEBUG)
+    {
+        // Only the interpreter stops at every instruction
+        const uint16_t pc = m_cpu.GetPC();
+        const uint64_t nbInstructions = m_nbInstructions;
+        m_cpu.ExecuteNextInstruction<DebugExecution>(m_nbInstructions);
+
+        // Debug runs are traced too, they are slow already
+        if(m_traceWriter != nullptr && m_nbInstructions != nbInstructions)
+        {
+            RecordTrace();
+        }
+
+        const bool hasMoved = m_nbInstructions != nbInstructions || m_cpu.GetPC() != pc;
+        return !m_debugger.CheckStop(m_cpu.GetPC(), m_cpu.GetSP(), hasMoved);
+    }
+    else
+    {
+        [[maybe_unused]] const uint64_t nbInstructions = m_nbInstructions;
+        switch(m_executionMode)
+        {
+            case ExecutionMode::Interpreter:
+                m_cpu.ExecuteNextInstruction(m_nbInstructions);
+                break;
+            case ExecutionMode::BlockCache:
+                m_cpu.ExecuteNextBlock(m_nbInstructions);
+                break;
+            case ExecutionMode::JIT:
+                m_cpu.ExecuteNextNativeBlock(m_nbInstructions);
+                break;
+        }
+
+        // Steps servicing an interrupt or waiting while halted are part of the next record
+        if constexpr(Policy::m_IS_TRACED)
+        {
+            if(m_nbInstructions != nbInstructions)
+            {
+                RecordTrace();
+            }
+        }
+        return true;
+    }
+}
+
+bool Emulator::StartTrace(const std::string& filePath)
+{
+    StopTrace();
+
+    auto traceWriter = std::make_unique<TraceWriter>();
+    if(!traceWriter->Open(filePath))
+    {
+        return false;
+    }
+
+    // The state the trace starts from comes first
+    m_traceWriter = std::move(traceWriter);
+    RecordTrace();
+    return true;
+}
+
+bool Emulator::StopTrace()
+{
+    if(m_traceWriter == nullptr)
+    {
+        return true;
+    }
+
+    const bool isWritten = m_traceWriter->Close();
+    m_traceWriter.reset();
+    return isWritten;
+}
+
+void Emulator::RecordTrace()
+{
+    const CPU::State state = m_cpu.GetState();
+    m_traceWriter->Write({m_nbInstructions, m_scheduler.GetTime(), state.regs, state.sp, state.pc, m_mem.Peek(state.pc),
+                          state.ime});
+}
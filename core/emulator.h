@@ -1,17 +1,179 @@
 #pragma once
 
+#include "apu.h"
 #include "cpu.h"
+#include "debugger.h"
+#include "disassemblycache.h"
+#include "joypad.h"
+#include "memory.h"
+#include "ppu.h"
+#include "savestate.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "timer.h"
+#include "trace.h"
 
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 class Emulator
 {
 public:
+    enum class ExecutionMode
+    {
+        // Decode and execute one instruction at a time
+        Interpreter,
+
+        // Replay cached pre-decoded blocks of instructions
+        BlockCache,
+
+        // Translate hot blocks to native code, falls back to the block cache on unsupported hosts
+        JIT
+    };
+
+public:
+    // Clock rate of the original hardware
+    static constexpr uint64_t m_CLOCK_RATE = 4194304;
+
+    // Clock cycles needed by the LCD to draw a whole frame
+    static constexpr uint64_t m_CYCLES_PER_FRAME = 70224;
+
+public:
+    Emulator();
+
     bool LoadCartridge(const std::string& filePath);
+    bool LoadCartridge(std::shared_ptr<const Cartridge> cartridge);
     void Play();
+    void Reset();
+    void SetExecutionMode(ExecutionMode mode) { m_executionMode = mode; }
+
+    // Snapshot of the whole machine. Writing over the same vector again does not allocate.
+    void SaveState(std::vector<uint8_t>& data) const;
+
+    // Returns false, and resets the machine, when the data is not a state of the loaded cartridge
+    bool LoadState(const uint8_t* data, size_t size);
+
+    // Called with each byte sent through the serial port, test ROMs report their results this way
+    void SetSerialOutputHandler(Serial::OutputHandler handler) { m_serialOutputHandler = std::move(handler); }
+
+    // Called with each completed frame, at the start of VBlank
+    void SetFrameHandler(PPU::FrameHandler handler) { m_frameHandler = std::move(handler); }
+    const PPU::Framebuffer& GetFramebuffer() const { return m_ppu.GetFramebuffer(); }
+
+    // Draws only the last of every given number of frames, or none with 0. The others skip pixel generation, see PPU.
+    void SetFrameSkip(unsigned int interval) { m_ppu.SetFrameSkip(interval); }
+
+    // Sound is only synthesized while enabled, 48 kHz stereo samples are queued to the output
+    void EnableAudio(bool isEnabled) { m_apu.EnableOutput(isEnabled); }
+    APU::Output& GetAudioOutput() { return m_apu.GetOutput(); }
+
+    // Mask of Joypad::Key held down from now on
+    void SetPressedKeys(uint8_t keys) { m_joypad.SetPressedKeys(keys); }
+
+    // Returns false when the host does not support the instruction set
+    bool SetPixelKernels(PixelKernels::InstructionSet set) { return m_ppu.SetPixelKernels(set); }
+
+    // Debugging and profiling support for the JIT, see CPU. Only the interpreter runs of the blocks checked in
+    // lockstep send serial bytes and frames, sound starts over from silence after each of them.
+    void EnableJITLockstep(bool isEnabled) { m_cpu.EnableJITLockstep(isEnabled); }
+    void EnableJITPerfMap(bool isEnabled) { m_cpu.EnableJITPerfMap(isEnabled); }
+    uint64_t GetJITMismatchCount() const { return m_cpu.GetJITMismatchCount(); }
+
+    // Hot spots of the guest code, see Profiler. Returns false when built without GB_PROFILER.
+    bool EnableProfiler(bool isEnabled) { return m_cpu.EnableProfiler(isEnabled); }
+    const Profiler* GetProfiler() { return m_cpu.GetProfiler(); }
+
+    // Bounded execution, used when running without a display. Runs end early when the debugger stops them.
+    void RunInstructions(uint64_t nbInstructions);
+    void RunCycles(uint64_t nbCycles);
+    void RunFrames(uint64_t nbFrames);
+    void RunFor(std::chrono::nanoseconds duration);
+
+    // Current state, for debugging and tools
+    CPU::State GetCPUState() const { return m_cpu.GetState(); }
+    const Memory::State& GetMemoryState() const { return m_mem.GetState(); }
+    const Memory& GetMemory() const { return m_mem; }
+
+    // Instruction boundaries of the address space, for debuggers. Only used from the thread running the emulator.
+    DisassemblyCache& GetDisassembly() { return m_disassembly; }
+
+    // Breakpoints, watchpoints and stepping, runs are interpreted with the debug checks while it has any. Only used
+    // from the thread running the emulator.
+    Debugger& GetDebugger() { return m_debugger; }
+
+    // Records the state of the CPU after every instruction, or every block with the block cache and native code, from
+    // now on, see TraceWriter. Stopping returns whether the whole trace was written.
+    bool StartTrace(const std::string& filePath);
+    bool StopTrace();
+
+    // Pages of the address space written or remapped since the last call, see Memory. Only used from the thread
+    // running the emulator.
+    void EnableDirtyTracking(bool isEnabled) { m_mem.EnableDirtyTracking(isEnabled); }
+    Memory::PageSet TakeDirtyPages() { return m_mem.TakeDirtyPages(); }
+
+    uint64_t GetInstructionCount() const { return m_nbInstructions; }
+    uint64_t GetCycleCount() const { return m_scheduler.GetTime(); }
+    uint64_t GetFrameCount() const { return m_scheduler.GetTime() / m_CYCLES_PER_FRAME; }
 
 private:
+    // What the steps between two events skip, see CPU::SkipIdleTime
+    enum class IdleSkipping : uint8_t
+    {
+        None,
+        Halt,
+        HaltAndLoops
+    };
+
+    // Runs until the given time, handling the events due on the way
+    void RunUntil(uint64_t time);
+
+    template <typename Policy>
+    void ExecuteUntil(uint64_t time);
+
+    // Steps until the deadline, returns false when the debugger stops the run
+    template <typename Policy, IdleSkipping Skipping>
+    bool ExecuteSteps(uint64_t deadline);
+
+    template <typename Policy>
+    void ExecuteInstructions(uint64_t targetInstructions);
+
+    // Returns false when the debugger stops the run
+    template <typename Policy>
+    bool Step();
+
+    void RecordTrace();
+
+    // Every component but the CPU, around the native runs of the blocks checked in lockstep
+    void SaveLockstepState();
+    void RestoreLockstepState();
+
+private:
+    Scheduler m_scheduler;
     Memory m_mem;
-    CPU m_cpu;
-};
\ No newline at end of file
+    Timer m_timer{m_mem, m_scheduler};
+    Serial m_serial{m_mem, m_scheduler};
+    PPU m_ppu{m_mem, m_scheduler};
+    APU m_apu{m_mem, m_scheduler};
+    Joypad m_joypad{m_mem};
+    CPU m_cpu{m_mem, m_scheduler};
+    DisassemblyCache m_disassembly{m_mem};
+    Debugger m_debugger{m_mem};
+
+    ExecutionMode m_executionMode = ExecutionMode::Interpreter;
+
+    // Only while tracing
+    std::unique_ptr<TraceWriter> m_traceWriter;
+
+    uint64_t m_nbInstructions{};
+
+    Serial::OutputHandler m_serialOutputHandler;
+    PPU::FrameHandler m_frameHandler;
+
+    // Only while native code runs a block checked in lockstep, its outputs are those of the interpreter
+    std::vector<uint8_t> m_lockstepState;
+    bool m_areOutputsHeld = false;
+};
@@ -0,0 +1,887 @@
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define GB_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define GB_JIT_SUPPORTED 0
+#endif
+
+#include <array>
+#include <cassert>
+#include <string>
+
+namespace
+{
+    // Size of the buffer holding the generated code of a CPU, flushed when full
+    constexpr size_t s_CODE_BUFFER_SIZE = 16 * 1024 * 1024;
+
+    // Room left at the end of the buffer so that a single instruction never overflows it
+    constexpr size_t s_CODE_BUFFER_SLACK = 256;
+
+    enum HostRegister : uint8_t
+    {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    // Register file base and guest stack pointer, both callee-saved
+    constexpr uint8_t s_STATE_REG = RBX;
+    constexpr uint8_t s_SP_REG = RBP;
+
+    // Guest registers live in r8-r15, in register file order: A, F, B, C, D, E, H, L
+    constexpr uint8_t s_ACC_REG = R8;
+    constexpr uint8_t s_FLAG_REG = R9;
+
+    constexpr uint8_t GetHostRegister(unsigned int regIdx)
+    {
+        return static_cast<uint8_t>(R8 + regIdx);
+    }
+
+    // Register file index of the operands encoded in the lower 3 bits of an opcode, (HL) has none
+    constexpr std::array<int, 8> s_OPERAND_INDICES{ 2, 3, 4, 5, 6, 7, -1, 0 };
+
+    // Register file indices of the high and low halves of BC, DE and HL
+    constexpr std::array<std::pair<unsigned int, unsigned int>, 3> s_PAIR_INDICES{{ {2, 3}, {4, 5}, {6, 7} }};
+
+    // Guest flags corresponding to the host flags loaded in AH by LAHF.
+    // Only zero, half-carry and carry are translated, subtraction is set by the generated code.
+    constexpr std::array<uint8_t, 256> MakeFlagTable()
+    {
+        std::array<uint8_t, 256> table{};
+        for(unsigned int hostFlags = 0; hostFlags < table.size(); ++hostFlags)
+        {
+            uint8_t flags{};
+            flags |= (hostFlags & 0x40) ? 0x80 : 0; // ZF
+            flags |= (hostFlags & 0x10) ? 0x20 : 0; // AF
+            flags |= (hostFlags & 0x01) ? 0x10 : 0; // CF
+            table[hostFlags] = flags;
+        }
+        return table;
+    }
+
+    constexpr std::array<uint8_t, 256> s_FLAG_TABLE = MakeFlagTable();
+
+    // Condition codes of the host conditional jumps
+    enum class HostCondition : uint8_t
+    {
+        Zero = 0x4,
+        NotZero = 0x5
+    };
+
+    // Minimal x86-64 assembler, only knows the instruction forms used by the translator
+    class X64Emitter
+    {
+    public:
+        X64Emitter(uint8_t* buffer, size_t capacity)
+            : m_buffer{buffer}
+            , m_capacity{capacity}
+            , m_size{}
+        { }
+
+        size_t GetSize() const { return m_size; }
+        bool HasOverflowed() const { return m_size > m_capacity; }
+
+        // mov dst32, src32
+        void MovRegReg(uint8_t dst, uint8_t src)
+        {
+            Rex(false, src, dst);
+            Byte(0x89);
+            ModRMReg(src, dst);
+        }
+
+        // mov dst32, imm32
+        void MovRegImm(uint8_t dst, uint32_t imm)
+        {
+            Rex(false, 0, dst);
+            Byte(0xB8 + (dst & 7));
+            Dword(imm);
+        }
+
+        // mov dst64, imm64
+        void MovRegImm64(uint8_t dst, uint64_t imm)
+        {
+            Rex(true, 0, dst);
+            Byte(0xB8 + (dst & 7));
+            Qword(imm);
+        }
+
+        // Group 1 operation on a 32-bit register: add, or, adc, sbb, and, sub, xor, cmp
+        void AluRegImm(uint8_t extension, uint8_t reg, uint32_t imm)
+        {
+            Rex(false, 0, reg);
+            Byte(0x81);
+            ModRMReg(extension, reg);
+            Dword(imm);
+        }
+
+        // or dst32, src32
+        void OrRegReg(uint8_t dst, uint8_t src)
+        {
+            Rex(false, src, dst);
+            Byte(0x09);
+            ModRMReg(src, dst);
+        }
+
+        // Group 1 operation between AL and an 8-bit register, given the "op rm8, r8" opcode
+        void AluAlReg(uint8_t opcode, uint8_t src)
+        {
+            Rex(false, src, RAX);
+            Byte(opcode);
+            ModRMReg(src, RAX);
+        }
+
+        // Group 1 operation between AL and an immediate, given the "op al, imm8" opcode
+        void AluAlImm(uint8_t opcode, uint8_t imm)
+        {
+            Byte(opcode);
+            Byte(imm);
+        }
+
+        // inc al or dec al
+        void IncDecAl(bool isDecrement)
+        {
+            Byte(0xFE);
+            ModRMReg(isDecrement ? 1 : 0, RAX);
+        }
+
+        void Lahf()
+        {
+            Byte(0x9F);
+        }
+
+        // movzx dst32, al
+        void MovzxRegAl(uint8_t dst)
+        {
+            Rex(false, dst, RAX);
+            Byte(0x0F);
+            Byte(0xB6);
+            ModRMReg(dst, RAX);
+        }
+
+        // movzx ecx, ah, which cannot be encoded with a REX prefix
+        void MovzxEcxAh()
+        {
+            Byte(0x0F);
+            Byte(0xB6);
+            Byte(0xCC);
+        }
+
+        // movzx dst32, byte [rdx + rcx]
+        void MovzxRegTableLookup(uint8_t dst)
+        {
+            Rex(false, dst, RDX);
+            Byte(0x0F);
+            Byte(0xB6);
+            Byte(static_cast<uint8_t>(((dst & 7) << 3) | 0x04));
+            Byte(static_cast<uint8_t>((RCX << 3) | RDX));
+        }
+
+        // mov byte [rdx + rcx], src8
+        void StoreByteTableLookup(uint8_t src)
+        {
+            Rex(false, src, RDX, src >= RSP);
+            Byte(0x88);
+            Byte(static_cast<uint8_t>(((src & 7) << 3) | 0x04));
+            Byte(static_cast<uint8_t>((RCX << 3) | RDX));
+        }
+
+        // mov rdx, qword [rdx + rcx * 8]
+        void LoadPointerTableEntry()
+        {
+            Byte(0x48);
+            Byte(0x8B);
+            Byte(0x14);
+            Byte(static_cast<uint8_t>(0xC0 | (RCX << 3) | RDX));
+        }
+
+        // test rdx, rdx
+        void TestRdxRdx()
+        {
+            Byte(0x48);
+            Byte(0x85);
+            Byte(0xD2);
+        }
+
+        // bt reg32, bit
+        void BtRegImm(uint8_t reg, uint8_t bit)
+        {
+            Rex(false, 0, reg);
+            Byte(0x0F);
+            Byte(0xBA);
+            ModRMReg(4, reg);
+            Byte(bit);
+        }
+
+        // test reg32, imm32
+        void TestRegImm(uint8_t reg, uint32_t imm)
+        {
+            Rex(false, 0, reg);
+            Byte(0xF7);
+            ModRMReg(0, reg);
+            Dword(imm);
+        }
+
+        // test al, al
+        void TestAlAl()
+        {
+            Byte(0x84);
+            Byte(0xC0);
+        }
+
+        // shl reg32, imm8 or shr reg32, imm8
+        void ShiftRegImm(bool isRight, uint8_t reg, uint8_t imm)
+        {
+            Rex(false, 0, reg);
+            Byte(0xC1);
+            ModRMReg(isRight ? 5 : 4, reg);
+            Byte(imm);
+        }
+
+        // mov byte [base + disp32], src8
+        void StoreByte(uint8_t base, int32_t disp, uint8_t src)
+        {
+            Rex(false, src, base, src >= RSP);
+            Byte(0x88);
+            ModRMMem(src, base, disp);
+        }
+
+        // movzx dst32, byte [base + disp32]
+        void LoadByte(uint8_t dst, uint8_t base, int32_t disp)
+        {
+            Rex(false, dst, base);
+            Byte(0x0F);
+            Byte(0xB6);
+            ModRMMem(dst, base, disp);
+        }
+
+        // mov word [base + disp32], src16
+        void StoreWord(uint8_t base, int32_t disp, uint8_t src)
+        {
+            Byte(0x66);
+            Rex(false, src, base);
+            Byte(0x89);
+            ModRMMem(src, base, disp);
+        }
+
+        // mov word [base + disp32], imm16
+        void StoreWordImm(uint8_t base, int32_t disp, uint16_t imm)
+        {
+            Byte(0x66);
+            Rex(false, 0, base);
+            Byte(0xC7);
+            ModRMMem(0, base, disp);
+            Byte(imm & 0xFF);
+            Byte(imm >> 8);
+        }
+
+        // mov dword [base + disp32], imm32
+        void StoreDwordImm(uint8_t base, int32_t disp, uint32_t imm)
+        {
+            Rex(false, 0, base);
+            Byte(0xC7);
+            ModRMMem(0, base, disp);
+            Dword(imm);
+        }
+
+        // movzx dst32, word [base + disp32]
+        void LoadWord(uint8_t dst, uint8_t base, int32_t disp)
+        {
+            Rex(false, dst, base);
+            Byte(0x0F);
+            Byte(0xB7);
+            ModRMMem(dst, base, disp);
+        }
+
+        void Push(uint8_t reg)
+        {
+            Rex(false, 0, reg);
+            Byte(0x50 + (reg & 7));
+        }
+
+        void Pop(uint8_t reg)
+        {
+            Rex(false, 0, reg);
+            Byte(0x58 + (reg & 7));
+        }
+
+        // sub rsp, imm8 or add rsp, imm8
+        void AdjustStack(int8_t delta)
+        {
+            Byte(0x48);
+            Byte(0x83);
+            ModRMReg(delta < 0 ? 5 : 0, RSP);
+            Byte(static_cast<uint8_t>(delta < 0 ? -delta : delta));
+        }
+
+        // call reg64
+        void CallReg(uint8_t reg)
+        {
+            Rex(false, 0, reg);
+            Byte(0xFF);
+            ModRMReg(2, reg);
+        }
+
+        void Ret()
+        {
+            Byte(0xC3);
+        }
+
+        // Conditional jump with a 32-bit displacement, returns the position to patch
+        size_t Jcc(HostCondition condition)
+        {
+            Byte(0x0F);
+            Byte(0x80 | static_cast<uint8_t>(condition));
+            Dword(0);
+            return m_size;
+        }
+
+        // Unconditional jump with a 32-bit displacement, returns the position to patch
+        size_t Jmp()
+        {
+            Byte(0xE9);
+            Dword(0);
+            return m_size;
+        }
+
+        // Makes the jump ending at jumpEnd land on the current position
+        void PatchJump(size_t jumpEnd)
+        {
+            const int32_t displacement = static_cast<int32_t>(m_size - jumpEnd);
+            if(jumpEnd <= m_capacity)
+            {
+                for(int i = 0; i < 4; ++i)
+                {
+                    m_buffer[jumpEnd - 4 + i] = static_cast<uint8_t>(displacement >> (8 * i));
+                }
+            }
+        }
+
+    private:
+        void Byte(uint8_t value)
+        {
+            if(m_size < m_capacity)
+            {
+                m_buffer[m_size] = value;
+            }
+            ++m_size;
+        }
+
+        void Dword(uint32_t value)
+        {
+            for(int i = 0; i < 4; ++i)
+            {
+                Byte(static_cast<uint8_t>(value >> (8 * i)));
+            }
+        }
+
+        void Qword(uint64_t value)
+        {
+            Dword(static_cast<uint32_t>(value));
+            Dword(static_cast<uint32_t>(value >> 32));
+        }
+
+        // A REX prefix is needed for 64-bit operands, r8-r15 and the spl-dil byte registers
+        void Rex(bool isWide, uint8_t reg, uint8_t rm, bool isByteRegister = false)
+        {
+            const uint8_t rex = static_cast<uint8_t>(0x40 | (isWide ? 0x08 : 0) | ((reg >> 3) << 2) | (rm >> 3));
+            if(rex != 0x40 || isByteRegister)
+            {
+                Byte(rex);
+            }
+        }
+
+        void ModRMReg(uint8_t reg, uint8_t rm)
+        {
+            Byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+        }
+
+        void ModRMMem(uint8_t reg, uint8_t base, int32_t disp)
+        {
+            Byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+            if((base & 7) == RSP)
+            {
+                Byte(0x24);
+            }
+            Dword(static_cast<uint32_t>(disp));
+        }
+
+    private:
+        uint8_t* m_buffer;
+        size_t m_capacity;
+        size_t m_size;
+    };
+}
+
+JIT::JIT(CPU& cpu)
+    : m_cpu{cpu}
+    , m_codeBuffer{}
+    , m_codeBufferSize{}
+    , m_codeBufferUsed{}
+    , m_perfMap{}
+{
+#if GB_JIT_SUPPORTED
+    void* buffer = mmap(nullptr, s_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffer != MAP_FAILED)
+    {
+        m_codeBuffer = static_cast<uint8_t*>(buffer);
+        m_codeBufferSize = s_CODE_BUFFER_SIZE;
+    }
+#endif
+}
+
+JIT::~JIT()
+{
+#if GB_JIT_SUPPORTED
+    if(m_codeBuffer != nullptr)
+    {
+        munmap(m_codeBuffer, m_codeBufferSize);
+    }
+#endif
+
+    if(m_perfMap != nullptr)
+    {
+        std::fclose(m_perfMap);
+    }
+}
+
+bool JIT::IsSupported()
+{
+    return GB_JIT_SUPPORTED;
+}
+
+void JIT::Flush()
+{
+    m_codeBufferUsed = 0;
+}
+
+void JIT::EnablePerfMap(bool isEnabled)
+{
+#if GB_JIT_SUPPORTED
+    if(isEnabled && m_perfMap == nullptr)
+    {
+        const std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+        m_perfMap = std::fopen(path.c_str(), "a");
+    }
+#endif
+
+    if(!isEnabled && m_perfMap != nullptr)
+    {
+        std::fclose(m_perfMap);
+        m_perfMap = nullptr;
+    }
+}
+
+CPU::NativeBlock JIT::Compile(const CPU::Block& block)
+{
+    if(m_codeBuffer == nullptr || m_codeBufferSize - m_codeBufferUsed < s_CODE_BUFFER_SLACK)
+    {
+        return nullptr;
+    }
+
+    uint8_t* const code = m_codeBuffer + m_codeBufferUsed;
+    X64Emitter emitter{code, m_codeBufferSize - m_codeBufferUsed - s_CODE_BUFFER_SLACK};
+
+    const int32_t spOffset = static_cast<int32_t>(reinterpret_cast<uint8_t*>(&m_cpu.m_SP) - m_cpu.m_GPRegs.data());
+    const int32_t pcOffset = static_cast<int32_t>(reinterpret_cast<uint8_t*>(&m_cpu.m_PC) - m_cpu.m_GPRegs.data());
+    const int32_t nativeCyclesOffset = static_cast<int32_t>(reinterpret_cast<uint8_t*>(&m_cpu.m_nativeCycles) - m_cpu.m_GPRegs.data());
+
+    constexpr std::array<uint8_t, 6> calleeSavedRegs{ RBX, RBP, R12, R13, R14, R15 };
+
+    auto loadGuestState = [&]()
+    {
+        for(unsigned int i = 0; i < CPU::m_NB_REGISTERS; ++i)
+        {
+            emitter.LoadByte(GetHostRegister(i), s_STATE_REG, static_cast<int32_t>(i));
+        }
+        emitter.LoadWord(s_SP_REG, s_STATE_REG, spOffset);
+    };
+
+    auto storeGuestState = [&]()
+    {
+        for(unsigned int i = 0; i < CPU::m_NB_REGISTERS; ++i)
+        {
+            emitter.StoreByte(s_STATE_REG, static_cast<int32_t>(i), GetHostRegister(i));
+        }
+        emitter.StoreWord(s_STATE_REG, spOffset, s_SP_REG);
+    };
+
+    // Leaves the block, PC is left untouched when it was already set by the interpreter
+    auto emitExit = [&](bool hasPC, uint16_t pc, uint32_t nbInstructions, uint32_t cycles)
+    {
+        storeGuestState();
+        if(hasPC)
+        {
+            emitter.StoreWordImm(s_STATE_REG, pcOffset, pc);
+        }
+
+        emitter.MovRegImm64(RAX, (static_cast<uint64_t>(nbInstructions) << 32) | cycles);
+        emitter.AdjustStack(8);
+        for(auto it = calleeSavedRegs.rbegin(); it != calleeSavedRegs.rend(); ++it)
+        {
+            emitter.Pop(*it);
+        }
+        emitter.Ret();
+    };
+
+    // Converts the host flags of the last operation to guest flags in the given register
+    auto emitFlagConversion = [&](uint8_t dst)
+    {
+        emitter.Lahf();
+        emitter.MovzxEcxAh();
+        emitter.MovRegImm64(RDX, reinterpret_cast<uint64_t>(s_FLAG_TABLE.data()));
+        emitter.MovzxRegTableLookup(dst);
+    };
+
+    // Puts the address held by a register pair in eax
+    auto emitPairAddress = [&](unsigned int pairIdx)
+    {
+        emitter.MovRegReg(RAX, GetHostRegister(s_PAIR_INDICES[pairIdx].first));
+        emitter.ShiftRegImm(false, RAX, 8);
+        emitter.OrRegReg(RAX, GetHostRegister(s_PAIR_INDICES[pairIdx].second));
+    };
+
+    // Looks up the page of the address in eax, rdx is left null when the page is not mapped directly
+    auto emitPageLookup = [&](const void* pageTable)
+    {
+        emitter.MovRegReg(RCX, RAX);
+        emitter.ShiftRegImm(true, RCX, 8);
+        emitter.MovRegImm64(RDX, reinterpret_cast<uint64_t>(pageTable));
+        emitter.LoadPointerTableEntry();
+        emitter.TestRdxRdx();
+    };
+
+    // Reads the byte at the address in eax into eax, accessCycles after the start of the block
+    auto emitRead = [&](uint32_t accessCycles)
+    {
+        emitPageLookup(m_cpu.m_mem.GetReadPageTable());
+        const size_t slowJump = emitter.Jcc(HostCondition::Zero);
+        emitter.MovzxRegAl(RCX);
+        emitter.MovzxRegTableLookup(RAX);
+        const size_t doneJump = emitter.Jmp();
+
+        emitter.PatchJump(slowJump);
+        storeGuestState();
+        emitter.StoreDwordImm(s_STATE_REG, nativeCyclesOffset, accessCycles);
+        emitter.MovRegReg(RSI, RAX);
+        emitter.MovRegImm64(RDI, reinterpret_cast<uint64_t>(&m_cpu));
+        emitter.MovRegImm64(RAX, reinterpret_cast<uint64_t>(&CPU::ReadFromNativeCode));
+        emitter.CallReg(RAX);
+        loadGuestState();
+
+        emitter.PatchJump(doneJump);
+    };
+
+    // Writes a guest register to the address in eax, accessCycles after the start of the block.
+    // Leaves the block if the write overwrote it.
+    auto emitWrite = [&](uint8_t src, uint32_t accessCycles, uint16_t nextAddr, uint32_t nbInstructions, uint32_t cycles)
+    {
+        emitPageLookup(m_cpu.m_mem.GetWritePageTable());
+        const size_t slowJump = emitter.Jcc(HostCondition::Zero);
+        emitter.MovzxRegAl(RCX);
+        emitter.StoreByteTableLookup(src);
+        const size_t doneJump = emitter.Jmp();
+
+        emitter.PatchJump(slowJump);
+        storeGuestState();
+        emitter.StoreDwordImm(s_STATE_REG, nativeCyclesOffset, accessCycles);
+        emitter.MovRegReg(RSI, RAX);
+        emitter.MovRegReg(RDX, src);
+        emitter.MovRegImm64(RDI, reinterpret_cast<uint64_t>(&m_cpu));
+        emitter.MovRegImm64(RAX, reinterpret_cast<uint64_t>(&CPU::WriteFromNativeCode));
+        emitter.CallReg(RAX);
+        loadGuestState();
+        emitter.TestAlAl();
+        const size_t validJump = emitter.Jcc(HostCondition::Zero);
+        emitExit(true, nextAddr, nbInstructions, cycles);
+        emitter.PatchJump(validJump);
+
+        emitter.PatchJump(doneJump);
+    };
+
+    // Prologue, the stack stays 16 bytes aligned for the calls to the interpreter
+    for(uint8_t reg : calleeSavedRegs)
+    {
+        emitter.Push(reg);
+    }
+    emitter.AdjustStack(-8);
+    emitter.MovRegImm64(s_STATE_REG, reinterpret_cast<uint64_t>(m_cpu.m_GPRegs.data()));
+    loadGuestState();
+
+    uint16_t addr = block.startAddr;
+    uint32_t nbInstructions{};
+    uint32_t cycles{};
+    bool hasExited{};
+
+    for(const CPU::DecodedInstruction& instruction : block.instructions)
+    {
+        const uint8_t opcode = instruction.opcode;
+        const uint16_t nextAddr = static_cast<uint16_t>(addr + instruction.length);
+        const uint8_t x = opcode >> 6;
+        const uint8_t y = (opcode >> 3) & 0x07;
+        const uint8_t z = opcode & 0x07;
+        const uint8_t p = y >> 1;
+
+        ++nbInstructions;
+        bool isTranslated = true;
+
+        // Data accesses happen after the opcode and its immediates are fetched
+        const uint32_t accessCycles = cycles + 4 * instruction.length;
+
+        if(opcode == 0x00)
+        {
+            // NOP
+        }
+        else if(x == 1 && s_OPERAND_INDICES[y] >= 0 && s_OPERAND_INDICES[z] >= 0)
+        {
+            // LD r, r
+            if(y != z)
+            {
+                emitter.MovRegReg(GetHostRegister(s_OPERAND_INDICES[y]), GetHostRegister(s_OPERAND_INDICES[z]));
+            }
+        }
+        else if(x == 1 && z == 6 && y != 6)
+        {
+            // LD r, (HL)
+            emitPairAddress(2);
+            emitRead(accessCycles);
+            emitter.MovzxRegAl(GetHostRegister(s_OPERAND_INDICES[y]));
+        }
+        else if(x == 1 && y == 6 && z != 6)
+        {
+            // LD (HL), r
+            emitPairAddress(2);
+            emitWrite(GetHostRegister(s_OPERAND_INDICES[z]), accessCycles, nextAddr, nbInstructions, cycles + instruction.cycles);
+        }
+        else if(opcode == 0x0A || opcode == 0x1A)
+        {
+            // LD A, (BC) and LD A, (DE)
+            emitPairAddress(p);
+            emitRead(accessCycles);
+            emitter.MovzxRegAl(s_ACC_REG);
+        }
+        else if(opcode == 0x02 || opcode == 0x12)
+        {
+            // LD (BC), A and LD (DE), A
+            emitPairAddress(p);
+            emitWrite(s_ACC_REG, accessCycles, nextAddr, nbInstructions, cycles + instruction.cycles);
+        }
+        else if(x == 0 && z == 6 && s_OPERAND_INDICES[y] >= 0)
+        {
+            // LD r, d8
+            emitter.MovRegImm(GetHostRegister(s_OPERAND_INDICES[y]), instruction.immediate & 0xFF);
+        }
+        else if(x == 0 && (z == 4 || z == 5) && s_OPERAND_INDICES[y] >= 0)
+        {
+            // INC r and DEC r leave the carry untouched
+            const uint8_t reg = GetHostRegister(s_OPERAND_INDICES[y]);
+            const bool isDecrement = z == 5;
+
+            emitter.MovRegReg(RAX, reg);
+            emitter.IncDecAl(isDecrement);
+            emitFlagConversion(RCX);
+            emitter.MovzxRegAl(reg);
+            emitter.AluRegImm(4, RCX, 0xA0);
+            emitter.AluRegImm(4, s_FLAG_REG, 0x10);
+            emitter.OrRegReg(s_FLAG_REG, RCX);
+            if(isDecrement)
+            {
+                emitter.AluRegImm(1, s_FLAG_REG, 0x40);
+            }
+        }
+        else if(x == 2 || (x == 3 && z == 6))
+        {
+            // ALU A, r, ALU A, (HL) and ALU A, d8. Host opcodes in guest operation order: add, adc, sub, sbb, and, xor, or, cmp
+            constexpr std::array<uint8_t, 8> hostOpcodes{ 0x00, 0x10, 0x28, 0x18, 0x20, 0x30, 0x08, 0x38 };
+
+            // The memory operand goes to dl, before the carry is loaded since the read clobbers the host flags
+            const bool isMemoryOperand = x == 2 && z == 6;
+            if(isMemoryOperand)
+            {
+                emitPairAddress(2);
+                emitRead(accessCycles);
+                emitter.MovRegReg(RDX, RAX);
+            }
+
+            // Carry in for ADC and SBC
+            if(y == 1 || y == 3)
+            {
+                emitter.BtRegImm(s_FLAG_REG, 4);
+            }
+
+            emitter.MovRegReg(RAX, s_ACC_REG);
+            if(isMemoryOperand)
+            {
+                emitter.AluAlReg(hostOpcodes[y], RDX);
+            }
+            else if(x == 2)
+            {
+                emitter.AluAlReg(hostOpcodes[y], GetHostRegister(s_OPERAND_INDICES[z]));
+            }
+            else
+            {
+                emitter.AluAlImm(static_cast<uint8_t>(hostOpcodes[y] + 4), instruction.immediate & 0xFF);
+            }
+
+            emitFlagConversion(s_FLAG_REG);
+            if(y != 7)
+            {
+                emitter.MovzxRegAl(s_ACC_REG);
+            }
+
+            if(y == 2 || y == 3 || y == 7)
+            {
+                emitter.AluRegImm(1, s_FLAG_REG, 0x40);
+            }
+            else if(y == 4)
+            {
+                emitter.AluRegImm(4, s_FLAG_REG, 0x80);
+                emitter.AluRegImm(1, s_FLAG_REG, 0x20);
+            }
+            else if(y == 5 || y == 6)
+            {
+                emitter.AluRegImm(4, s_FLAG_REG, 0x80);
+            }
+        }
+        else if(opcode == 0x2F)
+        {
+            // CPL
+            emitter.AluRegImm(6, s_ACC_REG, 0xFF);
+            emitter.AluRegImm(1, s_FLAG_REG, 0x60);
+        }
+        else if(opcode == 0x37)
+        {
+            // SCF
+            emitter.AluRegImm(4, s_FLAG_REG, 0x80);
+            emitter.AluRegImm(1, s_FLAG_REG, 0x10);
+        }
+        else if(opcode == 0x3F)
+        {
+            // CCF
+            emitter.AluRegImm(4, s_FLAG_REG, 0x90);
+            emitter.AluRegImm(6, s_FLAG_REG, 0x10);
+        }
+        else if(x == 0 && z == 1 && !(y & 1))
+        {
+            // LD rr, d16
+            if(p == 3)
+            {
+                emitter.MovRegImm(s_SP_REG, instruction.immediate);
+            }
+            else
+            {
+                emitter.MovRegImm(GetHostRegister(s_PAIR_INDICES[p].first), instruction.immediate >> 8);
+                emitter.MovRegImm(GetHostRegister(s_PAIR_INDICES[p].second), instruction.immediate & 0xFF);
+            }
+        }
+        else if(x == 0 && z == 3)
+        {
+            // INC rr and DEC rr
+            const uint32_t delta = (y & 1) ? 0xFFFFFFFF : 1;
+            if(p == 3)
+            {
+                emitter.AluRegImm(0, s_SP_REG, delta);
+                emitter.AluRegImm(4, s_SP_REG, 0xFFFF);
+            }
+            else
+            {
+                const uint8_t high = GetHostRegister(s_PAIR_INDICES[p].first);
+                const uint8_t low = GetHostRegister(s_PAIR_INDICES[p].second);
+                emitter.MovRegReg(RAX, high);
+                emitter.ShiftRegImm(false, RAX, 8);
+                emitter.OrRegReg(RAX, low);
+                emitter.AluRegImm(0, RAX, delta);
+                emitter.MovzxRegAl(low);
+                emitter.ShiftRegImm(true, RAX, 8);
+                emitter.MovzxRegAl(high);
+            }
+        }
+        else if(opcode == 0x18 || opcode == 0xC3 || ((opcode & 0xE7) == 0x20) || ((opcode & 0xE7) == 0xC2))
+        {
+            // JR and JP, always the last instruction of a block
+            const bool isRelative = x == 0;
+            const uint16_t target = isRelative ? static_cast<uint16_t>(nextAddr + static_cast<int8_t>(instruction.immediate & 0xFF))
+                                               : instruction.immediate;
+
+            const uint32_t takenCycles = cycles + Opcodes::Get(opcode).takenCycles;
+            cycles += instruction.cycles;
+
+            if(opcode == 0x18 || opcode == 0xC3)
+            {
+                emitExit(true, target, nbInstructions, cycles);
+            }
+            else
+            {
+                // Conditions in opcode order: NZ, Z, NC, C
+                const uint8_t condition = y & 0x03;
+                emitter.TestRegImm(s_FLAG_REG, (condition < 2) ? 0x80 : 0x10);
+                const size_t notTakenJump = emitter.Jcc((condition & 1) ? HostCondition::Zero : HostCondition::NotZero);
+                emitExit(true, target, nbInstructions, takenCycles);
+                emitter.PatchJump(notTakenJump);
+                emitExit(true, nextAddr, nbInstructions, cycles);
+            }
+
+            hasExited = true;
+        }
+        else
+        {
+            isTranslated = false;
+        }
+
+        if(isTranslated)
+        {
+            cycles += hasExited ? 0 : instruction.cycles;
+        }
+        else
+        {
+            // Hand the instruction over to the interpreter, which reads and writes the register file
+            storeGuestState();
+            emitter.StoreWordImm(s_STATE_REG, pcOffset, nextAddr);
+            emitter.StoreDwordImm(s_STATE_REG, nativeCyclesOffset, cycles);
+            emitter.MovRegImm64(RDI, reinterpret_cast<uint64_t>(&m_cpu));
+            emitter.MovRegImm64(RSI, reinterpret_cast<uint64_t>(&instruction));
+            emitter.MovRegImm64(RAX, reinterpret_cast<uint64_t>(&CPU::ExecuteFromNativeCode));
+            emitter.CallReg(RAX);
+            loadGuestState();
+
+            if(&instruction == &block.instructions.back())
+            {
+                emitExit(false, 0, nbInstructions, cycles);
+                hasExited = true;
+            }
+            else
+            {
+                // Leave if the instruction overwrote the block
+                emitter.TestAlAl();
+                const size_t validJump = emitter.Jcc(HostCondition::Zero);
+                emitExit(false, 0, nbInstructions, cycles);
+                emitter.PatchJump(validJump);
+            }
+        }
+
+        addr = nextAddr;
+    }
+
+    if(!hasExited)
+    {
+        emitExit(true, addr, nbInstructions, cycles);
+    }
+
+    if(emitter.HasOverflowed())
+    {
+        return nullptr;
+    }
+
+    m_codeBufferUsed += emitter.GetSize();
+
+    if(m_perfMap != nullptr)
+    {
+        std::fprintf(m_perfMap, "%lx %zx gb_block_%04x\n",
+                     static_cast<unsigned long>(reinterpret_cast<uintptr_t>(code)), emitter.GetSize(), block.startAddr);
+        std::fflush(m_perfMap);
+    }
+
+    return reinterpret_cast<CPU::NativeBlock>(code);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "cpu.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Translates cached blocks of SM83 instructions to x86-64 code.
+//
+// Within a translated block, the guest registers A to L live in r8 to r15 and
+// SP lives in ebp. PC is never materialized except when the block exits or 
+// calls back into the interpreter. Instructions without a native translation 
+// are executed by calling their interpreter handler.
+class JIT
+{
+public:
+    explicit JIT(CPU& cpu);
+    ~JIT();
+
+    JIT(const JIT&) = delete;
+    JIT& operator=(const JIT&) = delete;
+
+    // Whether native code can be generated on this host
+    static bool IsSupported();
+
+    // Returns nullptr when the code buffer is full, in which case it must be flushed
+    CPU::NativeBlock Compile(const CPU::Block& block);
+    void Flush();
+
+    // Writes /tmp/perf-<pid>.map so that perf can symbolize generated code
+    void EnablePerfMap(bool isEnabled);
+
+private:
+    CPU& m_cpu;
+
+    uint8_t* m_codeBuffer;
+    size_t m_codeBufferSize;
+    size_t m_codeBufferUsed;
+
+    std::FILE* m_perfMap;
+};
@@ -0,0 +1,81 @@
+#include "joypad.h"
+
+namespace
+{
+    constexpr uint8_t s_P1_PORT = 0x00;
+
+    // Selection bits of P1, a key group is selected when its bit is 0
+    constexpr uint8_t s_SELECT_DIRECTIONS_BIT = 0x10;
+    constexpr uint8_t s_SELECT_BUTTONS_BIT = 0x20;
+
+    constexpr uint32_t s_STATE_VERSION = 1;
+}
+
+Joypad::Joypad(Memory& mem)
+    : m_mem{mem}
+{
+    m_mem.SetIOHandlers(s_P1_PORT, [this](uint16_t){ return ReadRegister(); },
+                                   [this](uint16_t, uint8_t value){ WriteRegister(value); });
+
+    // Keys are pressed between runs
+    m_mem.SetIOEventDriven(s_P1_PORT, true);
+
+    Reset();
+}
+
+void Joypad::Reset()
+{
+    m_select = s_SELECT_DIRECTIONS_BIT | s_SELECT_BUTTONS_BIT;
+    m_pressedKeys = 0;
+}
+
+void Joypad::SetPressedKeys(uint8_t keys)
+{
+    // The interrupt fires on the falling edge of a selected input line
+    const uint8_t previousKeys = GetSelectedKeys();
+    m_pressedKeys = keys;
+    if(previousKeys & ~GetSelectedKeys() & 0x0F)
+    {
+        m_mem.RequestInterrupt(Memory::Interrupt::Joypad);
+    }
+}
+
+uint8_t Joypad::ReadRegister() const
+{
+    // Unused bits read as 1
+    return static_cast<uint8_t>(0xC0 | m_select | GetSelectedKeys());
+}
+
+void Joypad::WriteRegister(uint8_t value)
+{
+    m_select = value & (s_SELECT_DIRECTIONS_BIT | s_SELECT_BUTTONS_BIT);
+}
+
+uint8_t Joypad::GetSelectedKeys() const
+{
+    uint8_t lines{};
+    if(!(m_select & s_SELECT_DIRECTIONS_BIT))
+    {
+        lines |= m_pressedKeys & 0x0F;
+    }
+    if(!(m_select & s_SELECT_BUTTONS_BIT))
+    {
+        lines |= m_pressedKeys >> 4;
+    }
+
+    return static_cast<uint8_t>(~lines & 0x0F);
+}
+
+void Joypad::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::Joypad, s_STATE_VERSION);
+    writer.Write(m_select);
+    writer.Write(m_pressedKeys);
+    writer.EndChunk();
+}
+
+bool Joypad::Load(SaveStateReader& reader)
+{
+    return reader.OpenChunk(SaveStateChunk::Joypad, s_STATE_VERSION) && reader.Read(m_select) &&
+           reader.Read(m_pressedKeys) && reader.CloseChunk();
+}
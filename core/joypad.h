@@ -0,0 +1,57 @@
+#pragma once
+
+#include "memory.h"
+#include "savestate.h"
+
+#include <cstdint>
+
+// Buttons and direction pad, read through the P1 register.
+//
+// The program selects the direction keys, the buttons or both with bits 4 and 5
+// of P1 and reads the selected keys in its lower nibble, 0 when pressed. Pressing
+// a key that is selected requests the joypad interrupt.
+class Joypad
+{
+public:
+    // Keys, as bits of the state passed to SetPressedKeys
+    enum Key : uint8_t
+    {
+        Right = 0x01,
+        Left = 0x02,
+        Up = 0x04,
+        Down = 0x08,
+        A = 0x10,
+        B = 0x20,
+        Select = 0x40,
+        Start = 0x80
+    };
+
+public:
+    explicit Joypad(Memory& mem);
+    Joypad(const Joypad&) = delete;
+    Joypad& operator=(const Joypad&) = delete;
+
+    // Nothing pressed and nothing selected
+    void Reset();
+
+    // Mask of the keys held down from now on
+    void SetPressedKeys(uint8_t keys);
+    uint8_t GetPressedKeys() const { return m_pressedKeys; }
+
+    // Selection and pressed keys
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+private:
+    uint8_t ReadRegister() const;
+    void WriteRegister(uint8_t value);
+
+    // Lower nibble of P1, with the selected keys that are pressed cleared
+    uint8_t GetSelectedKeys() const;
+
+private:
+    Memory& m_mem;
+
+    uint8_t m_select;
+    uint8_t m_pressedKeys;
+};
@@ -1,18 +1,671 @@
 #include "memory.h"
 
 #include <algorithm>
+#include <iostream>
+#include <utility>
 
-void Memory::LoadROMBank(const std::vector<uint8_t>& data)
+namespace
 {
-    std::copy_n(data.begin(), 0x800, m_data.begin());
+    constexpr unsigned int s_ROM_BANK_SIZE = 0x4000;
+    constexpr unsigned int s_RAM_BANK_SIZE = 0x2000;
+
+    constexpr uint32_t s_STATE_VERSION = 1;
+
+    // Header and global checksums, identifying the cartridge of a save state
+    constexpr uint16_t s_HEADER_CHECKSUM_ADDR = 0x14D;
+
+    // Work RAM (0xC000-0xDDFF) and its echo (0xE000-0xFDFF) are the same memory
+    constexpr uint8_t GetMirrorPage(uint8_t page)
+    {
+        if(page >= 0xC0 && page <= 0xDD)
+        {
+            return page + 0x20;
+        }
+        if(page >= 0xE0 && page <= 0xFD)
+        {
+            return page - 0x20;
+        }
+        return page;
+    }
 }
 
-uint8_t Memory::Read(uint32_t offset) const
+Memory::Memory()
+    : m_state{}
+    , m_rom{}
+    , m_controllerType{ControllerType::None}
+    , m_nbROMBanks{}
+    , m_externalRAMSize{}
+    , m_readPages{}
+    , m_writePages{}
+    , m_directReadPages{}
+    , m_directWritePages{}
+    , m_codePages{}
+    , m_isDirtyTrackingEnabled{}
+    , m_areWatchpointsSuspended{}
 {
-    return m_data[offset];
+    auto readOpenBus = [](uint16_t){ return static_cast<uint8_t>(0xFF); };
+    auto ignoreWrite = [](uint16_t, uint8_t){};
+
+    m_readHandlers.fill(readOpenBus);
+    m_writeHandlers.fill(ignoreWrite);
+
+    // Writes to ROM go to the cartridge controller
+    std::fill(m_writeHandlers.begin(), m_writeHandlers.begin() + 0x80, 
+              [this](uint16_t addr, uint8_t value){ WriteController(addr, value); });
+
+    // OAM, followed by an unusable area
+    m_readHandlers[0xFE] = [this](uint16_t addr)
+    {
+        const unsigned int offset = addr & 0xFF;
+        return offset < m_state.oam.size() ? m_state.oam[offset] : static_cast<uint8_t>(0x00);
+    };
+    m_writeHandlers[0xFE] = [this](uint16_t addr, uint8_t value)
+    {
+        const unsigned int offset = addr & 0xFF;
+        if(offset < m_state.oam.size())
+        {
+            m_state.oam[offset] = value;
+        }
+    };
+
+    // I/O registers, high RAM and interrupt enable
+    m_readHandlers[0xFF] = [this](uint16_t addr){ return ReadHighPage(addr); };
+    m_writeHandlers[0xFF] = [this](uint16_t addr, uint8_t value){ WriteHighPage(addr, value); };
+
+    // Only the lower 5 bits of IF exist
+    SetIOHandlers(m_IF_PORT, [this](uint16_t){ return static_cast<uint8_t>(m_state.io[m_IF_PORT] | 0xE0); },
+                             [this](uint16_t, uint8_t value){ m_state.io[m_IF_PORT] = value & 0x1F; });
+    SetIOEventDriven(m_IF_PORT, true);
+
+    MapPages(0x80, 0x9F, m_state.vram.data(), m_state.vram.data());
+    MapPages(0xC0, 0xDF, m_state.wram.data(), m_state.wram.data());
+    MapPages(0xE0, 0xFD, m_state.wram.data(), m_state.wram.data());
+
+    Reset();
 }
 
-void Memory::Write(uint32_t offset, uint8_t value)
+bool Memory::LoadCartridge(std::shared_ptr<const Cartridge> cartridge)
 {
-    m_data[offset] = value;
-}
\ No newline at end of file
+    switch(cartridge->GetType())
+    {
+        case 0x00: case 0x08: case 0x09:
+            m_controllerType = ControllerType::None;
+            break;
+        case 0x01: case 0x02: case 0x03:
+            m_controllerType = ControllerType::MBC1;
+            break;
+        case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13:
+            m_controllerType = ControllerType::MBC3;
+            break;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E:
+            m_controllerType = ControllerType::MBC5;
+            break;
+        default:
+            std::cerr << "Unsupported cartridge type 0x" << std::hex << static_cast<unsigned int>(cartridge->GetType()) 
+                      << std::dec << "\n";
+            return false;
+    }
+
+    m_externalRAMSize = cartridge->GetRAMSize();
+    m_nbROMBanks = static_cast<unsigned int>(cartridge->GetROMSize() / s_ROM_BANK_SIZE);
+    m_rom = cartridge->GetROM();
+    m_cartridge = std::move(cartridge);
+
+    Reset();
+    return true;
+}
+
+void Memory::Reset()
+{
+    m_state.vram.fill(0);
+    m_state.wram.fill(0);
+    m_state.oam.fill(0);
+    m_state.io.fill(0);
+    m_state.hram.fill(0);
+    m_state.ie = 0;
+
+    m_state.romBank = 1;
+    m_state.upperBank = 0;
+    m_state.ramBank = 0;
+    m_state.isRAMEnabled = false;
+    m_state.isAdvancedBankingMode = false;
+
+    m_dirtyPages.set();
+    MapBanks();
+}
+
+void Memory::SetIOHandlers(uint8_t port, ReadHandler read, WriteHandler write)
+{
+    m_ioReadHandlers[port & 0x7F] = std::move(read);
+    m_ioWriteHandlers[port & 0x7F] = std::move(write);
+}
+
+void Memory::SetIOSyncHandler(IOSyncHandler handler)
+{
+    m_ioSyncHandler = std::move(handler);
+}
+
+bool Memory::IsReadEventDriven(uint16_t addr) const
+{
+    // Memory only changes when written, and DMA copies at once
+    if(addr < 0xFF00 || addr >= 0xFF80)
+    {
+        return true;
+    }
+
+    const uint8_t port = addr & 0x7F;
+    return !m_ioReadHandlers[port] || m_eventDrivenPorts[port];
+}
+
+void Memory::SetCodeWriteHandler(CodeWriteHandler handler, CodeCache cache)
+{
+    m_codeWriteHandlers[static_cast<size_t>(cache)] = std::move(handler);
+}
+
+void Memory::MarkCodePage(uint8_t page, CodeCache cache)
+{
+    const unsigned int shift = static_cast<unsigned int>(cache) * 2;
+
+    m_codePages[page] |= 0x01 << shift;
+    UpdateWritePage(page);
+
+    const uint8_t mirrorPage = GetMirrorPage(page);
+    if(mirrorPage != page)
+    {
+        m_codePages[mirrorPage] |= 0x02 << shift;
+        UpdateWritePage(mirrorPage);
+    }
+}
+
+void Memory::UnmarkCodePage(uint8_t page, CodeCache cache)
+{
+    const unsigned int shift = static_cast<unsigned int>(cache) * 2;
+
+    m_codePages[page] &= ~(0x01 << shift);
+    UpdateWritePage(page);
+
+    const uint8_t mirrorPage = GetMirrorPage(page);
+    if(mirrorPage != page)
+    {
+        m_codePages[mirrorPage] &= ~(0x02 << shift);
+        UpdateWritePage(mirrorPage);
+    }
+}
+
+void Memory::ClearCodePages(CodeCache cache)
+{
+    const unsigned int shift = static_cast<unsigned int>(cache) * 2;
+
+    for(unsigned int page = 0; page < m_NB_PAGES; ++page)
+    {
+        m_codePages[page] &= ~(0x03 << shift);
+        UpdateWritePage(static_cast<uint8_t>(page));
+    }
+}
+
+void Memory::EnableDirtyTracking(bool isEnabled)
+{
+    m_isDirtyTrackingEnabled = isEnabled;
+
+    // Everything is dirty when tracking starts, nothing was tracked before
+    m_dirtyPages.set();
+    m_cleanPages.reset();
+    for(unsigned int page = 0; page < m_NB_PAGES; ++page)
+    {
+        UpdateWritePage(static_cast<uint8_t>(page));
+    }
+}
+
+Memory::PageSet Memory::TakeDirtyPages()
+{
+    PageSet dirtyPages = m_dirtyPages;
+    if(!m_isDirtyTrackingEnabled)
+    {
+        return dirtyPages;
+    }
+
+    // Work RAM shows through its echo
+    for(unsigned int page = 0xC0; page <= 0xFD; ++page)
+    {
+        if(m_dirtyPages[page])
+        {
+            dirtyPages.set(GetMirrorPage(static_cast<uint8_t>(page)));
+        }
+    }
+
+    // Pages mapped directly are watched again, the others always go through the slow path anyway
+    for(unsigned int page = 0; page < m_NB_PAGES; ++page)
+    {
+        if(m_dirtyPages[page] && !m_cleanPages[page])
+        {
+            m_cleanPages.set(page);
+            UpdateWritePage(static_cast<uint8_t>(page));
+        }
+    }
+
+    m_dirtyPages.reset();
+    return dirtyPages;
+}
+
+void Memory::SetWatchHandler(WatchHandler handler)
+{
+    m_watchHandler = std::move(handler);
+}
+
+void Memory::WatchPages(const PageSet& readPages, const PageSet& writePages)
+{
+    m_watchedReadPages = readPages;
+    m_watchedWritePages = writePages;
+    for(unsigned int page = 0; page < m_NB_PAGES; ++page)
+    {
+        UpdateReadPage(static_cast<uint8_t>(page));
+        UpdateWritePage(static_cast<uint8_t>(page));
+    }
+}
+
+uint16_t Memory::GetROMBank(uint16_t addr) const
+{
+    const uint8_t* page = m_directReadPages[addr >> 8];
+    if(page == nullptr || m_rom == nullptr)
+    {
+        return 0;
+    }
+
+    return static_cast<uint16_t>((page - m_rom) / s_ROM_BANK_SIZE);
+}
+
+const uint8_t* Memory::GetROMBankData(unsigned int bank) const
+{
+    return m_rom != nullptr && bank < m_nbROMBanks ? m_rom + bank * s_ROM_BANK_SIZE : nullptr;
+}
+
+uint8_t Memory::Peek(uint16_t addr) const
+{
+    const uint8_t* page = m_directReadPages[addr >> 8];
+    if(page != nullptr)
+    {
+        return page[addr & 0xFF];
+    }
+
+    // The handlers of the other pages may synchronize the components, their memory is read directly instead
+    if(addr >= 0xFE00 && addr < 0xFEA0)
+    {
+        return m_state.oam[addr - 0xFE00];
+    }
+    if(addr >= 0xFF00 && addr < 0xFF80)
+    {
+        return m_state.io[addr - 0xFF00];
+    }
+    if(addr >= 0xFF80 && addr < 0xFFFF)
+    {
+        return m_state.hram[addr - 0xFF80];
+    }
+    if(addr == 0xFFFF)
+    {
+        return m_state.ie;
+    }
+
+    return ReadSlow(addr);
+}
+
+void Memory::Peek(uint16_t firstAddr, uint8_t* data, size_t size) const
+{
+    unsigned int addr = firstAddr;
+    const unsigned int endAddr = std::min(firstAddr + static_cast<unsigned int>(size), 0x10000u);
+
+    while(addr < endAddr)
+    {
+        const unsigned int pageEnd = std::min((addr | 0xFF) + 1, endAddr);
+        const uint8_t* page = m_directReadPages[addr >> 8];
+        if(page != nullptr)
+        {
+            data = std::copy(page + (addr & 0xFF), page + (pageEnd - (addr & ~0xFFu)), data);
+        }
+        else
+        {
+            for(unsigned int pageAddr = addr; pageAddr < pageEnd; ++pageAddr)
+            {
+                *data++ = Peek(static_cast<uint16_t>(pageAddr));
+            }
+        }
+        addr = pageEnd;
+    }
+}
+
+uint8_t Memory::ReadSlow(uint16_t addr) const
+{
+    const uint8_t page = addr >> 8;
+    if(m_watchedReadPages[page])
+    {
+        return ReadWatched(addr);
+    }
+
+    return m_readHandlers[page](addr);
+}
+
+uint8_t Memory::ReadWatched(uint16_t addr) const
+{
+    const uint8_t page = addr >> 8;
+    const uint8_t* data = m_directReadPages[page];
+    const uint8_t value = data != nullptr ? data[addr & 0xFF] : m_readHandlers[page](addr);
+
+    if(!m_areWatchpointsSuspended)
+    {
+        m_watchHandler(addr, value, false, value);
+    }
+    return value;
+}
+
+void Memory::WriteSlow(uint16_t addr, uint8_t value)
+{
+    const uint8_t page = addr >> 8;
+
+    // The handlers of the watched pages may compare with the value replaced
+    const bool isWatched = m_watchedWritePages[page] && !m_areWatchpointsSuspended;
+    const uint8_t previousValue = isWatched ? Peek(addr) : 0;
+
+    uint8_t* data = m_directWritePages[page];
+    if(data != nullptr)
+    {
+        data[addr & 0xFF] = value;
+    }
+    else
+    {
+        m_writeHandlers[page](addr, value);
+    }
+
+    if(m_isDirtyTrackingEnabled)
+    {
+        MarkDirty(page);
+    }
+
+    const uint8_t codePage = m_codePages[page];
+    if(codePage != 0)
+    {
+        NotifyCodeWrite(codePage, addr, addr);
+    }
+
+    if(isWatched)
+    {
+        m_watchHandler(addr, value, true, previousValue);
+    }
+}
+
+void Memory::NotifyCodeWrite(uint8_t codePage, uint16_t firstAddr, uint16_t lastAddr)
+{
+    // The handlers may unmark the page, the caches to notify were read before calling them
+    for(size_t cache = 0; cache < m_NB_CODE_CACHES; ++cache)
+    {
+        const uint8_t bits = codePage >> (cache * 2);
+        if(bits & 0x01)
+        {
+            m_codeWriteHandlers[cache](firstAddr, lastAddr);
+        }
+        if(bits & 0x02)
+        {
+            const uint16_t mirrorBase = static_cast<uint16_t>(GetMirrorPage(firstAddr >> 8) << 8);
+            m_codeWriteHandlers[cache](static_cast<uint16_t>(mirrorBase | (firstAddr & 0xFF)),
+                                       static_cast<uint16_t>(mirrorBase | (lastAddr & 0xFF)));
+        }
+    }
+}
+
+void Memory::MapPages(uint8_t firstPage, uint8_t lastPage, const uint8_t* readData, uint8_t* writeData)
+{
+    for(unsigned int page = firstPage; page <= lastPage; ++page)
+    {
+        const unsigned int offset = (page - firstPage) * m_PAGE_SIZE;
+        const uint8_t* previousReadData = m_directReadPages[page];
+
+        m_directReadPages[page] = readData != nullptr ? readData + offset : nullptr;
+        m_directWritePages[page] = writeData != nullptr ? writeData + offset : nullptr;
+        UpdateReadPage(static_cast<uint8_t>(page));
+        UpdateWritePage(static_cast<uint8_t>(page));
+
+        if(previousReadData != m_directReadPages[page])
+        {
+            MarkDirty(static_cast<uint8_t>(page));
+        }
+
+        // Code cached from a page that now shows different memory is stale, its mirror is not remapped with it
+        const uint8_t ownCodePage = m_codePages[page] & 0x55;
+        if(ownCodePage != 0 && previousReadData != m_directReadPages[page])
+        {
+            const uint16_t pageAddr = static_cast<uint16_t>(page << 8);
+            NotifyCodeWrite(ownCodePage, pageAddr, static_cast<uint16_t>(pageAddr | 0xFF));
+        }
+    }
+}
+
+void Memory::MapBanks()
+{
+    unsigned int lowBank = 0;
+    unsigned int highBank = m_state.romBank;
+    unsigned int ramBank = m_state.ramBank;
+
+    if(m_controllerType == ControllerType::MBC1)
+    {
+        // The upper bits select the RAM bank or the upper ROM bank bits, the latter also for 
+        // the first ROM area when the advanced banking mode is on
+        highBank |= m_state.upperBank << 5;
+        lowBank = m_state.isAdvancedBankingMode ? (m_state.upperBank << 5) : 0;
+        ramBank = m_state.isAdvancedBankingMode ? m_state.upperBank : 0;
+    }
+
+    if(m_rom == nullptr)
+    {
+        MapPages(0x00, 0x7F, nullptr, nullptr);
+    }
+    else
+    {
+        MapPages(0x00, 0x3F, m_rom + (lowBank % m_nbROMBanks) * s_ROM_BANK_SIZE, nullptr);
+        MapPages(0x40, 0x7F, m_rom + (highBank % m_nbROMBanks) * s_ROM_BANK_SIZE, nullptr);
+    }
+
+    // MBC3 maps its clock registers from bank 0x08 onward, the clock is not emulated
+    const bool isRAMBankValid = m_controllerType != ControllerType::MBC3 || ramBank < 0x08;
+
+    if(m_state.isRAMEnabled && m_externalRAMSize > 0 && isRAMBankValid)
+    {
+        const unsigned int nbRAMBanks = std::max(1u, m_externalRAMSize / s_RAM_BANK_SIZE);
+        uint8_t* ramData = m_state.externalRAM.data() + (ramBank % nbRAMBanks) * s_RAM_BANK_SIZE;
+        MapPages(0xA0, 0xBF, ramData, ramData);
+    }
+    else
+    {
+        MapPages(0xA0, 0xBF, nullptr, nullptr);
+    }
+}
+
+void Memory::WriteController(uint16_t addr, uint8_t value)
+{
+    switch(m_controllerType)
+    {
+        case ControllerType::None:
+            return;
+
+        case ControllerType::MBC1:
+            if(addr < 0x2000)
+            {
+                m_state.isRAMEnabled = (value & 0x0F) == 0x0A;
+            }
+            else if(addr < 0x4000)
+            {
+                m_state.romBank = std::max(1, value & 0x1F);
+            }
+            else if(addr < 0x6000)
+            {
+                m_state.upperBank = value & 0x03;
+            }
+            else
+            {
+                m_state.isAdvancedBankingMode = value & 0x01;
+            }
+            break;
+
+        case ControllerType::MBC3:
+            if(addr < 0x2000)
+            {
+                m_state.isRAMEnabled = (value & 0x0F) == 0x0A;
+            }
+            else if(addr < 0x4000)
+            {
+                m_state.romBank = std::max(1, value & 0x7F);
+            }
+            else if(addr < 0x6000)
+            {
+                m_state.ramBank = value;
+            }
+            break;
+
+        case ControllerType::MBC5:
+            if(addr < 0x2000)
+            {
+                m_state.isRAMEnabled = (value & 0x0F) == 0x0A;
+            }
+            else if(addr < 0x3000)
+            {
+                m_state.romBank = static_cast<uint16_t>((m_state.romBank & 0x100) | value);
+            }
+            else if(addr < 0x4000)
+            {
+                m_state.romBank = static_cast<uint16_t>((m_state.romBank & 0xFF) | ((value & 0x01) << 8));
+            }
+            else if(addr < 0x6000)
+            {
+                m_state.ramBank = value & 0x0F;
+            }
+            break;
+    }
+
+    MapBanks();
+}
+
+uint8_t Memory::ReadHighPage(uint16_t addr) const
+{
+    if(addr < 0xFF80)
+    {
+        if(m_ioSyncHandler)
+        {
+            m_ioSyncHandler();
+        }
+
+        const uint8_t port = addr & 0x7F;
+        const ReadHandler& handler = m_ioReadHandlers[port];
+        return handler ? handler(addr) : m_state.io[port];
+    }
+    if(addr < 0xFFFF)
+    {
+        return m_state.hram[addr - 0xFF80];
+    }
+
+    return m_state.ie;
+}
+
+void Memory::WriteHighPage(uint16_t addr, uint8_t value)
+{
+    if(addr < 0xFF80)
+    {
+        if(m_ioSyncHandler)
+        {
+            m_ioSyncHandler();
+        }
+
+        const uint8_t port = addr & 0x7F;
+        const WriteHandler& handler = m_ioWriteHandlers[port];
+        if(handler)
+        {
+            handler(addr, value);
+        }
+        else
+        {
+            m_state.io[port] = value;
+        }
+    }
+    else if(addr < 0xFFFF)
+    {
+        m_state.hram[addr - 0xFF80] = value;
+    }
+    else
+    {
+        m_state.ie = value;
+    }
+}
+
+void Memory::UpdateReadPage(uint8_t page)
+{
+    m_readPages[page] = m_watchedReadPages[page] ? nullptr : m_directReadPages[page];
+}
+
+void Memory::UpdateWritePage(uint8_t page)
+{
+    const bool isSlow = m_codePages[page] != 0 || m_cleanPages[page] || m_watchedWritePages[page];
+    m_writePages[page] = isSlow ? nullptr : m_directWritePages[page];
+}
+
+void Memory::MarkDirty(uint8_t page)
+{
+    m_dirtyPages.set(page);
+    if(m_cleanPages[page])
+    {
+        m_cleanPages.reset(page);
+        UpdateWritePage(page);
+    }
+}
+
+void Memory::Save(SaveStateWriter& writer) const
+{
+    std::array<uint8_t, 3> checksums{};
+    if(m_rom != nullptr)
+    {
+        std::copy_n(m_rom + s_HEADER_CHECKSUM_ADDR, checksums.size(), checksums.begin());
+    }
+
+    writer.BeginChunk(SaveStateChunk::Memory, s_STATE_VERSION);
+    writer.Write(checksums);
+    writer.Write(m_state.vram);
+    writer.Write(m_state.wram);
+    writer.Write(m_state.oam);
+    writer.Write(m_state.io);
+    writer.Write(m_state.hram);
+    writer.Write(m_state.ie);
+    writer.Write(m_state.romBank);
+    writer.Write(m_state.upperBank);
+    writer.Write(m_state.ramBank);
+    writer.Write(m_state.isRAMEnabled);
+    writer.Write(m_state.isAdvancedBankingMode);
+
+    // Only as much external RAM as the cartridge has
+    writer.Write(m_externalRAMSize);
+    writer.WriteBytes(m_state.externalRAM.data(), m_externalRAMSize);
+    writer.EndChunk();
+}
+
+bool Memory::Load(SaveStateReader& reader)
+{
+    std::array<uint8_t, 3> checksums;
+    if(!reader.OpenChunk(SaveStateChunk::Memory, s_STATE_VERSION) || !reader.Read(checksums))
+    {
+        return false;
+    }
+
+    if(m_rom == nullptr || !std::equal(checksums.begin(), checksums.end(), m_rom + s_HEADER_CHECKSUM_ADDR))
+    {
+        std::cerr << "Save state of another cartridge\n";
+        return false;
+    }
+
+    unsigned int externalRAMSize{};
+    if(!reader.Read(m_state.vram) || !reader.Read(m_state.wram) || !reader.Read(m_state.oam) || !reader.Read(m_state.io) ||
+       !reader.Read(m_state.hram) || !reader.Read(m_state.ie) || !reader.Read(m_state.romBank) ||
+       !reader.Read(m_state.upperBank) || !reader.Read(m_state.ramBank) || !reader.Read(m_state.isRAMEnabled) ||
+       !reader.Read(m_state.isAdvancedBankingMode) || !reader.Read(externalRAMSize) || externalRAMSize != m_externalRAMSize ||
+       !reader.ReadBytes(m_state.externalRAM.data(), externalRAMSize) || !reader.CloseChunk())
+    {
+        return false;
+    }
+
+    m_dirtyPages.set();
+    MapBanks();
+    return true;
+}
@@ -1,16 +1,240 @@
 #pragma once
 
+#include "cartridge.h"
+#include "savestate.h"
+
 #include <array>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
+#include <functional>
+#include <memory>
 
+// Game Boy memory bus, shared by every component of the emulator.
+//
+// Each 256 bytes page of the address space is either mapped directly to host
+// memory, in which case an access is a single indexed load or store, or goes
+// through the handlers of its region. ROM, video RAM, work RAM and its echo are
+// mapped directly. Writes to ROM (the cartridge controller), disabled external
+// RAM, OAM and the I/O page use handlers.
 class Memory
 {
 public:
-    void LoadROMBank(const std::vector<uint8_t>& data);
-    uint8_t Read(uint32_t offset) const;
-    void Write(uint32_t offset, uint8_t value);
+    using ReadHandler = std::function<uint8_t(uint16_t)>;
+    using WriteHandler = std::function<void(uint16_t, uint8_t)>;
+
+    // Called with the first and last address of a range overwritten in a page holding cached code
+    using CodeWriteHandler = std::function<void(uint16_t, uint16_t)>;
+
+    // Called before any I/O register access to bring the other components up to date
+    using IOSyncHandler = std::function<void()>;
+
+    // Called after each access to a watched page with the address, the value read or written and, for writes, the
+    // value it replaced
+    using WatchHandler = std::function<void(uint16_t, uint8_t, bool, uint8_t)>;
+
+    // Caches of code decoded from memory, each with its own code pages and code write handler. The profiler keeps
+    // counts of the instructions found in its pages.
+    enum class CodeCache : uint8_t
+    {
+        Blocks,
+        Disassembly,
+        Profiler
+    };
+
+    static constexpr unsigned int m_NB_PAGES = 256;
+    static constexpr unsigned int m_PAGE_SIZE = 256;
+
+    using PageSet = std::bitset<m_NB_PAGES>;
+
+    // Interrupt sources, as bits of the IF and IE registers
+    enum class Interrupt : uint8_t
+    {
+        VBlank = 0x01,
+        LCDStat = 0x02,
+        Timer = 0x04,
+        Serial = 0x08,
+        Joypad = 0x10
+    };
+
+    enum class ControllerType : uint8_t
+    {
+        None,
+        MBC1,
+        MBC3,
+        MBC5
+    };
+
+    // Contents of the bus and state of the cartridge controller
+    struct State
+    {
+        std::array<uint8_t, 0x2000> vram;
+        std::array<uint8_t, 0x2000> wram;
+        std::array<uint8_t, 0xA0> oam;
+        std::array<uint8_t, 0x80> io;
+        std::array<uint8_t, 0x7F> hram;
+        uint8_t ie;
+
+        std::array<uint8_t, 0x20000> externalRAM;
+
+        // Cartridge controller registers
+        uint16_t romBank;
+        uint8_t upperBank;
+        uint8_t ramBank;
+        bool isRAMEnabled;
+        bool isAdvancedBankingMode;
+    };
+
+public:
+    Memory();
+    Memory(const Memory&) = delete;
+    Memory& operator=(const Memory&) = delete;
+
+    // Returns false when the cartridge controller is not supported
+    bool LoadCartridge(std::shared_ptr<const Cartridge> cartridge);
+    void Reset();
+
+    // Contents and controller state, only loaded for the cartridge they were saved with
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+    uint8_t Read(uint16_t addr) const;
+    void Write(uint16_t addr, uint8_t value);
+
+    // Reads without side effects, for debuggers. I/O registers read back the last value written to them.
+    uint8_t Peek(uint16_t addr) const;
+    void Peek(uint16_t firstAddr, uint8_t* data, size_t size) const;
+
+    // Handlers of an I/O register (0xFF00-0xFF7F).
+    // Registers without handlers read back the last value written to them.
+    void SetIOHandlers(uint8_t port, ReadHandler read, WriteHandler write);
+    void SetIOSyncHandler(IOSyncHandler handler);
+
+    // Whether reading an address gives the same value until the next scheduler event, as long as nothing writes to
+    // memory. Registers with a read handler are taken to change with time unless their component says otherwise.
+    void SetIOEventDriven(uint8_t port, bool isEventDriven) { m_eventDrivenPorts[port & 0x7F] = isEventDriven; }
+    bool IsReadEventDriven(uint16_t addr) const;
+
+    // Interrupt flags (IF), requested by the components and acknowledged by the CPU
+    void RequestInterrupt(Interrupt interrupt) { m_state.io[m_IF_PORT] |= static_cast<uint8_t>(interrupt); }
+    void AcknowledgeInterrupts(uint8_t mask) { m_state.io[m_IF_PORT] &= ~mask; }
+
+    // Interrupts both requested and enabled
+    uint8_t GetPendingInterrupts() const { return m_state.io[m_IF_PORT] & m_state.ie & 0x1F; }
+
+    // Pages holding cached code, writing to them calls the code write handler of their cache
+    void SetCodeWriteHandler(CodeWriteHandler handler, CodeCache cache = CodeCache::Blocks);
+    void MarkCodePage(uint8_t page, CodeCache cache = CodeCache::Blocks);
+    void UnmarkCodePage(uint8_t page, CodeCache cache = CodeCache::Blocks);
+    void ClearCodePages(CodeCache cache = CodeCache::Blocks);
+
+    // Pages written or remapped since they were last taken, for debuggers. While tracking, the first write to a
+    // clean page goes through the slow path and marks it dirty, the following ones go straight to memory until the
+    // page is taken. Writes cost nothing more when not tracking.
+    void EnableDirtyTracking(bool isEnabled);
+    PageSet TakeDirtyPages();
+
+    // Pages watched by a debugger, their reads or writes go through the slow path and call the watch handler.
+    // Accesses to other pages cost nothing more. While suspended, reads and writes are not reported.
+    void SetWatchHandler(WatchHandler handler);
+    void WatchPages(const PageSet& readPages, const PageSet& writePages);
+    void SuspendWatchpoints(bool isSuspended) { m_areWatchpointsSuspended = isSuspended; }
+
+    // ROM bank mapped at a ROM address, code cached from ROM is only valid for that bank
+    uint16_t GetROMBank(uint16_t addr) const;
+
+    // Contents of a ROM bank whether it is mapped or not, nullptr past the end of the ROM
+    const uint8_t* GetROMBankData(unsigned int bank) const;
+    unsigned int GetNbROMBanks() const { return m_nbROMBanks; }
+
+    const State& GetState() const { return m_state; }
+
+    // Page tables used by native code, pages with nullptr entries must go through Read and Write
+    const uint8_t* const* GetReadPageTable() const { return m_readPages.data(); }
+    uint8_t* const* GetWritePageTable() const { return m_writePages.data(); }
 
 private:
-    std::array<uint8_t, 0xFFFF> m_data;
-};
\ No newline at end of file
+    uint8_t ReadSlow(uint16_t addr) const;
+    void WriteSlow(uint16_t addr, uint8_t value);
+
+    void MapPages(uint8_t firstPage, uint8_t lastPage, const uint8_t* readData, uint8_t* writeData);
+    void MapBanks();
+    void WriteController(uint16_t addr, uint8_t value);
+
+    uint8_t ReadHighPage(uint16_t addr) const;
+    void WriteHighPage(uint16_t addr, uint8_t value);
+
+    uint8_t ReadWatched(uint16_t addr) const;
+
+    void UpdateReadPage(uint8_t page);
+    void UpdateWritePage(uint8_t page);
+    void MarkDirty(uint8_t page);
+    void NotifyCodeWrite(uint8_t codePage, uint16_t firstAddr, uint16_t lastAddr);
+
+private:
+    static constexpr size_t m_NB_CODE_CACHES = 3;
+
+    static constexpr uint8_t m_IF_PORT = 0x0F;
+
+    State m_state;
+
+    std::shared_ptr<const Cartridge> m_cartridge;
+    const uint8_t* m_rom;
+    ControllerType m_controllerType;
+    unsigned int m_nbROMBanks;
+    unsigned int m_externalRAMSize;
+
+    // Fast path tables, a nullptr entry sends the access to the slow path
+    std::array<const uint8_t*, m_NB_PAGES> m_readPages;
+    std::array<uint8_t*, m_NB_PAGES> m_writePages;
+
+    // Where reads and writes to each page land when it is mapped directly, regardless of cached code and watchpoints
+    std::array<const uint8_t*, m_NB_PAGES> m_directReadPages;
+    std::array<uint8_t*, m_NB_PAGES> m_directWritePages;
+
+    std::array<ReadHandler, m_NB_PAGES> m_readHandlers;
+    std::array<WriteHandler, m_NB_PAGES> m_writeHandlers;
+
+    std::array<ReadHandler, 0x80> m_ioReadHandlers;
+    std::array<WriteHandler, 0x80> m_ioWriteHandlers;
+    std::bitset<0x80> m_eventDrivenPorts;
+    IOSyncHandler m_ioSyncHandler;
+
+    // Pages holding cached code, 2 bits per cache: the low one when the code is in the page itself, the high one
+    // when it is in its mirror
+    std::array<uint8_t, m_NB_PAGES> m_codePages;
+    std::array<CodeWriteHandler, m_NB_CODE_CACHES> m_codeWriteHandlers;
+
+    // Tracked pages not written since they were taken, their writes go through the slow path
+    bool m_isDirtyTrackingEnabled;
+    PageSet m_cleanPages;
+    PageSet m_dirtyPages;
+
+    WatchHandler m_watchHandler;
+    PageSet m_watchedReadPages;
+    PageSet m_watchedWritePages;
+    bool m_areWatchpointsSuspended;
+};
+
+inline uint8_t Memory::Read(uint16_t addr) const
+{
+    const uint8_t* page = m_readPages[addr >> 8];
+    if(page != nullptr)
+    {
+        return page[addr & 0xFF];
+    }
+
+    return ReadSlow(addr);
+}
+
+inline void Memory::Write(uint16_t addr, uint8_t value)
+{
+    uint8_t* page = m_writePages[addr >> 8];
+    if(page != nullptr)
+    {
+        page[addr & 0xFF] = value;
+        return;
+    }
+
+    WriteSlow(addr, value);
+}
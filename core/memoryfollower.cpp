@@ -0,0 +1,47 @@
+#include "memoryfollower.h"
+
+#include <algorithm>
+#include <cstddef>
+
+MemoryFollower::MemoryFollower(Emulator& emu)
+    : m_emu{emu}
+    , m_memory(0x10000)
+{
+    m_emu.EnableDirtyTracking(true);
+}
+
+MemoryFollower::~MemoryFollower()
+{
+    m_emu.EnableDirtyTracking(false);
+}
+
+void MemoryFollower::Update()
+{
+    const Memory::PageSet dirtyPages = m_emu.TakeDirtyPages();
+    for(unsigned int page = 0; page < Memory::m_NB_PAGES; ++page)
+    {
+        if(dirtyPages[page] || page == 0xFF)
+        {
+            m_emu.GetMemory().Peek(static_cast<uint16_t>(page * Memory::m_PAGE_SIZE),
+                                   &m_memory[page * Memory::m_PAGE_SIZE], Memory::m_PAGE_SIZE);
+        }
+    }
+}
+
+unsigned int MemoryFollower::CountStalePages() const
+{
+    std::vector<uint8_t> memory(0x10000);
+    m_emu.GetMemory().Peek(0x0000, memory.data(), memory.size());
+
+    unsigned int nbStalePages = 0;
+    for(unsigned int page = 0; page < Memory::m_NB_PAGES; ++page)
+    {
+        const auto pageStart = static_cast<ptrdiff_t>(page * Memory::m_PAGE_SIZE);
+        if(!std::equal(memory.begin() + pageStart, memory.begin() + pageStart + Memory::m_PAGE_SIZE,
+                       m_memory.begin() + pageStart))
+        {
+            ++nbStalePages;
+        }
+    }
+    return nbStalePages;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "emulator.h"
+
+#include <cstdint>
+#include <vector>
+
+// Copy of the address space kept up to date from the dirty pages, as debuggers do
+class MemoryFollower
+{
+public:
+    explicit MemoryFollower(Emulator& emu);
+    MemoryFollower(const MemoryFollower&) = delete;
+    MemoryFollower& operator=(const MemoryFollower&) = delete;
+    ~MemoryFollower();
+
+    // The I/O registers change without being written
+    void Update();
+
+    // Pages of the copy that differ from memory
+    unsigned int CountStalePages() const;
+
+private:
+    Emulator& m_emu;
+    std::vector<uint8_t> m_memory;
+};
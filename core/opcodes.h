@@ -0,0 +1,439 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Operands of the instructions, as the assembler writes them
+enum class Operand : uint8_t
+{
+    None,
+
+    A, B, C, D, E, H, L,
+    AF, BC, DE, HL, SP,
+
+    // Memory through a register pair, (C) is $FF00+C
+    AtBC, AtDE, AtHL, AtHLIncrement, AtHLDecrement, AtC,
+
+    // Immediates: d8, d16, (a16), ($FF00+a8)
+    Immediate8, Immediate16, AtImmediate16, AtHighImmediate8,
+
+    // Signed immediates: the target of JR, the offset of ADD SP and of LD HL,SP+r8
+    Relative8, Offset8, SPOffset8,
+
+    ConditionNZ, ConditionZ, ConditionNC, ConditionC,
+
+    // Taken from the opcode: the address of RST, the bit of BIT, RES and SET
+    Vector, Bit
+};
+
+// Where the instruction leaves the CPU. Anything but Next ends a block of straight-line code.
+enum class Flow : uint8_t
+{
+    Next,
+
+    // JR and JP
+    Jump,
+
+    // CALL and RST
+    Call,
+
+    // RET and RETI
+    Return,
+
+    Halt,
+    Stop,
+
+    // DI and EI, interrupts may be taken from the next instruction on
+    Interrupts,
+
+    // No instruction, the CPU locks up
+    Invalid
+};
+
+// What an instruction does to the flags, as masks of the F register: Z 0x80, N 0x40, H 0x20, C 0x10.
+// The other flags are left as they are.
+struct FlagEffects
+{
+    uint8_t computed = 0;
+    uint8_t set = 0;
+    uint8_t reset = 0;
+};
+
+struct OpcodeInfo
+{
+    // "LD", "JR", "BIT", nullptr for the invalid opcodes
+    const char* mnemonic = nullptr;
+    std::array<Operand, 2> operands{};
+
+    // Bytes, opcode and immediates, the 0xCB prefix included. STOP takes the byte following it.
+    uint8_t length = 1;
+
+    // Clock cycles when a conditional branch is not taken, and when it is. The 0xCB prefix takes none,
+    // the prefixed instructions count it.
+    uint8_t cycles = 4;
+    uint8_t takenCycles = 4;
+
+    FlagEffects flags;
+    Flow flow = Flow::Next;
+
+    constexpr bool IsValid() const { return mnemonic != nullptr; }
+    constexpr bool IsConditional() const { return takenCycles != cycles; }
+};
+
+// Metadata of the SM83 instructions, the unprefixed ones and those following the 0xCB prefix. Everything knowing
+// about opcodes reads it from here: the interpreter its lengths and cycles, the block decoder where blocks end, the
+// disassembler and the debugger. It is all built at compile time and looked up like any constant table.
+//
+// The timings are those checked by the instr_timing test ROM, the opcode_table test compares them to its own.
+class Opcodes
+{
+public:
+    static constexpr const OpcodeInfo& Get(uint8_t opcode) { return m_INFOS[opcode]; }
+    static constexpr const OpcodeInfo& GetCB(uint8_t opcode) { return m_CB_INFOS[opcode]; }
+
+    // Bytes an operand takes after the opcode
+    static constexpr unsigned int GetImmediateSize(Operand operand)
+    {
+        switch(operand)
+        {
+            case Operand::Immediate8: case Operand::AtHighImmediate8:
+            case Operand::Relative8: case Operand::Offset8: case Operand::SPOffset8:
+                return 1;
+
+            case Operand::Immediate16: case Operand::AtImmediate16:
+                return 2;
+
+            default:
+                return 0;
+        }
+    }
+
+    static constexpr uint8_t m_CB_PREFIX = 0xCB;
+    static constexpr uint8_t m_STOP = 0x10;
+
+private:
+    // Flags in the order Z N H C: '-' left as is, '0' reset, '1' set, anything else computed
+    static constexpr FlagEffects MakeFlags(const char* flags)
+    {
+        FlagEffects effects{};
+        for(unsigned int i = 0; i < 4; ++i)
+        {
+            const uint8_t mask = static_cast<uint8_t>(0x80 >> i);
+            if(flags[i] == '0')
+            {
+                effects.reset |= mask;
+            }
+            else if(flags[i] == '1')
+            {
+                effects.set |= mask;
+            }
+            else if(flags[i] != '-')
+            {
+                effects.computed |= mask;
+            }
+        }
+        return effects;
+    }
+
+    // Taken cycles of 0 for the instructions that do not branch conditionally
+    static constexpr OpcodeInfo MakeInfo(const char* mnemonic, Operand dst, Operand src, unsigned int length,
+                                         unsigned int cycles, unsigned int takenCycles, const char* flags,
+                                         Flow flow = Flow::Next)
+    {
+        OpcodeInfo info{};
+        info.mnemonic = mnemonic;
+        info.operands = {dst, src};
+        info.length = static_cast<uint8_t>(length);
+        info.cycles = static_cast<uint8_t>(cycles);
+        info.takenCycles = static_cast<uint8_t>(takenCycles != 0 ? takenCycles : cycles);
+        info.flags = MakeFlags(flags);
+        info.flow = flow;
+        return info;
+    }
+
+    static constexpr OpcodeInfo MakeInvalidInfo()
+    {
+        OpcodeInfo info{};
+        info.flow = Flow::Invalid;
+        return info;
+    }
+
+    static constexpr std::array<OpcodeInfo, 256> MakeInfos()
+    {
+        using O = Operand;
+        constexpr O N = O::None;
+
+        // 0x00-0x3F
+        const std::array<OpcodeInfo, 64> low{
+            MakeInfo("NOP",  N,              N,              1,  4,  0, "----"),
+            MakeInfo("LD",   O::BC,          O::Immediate16, 3, 12,  0, "----"),
+            MakeInfo("LD",   O::AtBC,        O::A,           1,  8,  0, "----"),
+            MakeInfo("INC",  O::BC,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::B,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::B,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::B,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("RLCA", N,              N,              1,  4,  0, "000C"),
+
+            MakeInfo("LD",   O::AtImmediate16, O::SP,        3, 20,  0, "----"),
+            MakeInfo("ADD",  O::HL,          O::BC,          1,  8,  0, "-0HC"),
+            MakeInfo("LD",   O::A,           O::AtBC,        1,  8,  0, "----"),
+            MakeInfo("DEC",  O::BC,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::C,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::C,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::C,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("RRCA", N,              N,              1,  4,  0, "000C"),
+
+            MakeInfo("STOP", N,              N,              2,  4,  0, "----", Flow::Stop),
+            MakeInfo("LD",   O::DE,          O::Immediate16, 3, 12,  0, "----"),
+            MakeInfo("LD",   O::AtDE,        O::A,           1,  8,  0, "----"),
+            MakeInfo("INC",  O::DE,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::D,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::D,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::D,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("RLA",  N,              N,              1,  4,  0, "000C"),
+
+            MakeInfo("JR",   O::Relative8,   N,              2, 12,  0, "----", Flow::Jump),
+            MakeInfo("ADD",  O::HL,          O::DE,          1,  8,  0, "-0HC"),
+            MakeInfo("LD",   O::A,           O::AtDE,        1,  8,  0, "----"),
+            MakeInfo("DEC",  O::DE,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::E,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::E,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::E,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("RRA",  N,              N,              1,  4,  0, "000C"),
+
+            MakeInfo("JR",   O::ConditionNZ, O::Relative8,   2,  8, 12, "----", Flow::Jump),
+            MakeInfo("LD",   O::HL,          O::Immediate16, 3, 12,  0, "----"),
+            MakeInfo("LD",   O::AtHLIncrement, O::A,         1,  8,  0, "----"),
+            MakeInfo("INC",  O::HL,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::H,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::H,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::H,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("DAA",  N,              N,              1,  4,  0, "Z-0C"),
+
+            MakeInfo("JR",   O::ConditionZ,  O::Relative8,   2,  8, 12, "----", Flow::Jump),
+            MakeInfo("ADD",  O::HL,          O::HL,          1,  8,  0, "-0HC"),
+            MakeInfo("LD",   O::A,           O::AtHLIncrement, 1,  8,  0, "----"),
+            MakeInfo("DEC",  O::HL,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::L,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::L,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::L,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("CPL",  N,              N,              1,  4,  0, "-11-"),
+
+            MakeInfo("JR",   O::ConditionNC, O::Relative8,   2,  8, 12, "----", Flow::Jump),
+            MakeInfo("LD",   O::SP,          O::Immediate16, 3, 12,  0, "----"),
+            MakeInfo("LD",   O::AtHLDecrement, O::A,         1,  8,  0, "----"),
+            MakeInfo("INC",  O::SP,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::AtHL,        N,              1, 12,  0, "Z0H-"),
+            MakeInfo("DEC",  O::AtHL,        N,              1, 12,  0, "Z1H-"),
+            MakeInfo("LD",   O::AtHL,        O::Immediate8,  2, 12,  0, "----"),
+            MakeInfo("SCF",  N,              N,              1,  4,  0, "-001"),
+
+            MakeInfo("JR",   O::ConditionC,  O::Relative8,   2,  8, 12, "----", Flow::Jump),
+            MakeInfo("ADD",  O::HL,          O::SP,          1,  8,  0, "-0HC"),
+            MakeInfo("LD",   O::A,           O::AtHLDecrement, 1,  8,  0, "----"),
+            MakeInfo("DEC",  O::SP,          N,              1,  8,  0, "----"),
+            MakeInfo("INC",  O::A,           N,              1,  4,  0, "Z0H-"),
+            MakeInfo("DEC",  O::A,           N,              1,  4,  0, "Z1H-"),
+            MakeInfo("LD",   O::A,           O::Immediate8,  2,  8,  0, "----"),
+            MakeInfo("CCF",  N,              N,              1,  4,  0, "-00C")
+        };
+
+        // 0xC0-0xFF
+        const OpcodeInfo invalid = MakeInvalidInfo();
+        const std::array<OpcodeInfo, 64> high{
+            MakeInfo("RET",  O::ConditionNZ, N,              1,  8, 20, "----", Flow::Return),
+            MakeInfo("POP",  O::BC,          N,              1, 12,  0, "----"),
+            MakeInfo("JP",   O::ConditionNZ, O::Immediate16, 3, 12, 16, "----", Flow::Jump),
+            MakeInfo("JP",   O::Immediate16, N,              3, 16,  0, "----", Flow::Jump),
+            MakeInfo("CALL", O::ConditionNZ, O::Immediate16, 3, 12, 24, "----", Flow::Call),
+            MakeInfo("PUSH", O::BC,          N,              1, 16,  0, "----"),
+            MakeInfo("ADD",  O::A,           O::Immediate8,  2,  8,  0, "Z0HC"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("RET",  O::ConditionZ,  N,              1,  8, 20, "----", Flow::Return),
+            MakeInfo("RET",  N,              N,              1, 16,  0, "----", Flow::Return),
+            MakeInfo("JP",   O::ConditionZ,  O::Immediate16, 3, 12, 16, "----", Flow::Jump),
+            MakeInfo("PREFIX", N,            N,              2,  0,  0, "----"),
+            MakeInfo("CALL", O::ConditionZ,  O::Immediate16, 3, 12, 24, "----", Flow::Call),
+            MakeInfo("CALL", O::Immediate16, N,              3, 24,  0, "----", Flow::Call),
+            MakeInfo("ADC",  O::A,           O::Immediate8,  2,  8,  0, "Z0HC"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("RET",  O::ConditionNC, N,              1,  8, 20, "----", Flow::Return),
+            MakeInfo("POP",  O::DE,          N,              1, 12,  0, "----"),
+            MakeInfo("JP",   O::ConditionNC, O::Immediate16, 3, 12, 16, "----", Flow::Jump),
+            invalid,
+            MakeInfo("CALL", O::ConditionNC, O::Immediate16, 3, 12, 24, "----", Flow::Call),
+            MakeInfo("PUSH", O::DE,          N,              1, 16,  0, "----"),
+            MakeInfo("SUB",  O::Immediate8,  N,              2,  8,  0, "Z1HC"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("RET",  O::ConditionC,  N,              1,  8, 20, "----", Flow::Return),
+            MakeInfo("RETI", N,              N,              1, 16,  0, "----", Flow::Return),
+            MakeInfo("JP",   O::ConditionC,  O::Immediate16, 3, 12, 16, "----", Flow::Jump),
+            invalid,
+            MakeInfo("CALL", O::ConditionC,  O::Immediate16, 3, 12, 24, "----", Flow::Call),
+            invalid,
+            MakeInfo("SBC",  O::A,           O::Immediate8,  2,  8,  0, "Z1HC"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("LDH",  O::AtHighImmediate8, O::A,      2, 12,  0, "----"),
+            MakeInfo("POP",  O::HL,          N,              1, 12,  0, "----"),
+            MakeInfo("LD",   O::AtC,         O::A,           1,  8,  0, "----"),
+            invalid,
+            invalid,
+            MakeInfo("PUSH", O::HL,          N,              1, 16,  0, "----"),
+            MakeInfo("AND",  O::Immediate8,  N,              2,  8,  0, "Z010"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("ADD",  O::SP,          O::Offset8,     2, 16,  0, "00HC"),
+            MakeInfo("JP",   O::HL,          N,              1,  4,  0, "----", Flow::Jump),
+            MakeInfo("LD",   O::AtImmediate16, O::A,         3, 16,  0, "----"),
+            invalid,
+            invalid,
+            invalid,
+            MakeInfo("XOR",  O::Immediate8,  N,              2,  8,  0, "Z000"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("LDH",  O::A,           O::AtHighImmediate8, 2, 12,  0, "----"),
+            MakeInfo("POP",  O::AF,          N,              1, 12,  0, "ZNHC"),
+            MakeInfo("LD",   O::A,           O::AtC,         1,  8,  0, "----"),
+            MakeInfo("DI",   N,              N,              1,  4,  0, "----", Flow::Interrupts),
+            invalid,
+            MakeInfo("PUSH", O::AF,          N,              1, 16,  0, "----"),
+            MakeInfo("OR",   O::Immediate8,  N,              2,  8,  0, "Z000"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call),
+
+            MakeInfo("LD",   O::HL,          O::SPOffset8,   2, 12,  0, "00HC"),
+            MakeInfo("LD",   O::SP,          O::HL,          1,  8,  0, "----"),
+            MakeInfo("LD",   O::A,           O::AtImmediate16, 3, 16,  0, "----"),
+            MakeInfo("EI",   N,              N,              1,  4,  0, "----", Flow::Interrupts),
+            invalid,
+            invalid,
+            MakeInfo("CP",   O::Immediate8,  N,              2,  8,  0, "Z1HC"),
+            MakeInfo("RST",  O::Vector,      N,              1, 16,  0, "----", Flow::Call)
+        };
+
+        // The register loads and the arithmetic in between are regular: the destination or operation in bits 3-5,
+        // the source in bits 0-2
+        const std::array<O, 8> registers{O::B, O::C, O::D, O::E, O::H, O::L, O::AtHL, O::A};
+        const std::array<const char*, 8> operations{"ADD", "ADC", "SUB", "SBC", "AND", "XOR", "OR", "CP"};
+        const std::array<const char*, 8> operationFlags{"Z0HC", "Z0HC", "Z1HC", "Z1HC", "Z010", "Z000", "Z000", "Z1HC"};
+
+        std::array<OpcodeInfo, 256> infos{};
+        for(unsigned int opcode = 0; opcode < infos.size(); ++opcode)
+        {
+            const unsigned int y = (opcode >> 3) & 0x07;
+            const unsigned int z = opcode & 0x07;
+            const bool usesMemory = y == 6 || z == 6;
+
+            if(opcode < 0x40)
+            {
+                infos[opcode] = low[opcode];
+            }
+            else if(opcode >= 0xC0)
+            {
+                infos[opcode] = high[opcode - 0xC0];
+            }
+            else if(opcode == 0x76)
+            {
+                infos[opcode] = MakeInfo("HALT", N, N, 1, 4, 0, "----", Flow::Halt);
+            }
+            else if(opcode < 0x80)
+            {
+                infos[opcode] = MakeInfo("LD", registers[y], registers[z], 1, usesMemory ? 8 : 4, 0, "----");
+            }
+            else
+            {
+                // SUB, AND, XOR, OR and CP leave the accumulator out
+                const bool hasAccumulator = y == 0 || y == 1 || y == 3;
+                infos[opcode] = MakeInfo(operations[y], hasAccumulator ? O::A : registers[z],
+                                         hasAccumulator ? registers[z] : N, 1, z == 6 ? 8 : 4, 0, operationFlags[y]);
+            }
+        }
+        return infos;
+    }
+
+    static constexpr std::array<OpcodeInfo, 256> MakeCBInfos()
+    {
+        using O = Operand;
+
+        const std::array<O, 8> registers{O::B, O::C, O::D, O::E, O::H, O::L, O::AtHL, O::A};
+        const std::array<const char*, 8> shifts{"RLC", "RRC", "RL", "RR", "SLA", "SRA", "SWAP", "SRL"};
+        const std::array<const char*, 3> bitOperations{"BIT", "RES", "SET"};
+
+        std::array<OpcodeInfo, 256> infos{};
+        for(unsigned int opcode = 0; opcode < infos.size(); ++opcode)
+        {
+            const unsigned int x = opcode >> 6;
+            const unsigned int y = (opcode >> 3) & 0x07;
+            const unsigned int z = opcode & 0x07;
+
+            // BIT only reads (HL), the others write it back
+            if(x == 0)
+            {
+                infos[opcode] = MakeInfo(shifts[y], registers[z], O::None, 2, z == 6 ? 16 : 8, 0,
+                                         y == 6 ? "Z000" : "Z00C");
+            }
+            else
+            {
+                const unsigned int memoryCycles = x == 1 ? 12 : 16;
+                infos[opcode] = MakeInfo(bitOperations[x - 1], O::Bit, registers[z], 2, z == 6 ? memoryCycles : 8, 0,
+                                         x == 1 ? "Z01-" : "----");
+            }
+        }
+        return infos;
+    }
+
+private:
+    static const std::array<OpcodeInfo, 256> m_INFOS;
+    static const std::array<OpcodeInfo, 256> m_CB_INFOS;
+};
+
+inline constexpr std::array<OpcodeInfo, 256> Opcodes::m_INFOS = Opcodes::MakeInfos();
+inline constexpr std::array<OpcodeInfo, 256> Opcodes::m_CB_INFOS = Opcodes::MakeCBInfos();
+
+// Every instruction takes the bytes of its operands, except STOP and the prefix that take a byte of their own
+constexpr bool AreOpcodeLengthsConsistent()
+{
+    for(unsigned int opcode = 0; opcode < 256; ++opcode)
+    {
+        const OpcodeInfo& info = Opcodes::Get(static_cast<uint8_t>(opcode));
+        const OpcodeInfo& cbInfo = Opcodes::GetCB(static_cast<uint8_t>(opcode));
+        const bool hasExtraByte = opcode == Opcodes::m_STOP || opcode == Opcodes::m_CB_PREFIX;
+
+        if(info.length != 1 + Opcodes::GetImmediateSize(info.operands[0]) + Opcodes::GetImmediateSize(info.operands[1]) +
+                          (hasExtraByte ? 1 : 0) ||
+           cbInfo.length != 2)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every byte of the instruction takes a cycle, but the byte following STOP, and the prefix the prefixed ones count
+constexpr bool AreOpcodeCyclesConsistent()
+{
+    auto isConsistent = [](const OpcodeInfo& info, unsigned int nbBytes)
+    {
+        return info.cycles % 4 == 0 && info.cycles >= 4 * nbBytes && info.takenCycles >= info.cycles;
+    };
+
+    for(unsigned int opcode = 0; opcode < 256; ++opcode)
+    {
+        const OpcodeInfo& info = Opcodes::Get(static_cast<uint8_t>(opcode));
+        const bool isPrefix = opcode == Opcodes::m_CB_PREFIX;
+        const unsigned int nbBytes = opcode == Opcodes::m_STOP ? 1 : info.length;
+
+        if((!isPrefix && !isConsistent(info, nbBytes)) ||
+           !isConsistent(Opcodes::GetCB(static_cast<uint8_t>(opcode)), 2))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(AreOpcodeLengthsConsistent(), "Opcode length not matching its operands");
+static_assert(AreOpcodeCyclesConsistent(), "Opcode cycles not matching its length");
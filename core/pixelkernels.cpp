@@ -0,0 +1,302 @@
+#include "pixelkernels.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GB_SIMD_KERNELS_SUPPORTED 1
+#include <immintrin.h>
+#else
+#define GB_SIMD_KERNELS_SUPPORTED 0
+#endif
+
+namespace
+{
+    void DecodeTileRowsScalar(const uint8_t* lowPlanes, const uint8_t* highPlanes, size_t nbRows, uint8_t* colors)
+    {
+        for(size_t row = 0; row < nbRows; ++row)
+        {
+            for(unsigned int x = 0; x < 8; ++x)
+            {
+                const unsigned int bit = 7 - x;
+                colors[row * 8 + x] = static_cast<uint8_t>(((lowPlanes[row] >> bit) & 1) |
+                                                           (((highPlanes[row] >> bit) & 1) << 1));
+            }
+        }
+    }
+
+    void ApplyPaletteScalar(const uint8_t* colors, size_t nbPixels, uint8_t palette, uint8_t* shades)
+    {
+        for(size_t i = 0; i < nbPixels; ++i)
+        {
+            shades[i] = (palette >> (2 * colors[i])) & 0x03;
+        }
+    }
+
+    void ConvertShadesScalar(const uint8_t* shades, size_t nbPixels, const PixelKernels::ShadeColors& shadeColors,
+                             uint32_t* pixels)
+    {
+        for(size_t i = 0; i < nbPixels; ++i)
+        {
+            pixels[i] = shadeColors[shades[i]];
+        }
+    }
+
+#if GB_SIMD_KERNELS_SUPPORTED
+    // SSE2 is part of x86-64, these need no runtime check
+
+    // Bytes equal to 0xFF where the pixel bit is set in the bit plane bytes repeated 8 times
+    inline __m128i ExpandPlaneBitsSSE2(__m128i planes)
+    {
+        const __m128i pixelBits = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80),
+                                               0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, static_cast<char>(0x80));
+        return _mm_cmpeq_epi8(_mm_and_si128(planes, pixelBits), pixelBits);
+    }
+
+    void DecodeTileRowsSSE2(const uint8_t* lowPlanes, const uint8_t* highPlanes, size_t nbRows, uint8_t* colors)
+    {
+        const __m128i ones = _mm_set1_epi8(1);
+        const __m128i twos = _mm_set1_epi8(2);
+
+        size_t row = 0;
+        for(; row + 8 <= nbRows; row += 8)
+        {
+            // Repeat each plane byte 8 times, 2 rows per vector
+            const __m128i low = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(lowPlanes + row));
+            const __m128i high = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(highPlanes + row));
+            const __m128i low2 = _mm_unpacklo_epi8(low, low);
+            const __m128i high2 = _mm_unpacklo_epi8(high, high);
+            const __m128i low4[2] = { _mm_unpacklo_epi16(low2, low2), _mm_unpackhi_epi16(low2, low2) };
+            const __m128i high4[2] = { _mm_unpacklo_epi16(high2, high2), _mm_unpackhi_epi16(high2, high2) };
+
+            for(unsigned int i = 0; i < 2; ++i)
+            {
+                const __m128i low8[2] = { _mm_unpacklo_epi32(low4[i], low4[i]), _mm_unpackhi_epi32(low4[i], low4[i]) };
+                const __m128i high8[2] = { _mm_unpacklo_epi32(high4[i], high4[i]), _mm_unpackhi_epi32(high4[i], high4[i]) };
+
+                for(unsigned int j = 0; j < 2; ++j)
+                {
+                    const __m128i result = _mm_or_si128(_mm_and_si128(ExpandPlaneBitsSSE2(low8[j]), ones),
+                                                        _mm_and_si128(ExpandPlaneBitsSSE2(high8[j]), twos));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(colors + (row + 4 * i + 2 * j) * 8), result);
+                }
+            }
+        }
+
+        DecodeTileRowsScalar(lowPlanes + row, highPlanes + row, nbRows - row, colors + row * 8);
+    }
+
+    void ApplyPaletteSSE2(const uint8_t* colors, size_t nbPixels, uint8_t palette, uint8_t* shades)
+    {
+        // No byte shuffle before SSSE3, select the shade of each of the 4 colors
+        __m128i colorIndices[4];
+        __m128i colorShades[4];
+        for(unsigned int color = 0; color < 4; ++color)
+        {
+            colorIndices[color] = _mm_set1_epi8(static_cast<char>(color));
+            colorShades[color] = _mm_set1_epi8(static_cast<char>((palette >> (2 * color)) & 0x03));
+        }
+
+        size_t i = 0;
+        for(; i + 16 <= nbPixels; i += 16)
+        {
+            const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colors + i));
+
+            __m128i result = _mm_setzero_si128();
+            for(unsigned int color = 0; color < 4; ++color)
+            {
+                const __m128i isColor = _mm_cmpeq_epi8(input, colorIndices[color]);
+                result = _mm_or_si128(result, _mm_and_si128(isColor, colorShades[color]));
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(shades + i), result);
+        }
+
+        ApplyPaletteScalar(colors + i, nbPixels - i, palette, shades + i);
+    }
+
+    void ConvertShadesSSE2(const uint8_t* shades, size_t nbPixels, const PixelKernels::ShadeColors& shadeColors,
+                           uint32_t* pixels)
+    {
+        __m128i shadeIndices[4];
+        __m128i colors[4];
+        for(unsigned int shade = 0; shade < 4; ++shade)
+        {
+            shadeIndices[shade] = _mm_set1_epi32(static_cast<int>(shade));
+            colors[shade] = _mm_set1_epi32(static_cast<int>(shadeColors[shade]));
+        }
+
+        const __m128i zero = _mm_setzero_si128();
+
+        size_t i = 0;
+        for(; i + 16 <= nbPixels; i += 16)
+        {
+            // Widen the shades to 32 bits, 4 pixels per vector
+            const __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shades + i));
+            const __m128i input16[2] = { _mm_unpacklo_epi8(input, zero), _mm_unpackhi_epi8(input, zero) };
+
+            for(unsigned int j = 0; j < 4; ++j)
+            {
+                const __m128i input32 = (j & 1) ? _mm_unpackhi_epi16(input16[j / 2], zero)
+                                                : _mm_unpacklo_epi16(input16[j / 2], zero);
+
+                __m128i result = _mm_setzero_si128();
+                for(unsigned int shade = 0; shade < 4; ++shade)
+                {
+                    const __m128i isShade = _mm_cmpeq_epi32(input32, shadeIndices[shade]);
+                    result = _mm_or_si128(result, _mm_and_si128(isShade, colors[shade]));
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(pixels + i + 4 * j), result);
+            }
+        }
+
+        ConvertShadesScalar(shades + i, nbPixels - i, shadeColors, pixels + i);
+    }
+
+    __attribute__((target("avx2")))
+    void DecodeTileRowsAVX2(const uint8_t* lowPlanes, const uint8_t* highPlanes, size_t nbRows, uint8_t* colors)
+    {
+        // Byte shuffles repeating each plane byte 8 times, 4 rows per vector out of 8 broadcast bytes
+        const __m256i firstRows = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                   2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+        const __m256i lastRows = _mm256_add_epi8(firstRows, _mm256_set1_epi8(4));
+
+        const __m256i pixelBits = _mm256_set1_epi64x(0x0102040810204080);
+        const __m256i ones = _mm256_set1_epi8(1);
+        const __m256i twos = _mm256_set1_epi8(2);
+
+        size_t row = 0;
+        for(; row + 8 <= nbRows; row += 8)
+        {
+            long long lowBytes;
+            long long highBytes;
+            std::memcpy(&lowBytes, lowPlanes + row, sizeof(lowBytes));
+            std::memcpy(&highBytes, highPlanes + row, sizeof(highBytes));
+
+            const __m256i low = _mm256_set1_epi64x(lowBytes);
+            const __m256i high = _mm256_set1_epi64x(highBytes);
+
+            for(unsigned int i = 0; i < 2; ++i)
+            {
+                const __m256i rows = i == 0 ? firstRows : lastRows;
+                const __m256i lowBits = _mm256_and_si256(_mm256_shuffle_epi8(low, rows), pixelBits);
+                const __m256i highBits = _mm256_and_si256(_mm256_shuffle_epi8(high, rows), pixelBits);
+
+                const __m256i result = _mm256_or_si256(_mm256_and_si256(_mm256_cmpeq_epi8(lowBits, pixelBits), ones),
+                                                       _mm256_and_si256(_mm256_cmpeq_epi8(highBits, pixelBits), twos));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(colors + (row + 4 * i) * 8), result);
+            }
+        }
+
+        DecodeTileRowsScalar(lowPlanes + row, highPlanes + row, nbRows - row, colors + row * 8);
+    }
+
+    __attribute__((target("avx2")))
+    void ApplyPaletteAVX2(const uint8_t* colors, size_t nbPixels, uint8_t palette, uint8_t* shades)
+    {
+        // Color indices are below 4, a byte shuffle looks their shade up
+        const char shade0 = palette & 0x03;
+        const char shade1 = (palette >> 2) & 0x03;
+        const char shade2 = (palette >> 4) & 0x03;
+        const char shade3 = (palette >> 6) & 0x03;
+        const __m256i table = _mm256_setr_epi8(shade0, shade1, shade2, shade3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               shade0, shade1, shade2, shade3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+        size_t i = 0;
+        for(; i + 32 <= nbPixels; i += 32)
+        {
+            const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colors + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(shades + i), _mm256_shuffle_epi8(table, input));
+        }
+
+        ApplyPaletteScalar(colors + i, nbPixels - i, palette, shades + i);
+    }
+
+    __attribute__((target("avx2")))
+    void ConvertShadesAVX2(const uint8_t* shades, size_t nbPixels, const PixelKernels::ShadeColors& shadeColors,
+                           uint32_t* pixels)
+    {
+        const __m256i table = _mm256_setr_epi32(static_cast<int>(shadeColors[0]), static_cast<int>(shadeColors[1]),
+                                                static_cast<int>(shadeColors[2]), static_cast<int>(shadeColors[3]),
+                                                static_cast<int>(shadeColors[0]), static_cast<int>(shadeColors[1]),
+                                                static_cast<int>(shadeColors[2]), static_cast<int>(shadeColors[3]));
+
+        size_t i = 0;
+        for(; i + 8 <= nbPixels; i += 8)
+        {
+            const __m256i input = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(shades + i)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i), _mm256_permutevar8x32_epi32(table, input));
+        }
+
+        ConvertShadesScalar(shades + i, nbPixels - i, shadeColors, pixels + i);
+    }
+#endif
+}
+
+PixelKernels::PixelKernels()
+{
+    SetInstructionSet(InstructionSet::Scalar);
+    SetInstructionSet(GetBestSupported());
+}
+
+bool PixelKernels::IsSupported(InstructionSet set)
+{
+    switch(set)
+    {
+        case InstructionSet::Scalar:
+            return true;
+#if GB_SIMD_KERNELS_SUPPORTED
+        case InstructionSet::SSE2:
+            return true;
+        case InstructionSet::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+PixelKernels::InstructionSet PixelKernels::GetBestSupported()
+{
+    for(InstructionSet set : { InstructionSet::AVX2, InstructionSet::SSE2 })
+    {
+        if(IsSupported(set))
+        {
+            return set;
+        }
+    }
+
+    return InstructionSet::Scalar;
+}
+
+bool PixelKernels::SetInstructionSet(InstructionSet set)
+{
+    if(!IsSupported(set))
+    {
+        return false;
+    }
+
+    switch(set)
+    {
+#if GB_SIMD_KERNELS_SUPPORTED
+        case InstructionSet::SSE2:
+            m_decodeTileRows = DecodeTileRowsSSE2;
+            m_applyPalette = ApplyPaletteSSE2;
+            m_convertShades = ConvertShadesSSE2;
+            break;
+        case InstructionSet::AVX2:
+            m_decodeTileRows = DecodeTileRowsAVX2;
+            m_applyPalette = ApplyPaletteAVX2;
+            m_convertShades = ConvertShadesAVX2;
+            break;
+#endif
+        default:
+            m_decodeTileRows = DecodeTileRowsScalar;
+            m_applyPalette = ApplyPaletteScalar;
+            m_convertShades = ConvertShadesScalar;
+            break;
+    }
+
+    m_instructionSet = set;
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Conversion of tile data to host pixels, the hot loops of the PPU.
+//
+// Every kernel has a portable scalar version. On x86-64 hosts, SSE2 and AVX2
+// versions are built as well and the best one the host supports is picked at
+// runtime. All versions produce bit-identical output.
+class PixelKernels
+{
+public:
+    enum class InstructionSet
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    // 0xAARRGGBB host color of each of the 4 shades, from lightest to darkest
+    using ShadeColors = std::array<uint32_t, 4>;
+
+public:
+    // Starts with the best instruction set supported by the host
+    PixelKernels();
+
+    static bool IsSupported(InstructionSet set);
+    static InstructionSet GetBestSupported();
+
+    // Returns false, keeping the current kernels, when the host does not support the instruction set
+    bool SetInstructionSet(InstructionSet set);
+    InstructionSet GetInstructionSet() const { return m_instructionSet; }
+
+    // Decodes rows of 2bpp planar tile data, given as separate low and high bit planes,
+    // to 8 color indices (0-3) per row, leftmost pixel first
+    void DecodeTileRows(const uint8_t* lowPlanes, const uint8_t* highPlanes, size_t nbRows, uint8_t* colors) const
+    {
+        m_decodeTileRows(lowPlanes, highPlanes, nbRows, colors);
+    }
+
+    // Maps color indices to shades through a palette register laid out like BGP
+    void ApplyPalette(const uint8_t* colors, size_t nbPixels, uint8_t palette, uint8_t* shades) const
+    {
+        m_applyPalette(colors, nbPixels, palette, shades);
+    }
+
+    void ConvertShades(const uint8_t* shades, size_t nbPixels, const ShadeColors& shadeColors, uint32_t* pixels) const
+    {
+        m_convertShades(shades, nbPixels, shadeColors, pixels);
+    }
+
+private:
+    using DecodeTileRowsKernel = void(*)(const uint8_t*, const uint8_t*, size_t, uint8_t*);
+    using ApplyPaletteKernel = void(*)(const uint8_t*, size_t, uint8_t, uint8_t*);
+    using ConvertShadesKernel = void(*)(const uint8_t*, size_t, const ShadeColors&, uint32_t*);
+
+    InstructionSet m_instructionSet;
+
+    DecodeTileRowsKernel m_decodeTileRows;
+    ApplyPaletteKernel m_applyPalette;
+    ConvertShadesKernel m_convertShades;
+};
@@ -0,0 +1,16 @@
+#include "ppmwriter.h"
+
+#include <fstream>
+
+bool WritePPM(const PPU::Framebuffer& frame, const std::string& filePath)
+{
+    std::ofstream file{filePath, std::ios::binary};
+    file << "P6\n" << PPU::m_SCREEN_WIDTH << " " << PPU::m_SCREEN_HEIGHT << "\n255\n";
+    for(uint32_t pixel : frame)
+    {
+        const char rgb[3]{ static_cast<char>(pixel >> 16), static_cast<char>(pixel >> 8), static_cast<char>(pixel) };
+        file.write(rgb, sizeof(rgb));
+    }
+
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "ppu.h"
+
+#include <string>
+
+// Saves a frame as a binary PPM image, readable without any library
+bool WritePPM(const PPU::Framebuffer& frame, const std::string& filePath);
@@ -0,0 +1,597 @@
+#include "ppu.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+    constexpr uint8_t s_LCDC_PORT = 0x40;
+    constexpr uint8_t s_STAT_PORT = 0x41;
+    constexpr uint8_t s_SCY_PORT = 0x42;
+    constexpr uint8_t s_SCX_PORT = 0x43;
+    constexpr uint8_t s_LY_PORT = 0x44;
+    constexpr uint8_t s_LYC_PORT = 0x45;
+    constexpr uint8_t s_DMA_PORT = 0x46;
+    constexpr uint8_t s_BGP_PORT = 0x47;
+    constexpr uint8_t s_OBP0_PORT = 0x48;
+    constexpr uint8_t s_OBP1_PORT = 0x49;
+    constexpr uint8_t s_WY_PORT = 0x4A;
+    constexpr uint8_t s_WX_PORT = 0x4B;
+
+    constexpr uint64_t s_OAM_SCAN_CYCLES = 80;
+    constexpr uint64_t s_DRAWING_CYCLES = 172;
+    constexpr uint64_t s_LINE_CYCLES = 456;
+    constexpr uint64_t s_HBLANK_CYCLES = s_LINE_CYCLES - s_OAM_SCAN_CYCLES - s_DRAWING_CYCLES;
+
+    // Lines 144 to 153 are VBlank
+    constexpr unsigned int s_NB_LINES = 154;
+    constexpr uint64_t s_FRAME_CYCLES = s_NB_LINES * s_LINE_CYCLES;
+
+    constexpr unsigned int s_MAX_SPRITES_PER_LINE = 10;
+    constexpr unsigned int s_NB_SPRITES = 40;
+
+    // Tiles needed to cover a line, with one more for the fine horizontal scroll
+    constexpr unsigned int s_NB_LINE_TILES = PPU::m_SCREEN_WIDTH / 8 + 1;
+
+    // Greys of the original screen, from lightest to darkest
+    constexpr PixelKernels::ShadeColors s_SHADE_COLORS{ 0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000 };
+
+    constexpr uint32_t s_STATE_VERSION = 2;
+
+    constexpr uint8_t ReverseBits(uint8_t value)
+    {
+        uint8_t result{};
+        for(unsigned int i = 0; i < 8; ++i)
+        {
+            result = static_cast<uint8_t>((result << 1) | ((value >> i) & 1));
+        }
+
+        return result;
+    }
+}
+
+PPU::PPU(Memory& mem, Scheduler& scheduler)
+    : m_mem{mem}
+    , m_scheduler{scheduler}
+    , m_frameSkipInterval{1}
+    , m_isFrameDrawn{true}
+    , m_lineStartTime{}
+    , m_isLineCollapsed{}
+{
+    for(uint8_t port = s_LCDC_PORT; port <= s_WX_PORT; ++port)
+    {
+        m_mem.SetIOHandlers(port, [this](uint16_t addr){ return ReadRegister(addr); },
+                                  [this](uint16_t addr, uint8_t value){ WriteRegister(addr, value); });
+        m_mem.SetIOEventDriven(port, true);
+    }
+
+    m_scheduler.SetEventHandler(Scheduler::EventType::PPUMode, [this](uint64_t time){ AdvanceMode(time); });
+
+    Reset();
+}
+
+void PPU::Reset()
+{
+    m_lcdc = 0x91;
+    m_stat = 0;
+    m_scy = 0;
+    m_scx = 0;
+    m_ly = 0;
+    m_lyc = 0;
+    m_dma = 0xFF;
+    m_bgp = 0xFC;
+    m_obp0 = 0xFF;
+    m_obp1 = 0xFF;
+    m_wy = 0;
+    m_wx = 0;
+
+    m_windowLine = 0;
+    m_isStatLineHigh = false;
+    SetLineCollapsed(false);
+    m_framebuffer.fill(s_SHADE_COLORS[0]);
+
+    EnterMode(Mode::OAMScan, m_scheduler.GetTime());
+}
+
+void PPU::SetFrameHandler(FrameHandler handler)
+{
+    m_frameHandler = std::move(handler);
+}
+
+void PPU::SetFrameSkip(unsigned int interval)
+{
+    m_frameSkipInterval = interval;
+
+    // Drawing everything starts right away, skipping waits for the next frame
+    if(interval == 1)
+    {
+        m_isFrameDrawn = true;
+        ExpandLine();
+    }
+}
+
+bool PPU::IsFrameDrawn(uint64_t startTime) const
+{
+    if(m_frameSkipInterval <= 1)
+    {
+        return m_frameSkipInterval == 1;
+    }
+
+    // Frames started by turning the LCD on are not aligned with the emulated ones, the one that ends in the last
+    // emulated frame of the interval draws its lines up to VBlank and the one that starts in it the lines after
+    const uint64_t startFrame = startTime / s_FRAME_CYCLES;
+    const uint64_t vblankFrame = (startTime + m_SCREEN_HEIGHT * s_LINE_CYCLES) / s_FRAME_CYCLES;
+    return (startFrame + 1) % m_frameSkipInterval == 0 || (vblankFrame + 1) % m_frameSkipInterval == 0;
+}
+
+uint8_t PPU::ReadRegister(uint16_t addr) const
+{
+    switch(addr & 0x7F)
+    {
+        case s_LCDC_PORT:
+            return m_lcdc;
+        case s_STAT_PORT:
+        {
+            // Bit 7 is unused, the mode reads as HBlank while the LCD is off
+            const uint8_t coincidence = m_ly == m_lyc ? 0x04 : 0x00;
+            const uint8_t mode = IsEnabled() ? static_cast<uint8_t>(GetMode()) : 0;
+            return static_cast<uint8_t>(0x80 | m_stat | coincidence | mode);
+        }
+        case s_SCY_PORT:
+            return m_scy;
+        case s_SCX_PORT:
+            return m_scx;
+        case s_LY_PORT:
+            return m_ly;
+        case s_LYC_PORT:
+            return m_lyc;
+        case s_DMA_PORT:
+            return m_dma;
+        case s_BGP_PORT:
+            return m_bgp;
+        case s_OBP0_PORT:
+            return m_obp0;
+        case s_OBP1_PORT:
+            return m_obp1;
+        case s_WY_PORT:
+            return m_wy;
+        default:
+            return m_wx;
+    }
+}
+
+void PPU::WriteRegister(uint16_t addr, uint8_t value)
+{
+    switch(addr & 0x7F)
+    {
+        case s_LCDC_PORT:
+        {
+            const bool wasEnabled = IsEnabled();
+            m_lcdc = value;
+
+            if(wasEnabled && !IsEnabled())
+            {
+                // The screen goes blank and LY stays at 0 until the LCD is turned on again
+                m_scheduler.Cancel(Scheduler::EventType::PPUMode);
+                m_mode = Mode::HBlank;
+                SetLineCollapsed(false);
+                m_ly = 0;
+                m_windowLine = 0;
+                m_framebuffer.fill(s_SHADE_COLORS[0]);
+                UpdateStatInterrupt();
+            }
+            else if(!wasEnabled && IsEnabled())
+            {
+                EnterMode(Mode::OAMScan, m_scheduler.GetTime());
+            }
+            break;
+        }
+        case s_STAT_PORT:
+            ExpandLine();
+            m_stat = value & 0x78;
+            UpdateStatInterrupt();
+            break;
+        case s_SCY_PORT:
+            m_scy = value;
+            break;
+        case s_SCX_PORT:
+            m_scx = value;
+            break;
+        case s_LY_PORT:
+            // Read-only
+            break;
+        case s_LYC_PORT:
+            m_lyc = value;
+            UpdateStatInterrupt();
+            break;
+        case s_DMA_PORT:
+            // Copied at once rather than over 160 M-cycles
+            m_dma = value;
+            for(uint16_t i = 0; i < m_mem.GetState().oam.size(); ++i)
+            {
+                m_mem.Write(static_cast<uint16_t>(0xFE00 + i), m_mem.Read(static_cast<uint16_t>((value << 8) + i)));
+            }
+            break;
+        case s_BGP_PORT:
+            m_bgp = value;
+            break;
+        case s_OBP0_PORT:
+            m_obp0 = value;
+            break;
+        case s_OBP1_PORT:
+            m_obp1 = value;
+            break;
+        case s_WY_PORT:
+            m_wy = value;
+            break;
+        default:
+            m_wx = value;
+            break;
+    }
+}
+
+void PPU::AdvanceMode(uint64_t time)
+{
+    // The end of a collapsed line, past its drawing and its HBlank
+    if(m_isLineCollapsed)
+    {
+        SetLineCollapsed(false);
+        SkipScanline();
+        m_mode = Mode::HBlank;
+    }
+
+    switch(m_mode)
+    {
+        case Mode::OAMScan:
+            EnterMode(Mode::Drawing, time);
+            break;
+        case Mode::Drawing:
+            if(m_isFrameDrawn)
+            {
+                RenderScanline();
+            }
+            else
+            {
+                SkipScanline();
+            }
+            EnterMode(Mode::HBlank, time);
+            break;
+        case Mode::HBlank:
+            ++m_ly;
+            if(m_ly == m_SCREEN_HEIGHT)
+            {
+                m_windowLine = 0;
+                m_mem.RequestInterrupt(Memory::Interrupt::VBlank);
+                EnterMode(Mode::VBlank, time);
+
+                if(m_isFrameDrawn && m_frameHandler)
+                {
+                    m_frameHandler(m_framebuffer);
+                }
+            }
+            else
+            {
+                EnterMode(Mode::OAMScan, time);
+            }
+            break;
+        case Mode::VBlank:
+            if(++m_ly == s_NB_LINES)
+            {
+                m_ly = 0;
+                EnterMode(Mode::OAMScan, time);
+            }
+            else
+            {
+                EnterMode(Mode::VBlank, time);
+            }
+            break;
+    }
+}
+
+void PPU::EnterMode(Mode mode, uint64_t time)
+{
+    m_mode = mode;
+
+    if(mode == Mode::OAMScan)
+    {
+        if(m_ly == 0)
+        {
+            m_isFrameDrawn = IsFrameDrawn(time);
+        }
+
+        m_lineStartTime = time;
+        if(CanCollapseLine())
+        {
+            SetLineCollapsed(true);
+            m_scheduler.Schedule(Scheduler::EventType::PPUMode, time + s_LINE_CYCLES);
+            UpdateStatInterrupt();
+            return;
+        }
+    }
+
+    uint64_t duration{};
+    switch(mode)
+    {
+        case Mode::HBlank:
+            duration = s_HBLANK_CYCLES;
+            break;
+        case Mode::VBlank:
+            duration = s_LINE_CYCLES;
+            break;
+        case Mode::OAMScan:
+            duration = s_OAM_SCAN_CYCLES;
+            break;
+        case Mode::Drawing:
+            duration = s_DRAWING_CYCLES;
+            break;
+    }
+
+    m_scheduler.Schedule(Scheduler::EventType::PPUMode, time + duration);
+    UpdateStatInterrupt();
+}
+
+void PPU::ExpandLine()
+{
+    if(!m_isLineCollapsed)
+    {
+        return;
+    }
+
+    // Back in the mode of the current time, until its normal end
+    SetLineCollapsed(false);
+    m_mode = GetMode();
+    switch(m_mode)
+    {
+        case Mode::OAMScan:
+            m_scheduler.Schedule(Scheduler::EventType::PPUMode, m_lineStartTime + s_OAM_SCAN_CYCLES);
+            break;
+        case Mode::Drawing:
+            m_scheduler.Schedule(Scheduler::EventType::PPUMode, m_lineStartTime + s_OAM_SCAN_CYCLES + s_DRAWING_CYCLES);
+            break;
+        default:
+            SkipScanline();
+            m_scheduler.Schedule(Scheduler::EventType::PPUMode, m_lineStartTime + s_LINE_CYCLES);
+            break;
+    }
+}
+
+void PPU::SetLineCollapsed(bool isCollapsed)
+{
+    // The mode of a collapsed line changes without events
+    m_isLineCollapsed = isCollapsed;
+    m_mem.SetIOEventDriven(s_STAT_PORT, !isCollapsed);
+}
+
+PPU::Mode PPU::GetMode() const
+{
+    if(!m_isLineCollapsed)
+    {
+        return m_mode;
+    }
+
+    const uint64_t lineTime = m_scheduler.GetTime() - m_lineStartTime;
+    return lineTime < s_OAM_SCAN_CYCLES                    ? Mode::OAMScan
+         : lineTime < s_OAM_SCAN_CYCLES + s_DRAWING_CYCLES ? Mode::Drawing
+                                                            : Mode::HBlank;
+}
+
+void PPU::UpdateStatInterrupt()
+{
+    const bool isStatLineHigh = IsEnabled() && (((m_stat & 0x40) && m_ly == m_lyc) ||
+                                                ((m_stat & 0x20) && m_mode == Mode::OAMScan) ||
+                                                ((m_stat & 0x10) && m_mode == Mode::VBlank) ||
+                                                ((m_stat & 0x08) && m_mode == Mode::HBlank));
+
+    // Sources are or'ed into a single line, the interrupt is requested on its rising edge
+    if(isStatLineHigh && !m_isStatLineHigh)
+    {
+        m_mem.RequestInterrupt(Memory::Interrupt::LCDStat);
+    }
+
+    m_isStatLineHigh = isStatLineHigh;
+}
+
+void PPU::RenderScanline()
+{
+    std::array<uint8_t, m_SCREEN_WIDTH> colors;
+    std::array<uint8_t, m_SCREEN_WIDTH> shades;
+
+    RenderBackground(colors.data());
+    m_kernels.ApplyPalette(colors.data(), colors.size(), m_bgp, shades.data());
+    RenderSprites(colors.data(), shades.data());
+
+    m_kernels.ConvertShades(shades.data(), shades.size(), s_SHADE_COLORS, &m_framebuffer[m_ly * m_SCREEN_WIDTH]);
+}
+
+void PPU::SkipScanline()
+{
+    // Same condition as the window drawn by RenderBackground
+    if((m_lcdc & 0x01) && (m_lcdc & 0x20) && m_ly >= m_wy && m_wx < m_SCREEN_WIDTH + 7)
+    {
+        ++m_windowLine;
+    }
+}
+
+void PPU::RenderBackground(uint8_t* colors)
+{
+    // Without the background, the window is hidden as well
+    if(!(m_lcdc & 0x01))
+    {
+        std::fill_n(colors, m_SCREEN_WIDTH, 0);
+        return;
+    }
+
+    std::array<uint8_t, s_NB_LINE_TILES * 8> tileColors;
+
+    const unsigned int y = (m_scy + m_ly) & 0xFF;
+    const uint16_t backgroundMapAddr = (m_lcdc & 0x08) ? 0x1C00 : 0x1800;
+    DecodeTileMapRow(static_cast<uint16_t>(backgroundMapAddr + (y / 8) * 32), m_scx / 8, y % 8, tileColors.data());
+    std::copy_n(tileColors.begin() + m_scx % 8, m_SCREEN_WIDTH, colors);
+
+    if(!(m_lcdc & 0x20) || m_ly < m_wy || m_wx >= m_SCREEN_WIDTH + 7)
+    {
+        return;
+    }
+
+    const uint16_t windowMapAddr = (m_lcdc & 0x40) ? 0x1C00 : 0x1800;
+    DecodeTileMapRow(static_cast<uint16_t>(windowMapAddr + (m_windowLine / 8) * 32), 0, m_windowLine % 8, tileColors.data());
+
+    // The window starts at WX - 7 and may be cut by the left edge
+    const int windowX = m_wx - 7;
+    const unsigned int firstX = static_cast<unsigned int>(std::max(windowX, 0));
+    std::copy_n(tileColors.begin() + (firstX - windowX), m_SCREEN_WIDTH - firstX, colors + firstX);
+
+    ++m_windowLine;
+}
+
+void PPU::DecodeTileMapRow(uint16_t tileMapAddr, unsigned int firstEntry, unsigned int fineY, uint8_t* colors)
+{
+    const std::array<uint8_t, 0x2000>& vram = m_mem.GetState().vram;
+
+    std::array<uint8_t, s_NB_LINE_TILES> lowPlanes;
+    std::array<uint8_t, s_NB_LINE_TILES> highPlanes;
+    for(unsigned int i = 0; i < s_NB_LINE_TILES; ++i)
+    {
+        const uint8_t tile = vram[tileMapAddr + ((firstEntry + i) & 31)];
+
+        // Tiles 0-255 from 0x8000, or -128-127 from 0x9000
+        const unsigned int tileAddr = (m_lcdc & 0x10) ? tile * 16 : 0x1000 + static_cast<int8_t>(tile) * 16;
+        lowPlanes[i] = vram[tileAddr + fineY * 2];
+        highPlanes[i] = vram[tileAddr + fineY * 2 + 1];
+    }
+
+    m_kernels.DecodeTileRows(lowPlanes.data(), highPlanes.data(), s_NB_LINE_TILES, colors);
+}
+
+void PPU::RenderSprites(const uint8_t* backgroundColors, uint8_t* shades)
+{
+    if(!(m_lcdc & 0x02))
+    {
+        return;
+    }
+
+    const Memory::State& memState = m_mem.GetState();
+    const unsigned int height = (m_lcdc & 0x04) ? 16 : 8;
+
+    // The first sprites covering the line in OAM order
+    std::array<uint8_t, s_MAX_SPRITES_PER_LINE> sprites;
+    unsigned int nbSprites{};
+    for(uint8_t sprite = 0; sprite < s_NB_SPRITES && nbSprites < s_MAX_SPRITES_PER_LINE; ++sprite)
+    {
+        const unsigned int row = m_ly + 16u - memState.oam[sprite * 4];
+        if(row < height)
+        {
+            sprites[nbSprites++] = sprite;
+        }
+    }
+
+    // Sprites further left are in front, then the first ones in OAM
+    std::stable_sort(sprites.begin(), sprites.begin() + nbSprites, [&memState](uint8_t lhs, uint8_t rhs)
+    {
+        return memState.oam[lhs * 4 + 1] < memState.oam[rhs * 4 + 1];
+    });
+
+    std::array<uint8_t, s_MAX_SPRITES_PER_LINE> lowPlanes;
+    std::array<uint8_t, s_MAX_SPRITES_PER_LINE> highPlanes;
+    for(unsigned int i = 0; i < nbSprites; ++i)
+    {
+        const uint8_t* sprite = &memState.oam[sprites[i] * 4];
+        const uint8_t attributes = sprite[3];
+
+        unsigned int row = m_ly + 16u - sprite[0];
+        if(attributes & 0x40)
+        {
+            row = height - 1 - row;
+        }
+
+        // 8x16 sprites use an even tile and the one after it
+        const uint8_t tile = height == 16 ? sprite[2] & 0xFE : sprite[2];
+        const unsigned int rowAddr = tile * 16 + row * 2;
+        lowPlanes[i] = memState.vram[rowAddr];
+        highPlanes[i] = memState.vram[rowAddr + 1];
+
+        if(attributes & 0x20)
+        {
+            lowPlanes[i] = ReverseBits(lowPlanes[i]);
+            highPlanes[i] = ReverseBits(highPlanes[i]);
+        }
+    }
+
+    std::array<uint8_t, s_MAX_SPRITES_PER_LINE * 8> spriteColors;
+    m_kernels.DecodeTileRows(lowPlanes.data(), highPlanes.data(), nbSprites, spriteColors.data());
+
+    // A pixel goes to the sprite in front even when the background hides it
+    std::array<bool, m_SCREEN_WIDTH> isCovered{};
+    for(unsigned int i = 0; i < nbSprites; ++i)
+    {
+        const uint8_t* sprite = &memState.oam[sprites[i] * 4];
+        const uint8_t attributes = sprite[3];
+        const uint8_t palette = (attributes & 0x10) ? m_obp1 : m_obp0;
+        const bool isBehindBackground = attributes & 0x80;
+
+        for(unsigned int pixel = 0; pixel < 8; ++pixel)
+        {
+            const unsigned int x = sprite[1] + pixel - 8u;
+            const uint8_t color = spriteColors[i * 8 + pixel];
+            if(x >= m_SCREEN_WIDTH || color == 0 || isCovered[x])
+            {
+                continue;
+            }
+
+            isCovered[x] = true;
+            if(!isBehindBackground || backgroundColors[x] == 0)
+            {
+                shades[x] = (palette >> (2 * color)) & 0x03;
+            }
+        }
+    }
+}
+
+void PPU::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::PPU, s_STATE_VERSION);
+    writer.Write(m_framebuffer);
+    writer.Write(m_mode);
+    writer.Write(m_lineStartTime);
+    writer.Write(m_isLineCollapsed);
+    writer.Write(m_windowLine);
+    writer.Write(m_isStatLineHigh);
+    for(uint8_t reg : { m_lcdc, m_stat, m_scy, m_scx, m_ly, m_lyc, m_dma, m_bgp, m_obp0, m_obp1, m_wy, m_wx })
+    {
+        writer.Write(reg);
+    }
+    writer.EndChunk();
+}
+
+bool PPU::Load(SaveStateReader& reader)
+{
+    if(!reader.OpenChunk(SaveStateChunk::PPU, s_STATE_VERSION) || !reader.Read(m_framebuffer) || !reader.Read(m_mode) ||
+       !reader.Read(m_lineStartTime) || !reader.Read(m_isLineCollapsed) || !reader.Read(m_windowLine) || !reader.Read(m_isStatLineHigh))
+    {
+        return false;
+    }
+
+    for(uint8_t* reg : { &m_lcdc, &m_stat, &m_scy, &m_scx, &m_ly, &m_lyc, &m_dma, &m_bgp, &m_obp0, &m_obp1, &m_wy, &m_wx })
+    {
+        if(!reader.Read(*reg))
+        {
+            return false;
+        }
+    }
+
+    if(!reader.CloseChunk())
+    {
+        return false;
+    }
+
+    SetLineCollapsed(m_isLineCollapsed);
+
+    // Which frames are drawn is not part of the state, the current one is only drawn when all of them are
+    m_isFrameDrawn = m_frameSkipInterval == 1;
+    if(m_isFrameDrawn)
+    {
+        ExpandLine();
+    }
+
+    return true;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "memory.h"
+#include "pixelkernels.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+
+// LCD controller: LCDC, STAT, scroll, LY, LYC, palettes, window position and OAM DMA.
+//
+// Mode changes are scheduler events, nothing happens in between. A whole
+// scanline is drawn at once when the line enters HBlank, with the register
+// values of that time, into a framebuffer of host pixels.
+class PPU
+{
+public:
+    static constexpr unsigned int m_SCREEN_WIDTH = 160;
+    static constexpr unsigned int m_SCREEN_HEIGHT = 144;
+
+    // 0xAARRGGBB pixels, row by row
+    using Framebuffer = std::array<uint32_t, m_SCREEN_WIDTH * m_SCREEN_HEIGHT>;
+
+    // Called with the completed frame when VBlank starts
+    using FrameHandler = std::function<void(const Framebuffer&)>;
+
+public:
+    PPU(Memory& mem, Scheduler& scheduler);
+    PPU(const PPU&) = delete;
+    PPU& operator=(const PPU&) = delete;
+
+    // State left by the boot ROM, with the LCD on at the start of a frame
+    void Reset();
+
+    // Registers, mode and the frame drawn so far
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+    void SetFrameHandler(FrameHandler handler);
+    const Framebuffer& GetFramebuffer() const { return m_framebuffer; }
+
+    // Only draws the frames ending or starting in the last of every given number of emulated frames, 1
+    // draws them all and 0 none. At the end of such an emulated frame the framebuffer is the same as with
+    // every frame drawn. Skipped frames keep the timing, registers and interrupts the program sees, the
+    // frame handler only gets the drawn frames.
+    void SetFrameSkip(unsigned int interval);
+
+    // Returns false when the host does not support the instruction set
+    bool SetPixelKernels(PixelKernels::InstructionSet set) { return m_kernels.SetInstructionSet(set); }
+
+private:
+    enum class Mode : uint8_t
+    {
+        HBlank,
+        VBlank,
+        OAMScan,
+        Drawing
+    };
+
+    uint8_t ReadRegister(uint16_t addr) const;
+    void WriteRegister(uint16_t addr, uint8_t value);
+
+    // Moves to the next mode, at the time it was due
+    void AdvanceMode(uint64_t time);
+    void EnterMode(Mode mode, uint64_t time);
+
+    // Lines of skipped frames are a single event when no STAT interrupt depends on the modes within the line,
+    // the mode is computed from the time when read. Expanding goes back to one event per mode.
+    bool CanCollapseLine() const { return !m_isFrameDrawn && !(m_stat & 0x28); }
+    void ExpandLine();
+    void SetLineCollapsed(bool isCollapsed);
+    Mode GetMode() const;
+
+    bool IsEnabled() const { return m_lcdc & 0x80; }
+
+    // Whether the frame starting at the given time is drawn, with the frame skip interval
+    bool IsFrameDrawn(uint64_t startTime) const;
+
+    // Requests the STAT interrupt when one of its enabled sources becomes active
+    void UpdateStatInterrupt();
+
+    void RenderScanline();
+
+    // Window line counter of a scanline that is not drawn
+    void SkipScanline();
+    void RenderBackground(uint8_t* colors);
+    void RenderSprites(const uint8_t* backgroundColors, uint8_t* shades);
+
+    // Decodes the row of 8 pixels of each tile map entry, starting at the given entry of the row
+    void DecodeTileMapRow(uint16_t tileMapAddr, unsigned int firstEntry, unsigned int fineY, uint8_t* colors);
+
+private:
+    Memory& m_mem;
+    Scheduler& m_scheduler;
+    PixelKernels m_kernels;
+    FrameHandler m_frameHandler;
+
+    Framebuffer m_framebuffer;
+
+    unsigned int m_frameSkipInterval;
+    bool m_isFrameDrawn;
+
+    Mode m_mode;
+
+    // Start of the current line, and whether it is a single event from OAM scan to the end of HBlank
+    uint64_t m_lineStartTime;
+    bool m_isLineCollapsed;
+
+    // Line of the window drawn next, it only advances on lines where the window is visible
+    unsigned int m_windowLine;
+    bool m_isStatLineHigh;
+
+    uint8_t m_lcdc;
+    uint8_t m_stat;
+    uint8_t m_scy;
+    uint8_t m_scx;
+    uint8_t m_ly;
+    uint8_t m_lyc;
+    uint8_t m_dma;
+    uint8_t m_bgp;
+    uint8_t m_obp0;
+    uint8_t m_obp1;
+    uint8_t m_wy;
+    uint8_t m_wx;
+};
@@ -0,0 +1,415 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+
+namespace
+{
+    // Entries of a report table, hottest first
+    struct Entry
+    {
+        std::string name;
+        Profiler::Counter counter;
+    };
+
+    void WriteTable(std::ostream& stream, const char* title, std::vector<Entry> entries, uint64_t totalCycles,
+                    size_t nbEntries)
+    {
+        entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& entry){ return entry.counter.nbExecutions == 0; }),
+                      entries.end());
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+        {
+            return lhs.counter.cycles > rhs.counter.cycles;
+        });
+
+        stream << "\n" << title << ", " << entries.size() << " executed, by cycles:\n"
+               << "  " << std::left << std::setw(10) << "" << std::right << std::setw(16) << "Executions"
+               << std::setw(16) << "Cycles" << std::setw(9) << "Share" << "\n";
+
+        for(size_t i = 0; i < std::min(nbEntries, entries.size()); ++i)
+        {
+            const Entry& entry = entries[i];
+            stream << "  " << std::left << std::setw(10) << entry.name << std::right << std::setw(16) << entry.counter.nbExecutions
+                   << std::setw(16) << entry.counter.cycles << std::setw(8) << std::fixed << std::setprecision(2)
+                   << (totalCycles != 0 ? 100.0 * entry.counter.cycles / totalCycles : 0.0) << "%\n";
+        }
+    }
+
+    std::string ToHex(unsigned int value, int width)
+    {
+        std::ostringstream stream;
+        stream << std::uppercase << std::hex << std::setfill('0') << std::setw(width) << value;
+        return stream.str();
+    }
+}
+
+Profiler::Profiler(Memory& mem, const Scheduler& scheduler)
+    : m_mem{mem}
+    , m_scheduler{scheduler}
+{
+    m_mem.SetCodeWriteHandler([this](uint16_t firstAddr, uint16_t lastAddr){ FlushPendingCounts(firstAddr, lastAddr); },
+                              Memory::CodeCache::Profiler);
+    Reset();
+}
+
+Profiler::~Profiler()
+{
+    m_mem.ClearCodePages(Memory::CodeCache::Profiler);
+    m_mem.SetCodeWriteHandler(nullptr, Memory::CodeCache::Profiler);
+}
+
+void Profiler::Reset()
+{
+    m_pendingCounters.fill({});
+    m_pendingInstructions.fill({});
+    m_pendingPages.reset();
+    m_mem.ClearCodePages(Memory::CodeCache::Profiler);
+
+    m_opcodes.fill({});
+    m_cbOpcodes.fill({});
+    m_addresses.assign(0x10000, AddressCounter{});
+    m_bankedAddresses.clear();
+    m_haltCycles = 0;
+
+    m_nodes.assign(1, Node{ 0, m_ROOT_FUNCTION, 1, 0, 0 });
+    m_children.clear();
+    m_stack.assign(1, Frame{ 0, 0 });
+    m_lastNodeTime = m_scheduler.GetTime();
+}
+
+void Profiler::AddInstructionCounts(uint16_t pc, uint16_t romBank, uint8_t opcode, uint8_t operand, uint64_t nbExecutions,
+                                    uint64_t cycles)
+{
+    AddressCounter& address = pc < 0x4000 || pc >= 0x8000 ? m_addresses[pc] : GetBankedAddressCounter(pc, romBank);
+    AddInstructionCounts(address, static_cast<uint16_t>(opcode | operand << 8), nbExecutions, cycles);
+}
+
+void Profiler::FlushPendingCounts(uint16_t firstAddr, uint16_t lastAddr)
+{
+    // The instruction of an address includes the byte following it
+    for(unsigned int pc = firstAddr != 0 ? firstAddr - 1u : 0; pc <= lastAddr; ++pc)
+    {
+        Counter& counter = m_pendingCounters[pc];
+        if(counter.nbExecutions != 0)
+        {
+            const PendingInstruction& instruction = m_pendingInstructions[pc];
+            AddInstructionCounts(static_cast<uint16_t>(pc), instruction.romBank, instruction.instruction & 0xFF,
+                                 instruction.instruction >> 8, counter.nbExecutions, counter.cycles);
+            counter = {};
+        }
+    }
+}
+
+void Profiler::StartPendingCount(uint16_t pc, uint8_t opcode, uint8_t operand)
+{
+    const uint16_t romBank = pc >= 0x4000 && pc < 0x8000 ? m_mem.GetROMBank(pc) : 0;
+    m_pendingInstructions[pc] = PendingInstruction{ romBank, static_cast<uint16_t>(opcode | operand << 8) };
+
+    for(const uint8_t page : { static_cast<uint8_t>(pc >> 8), static_cast<uint8_t>((pc + 1) >> 8) })
+    {
+        if(!m_pendingPages[page])
+        {
+            m_pendingPages.set(page);
+            m_mem.MarkCodePage(page, Memory::CodeCache::Profiler);
+        }
+    }
+}
+
+void Profiler::RecordInterrupt(uint16_t vector, unsigned int cycles, uint16_t sp)
+{
+    // Dispatching is part of the handler
+    EnterNode(m_INTERRUPT_FUNCTION | vector, sp, m_scheduler.GetTime() - cycles);
+}
+
+Profiler::BankCounters& Profiler::AddBank(uint16_t romBank)
+{
+    if(romBank >= m_bankedAddresses.size())
+    {
+        m_bankedAddresses.resize(romBank + 1u);
+    }
+
+    m_bankedAddresses[romBank] = std::make_unique<BankCounters>();
+    m_bankedAddresses[romBank]->fill({});
+    return *m_bankedAddresses[romBank];
+}
+
+void Profiler::SetInstruction(AddressCounter& address, uint16_t instruction)
+{
+    AddOpcodeCounts(address, m_opcodes, m_cbOpcodes);
+    address.opcodeCounter = address.counter;
+    address.instruction = instruction;
+}
+
+void Profiler::AddOpcodeCounts(const AddressCounter& address, std::array<Counter, 256>& opcodes,
+                               std::array<Counter, 256>& cbOpcodes)
+{
+    const uint8_t opcode = address.instruction & 0xFF;
+    const Counter counts{ address.counter.nbExecutions - address.opcodeCounter.nbExecutions,
+                          address.counter.cycles - address.opcodeCounter.cycles };
+
+    opcodes[opcode].nbExecutions += counts.nbExecutions;
+    opcodes[opcode].cycles += counts.cycles;
+    if(opcode == 0xCB)
+    {
+        cbOpcodes[address.instruction >> 8].nbExecutions += counts.nbExecutions;
+        cbOpcodes[address.instruction >> 8].cycles += counts.cycles;
+    }
+}
+
+void Profiler::EnterNode(uint32_t function, uint16_t sp, uint64_t time)
+{
+    if(m_stack.size() >= m_MAX_DEPTH)
+    {
+        return;
+    }
+
+    const uint32_t parent = m_stack.back().node;
+    uint32_t node = m_nodes[parent].lastChild;
+    if(node == 0 || m_nodes[node].function != function)
+    {
+        const uint64_t key = (static_cast<uint64_t>(parent) << 32) | function;
+        const auto child = m_children.find(key);
+        if(child != m_children.end())
+        {
+            node = child->second;
+        }
+        else if(m_nodes.size() < m_MAX_NODES)
+        {
+            node = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.push_back(Node{ parent, function, 0, 0, 0 });
+            m_children.emplace(key, node);
+        }
+        else
+        {
+            return;
+        }
+
+        m_nodes[parent].lastChild = node;
+    }
+
+    UpdateSelfCycles(time);
+
+    m_nodes[node].nbCalls++;
+    m_stack.push_back(Frame{ node, sp });
+}
+
+void Profiler::ReturnTo(uint16_t sp)
+{
+    // Frames whose return address is at or below the one just popped are over, the root frame never ends
+    if(m_stack.size() > 1 && m_stack.back().sp < sp)
+    {
+        UpdateSelfCycles(m_scheduler.GetTime());
+    }
+
+    while(m_stack.size() > 1 && m_stack.back().sp < sp)
+    {
+        m_stack.pop_back();
+    }
+}
+
+uint64_t Profiler::GetSelfCycles(uint32_t node) const
+{
+    const uint64_t time = m_scheduler.GetTime();
+    const bool isRunning = node == m_stack.back().node && time > m_lastNodeTime;
+    return m_nodes[node].selfCycles + (isRunning ? time - m_lastNodeTime : 0);
+}
+
+void Profiler::UpdateSelfCycles(uint64_t time)
+{
+    // Loading a state can take the time back
+    if(time > m_lastNodeTime)
+    {
+        m_nodes[m_stack.back().node].selfCycles += time - m_lastNodeTime;
+    }
+    m_lastNodeTime = time;
+}
+
+uint32_t Profiler::MakeFunction(uint16_t pc) const
+{
+    const uint16_t romBank = pc >= 0x4000 && pc < 0x8000 ? m_mem.GetROMBank(pc) : 0;
+    return (static_cast<uint32_t>(romBank) << 16) | pc;
+}
+
+std::string Profiler::GetFunctionName(uint32_t function)
+{
+    if(function == m_ROOT_FUNCTION)
+    {
+        return "reset";
+    }
+
+    if(function & m_INTERRUPT_FUNCTION)
+    {
+        static constexpr const char* s_INTERRUPT_NAMES[] = { "VBlank", "LCDStat", "Timer", "Serial", "Joypad" };
+        const unsigned int interrupt = ((function & 0xFFFF) - 0x40) / 8;
+        return std::string{"int:"} + (interrupt < 5 ? s_INTERRUPT_NAMES[interrupt] : "?");
+    }
+
+    return GetAddressName(function & 0xFFFF, static_cast<uint16_t>(function >> 16));
+}
+
+std::string Profiler::GetAddressName(uint16_t pc, uint16_t romBank)
+{
+    // ROM addresses with their bank, anything else as is
+    return pc < 0x8000 ? ToHex(romBank, 2) + ":" + ToHex(pc, 4) : ToHex(pc, 4);
+}
+
+void Profiler::WriteReport(std::ostream& stream, size_t nbEntries) const
+{
+    const auto sum = [](const auto& counters, uint64_t Counter::*field)
+    {
+        return std::accumulate(counters.begin(), counters.end(), uint64_t{}, [field](uint64_t total, const Counter& counter)
+        {
+            return total + counter.*field;
+        });
+    };
+
+    // Opcode counters of the instructions still found where they ran
+    std::array<Counter, 256> opcodes = m_opcodes;
+    std::array<Counter, 256> cbOpcodes = m_cbOpcodes;
+    for(const AddressCounter& address : m_addresses)
+    {
+        AddOpcodeCounts(address, opcodes, cbOpcodes);
+    }
+    for(const std::unique_ptr<BankCounters>& bankCounters : m_bankedAddresses)
+    {
+        if(bankCounters != nullptr)
+        {
+            for(const AddressCounter& address : *bankCounters)
+            {
+                AddOpcodeCounts(address, opcodes, cbOpcodes);
+            }
+        }
+    }
+
+    const uint64_t nbInstructions = sum(opcodes, &Counter::nbExecutions);
+    const uint64_t cycles = sum(opcodes, &Counter::cycles);
+    const std::ios::fmtflags flags = stream.flags();
+
+    stream << "Instructions:     " << nbInstructions << "\n"
+           << "Cycles:           " << cycles << " executing, " << m_haltCycles << " halted\n";
+
+    std::vector<Entry> entries;
+    for(unsigned int opcode = 0; opcode < opcodes.size(); ++opcode)
+    {
+        entries.push_back({ ToHex(opcode, 2), opcodes[opcode] });
+    }
+    WriteTable(stream, "Opcodes", entries, cycles, nbEntries);
+
+    entries.clear();
+    for(unsigned int opcode = 0; opcode < cbOpcodes.size(); ++opcode)
+    {
+        entries.push_back({ "CB " + ToHex(opcode, 2), cbOpcodes[opcode] });
+    }
+    WriteTable(stream, "CB opcodes", entries, cycles, nbEntries);
+
+    // Banks are computed from the addresses, RAM holds the code running outside of ROM
+    entries.clear();
+    std::vector<Entry> banks;
+    banks.push_back({ "00", {} });
+    banks.push_back({ "RAM", {} });
+    for(unsigned int pc = 0; pc < m_addresses.size(); ++pc)
+    {
+        const Counter& counter = m_addresses[pc].counter;
+        if(counter.nbExecutions == 0)
+        {
+            continue;
+        }
+
+        entries.push_back({ GetAddressName(static_cast<uint16_t>(pc), 0), counter });
+        Counter& bank = banks[pc < 0x4000 ? 0 : 1].counter;
+        bank.nbExecutions += counter.nbExecutions;
+        bank.cycles += counter.cycles;
+    }
+    for(size_t romBank = 0; romBank < m_bankedAddresses.size(); ++romBank)
+    {
+        if(m_bankedAddresses[romBank] == nullptr)
+        {
+            continue;
+        }
+
+        Counter& bank = banks.emplace_back(Entry{ ToHex(static_cast<unsigned int>(romBank), 2), {} }).counter;
+        const BankCounters& bankCounters = *m_bankedAddresses[romBank];
+        for(unsigned int offset = 0; offset < bankCounters.size(); ++offset)
+        {
+            const Counter& counter = bankCounters[offset].counter;
+            if(counter.nbExecutions != 0)
+            {
+                entries.push_back({ GetAddressName(static_cast<uint16_t>(0x4000 + offset), static_cast<uint16_t>(romBank)), counter });
+                bank.nbExecutions += counter.nbExecutions;
+                bank.cycles += counter.cycles;
+            }
+        }
+    }
+    WriteTable(stream, "Addresses", entries, cycles, nbEntries);
+    WriteTable(stream, "Banks", banks, cycles, nbEntries);
+
+    // Cycles of each call tree node with its callees. Nodes come after their parent.
+    std::vector<uint64_t> totalCycles(m_nodes.size());
+    for(size_t node = m_nodes.size(); node-- > 0;)
+    {
+        totalCycles[node] += GetSelfCycles(static_cast<uint32_t>(node));
+        if(node != 0)
+        {
+            totalCycles[m_nodes[node].parent] += totalCycles[node];
+        }
+    }
+
+    // Recursive calls only count once in the total of a function
+    std::unordered_map<uint32_t, Counter> functions;
+    std::unordered_map<uint32_t, uint64_t> selfCycles;
+    for(size_t node = 0; node < m_nodes.size(); ++node)
+    {
+        const uint32_t function = m_nodes[node].function;
+        Counter& counter = functions[function];
+        counter.nbExecutions += m_nodes[node].nbCalls;
+        selfCycles[function] += GetSelfCycles(static_cast<uint32_t>(node));
+
+        bool isRecursive = false;
+        for(size_t ancestor = node; ancestor != 0 && !isRecursive;)
+        {
+            ancestor = m_nodes[ancestor].parent;
+            isRecursive = m_nodes[ancestor].function == function;
+        }
+        if(!isRecursive)
+        {
+            counter.cycles += totalCycles[node];
+        }
+    }
+
+    std::vector<std::pair<uint32_t, Counter>> sortedFunctions{functions.begin(), functions.end()};
+    std::sort(sortedFunctions.begin(), sortedFunctions.end(), [](const auto& lhs, const auto& rhs)
+    {
+        return lhs.second.cycles != rhs.second.cycles ? lhs.second.cycles > rhs.second.cycles : lhs.first < rhs.first;
+    });
+
+    stream << "\nFunctions, " << sortedFunctions.size() << " called, by elapsed cycles with their callees:\n"
+           << "  " << std::left << std::setw(14) << "" << std::right << std::setw(12) << "Calls" << std::setw(16) << "Self cycles"
+           << std::setw(16) << "Total cycles" << std::setw(9) << "Share" << "\n";
+    for(size_t i = 0; i < std::min(nbEntries, sortedFunctions.size()); ++i)
+    {
+        const auto& [function, counter] = sortedFunctions[i];
+        stream << "  " << std::left << std::setw(14) << GetFunctionName(function) << std::right << std::setw(12) << counter.nbExecutions
+               << std::setw(16) << selfCycles[function] << std::setw(16) << counter.cycles << std::setw(8) << std::fixed
+               << std::setprecision(2) << (totalCycles[0] != 0 ? 100.0 * counter.cycles / totalCycles[0] : 0.0) << "%\n";
+    }
+
+    stream.flags(flags);
+}
+
+void Profiler::WriteCollapsedStacks(std::ostream& stream) const
+{
+    std::vector<std::string> paths(m_nodes.size());
+    for(size_t node = 0; node < m_nodes.size(); ++node)
+    {
+        const std::string name = GetFunctionName(m_nodes[node].function);
+        paths[node] = node == 0 ? name : paths[m_nodes[node].parent] + ";" + name;
+
+        const uint64_t selfCycles = GetSelfCycles(static_cast<uint32_t>(node));
+        if(selfCycles != 0)
+        {
+            stream << paths[node] << " " << selfCycles << "\n";
+        }
+    }
+}
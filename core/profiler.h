@@ -0,0 +1,220 @@
+#pragma once
+
+#include "memory.h"
+#include "opcodes.h"
+#include "scheduler.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Hot spots of the guest code: executions and clock cycles per opcode, per
+// address and per ROM bank, and a call graph.
+//
+// The CPU feeds it the instructions it executes when built with GB_PROFILER,
+// and the hooks are compiled out otherwise. The interpreter records each
+// instruction, the block cache counts the runs of its blocks and adds them in
+// bulk. Native code is not instrumented, the JIT execution mode runs the block
+// cache while profiling.
+//
+// Instructions recorded by the interpreter are only counted by address, the
+// ROM bank and the instruction are taken when an address starts being counted.
+// The pages holding them are code pages of the profiler: writing to them or
+// mapping other memory there adds the pending counts to those of their
+// instruction first.
+//
+// The call graph follows CALL, RST and interrupt entries, and the returns that
+// pop their return address. Frames are matched by stack pointer, so that code
+// dropping its return address and jumping away only loses its frames at the
+// next return of a caller. Functions are charged the time elapsed between
+// these entries and returns, waiting in HALT included.
+class Profiler
+{
+public:
+    struct Counter
+    {
+        uint64_t nbExecutions;
+        uint64_t cycles;
+    };
+
+public:
+    Profiler(Memory& mem, const Scheduler& scheduler);
+    ~Profiler();
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    void Reset();
+
+    // Called after each instruction with its address, opcode and the byte following it, or once for many runs of it
+    void RecordInstruction(uint16_t pc, uint8_t opcode, uint8_t operand, uint64_t cycles, uint64_t nbExecutions = 1)
+    {
+        Counter& counter = m_pendingCounters[pc];
+        if(counter.nbExecutions == 0)
+        {
+            StartPendingCount(pc, opcode, operand);
+        }
+        counter.nbExecutions += nbExecutions;
+        counter.cycles += cycles;
+    }
+
+    // Adds the counts recorded by address to those of their instruction, before reading the profile or when the
+    // memory they were counted from may have changed without writes
+    void FlushPendingCounts(uint16_t firstAddr = 0x0000, uint16_t lastAddr = 0xFFFF);
+
+    // Same for many runs of an instruction at once, from the given ROM bank
+    void AddInstructionCounts(uint16_t pc, uint16_t romBank, uint8_t opcode, uint8_t operand, uint64_t nbExecutions,
+                              uint64_t cycles);
+
+    // Called after the instructions that can call or return, with the PC following them and the one they left.
+    // Those that went elsewhere were taken.
+    void RecordBranch(uint8_t opcode, uint16_t fallThroughPC, uint16_t nextPC, uint16_t sp)
+    {
+        const Flow flow = Opcodes::Get(opcode).flow;
+        if((flow != Flow::Call && flow != Flow::Return) || nextPC == fallThroughPC)
+        {
+            return;
+        }
+
+        if(flow == Flow::Call)
+        {
+            EnterNode(MakeFunction(nextPC), sp, m_scheduler.GetTime());
+        }
+        else
+        {
+            ReturnTo(sp);
+        }
+    }
+
+    // Entry into an interrupt handler, after its return address is pushed
+    void RecordInterrupt(uint16_t vector, unsigned int cycles, uint16_t sp);
+
+    // Cycles spent waiting for an interrupt
+    void RecordHalt(uint64_t cycles) { m_haltCycles += cycles; }
+
+    // Totals, then the hottest opcodes, addresses, banks and functions
+    void WriteReport(std::ostream& stream, size_t nbEntries = 40) const;
+
+    // One line per call path with its own cycles, "frame;frame;frame cycles", the input of flame graph tools
+    void WriteCollapsedStacks(std::ostream& stream) const;
+
+private:
+    // Functions are identified by their entry address and ROM bank, interrupt handlers by their vector
+    struct Node
+    {
+        uint32_t parent;
+        uint32_t function;
+        uint64_t nbCalls;
+        uint64_t selfCycles;
+
+        // Callee of the last call, most calls go to the same one as the previous time
+        uint32_t lastChild;
+    };
+
+    struct Frame
+    {
+        uint32_t node;
+
+        // Stack pointer with the return address pushed, the frame ends when a return pops it
+        uint16_t sp;
+    };
+
+    static constexpr uint32_t m_INTERRUPT_FUNCTION = 0x80000000;
+    static constexpr uint32_t m_ROOT_FUNCTION = 0xFFFFFFFF;
+
+    // Bounds of the call graph, deeper calls and new paths past the node limit stay in their caller
+    static constexpr size_t m_MAX_DEPTH = 1024;
+    static constexpr size_t m_MAX_NODES = 1 << 20;
+
+    // Counters of an address and the instruction found there last, opcode and following byte.
+    // The counts up to the last change of instruction were added to the opcode counters already.
+    struct AddressCounter
+    {
+        Counter counter;
+        Counter opcodeCounter;
+        uint16_t instruction;
+    };
+
+    using BankCounters = std::array<AddressCounter, 0x4000>;
+
+    // Only the switchable ROM bank area holds different code at the same address, the fixed one counts as bank 0
+    AddressCounter& GetBankedAddressCounter(uint16_t pc, uint16_t romBank)
+    {
+        if(romBank < m_bankedAddresses.size() && m_bankedAddresses[romBank] != nullptr)
+        {
+            return (*m_bankedAddresses[romBank])[pc - 0x4000];
+        }
+
+        return AddBank(romBank)[pc - 0x4000];
+    }
+
+    void AddInstructionCounts(AddressCounter& address, uint16_t instruction, uint64_t nbExecutions, uint64_t cycles)
+    {
+        // Opcode counters are summed up from the addresses, unless the address held another instruction before
+        if(address.instruction != instruction)
+        {
+            SetInstruction(address, instruction);
+        }
+        address.counter.nbExecutions += nbExecutions;
+        address.counter.cycles += cycles;
+    }
+
+    // Bank and instruction an address is counted for, while it has pending counts
+    struct PendingInstruction
+    {
+        uint16_t romBank;
+        uint16_t instruction;
+    };
+
+    void StartPendingCount(uint16_t pc, uint8_t opcode, uint8_t operand);
+
+    BankCounters& AddBank(uint16_t romBank);
+    void SetInstruction(AddressCounter& address, uint16_t instruction);
+
+    // Adds the counts of the instruction at an address since it was set to the opcode counters
+    static void AddOpcodeCounts(const AddressCounter& address, std::array<Counter, 256>& opcodes,
+                                std::array<Counter, 256>& cbOpcodes);
+
+    void EnterNode(uint32_t function, uint16_t sp, uint64_t time);
+    void ReturnTo(uint16_t sp);
+    uint64_t GetSelfCycles(uint32_t node) const;
+
+    // Charges the time elapsed since the last entry or return to the running function
+    void UpdateSelfCycles(uint64_t time);
+
+    // Entry address and the ROM bank mapped there
+    uint32_t MakeFunction(uint16_t pc) const;
+    static std::string GetFunctionName(uint32_t function);
+    static std::string GetAddressName(uint16_t pc, uint16_t romBank);
+
+private:
+    Memory& m_mem;
+    const Scheduler& m_scheduler;
+
+    // Counts of the interpreter by address, and the pages holding them
+    std::array<Counter, 0x10000> m_pendingCounters;
+    std::array<PendingInstruction, 0x10000> m_pendingInstructions;
+    Memory::PageSet m_pendingPages;
+
+    // Instructions no longer found at the address they ran from, the others are only counted by address
+    std::array<Counter, 256> m_opcodes;
+    std::array<Counter, 256> m_cbOpcodes;
+
+    // By address, and by bank for the switchable ROM bank area
+    std::vector<AddressCounter> m_addresses;
+    std::vector<std::unique_ptr<BankCounters>> m_bankedAddresses;
+
+    uint64_t m_haltCycles;
+
+    // Call tree, node 0 is the code running since reset
+    std::vector<Node> m_nodes;
+    std::unordered_map<uint64_t, uint32_t> m_children;
+    std::vector<Frame> m_stack;
+
+    // Time the running function was last charged at
+    uint64_t m_lastNodeTime;
+};
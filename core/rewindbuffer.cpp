@@ -0,0 +1,209 @@
+#include "rewindbuffer.h"
+
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+    constexpr size_t s_WORD_SIZE = sizeof(uint64_t);
+
+    // Up to 10 bytes for a 64-bit count
+    constexpr size_t s_MAX_COUNT_SIZE = 10;
+
+    uint64_t LoadWord(const uint8_t* data, size_t wordIdx)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + wordIdx * s_WORD_SIZE, s_WORD_SIZE);
+        return word;
+    }
+
+    void StoreWord(uint8_t* data, size_t wordIdx, uint64_t word)
+    {
+        std::memcpy(data + wordIdx * s_WORD_SIZE, &word, s_WORD_SIZE);
+    }
+
+    // 7 bits per byte, the highest bit tells whether more bytes follow
+    uint8_t* WriteCount(uint8_t* out, size_t count)
+    {
+        while(count >= 0x80)
+        {
+            *out++ = static_cast<uint8_t>(count | 0x80);
+            count >>= 7;
+        }
+
+        *out++ = static_cast<uint8_t>(count);
+        return out;
+    }
+
+    const uint8_t* ReadCount(const uint8_t* in, size_t& count)
+    {
+        count = 0;
+        for(unsigned int shift = 0; ; shift += 7)
+        {
+            const uint8_t byte = *in++;
+            count |= static_cast<size_t>(byte & 0x7F) << shift;
+            if(!(byte & 0x80))
+            {
+                return in;
+            }
+        }
+    }
+}
+
+RewindBuffer::RewindBuffer(Emulator& emu, unsigned int interval, size_t memoryCap)
+    : m_emu{emu}
+    , m_interval{interval != 0 ? interval : 1}
+    , m_memoryCap{memoryCap}
+    , m_stateSize{}
+    , m_latestFrame{}
+    , m_deltasSize{}
+    , m_snapshotTime{}
+{
+}
+
+void RewindBuffer::RunFrames(uint64_t nbFrames)
+{
+    for(uint64_t frameIdx = 0; frameIdx < nbFrames; ++frameIdx)
+    {
+        const uint64_t frame = m_emu.GetFrameCount();
+        if(frame % m_interval == 0 && (IsEmpty() || frame != m_latestFrame))
+        {
+            TakeSnapshot(frame);
+        }
+
+        m_emu.RunFrames(1);
+    }
+}
+
+bool RewindBuffer::RewindTo(uint64_t frame)
+{
+    if(IsEmpty() || frame < GetOldestFrame() || frame > m_emu.GetFrameCount())
+    {
+        return false;
+    }
+
+    // Back from the newest snapshot to the nearest one
+    const size_t nbWords = m_latest.size() / s_WORD_SIZE;
+    while(m_latestFrame > frame)
+    {
+        const Delta& delta = m_deltas.back();
+        ApplyDelta(delta.data, m_latest.data(), nbWords);
+        m_latestFrame = delta.frame;
+        m_deltasSize -= delta.data.size();
+        m_deltas.pop_back();
+    }
+
+    if(!m_emu.LoadState(m_latest.data(), m_stateSize))
+    {
+        std::cerr << "Unable to restore a rewind snapshot\n";
+        Clear();
+        return false;
+    }
+
+    m_emu.RunFrames(frame - m_latestFrame);
+    return true;
+}
+
+void RewindBuffer::Clear()
+{
+    m_latest.clear();
+    m_stateSize = 0;
+    m_latestFrame = 0;
+    m_deltas.clear();
+    m_deltasSize = 0;
+}
+
+void RewindBuffer::TakeSnapshot(uint64_t frame)
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    m_emu.SaveState(m_state);
+    const size_t stateSize = m_state.size();
+    m_state.resize((stateSize + s_WORD_SIZE - 1) / s_WORD_SIZE * s_WORD_SIZE);
+
+    // States of the same cartridge all have the same size, anything else starts a new history
+    if(stateSize != m_stateSize)
+    {
+        Clear();
+    }
+
+    if(!IsEmpty())
+    {
+        const size_t nbWords = m_latest.size() / s_WORD_SIZE;
+        // Every word different, in runs as short as they can be
+        const size_t maxEncodedSize = m_latest.size() + 2 * s_MAX_COUNT_SIZE * (nbWords + 1);
+        if(m_encoded.size() < maxEncodedSize)
+        {
+            m_encoded.resize(maxEncodedSize);
+        }
+
+        const size_t encodedSize = EncodeDelta(m_latest.data(), m_state.data(), nbWords, m_encoded.data());
+        m_deltas.push_back({ m_latestFrame, std::vector<uint8_t>(m_encoded.begin(), m_encoded.begin() + encodedSize) });
+        m_deltasSize += encodedSize;
+    }
+
+    m_latest.swap(m_state);
+    m_stateSize = stateSize;
+    m_latestFrame = frame;
+
+    while(GetMemoryUsage() > m_memoryCap && !m_deltas.empty())
+    {
+        m_deltasSize -= m_deltas.front().data.size();
+        m_deltas.pop_front();
+    }
+
+    m_snapshotTime += Clock::now() - start;
+}
+
+size_t RewindBuffer::EncodeDelta(const uint8_t* older, const uint8_t* newer, size_t nbWords, uint8_t* encoded)
+{
+    uint8_t* out = encoded;
+
+    size_t wordIdx = 0;
+    while(wordIdx < nbWords)
+    {
+        const size_t sameStart = wordIdx;
+        while(wordIdx < nbWords && LoadWord(older, wordIdx) == LoadWord(newer, wordIdx))
+        {
+            ++wordIdx;
+        }
+
+        const size_t diffStart = wordIdx;
+        while(wordIdx < nbWords && LoadWord(older, wordIdx) != LoadWord(newer, wordIdx))
+        {
+            ++wordIdx;
+        }
+
+        out = WriteCount(out, diffStart - sameStart);
+        out = WriteCount(out, wordIdx - diffStart);
+        for(size_t diffIdx = diffStart; diffIdx < wordIdx; ++diffIdx)
+        {
+            StoreWord(out, 0, LoadWord(older, diffIdx) ^ LoadWord(newer, diffIdx));
+            out += s_WORD_SIZE;
+        }
+    }
+
+    return static_cast<size_t>(out - encoded);
+}
+
+void RewindBuffer::ApplyDelta(const std::vector<uint8_t>& encoded, uint8_t* state, size_t nbWords)
+{
+    const uint8_t* in = encoded.data();
+
+    size_t wordIdx = 0;
+    while(wordIdx < nbWords)
+    {
+        size_t nbSame;
+        size_t nbDiff;
+        in = ReadCount(in, nbSame);
+        in = ReadCount(in, nbDiff);
+
+        wordIdx += nbSame;
+        for(size_t diffIdx = 0; diffIdx < nbDiff; ++diffIdx, ++wordIdx)
+        {
+            StoreWord(state, wordIdx, LoadWord(state, wordIdx) ^ LoadWord(in, diffIdx));
+        }
+        in += nbDiff * s_WORD_SIZE;
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "emulator.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// History of recent emulator states, to go back to any frame it covers.
+//
+// A snapshot is taken every few frames. Only the newest one is kept whole, each
+// older one is the XOR of its state with the next snapshot, compressed as runs
+// of identical and differing 64-bit words. Going back applies these deltas from
+// the newest snapshot down to the nearest one, then emulates forward to the
+// exact frame. The oldest snapshots are dropped to stay under a memory cap.
+class RewindBuffer
+{
+public:
+    // One snapshot per second of emulated time, and about an hour of history for most games
+    static constexpr unsigned int m_DEFAULT_INTERVAL = 60;
+    static constexpr size_t m_DEFAULT_MEMORY_CAP = 64 << 20;
+
+public:
+    explicit RewindBuffer(Emulator& emu, unsigned int interval = m_DEFAULT_INTERVAL, size_t memoryCap = m_DEFAULT_MEMORY_CAP);
+    RewindBuffer(const RewindBuffer&) = delete;
+    RewindBuffer& operator=(const RewindBuffer&) = delete;
+
+    // Runs whole frames, taking a snapshot at the start of every interval
+    void RunFrames(uint64_t nbFrames);
+
+    // Goes back to the start of a frame between the oldest snapshot and now, the history after it is dropped.
+    // Returns false when the frame is not covered.
+    bool RewindTo(uint64_t frame);
+
+    // Forgets the history, after the emulator was reset or given another cartridge
+    void Clear();
+
+    bool IsEmpty() const { return m_latest.empty(); }
+    uint64_t GetOldestFrame() const { return m_deltas.empty() ? m_latestFrame : m_deltas.front().frame; }
+    size_t GetNbSnapshots() const { return IsEmpty() ? 0 : m_deltas.size() + 1; }
+    size_t GetMemoryUsage() const { return m_latest.size() + m_deltasSize + m_deltas.size() * sizeof(Delta); }
+
+    // Time spent taking snapshots, to measure what the history costs
+    std::chrono::nanoseconds GetSnapshotTime() const { return m_snapshotTime; }
+
+private:
+    // State of a snapshot, XORed with the next snapshot and compressed
+    struct Delta
+    {
+        uint64_t frame;
+        std::vector<uint8_t> data;
+    };
+
+    void TakeSnapshot(uint64_t frame);
+
+    // Runs of words: the number of identical words, the number of differing words, then their XOR
+    static size_t EncodeDelta(const uint8_t* older, const uint8_t* newer, size_t nbWords, uint8_t* encoded);
+    static void ApplyDelta(const std::vector<uint8_t>& encoded, uint8_t* state, size_t nbWords);
+
+private:
+    Emulator& m_emu;
+    unsigned int m_interval;
+    size_t m_memoryCap;
+
+    // Newest snapshot, zero-padded to whole words
+    std::vector<uint8_t> m_latest;
+    size_t m_stateSize;
+    uint64_t m_latestFrame;
+
+    // Oldest first
+    std::deque<Delta> m_deltas;
+    size_t m_deltasSize;
+
+    // Reused from one snapshot to the next
+    std::vector<uint8_t> m_state;
+    std::vector<uint8_t> m_encoded;
+
+    std::chrono::nanoseconds m_snapshotTime;
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// Queue between one producer thread and one consumer thread, without locks.
+//
+// The producer never waits: values that do not fit are dropped, so a producer
+// nobody consumes from only pays for a full check.
+template<typename T, size_t Capacity>
+class RingBuffer
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+    RingBuffer() = default;
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // Producer side, returns the number of values queued
+    size_t Push(const T* values, size_t nbValues)
+    {
+        const size_t writePos = m_writePos.load(std::memory_order_relaxed);
+        const size_t nbFree = Capacity - (writePos - m_readPos.load(std::memory_order_acquire));
+        nbValues = std::min(nbValues, nbFree);
+
+        for(size_t i = 0; i < nbValues; ++i)
+        {
+            m_values[(writePos + i) & (Capacity - 1)] = values[i];
+        }
+
+        m_writePos.store(writePos + nbValues, std::memory_order_release);
+        return nbValues;
+    }
+
+    // Consumer side, returns the number of values dequeued
+    size_t Pop(T* values, size_t maxValues)
+    {
+        const size_t readPos = m_readPos.load(std::memory_order_relaxed);
+        const size_t nbValues = std::min(maxValues, m_writePos.load(std::memory_order_acquire) - readPos);
+
+        for(size_t i = 0; i < nbValues; ++i)
+        {
+            values[i] = m_values[(readPos + i) & (Capacity - 1)];
+        }
+
+        m_readPos.store(readPos + nbValues, std::memory_order_release);
+        return nbValues;
+    }
+
+    // Consumer side, drops everything queued
+    void Clear()
+    {
+        m_readPos.store(m_writePos.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+private:
+    std::array<T, Capacity> m_values{};
+
+    // Free-running positions, each written by one side only and kept on separate cache lines
+    alignas(64) std::atomic<size_t> m_writePos{0};
+    alignas(64) std::atomic<size_t> m_readPos{0};
+};
@@ -0,0 +1,165 @@
+#include "savestate.h"
+
+#include <iostream>
+#include <string>
+
+namespace
+{
+    constexpr uint32_t s_MAGIC = MakeSaveStateChunkId("GBST");
+    constexpr uint32_t s_FORMAT_VERSION = 1;
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t formatVersion;
+        uint32_t nbChunks;
+    };
+
+    struct ChunkHeader
+    {
+        uint32_t id;
+        uint32_t version;
+        uint32_t size;
+    };
+
+    std::string GetChunkName(uint32_t id)
+    {
+        return { static_cast<char>(id), static_cast<char>(id >> 8), static_cast<char>(id >> 16), static_cast<char>(id >> 24) };
+    }
+}
+
+SaveStateWriter::SaveStateWriter(std::vector<uint8_t>& data)
+    : m_data{data}
+    , m_size{}
+    , m_chunkStart{}
+    , m_nbChunks{}
+{
+    Write(Header{});
+}
+
+void SaveStateWriter::BeginChunk(SaveStateChunk chunk, uint32_t version)
+{
+    m_chunkStart = m_size;
+    Write(ChunkHeader{ static_cast<uint32_t>(chunk), version, 0 });
+}
+
+void SaveStateWriter::EndChunk()
+{
+    const uint32_t size = static_cast<uint32_t>(m_size - m_chunkStart - sizeof(ChunkHeader));
+    std::memcpy(&m_data[m_chunkStart + offsetof(ChunkHeader, size)], &size, sizeof(size));
+    ++m_nbChunks;
+}
+
+void SaveStateWriter::WriteBytes(const void* bytes, size_t size)
+{
+    // Only the first state written to the vector grows it, later ones are plain copies
+    if(m_size + size > m_data.size())
+    {
+        m_data.resize(m_size + size);
+    }
+
+    std::memcpy(&m_data[m_size], bytes, size);
+    m_size += size;
+}
+
+void SaveStateWriter::Finish()
+{
+    const Header header{ s_MAGIC, s_FORMAT_VERSION, m_nbChunks };
+    std::memcpy(m_data.data(), &header, sizeof(header));
+    m_data.resize(m_size);
+}
+
+SaveStateReader::SaveStateReader(const uint8_t* data, size_t size)
+    : m_data{data}
+    , m_isValid{false}
+    , m_pos{}
+    , m_end{}
+{
+    Header header;
+    if(size < sizeof(header))
+    {
+        std::cerr << "Save state too short\n";
+        return;
+    }
+
+    std::memcpy(&header, data, sizeof(header));
+    if(header.magic != s_MAGIC || header.formatVersion != s_FORMAT_VERSION)
+    {
+        std::cerr << "Not a save state, or of an unsupported version\n";
+        return;
+    }
+
+    size_t offset = sizeof(header);
+    for(uint32_t chunkIdx = 0; chunkIdx < header.nbChunks; ++chunkIdx)
+    {
+        ChunkHeader chunkHeader;
+        if(size - offset < sizeof(chunkHeader))
+        {
+            std::cerr << "Save state truncated\n";
+            return;
+        }
+
+        std::memcpy(&chunkHeader, data + offset, sizeof(chunkHeader));
+        offset += sizeof(chunkHeader);
+        if(size - offset < chunkHeader.size)
+        {
+            std::cerr << "Save state truncated\n";
+            return;
+        }
+
+        m_chunks.push_back({ chunkHeader.id, chunkHeader.version, offset, chunkHeader.size });
+        offset += chunkHeader.size;
+    }
+
+    m_isValid = true;
+}
+
+bool SaveStateReader::OpenChunk(SaveStateChunk chunk, uint32_t version)
+{
+    const uint32_t id = static_cast<uint32_t>(chunk);
+    for(const Chunk& candidate : m_chunks)
+    {
+        if(candidate.id != id)
+        {
+            continue;
+        }
+
+        if(candidate.version != version)
+        {
+            std::cerr << "Unsupported version " << candidate.version << " of save state chunk " << GetChunkName(id) << "\n";
+            return false;
+        }
+
+        m_pos = candidate.offset;
+        m_end = candidate.offset + candidate.size;
+        return true;
+    }
+
+    std::cerr << "Missing save state chunk " << GetChunkName(id) << "\n";
+    return false;
+}
+
+bool SaveStateReader::ReadBytes(void* bytes, size_t size)
+{
+    if(m_end - m_pos < size)
+    {
+        std::cerr << "Save state chunk too short\n";
+        m_pos = m_end;
+        return false;
+    }
+
+    std::memcpy(bytes, m_data + m_pos, size);
+    m_pos += size;
+    return true;
+}
+
+bool SaveStateReader::CloseChunk()
+{
+    if(m_pos != m_end)
+    {
+        std::cerr << "Save state chunk of an unexpected size\n";
+        return false;
+    }
+
+    return true;
+}
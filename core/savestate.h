@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Binary layout of save states.
+//
+// A header (magic, format version, number of chunks) is followed by one chunk per
+// component: its identifier, its own version and the size of its data. The data is
+// the raw bytes of the component fields in host order, written and read back with
+// plain copies. Readers skip chunks they do not know, and a component refuses a
+// chunk of another version than its own.
+constexpr uint32_t MakeSaveStateChunkId(const char (&name)[5])
+{
+    return static_cast<uint32_t>(name[0]) | (static_cast<uint32_t>(name[1]) << 8) |
+           (static_cast<uint32_t>(name[2]) << 16) | (static_cast<uint32_t>(name[3]) << 24);
+}
+
+// Identifiers of the chunks, as four characters in the data
+enum class SaveStateChunk : uint32_t
+{
+    Emulator = MakeSaveStateChunkId("EMU "),
+    Scheduler = MakeSaveStateChunkId("SCHD"),
+    CPU = MakeSaveStateChunkId("CPU "),
+    Memory = MakeSaveStateChunkId("MEM "),
+    Timer = MakeSaveStateChunkId("TIMR"),
+    Serial = MakeSaveStateChunkId("SERL"),
+    PPU = MakeSaveStateChunkId("PPU "),
+    APU = MakeSaveStateChunkId("APU "),
+    Joypad = MakeSaveStateChunkId("JOYP")
+};
+
+class SaveStateWriter
+{
+public:
+    // Writes over the data, which keeps its capacity from one state to the next
+    explicit SaveStateWriter(std::vector<uint8_t>& data);
+    SaveStateWriter(const SaveStateWriter&) = delete;
+    SaveStateWriter& operator=(const SaveStateWriter&) = delete;
+
+    void BeginChunk(SaveStateChunk chunk, uint32_t version);
+    void EndChunk();
+
+    template<typename T>
+    void Write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be copied to a save state");
+        WriteBytes(&value, sizeof(T));
+    }
+
+    void WriteBytes(const void* bytes, size_t size);
+
+    // Trims the data to what was written
+    void Finish();
+
+private:
+    std::vector<uint8_t>& m_data;
+    size_t m_size;
+    size_t m_chunkStart;
+    uint32_t m_nbChunks;
+};
+
+class SaveStateReader
+{
+public:
+    // The data must outlive the reader
+    SaveStateReader(const uint8_t* data, size_t size);
+    SaveStateReader(const SaveStateReader&) = delete;
+    SaveStateReader& operator=(const SaveStateReader&) = delete;
+
+    // False when the header or the chunk table is invalid
+    bool IsValid() const { return m_isValid; }
+
+    // Moves to the data of a chunk, returns false after reporting on stderr when it is missing or of another version
+    bool OpenChunk(SaveStateChunk chunk, uint32_t version);
+
+    // Returns false when the chunk is too short
+    template<typename T>
+    bool Read(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be copied from a save state");
+        return ReadBytes(&value, sizeof(T));
+    }
+
+    bool ReadBytes(void* bytes, size_t size);
+
+    // Returns false, after reporting on stderr, when some of the chunk data was not read
+    bool CloseChunk();
+
+private:
+    struct Chunk
+    {
+        uint32_t id;
+        uint32_t version;
+        size_t offset;
+        size_t size;
+    };
+
+    const uint8_t* m_data;
+    bool m_isValid;
+    std::vector<Chunk> m_chunks;
+
+    // Part of the open chunk left to read
+    size_t m_pos;
+    size_t m_end;
+};
@@ -0,0 +1,93 @@
+#include "scheduler.h"
+
+#include <utility>
+
+namespace
+{
+    constexpr uint32_t s_STATE_VERSION = 1;
+}
+
+Scheduler::Scheduler()
+    : m_time{}
+    , m_generations{}
+{
+    m_eventTimes.fill(m_NO_EVENT);
+}
+
+void Scheduler::Reset()
+{
+    m_time = 0;
+    m_events = {};
+    m_generations.fill(0);
+    m_eventTimes.fill(m_NO_EVENT);
+}
+
+void Scheduler::SetEventHandler(EventType type, EventHandler handler)
+{
+    m_handlers[static_cast<size_t>(type)] = std::move(handler);
+}
+
+void Scheduler::Schedule(EventType type, uint64_t time)
+{
+    const uint32_t generation = ++m_generations[static_cast<size_t>(type)];
+    m_eventTimes[static_cast<size_t>(type)] = time;
+    m_events.push({time, generation, type});
+}
+
+void Scheduler::Cancel(EventType type)
+{
+    ++m_generations[static_cast<size_t>(type)];
+    m_eventTimes[static_cast<size_t>(type)] = m_NO_EVENT;
+}
+
+uint64_t Scheduler::GetNextEventTime() const
+{
+    // Outdated events only make the CPU stop early for nothing
+    return m_events.empty() ? m_NO_EVENT : m_events.top().time;
+}
+
+void Scheduler::RunDueEvents()
+{
+    while(!m_events.empty() && m_events.top().time <= m_time)
+    {
+        const Event event = m_events.top();
+        m_events.pop();
+
+        const size_t typeIdx = static_cast<size_t>(event.type);
+        if(event.generation == m_generations[typeIdx])
+        {
+            m_eventTimes[typeIdx] = m_NO_EVENT;
+            m_handlers[typeIdx](event.time);
+        }
+    }
+}
+
+void Scheduler::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::Scheduler, s_STATE_VERSION);
+    writer.Write(m_time);
+    writer.Write(m_eventTimes);
+    writer.EndChunk();
+}
+
+bool Scheduler::Load(SaveStateReader& reader)
+{
+    std::array<uint64_t, static_cast<size_t>(EventType::Count)> eventTimes;
+    if(!reader.OpenChunk(SaveStateChunk::Scheduler, s_STATE_VERSION) || !reader.Read(m_time) || !reader.Read(eventTimes) || !reader.CloseChunk())
+    {
+        return false;
+    }
+
+    // Events are queued again, the outdated ones are gone
+    m_events = {};
+    m_eventTimes.fill(m_NO_EVENT);
+    for(size_t typeIdx = 0; typeIdx < eventTimes.size(); ++typeIdx)
+    {
+        if(eventTimes[typeIdx] != m_NO_EVENT)
+        {
+            Schedule(static_cast<EventType>(typeIdx), eventTimes[typeIdx]);
+        }
+    }
+
+    return true;
+}
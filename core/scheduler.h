@@ -0,0 +1,86 @@
+#pragma once
+
+#include "savestate.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <tuple>
+#include <vector>
+
+// Emulated time, in clock cycles, and the events due at given points of it.
+//
+// Components are not ticked every cycle. They schedule an event for the next
+// time something happens on its own, such as a timer overflow or the end of a
+// serial transfer, and compute their state from the current time when the CPU
+// accesses them. The CPU runs freely until the next event is due.
+class Scheduler
+{
+public:
+    enum class EventType : uint8_t
+    {
+        TimerOverflow,
+        SerialTransfer,
+        PPUMode,
+        FrameSequencer,
+
+        Count
+    };
+
+    // Called with the time the event was scheduled for, which may be slightly in the past
+    using EventHandler = std::function<void(uint64_t)>;
+
+    static constexpr uint64_t m_NO_EVENT = std::numeric_limits<uint64_t>::max();
+
+public:
+    Scheduler();
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Back to time 0 without any event pending
+    void Reset();
+
+    uint64_t GetTime() const { return m_time; }
+    void SetTime(uint64_t time) { m_time = time; }
+    void AdvanceTime(uint64_t cycles) { m_time += cycles; }
+
+    void SetEventHandler(EventType type, EventHandler handler);
+
+    // Each type of event has at most one occurrence pending, scheduling it again replaces it
+    void Schedule(EventType type, uint64_t time);
+    void Cancel(EventType type);
+
+    // Time of the next event, m_NO_EVENT if there is none
+    uint64_t GetNextEventTime() const;
+
+    // Calls the handlers of the events due by now, in time order. Events due at the same time run in the order of
+    // their types, whatever order they were scheduled or loaded in.
+    void RunDueEvents();
+
+    // Time and pending events, the handlers stay as they are
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+private:
+    struct Event
+    {
+        uint64_t time;
+        uint32_t generation;
+        EventType type;
+
+        bool operator>(const Event& other) const { return std::tie(time, type) > std::tie(other.time, other.type); }
+    };
+
+    uint64_t m_time;
+
+    // Events in time order. Replaced and cancelled events stay in the queue with an outdated generation.
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_events;
+    std::array<uint32_t, static_cast<size_t>(EventType::Count)> m_generations;
+
+    // Time of the pending occurrence of each type of event, m_NO_EVENT if there is none
+    std::array<uint64_t, static_cast<size_t>(EventType::Count)> m_eventTimes;
+
+    std::array<EventHandler, static_cast<size_t>(EventType::Count)> m_handlers;
+};
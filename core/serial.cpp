@@ -0,0 +1,97 @@
+#include "serial.h"
+
+#include <utility>
+
+namespace
+{
+    constexpr uint8_t s_SB_PORT = 0x01;
+    constexpr uint8_t s_SC_PORT = 0x02;
+
+    // Transfer start and internal clock bits of SC
+    constexpr uint8_t s_START_BIT = 0x80;
+    constexpr uint8_t s_INTERNAL_CLOCK_BIT = 0x01;
+
+    // 8 bits at 8192 Hz
+    constexpr uint64_t s_TRANSFER_CYCLES = 8 * 512;
+
+    constexpr uint32_t s_STATE_VERSION = 1;
+}
+
+Serial::Serial(Memory& mem, Scheduler& scheduler)
+    : m_mem{mem}
+    , m_scheduler{scheduler}
+{
+    for(uint8_t port : { s_SB_PORT, s_SC_PORT })
+    {
+        m_mem.SetIOHandlers(port, [this](uint16_t addr){ return ReadRegister(addr); },
+                                  [this](uint16_t addr, uint8_t value){ WriteRegister(addr, value); });
+        m_mem.SetIOEventDriven(port, true);
+    }
+
+    m_scheduler.SetEventHandler(Scheduler::EventType::SerialTransfer, [this](uint64_t){ CompleteTransfer(); });
+
+    Reset();
+}
+
+void Serial::Reset()
+{
+    m_data = 0;
+    m_control = 0;
+    m_scheduler.Cancel(Scheduler::EventType::SerialTransfer);
+}
+
+void Serial::SetOutputHandler(OutputHandler handler)
+{
+    m_outputHandler = std::move(handler);
+}
+
+uint8_t Serial::ReadRegister(uint16_t addr) const
+{
+    // Unused bits of SC read as 1
+    return (addr & 0x7F) == s_SB_PORT ? m_data : static_cast<uint8_t>(m_control | 0x7E);
+}
+
+void Serial::WriteRegister(uint16_t addr, uint8_t value)
+{
+    if((addr & 0x7F) == s_SB_PORT)
+    {
+        m_data = value;
+        return;
+    }
+
+    m_control = value & (s_START_BIT | s_INTERNAL_CLOCK_BIT);
+    if(m_control == (s_START_BIT | s_INTERNAL_CLOCK_BIT))
+    {
+        if(m_outputHandler)
+        {
+            m_outputHandler(m_data);
+        }
+
+        m_scheduler.Schedule(Scheduler::EventType::SerialTransfer, m_scheduler.GetTime() + s_TRANSFER_CYCLES);
+    }
+    else
+    {
+        m_scheduler.Cancel(Scheduler::EventType::SerialTransfer);
+    }
+}
+
+void Serial::CompleteTransfer()
+{
+    m_data = 0xFF;
+    m_control &= ~s_START_BIT;
+    m_mem.RequestInterrupt(Memory::Interrupt::Serial);
+}
+
+void Serial::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::Serial, s_STATE_VERSION);
+    writer.Write(m_data);
+    writer.Write(m_control);
+    writer.EndChunk();
+}
+
+bool Serial::Load(SaveStateReader& reader)
+{
+    return reader.OpenChunk(SaveStateChunk::Serial, s_STATE_VERSION) && reader.Read(m_data) && reader.Read(m_control) &&
+           reader.CloseChunk();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "memory.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#include <cstdint>
+#include <functional>
+
+// Serial port (SB and SC registers), without a link partner.
+//
+// Transfers driven by the internal clock complete after 8 bits at 8192 Hz and
+// receive 0xFF. Transfers waiting for an external clock never complete.
+class Serial
+{
+public:
+    // Called with each byte the emulated program sends, when its transfer starts
+    using OutputHandler = std::function<void(uint8_t)>;
+
+public:
+    Serial(Memory& mem, Scheduler& scheduler);
+    Serial(const Serial&) = delete;
+    Serial& operator=(const Serial&) = delete;
+
+    void Reset();
+    void SetOutputHandler(OutputHandler handler);
+
+    // SB and SC, a transfer in progress is part of the scheduler state
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+private:
+    uint8_t ReadRegister(uint16_t addr) const;
+    void WriteRegister(uint16_t addr, uint8_t value);
+    void CompleteTransfer();
+
+private:
+    Memory& m_mem;
+    Scheduler& m_scheduler;
+    OutputHandler m_outputHandler;
+
+    uint8_t m_data;
+    uint8_t m_control;
+};
@@ -0,0 +1,75 @@
+#include "testresultwatcher.h"
+
+#include <algorithm>
+#include <array>
+
+TestResultWatcher::TestResultWatcher(Emulator& emu, std::ostream* serialOutputStream)
+    : m_emu{emu}
+    , m_status{Status::Running}
+    , m_source{}
+    , m_nbCycles{}
+{
+    m_emu.SetSerialOutputHandler([this, serialOutputStream](uint8_t byte)
+    {
+        m_serialOutput += static_cast<char>(byte);
+        if(serialOutputStream != nullptr)
+        {
+            *serialOutputStream << static_cast<char>(byte) << std::flush;
+        }
+    });
+}
+
+bool TestResultWatcher::Update()
+{
+    if(m_status != Status::Running)
+    {
+        return true;
+    }
+
+    if(m_serialOutput.find("Passed") != std::string::npos || m_serialOutput.find("Failed") != std::string::npos)
+    {
+        SetResult(m_serialOutput.find("Failed") == std::string::npos, "through the serial port");
+        return true;
+    }
+
+    // 0x80 while still running
+    const Memory::State& memState = m_emu.GetMemoryState();
+    const std::array<uint8_t, 0x20000>& ram = memState.externalRAM;
+    if(ram[1] == 0xDE && ram[2] == 0xB0 && ram[3] == 0x61 && ram[0] != 0x80)
+    {
+        SetResult(ram[0] == 0, "in cartridge RAM");
+        return true;
+    }
+
+    const auto tileMapBegin = memState.vram.begin() + m_TILE_MAPS_OFFSET;
+    const auto isOnScreen = [tileMapBegin, &memState](const std::string& text)
+    {
+        return std::search(tileMapBegin, memState.vram.end(), text.begin(), text.end()) != memState.vram.end();
+    };
+    if(isOnScreen("Passed") || isOnScreen("Failed"))
+    {
+        SetResult(!isOnScreen("Failed"), "on screen");
+        return true;
+    }
+
+    return false;
+}
+
+void TestResultWatcher::WriteStatus(std::ostream& stream) const
+{
+    if(m_status == Status::Running)
+    {
+        stream << "Test status:      no result\n";
+        return;
+    }
+
+    stream << "Test status:      " << (m_status == Status::Passed ? "passed" : "failed") << ", reported "
+           << m_source << " after " << m_nbCycles << " cycles\n";
+}
+
+void TestResultWatcher::SetResult(bool isPassed, const char* source)
+{
+    m_status = isPassed ? Status::Passed : Status::Failed;
+    m_source = source;
+    m_nbCycles = m_emu.GetCycleCount();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "emulator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Result of Blargg's test ROMs while they run. They print "Passed" or "Failed" through the serial port when done,
+// those with cartridge RAM leave a status code there as well, followed by a signature and a text. The oldest ones
+// only print on screen, their font tiles are numbered by character code. The first result reported counts.
+class TestResultWatcher
+{
+public:
+    enum class Status
+    {
+        Running,
+        Passed,
+        Failed
+    };
+
+public:
+    // Takes over the serial output of the emulator, and copies it to the given stream if any
+    TestResultWatcher(Emulator& emu, std::ostream* serialOutputStream);
+    TestResultWatcher(const TestResultWatcher&) = delete;
+    TestResultWatcher& operator=(const TestResultWatcher&) = delete;
+
+    // Looks for a result, returns whether there is one
+    bool Update();
+
+    Status GetStatus() const { return m_status; }
+
+    // The status, then where and when it was reported
+    void WriteStatus(std::ostream& stream) const;
+
+private:
+    void SetResult(bool isPassed, const char* source);
+
+private:
+    static constexpr size_t m_TILE_MAPS_OFFSET = 0x1800;
+
+    Emulator& m_emu;
+    std::string m_serialOutput;
+    Status m_status;
+    const char* m_source;
+    uint64_t m_nbCycles;
+};
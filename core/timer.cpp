@@ -0,0 +1,170 @@
+#include "timer.h"
+
+#include <array>
+
+namespace
+{
+    constexpr uint8_t s_DIV_PORT = 0x04;
+    constexpr uint8_t s_TIMA_PORT = 0x05;
+    constexpr uint8_t s_TMA_PORT = 0x06;
+    constexpr uint8_t s_TAC_PORT = 0x07;
+
+    // Counter value when the boot ROM hands over to the cartridge
+    constexpr uint64_t s_BOOT_COUNTER = 0xABCC;
+
+    constexpr uint32_t s_STATE_VERSION = 1;
+}
+
+Timer::Timer(Memory& mem, Scheduler& scheduler)
+    : m_mem{mem}
+    , m_scheduler{scheduler}
+{
+    for(uint8_t port : { s_DIV_PORT, s_TIMA_PORT, s_TMA_PORT, s_TAC_PORT })
+    {
+        m_mem.SetIOHandlers(port, [this](uint16_t addr){ return ReadRegister(addr); },
+                                  [this](uint16_t addr, uint8_t value){ WriteRegister(addr, value); });
+    }
+
+    m_scheduler.SetEventHandler(Scheduler::EventType::TimerOverflow, [this](uint64_t time)
+    {
+        Update(time);
+        ScheduleOverflow();
+    });
+
+    Reset();
+}
+
+void Timer::Reset()
+{
+    m_counterOffset = s_BOOT_COUNTER - m_scheduler.GetTime();
+    m_updateTime = m_scheduler.GetTime();
+    m_tima = 0;
+    m_tma = 0;
+    m_tac = 0;
+
+    m_scheduler.Cancel(Scheduler::EventType::TimerOverflow);
+}
+
+uint8_t Timer::ReadRegister(uint16_t addr)
+{
+    const uint64_t time = m_scheduler.GetTime();
+
+    switch(addr & 0x7F)
+    {
+        case s_DIV_PORT:
+            return static_cast<uint8_t>(GetCounter(time) >> 8);
+        case s_TIMA_PORT:
+            Update(time);
+            return m_tima;
+        case s_TMA_PORT:
+            return m_tma;
+        default:
+            return m_tac | 0xF8;
+    }
+}
+
+void Timer::WriteRegister(uint16_t addr, uint8_t value)
+{
+    const uint64_t time = m_scheduler.GetTime();
+    Update(time);
+
+    // TIMA is fed by the selected counter bit and'ed with the enable bit, turning that signal 
+    // off through DIV or TAC is a falling edge as well
+    const bool wasInputHigh = IsEnabled() && ((GetCounter(time) >> GetInputBit()) & 1);
+
+    switch(addr & 0x7F)
+    {
+        case s_DIV_PORT:
+            m_counterOffset = 0 - time;
+            break;
+        case s_TIMA_PORT:
+            m_tima = value;
+            break;
+        case s_TMA_PORT:
+            m_tma = value;
+            break;
+        default:
+            m_tac = value & 0x07;
+            break;
+    }
+
+    const bool isInputHigh = IsEnabled() && ((GetCounter(time) >> GetInputBit()) & 1);
+    if(wasInputHigh && !isInputHigh)
+    {
+        IncrementTIMA(1);
+    }
+
+    ScheduleOverflow();
+}
+
+void Timer::Update(uint64_t time)
+{
+    if(time <= m_updateTime)
+    {
+        return;
+    }
+
+    if(IsEnabled())
+    {
+        // Falling edges of the input bit are the multiples of twice its weight crossed since the last update
+        const unsigned int shift = GetInputBit() + 1;
+        IncrementTIMA((GetCounter(time) >> shift) - (GetCounter(m_updateTime) >> shift));
+    }
+
+    m_updateTime = time;
+}
+
+void Timer::ScheduleOverflow()
+{
+    if(!IsEnabled())
+    {
+        m_scheduler.Cancel(Scheduler::EventType::TimerOverflow);
+        return;
+    }
+
+    // Time of the falling edge bringing TIMA past 0xFF
+    const unsigned int shift = GetInputBit() + 1;
+    const uint64_t nbIncrements = 0x100 - m_tima;
+    const uint64_t overflowCounter = ((GetCounter(m_updateTime) >> shift) + nbIncrements) << shift;
+    m_scheduler.Schedule(Scheduler::EventType::TimerOverflow, overflowCounter - m_counterOffset);
+}
+
+void Timer::IncrementTIMA(uint64_t nbIncrements)
+{
+    const uint64_t nbIncrementsToOverflow = 0x100 - m_tima;
+    if(nbIncrements < nbIncrementsToOverflow)
+    {
+        m_tima = static_cast<uint8_t>(m_tima + nbIncrements);
+        return;
+    }
+
+    // Every later overflow reloads TMA again, only the last one matters
+    const uint64_t period = 0x100 - m_tma;
+    m_tima = static_cast<uint8_t>(m_tma + (nbIncrements - nbIncrementsToOverflow) % period);
+    m_mem.RequestInterrupt(Memory::Interrupt::Timer);
+}
+
+unsigned int Timer::GetInputBit() const
+{
+    // 4096 Hz, 262144 Hz, 65536 Hz and 16384 Hz
+    constexpr std::array<unsigned int, 4> inputBits{ 9, 3, 5, 7 };
+    return inputBits[m_tac & 0x03];
+}
+
+void Timer::Save(SaveStateWriter& writer) const
+{
+    writer.BeginChunk(SaveStateChunk::Timer, s_STATE_VERSION);
+    writer.Write(m_counterOffset);
+    writer.Write(m_updateTime);
+    writer.Write(m_tima);
+    writer.Write(m_tma);
+    writer.Write(m_tac);
+    writer.EndChunk();
+}
+
+bool Timer::Load(SaveStateReader& reader)
+{
+    return reader.OpenChunk(SaveStateChunk::Timer, s_STATE_VERSION) && reader.Read(m_counterOffset) &&
+           reader.Read(m_updateTime) && reader.Read(m_tima) && reader.Read(m_tma) && reader.Read(m_tac) &&
+           reader.CloseChunk();
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "memory.h"
+#include "savestate.h"
+#include "scheduler.h"
+
+#include <cstdint>
+
+// DIV, TIMA, TMA and TAC registers.
+//
+// DIV is the upper byte of a 16-bit counter incremented every clock cycle, and
+// TIMA is incremented on the falling edges of the counter bit selected by TAC.
+// Both are computed from the time of the access rather than ticked, the only
+// event is the next TIMA overflow.
+class Timer
+{
+public:
+    Timer(Memory& mem, Scheduler& scheduler);
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    // State left by the boot ROM
+    void Reset();
+
+    // Counter and registers, the pending overflow is part of the scheduler state
+    void Save(SaveStateWriter& writer) const;
+    bool Load(SaveStateReader& reader);
+
+private:
+    uint8_t ReadRegister(uint16_t addr);
+    void WriteRegister(uint16_t addr, uint8_t value);
+
+    // Brings TIMA up to date, raising the interrupt for overflows that happened since the last update
+    void Update(uint64_t time);
+    void ScheduleOverflow();
+
+    // Adds TIMA increments, reloading it from TMA on overflow
+    void IncrementTIMA(uint64_t nbIncrements);
+
+    uint64_t GetCounter(uint64_t time) const { return time + m_counterOffset; }
+    bool IsEnabled() const { return m_tac & 0x04; }
+
+    // Position of the counter bit whose falling edges increment TIMA, for the selected frequency
+    unsigned int GetInputBit() const;
+
+private:
+    Memory& m_mem;
+    Scheduler& m_scheduler;
+
+    // Internal counter value at any time, restarted from 0 when DIV is written
+    uint64_t m_counterOffset;
+
+    // Time TIMA was last brought up to date
+    uint64_t m_updateTime;
+
+    uint8_t m_tima;
+    uint8_t m_tma;
+    uint8_t m_tac;
+};
@@ -0,0 +1,440 @@
+#include "trace.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+namespace
+{
+    constexpr char s_MAGIC[8] = "GBTRACE";
+    constexpr uint32_t s_VERSION = 1;
+
+    // Stored size of a record, see EncodeRecord
+    constexpr size_t s_RECORD_SIZE = 30;
+
+    // Run-length encoding: a control byte below 0x80 is followed by that many literal bytes plus one, from 0x80 on
+    // it is followed by a byte repeated s_MIN_RUN times more than the control byte minus 0x80
+    constexpr size_t s_MAX_LITERALS = 0x80;
+    constexpr size_t s_MIN_RUN = 3;
+    constexpr size_t s_MAX_RUN = 0x7F + s_MIN_RUN;
+
+    // The trailer gives the offset of the index and its number of blocks, then the magic again
+    constexpr size_t s_TRAILER_SIZE = 24;
+
+    template<typename T>
+    void WriteValue(std::ofstream& file, const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be written to a trace");
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool ReadValue(std::ifstream& file, T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be read from a trace");
+        return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    void EncodeRecord(const TraceRecord& record, uint8_t* bytes)
+    {
+        std::memcpy(bytes, &record.instruction, 8);
+        std::memcpy(bytes + 8, &record.cycle, 8);
+        std::memcpy(bytes + 16, record.regs.data(), 8);
+        std::memcpy(bytes + 24, &record.sp, 2);
+        std::memcpy(bytes + 26, &record.pc, 2);
+        bytes[28] = record.opcode;
+        bytes[29] = record.ime ? 1 : 0;
+    }
+
+    void DecodeRecord(const uint8_t* bytes, TraceRecord& record)
+    {
+        std::memcpy(&record.instruction, bytes, 8);
+        std::memcpy(&record.cycle, bytes + 8, 8);
+        std::memcpy(record.regs.data(), bytes + 16, 8);
+        std::memcpy(&record.sp, bytes + 24, 2);
+        std::memcpy(&record.pc, bytes + 26, 2);
+        record.opcode = bytes[28];
+        record.ime = bytes[29] != 0;
+    }
+
+    // Adds or subtracts every field of a record to those of another, the IME is stored as whether it changed
+    template<bool IsAdded>
+    TraceRecord ApplyDelta(const TraceRecord& record, const TraceRecord& previous)
+    {
+        auto apply = [](auto value, auto previousValue)
+        {
+            return static_cast<decltype(value)>(IsAdded ? value + previousValue : value - previousValue);
+        };
+
+        TraceRecord result;
+        result.instruction = apply(record.instruction, previous.instruction);
+        result.cycle = apply(record.cycle, previous.cycle);
+        for(size_t i = 0; i < record.regs.size(); ++i)
+        {
+            result.regs[i] = apply(record.regs[i], previous.regs[i]);
+        }
+        result.sp = apply(record.sp, previous.sp);
+        result.pc = apply(record.pc, previous.pc);
+        result.opcode = apply(record.opcode, previous.opcode);
+        result.ime = record.ime != previous.ime;
+        return result;
+    }
+
+    // Delta-encodes the records, splits them into byte planes and run-length encodes those
+    void EncodeBlock(const std::vector<TraceRecord>& records, std::vector<uint8_t>& planeData,
+                     std::vector<uint8_t>& encodedData)
+    {
+        const size_t nbRecords = records.size();
+        planeData.resize(nbRecords * s_RECORD_SIZE);
+        for(size_t i = 0; i < nbRecords; ++i)
+        {
+            std::array<uint8_t, s_RECORD_SIZE> bytes;
+            EncodeRecord(i == 0 ? records[0] : ApplyDelta<false>(records[i], records[i - 1]), bytes.data());
+            for(size_t byte = 0; byte < s_RECORD_SIZE; ++byte)
+            {
+                planeData[byte * nbRecords + i] = bytes[byte];
+            }
+        }
+
+        encodedData.clear();
+        const size_t size = planeData.size();
+        size_t pos = 0;
+        while(pos < size)
+        {
+            size_t runLength = 1;
+            while(pos + runLength < size && runLength < s_MAX_RUN && planeData[pos + runLength] == planeData[pos])
+            {
+                ++runLength;
+            }
+
+            if(runLength >= s_MIN_RUN)
+            {
+                encodedData.push_back(static_cast<uint8_t>(0x80 + runLength - s_MIN_RUN));
+                encodedData.push_back(planeData[pos]);
+                pos += runLength;
+                continue;
+            }
+
+            // Literals up to the next run
+            const size_t firstLiteral = pos;
+            while(pos < size && pos - firstLiteral < s_MAX_LITERALS)
+            {
+                if(pos + 2 < size && planeData[pos] == planeData[pos + 1] && planeData[pos] == planeData[pos + 2])
+                {
+                    break;
+                }
+                ++pos;
+            }
+
+            encodedData.push_back(static_cast<uint8_t>(pos - firstLiteral - 1));
+            encodedData.insert(encodedData.end(), planeData.begin() + static_cast<std::ptrdiff_t>(firstLiteral),
+                               planeData.begin() + static_cast<std::ptrdiff_t>(pos));
+        }
+    }
+
+    // Returns false when the data does not decode to exactly the given number of records
+    bool DecodeBlock(const std::vector<uint8_t>& encodedData, size_t nbRecords, std::vector<uint8_t>& planeData,
+                     std::vector<TraceRecord>& records)
+    {
+        const size_t size = nbRecords * s_RECORD_SIZE;
+        planeData.resize(size);
+
+        size_t pos = 0;
+        size_t encodedPos = 0;
+        while(encodedPos < encodedData.size())
+        {
+            const uint8_t control = encodedData[encodedPos++];
+            if(control < 0x80)
+            {
+                const size_t nbLiterals = control + 1u;
+                if(encodedPos + nbLiterals > encodedData.size() || pos + nbLiterals > size)
+                {
+                    return false;
+                }
+                std::copy_n(encodedData.begin() + static_cast<std::ptrdiff_t>(encodedPos), nbLiterals,
+                            planeData.begin() + static_cast<std::ptrdiff_t>(pos));
+                encodedPos += nbLiterals;
+                pos += nbLiterals;
+            }
+            else
+            {
+                const size_t runLength = control - 0x80u + s_MIN_RUN;
+                if(encodedPos >= encodedData.size() || pos + runLength > size)
+                {
+                    return false;
+                }
+                std::fill_n(planeData.begin() + static_cast<std::ptrdiff_t>(pos), runLength, encodedData[encodedPos++]);
+                pos += runLength;
+            }
+        }
+
+        if(pos != size)
+        {
+            return false;
+        }
+
+        records.resize(nbRecords);
+        for(size_t i = 0; i < nbRecords; ++i)
+        {
+            std::array<uint8_t, s_RECORD_SIZE> bytes;
+            for(size_t byte = 0; byte < s_RECORD_SIZE; ++byte)
+            {
+                bytes[byte] = planeData[byte * nbRecords + i];
+            }
+
+            DecodeRecord(bytes.data(), records[i]);
+            if(i > 0)
+            {
+                records[i] = ApplyDelta<true>(records[i], records[i - 1]);
+            }
+        }
+        return true;
+    }
+
+    void WriteBlockInfo(std::ofstream& file, const TraceBlockInfo& info)
+    {
+        std::array<uint8_t, s_RECORD_SIZE> lastRecord;
+        EncodeRecord(info.lastRecord, lastRecord.data());
+
+        WriteValue(file, info.offset);
+        WriteValue(file, info.size);
+        WriteValue(file, info.nbRecords);
+        WriteValue(file, info.firstInstruction);
+        WriteValue(file, info.checksum);
+        WriteValue(file, info.totalChecksum);
+        WriteValue(file, lastRecord);
+    }
+
+    bool ReadBlockInfo(std::ifstream& file, TraceBlockInfo& info)
+    {
+        std::array<uint8_t, s_RECORD_SIZE> lastRecord;
+        if(!ReadValue(file, info.offset) || !ReadValue(file, info.size) || !ReadValue(file, info.nbRecords) ||
+           !ReadValue(file, info.firstInstruction) || !ReadValue(file, info.checksum) ||
+           !ReadValue(file, info.totalChecksum) || !ReadValue(file, lastRecord))
+        {
+            return false;
+        }
+
+        DecodeRecord(lastRecord.data(), info.lastRecord);
+        return true;
+    }
+}
+
+bool TraceRecord::operator==(const TraceRecord& other) const
+{
+    return instruction == other.instruction && cycle == other.cycle && regs == other.regs && sp == other.sp &&
+           pc == other.pc && opcode == other.opcode && ime == other.ime;
+}
+
+TraceWriter::TraceWriter()
+    : m_isClosing{}
+    , m_totalChecksum{}
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+    Close();
+}
+
+bool TraceWriter::Open(const std::string& filePath)
+{
+    Close();
+
+    m_file.open(filePath, std::ios::binary);
+    m_file.write(s_MAGIC, sizeof(s_MAGIC));
+    WriteValue(m_file, s_VERSION);
+    WriteValue(m_file, static_cast<uint32_t>(s_RECORD_SIZE));
+    WriteValue(m_file, static_cast<uint32_t>(m_BLOCK_SIZE));
+    if(!m_file)
+    {
+        m_file.close();
+        return false;
+    }
+
+    m_index.clear();
+    m_totalChecksum = HashBytes(nullptr, 0);
+    m_block.clear();
+    m_block.reserve(m_BLOCK_SIZE);
+    m_isClosing = false;
+    m_thread = std::thread{[this](){ Run(); }};
+    return true;
+}
+
+bool TraceWriter::Close()
+{
+    if(!m_thread.joinable())
+    {
+        return true;
+    }
+
+    if(!m_block.empty())
+    {
+        QueueBlock();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_isClosing = true;
+    }
+    m_blockQueued.notify_one();
+    m_thread.join();
+
+    // The writing thread is done with the file
+    const uint64_t indexOffset = static_cast<uint64_t>(m_file.tellp());
+    for(const TraceBlockInfo& info : m_index)
+    {
+        WriteBlockInfo(m_file, info);
+    }
+    WriteValue(m_file, indexOffset);
+    WriteValue(m_file, static_cast<uint64_t>(m_index.size()));
+    m_file.write(s_MAGIC, sizeof(s_MAGIC));
+
+    const bool isWritten = static_cast<bool>(m_file);
+    m_file.close();
+    return isWritten;
+}
+
+void TraceWriter::QueueBlock()
+{
+    std::unique_lock<std::mutex> lock{m_mutex};
+    m_blockWritten.wait(lock, [this](){ return m_queuedBlocks.size() < m_MAX_QUEUED_BLOCKS; });
+    m_queuedBlocks.push_back(std::move(m_block));
+
+    // Blocks go back and forth between the threads, without allocating once they are all there
+    m_block = {};
+    if(!m_freeBlocks.empty())
+    {
+        m_block = std::move(m_freeBlocks.back());
+        m_freeBlocks.pop_back();
+    }
+    lock.unlock();
+
+    m_blockQueued.notify_one();
+    m_block.reserve(m_BLOCK_SIZE);
+}
+
+void TraceWriter::Run()
+{
+    for(;;)
+    {
+        std::vector<TraceRecord> records;
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_blockQueued.wait(lock, [this](){ return !m_queuedBlocks.empty() || m_isClosing; });
+            if(m_queuedBlocks.empty())
+            {
+                return;
+            }
+
+            records = std::move(m_queuedBlocks.front());
+            m_queuedBlocks.pop_front();
+        }
+
+        WriteBlock(records);
+
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            records.clear();
+            m_freeBlocks.push_back(std::move(records));
+        }
+        m_blockWritten.notify_one();
+    }
+}
+
+void TraceWriter::WriteBlock(const std::vector<TraceRecord>& records)
+{
+    EncodeBlock(records, m_planeData, m_encodedData);
+
+    // The encoding of a block only depends on its records, and is a lot smaller to go through. The total checksum
+    // chains those of the blocks.
+    TraceBlockInfo info{};
+    info.offset = static_cast<uint64_t>(m_file.tellp());
+    info.size = static_cast<uint32_t>(m_encodedData.size());
+    info.nbRecords = static_cast<uint32_t>(records.size());
+    info.firstInstruction = records.front().instruction;
+    info.checksum = HashBytes(m_encodedData.data(), m_encodedData.size());
+    m_totalChecksum = HashBytes(reinterpret_cast<const uint8_t*>(&info.checksum), sizeof(info.checksum), m_totalChecksum);
+    info.totalChecksum = m_totalChecksum;
+    info.lastRecord = records.back();
+
+    m_file.write(reinterpret_cast<const char*>(m_encodedData.data()), static_cast<std::streamsize>(m_encodedData.size()));
+
+    m_index.push_back(info);
+}
+
+bool TraceReader::Open(const std::string& filePath)
+{
+    m_file.close();
+    m_file.clear();
+    m_blocks.clear();
+    m_nbRecords = 0;
+
+    m_file.open(filePath, std::ios::binary);
+
+    char magic[sizeof(s_MAGIC)]{};
+    uint32_t version{};
+    uint32_t recordSize{};
+    uint32_t blockSize{};
+    if(!m_file.read(magic, sizeof(magic)) || std::memcmp(magic, s_MAGIC, sizeof(magic)) != 0 ||
+       !ReadValue(m_file, version) || version != s_VERSION || !ReadValue(m_file, recordSize) ||
+       recordSize != s_RECORD_SIZE || !ReadValue(m_file, blockSize))
+    {
+        return false;
+    }
+
+    // A trace still being written, or cut short, has no trailer
+    uint64_t indexOffset{};
+    uint64_t nbBlocks{};
+    if(!m_file.seekg(0, std::ios::end))
+    {
+        return false;
+    }
+    const uint64_t fileSize = static_cast<uint64_t>(m_file.tellg());
+    if(fileSize < s_TRAILER_SIZE || !m_file.seekg(static_cast<std::streamoff>(fileSize - s_TRAILER_SIZE)) ||
+       !ReadValue(m_file, indexOffset) || !ReadValue(m_file, nbBlocks) || !m_file.read(magic, sizeof(magic)) ||
+       std::memcmp(magic, s_MAGIC, sizeof(magic)) != 0 || indexOffset > fileSize - s_TRAILER_SIZE ||
+       nbBlocks > fileSize)
+    {
+        return false;
+    }
+
+    m_file.seekg(static_cast<std::streamoff>(indexOffset));
+    m_blocks.resize(static_cast<size_t>(nbBlocks));
+    for(TraceBlockInfo& info : m_blocks)
+    {
+        if(!ReadBlockInfo(m_file, info) || info.nbRecords == 0 || info.offset + info.size > indexOffset)
+        {
+            m_blocks.clear();
+            return false;
+        }
+        m_nbRecords += info.nbRecords;
+    }
+
+    return true;
+}
+
+bool TraceReader::ReadBlock(size_t blockIdx, std::vector<TraceRecord>& records)
+{
+    const TraceBlockInfo& info = m_blocks[blockIdx];
+    m_encodedData.resize(info.size);
+    m_file.clear();
+    if(!m_file.seekg(static_cast<std::streamoff>(info.offset)) ||
+       !m_file.read(reinterpret_cast<char*>(m_encodedData.data()), static_cast<std::streamsize>(info.size)) ||
+       HashBytes(m_encodedData.data(), m_encodedData.size()) != info.checksum)
+    {
+        return false;
+    }
+
+    return DecodeBlock(m_encodedData, info.nbRecords, m_planeData, records);
+}
+
+size_t TraceReader::FindBlock(uint64_t instruction) const
+{
+    auto isBefore = [](uint64_t instruction, const TraceBlockInfo& info){ return instruction < info.firstInstruction; };
+    const auto next = std::upper_bound(m_blocks.begin(), m_blocks.end(), instruction, isBefore);
+    return next == m_blocks.begin() ? m_blocks.size() : static_cast<size_t>(next - m_blocks.begin() - 1);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Execution traces: the state of the CPU at instruction boundaries, one fixed-width record each, for finding where
+// two runs part ways, see gb-tracediff.
+//
+// Records are stored in blocks of m_BLOCK_SIZE. Each record of a block is delta-encoded from the previous one, the
+// block is split into byte planes so that the bytes that seldom change line up, and the planes are run-length
+// encoded. Blocks are independent, readers only decode those they look at. The index at the end of the file gives,
+// for every block, where it is, its first instruction, its last record, the checksum of its records and the
+// checksum of all the records up to its end: the first block where two traces differ is found by a binary search
+// over their indexes, without decoding anything.
+//
+// Records are keyed by the number of instructions executed before them. The interpreter records every instruction,
+// the block cache and native code only the ends of their blocks, traces of different modes are compared where both
+// have a record.
+struct TraceRecord
+{
+    // Instructions executed before this point, and the clock cycles
+    uint64_t instruction;
+    uint64_t cycle;
+
+    // In register file order: A, F, B, C, D, E, H, L
+    std::array<uint8_t, 8> regs;
+    uint16_t sp;
+    uint16_t pc;
+
+    // Opcode at PC, the next one to execute
+    uint8_t opcode;
+    bool ime;
+
+    bool operator==(const TraceRecord& other) const;
+    bool operator!=(const TraceRecord& other) const { return !(*this == other); }
+};
+
+// Position and checksums of a block, as found in the index
+struct TraceBlockInfo
+{
+    uint64_t offset;
+    uint32_t size;
+    uint32_t nbRecords;
+    uint64_t firstInstruction;
+    uint64_t checksum;
+    uint64_t totalChecksum;
+    TraceRecord lastRecord;
+};
+
+// Encodes and writes the blocks on a thread of its own, the emulator only copies records into the current block.
+// It waits for the writing thread only when a whole queue of blocks is still waiting to be written.
+class TraceWriter
+{
+public:
+    static constexpr size_t m_BLOCK_SIZE = 4096;
+
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Starts the writing thread, after closing a previous trace
+    bool Open(const std::string& filePath);
+
+    // Records must come in increasing instruction order
+    void Write(const TraceRecord& record)
+    {
+        m_block.push_back(record);
+        if(m_block.size() == m_BLOCK_SIZE)
+        {
+            QueueBlock();
+        }
+    }
+
+    // Writes the last block and the index, returns whether the whole trace was written
+    bool Close();
+
+private:
+    void QueueBlock();
+    void Run();
+    void WriteBlock(const std::vector<TraceRecord>& records);
+
+private:
+    static constexpr size_t m_MAX_QUEUED_BLOCKS = 8;
+
+    std::vector<TraceRecord> m_block;
+
+    std::mutex m_mutex;
+    std::condition_variable m_blockQueued;
+    std::condition_variable m_blockWritten;
+    std::deque<std::vector<TraceRecord>> m_queuedBlocks;
+    std::vector<std::vector<TraceRecord>> m_freeBlocks;
+    bool m_isClosing;
+    std::thread m_thread;
+
+    // Only used by the writing thread while it runs
+    std::ofstream m_file;
+    std::vector<TraceBlockInfo> m_index;
+    uint64_t m_totalChecksum;
+    std::vector<uint8_t> m_planeData;
+    std::vector<uint8_t> m_encodedData;
+};
+
+class TraceReader
+{
+public:
+    TraceReader() = default;
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    // Reads the index, returns false when the file is not a whole trace
+    bool Open(const std::string& filePath);
+
+    const std::vector<TraceBlockInfo>& GetBlocks() const { return m_blocks; }
+    uint64_t GetNbRecords() const { return m_nbRecords; }
+
+    // Returns false when the block does not decode to records matching its checksum
+    bool ReadBlock(size_t blockIdx, std::vector<TraceRecord>& records);
+
+    // Block that would hold the record of the given instruction, the number of blocks when it is before the first one
+    size_t FindBlock(uint64_t instruction) const;
+
+private:
+    std::ifstream m_file;
+    std::vector<TraceBlockInfo> m_blocks;
+    uint64_t m_nbRecords{};
+    std::vector<uint8_t> m_planeData;
+    std::vector<uint8_t> m_encodedData;
+};
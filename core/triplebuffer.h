@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Hands values over from one producer thread to one consumer thread without locks.
+//
+// The producer fills the back buffer and publishes it, the consumer reads the front
+// buffer. The third buffer sits between them, holding the latest published value
+// until the consumer takes it. Neither side ever waits for the other, the producer
+// overwrites values the consumer did not take in time.
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() = default;
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Producer side
+    T& GetBackBuffer() { return m_buffers[m_backIdx]; }
+    void Publish()
+    {
+        m_backIdx = m_middle.exchange(m_backIdx | m_NEW_VALUE_BIT, std::memory_order_acq_rel) & m_INDEX_MASK;
+    }
+
+    // Consumer side, returns whether a value was published since the last update
+    bool Update()
+    {
+        if(!(m_middle.load(std::memory_order_relaxed) & m_NEW_VALUE_BIT))
+        {
+            return false;
+        }
+
+        m_frontIdx = m_middle.exchange(m_frontIdx, std::memory_order_acq_rel) & m_INDEX_MASK;
+        return true;
+    }
+
+    const T& GetFrontBuffer() const { return m_buffers[m_frontIdx]; }
+
+private:
+    static constexpr uint8_t m_INDEX_MASK = 0x03;
+    static constexpr uint8_t m_NEW_VALUE_BIT = 0x04;
+
+    std::array<T, 3> m_buffers{};
+
+    // Each index is owned by one side, kept on separate cache lines
+    alignas(64) uint8_t m_backIdx = 0;
+    alignas(64) std::atomic<uint8_t> m_middle{1};
+    alignas(64) uint8_t m_frontIdx = 2;
+};
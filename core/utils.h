@@ -1,8 +1,8 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
-#include <vector>
 
 constexpr unsigned int GetNbSetBits(uint64_t val)
 {
@@ -31,4 +31,13 @@ constexpr unsigned int GetSetBitPosition(uint64_t val)
     return pos;
 }
 
-std::vector<unsigned int> GetSetBitPositions(uint64_t val);
+// FNV-1a, only used to compare the states of runs. Chain calls through the hash to cover several buffers.
+inline uint64_t HashBytes(const uint8_t* data, size_t size, uint64_t hash = 0xCBF29CE484222325)
+{
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ data[i]) * 0x100000001B3;
+    }
+
+    return hash;
+}
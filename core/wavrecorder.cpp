@@ -0,0 +1,17 @@
+#include "wavrecorder.h"
+
+#include <array>
+
+WavRecorder::WavRecorder(APU::Output& output)
+    : m_output{output}
+{
+}
+
+void WavRecorder::Drain()
+{
+    std::array<APU::Sample, 4096> samples;
+    while(const size_t nbSamples = m_output.Pop(samples.data(), samples.size()))
+    {
+        m_writer.Write(&samples[0].left, nbSamples);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "apu.h"
+#include "wavwriter.h"
+
+#include <string>
+
+// Consumer of the sound output writing it to a WAV file, drained between slices of emulation so that nothing is
+// dropped
+class WavRecorder
+{
+public:
+    explicit WavRecorder(APU::Output& output);
+    WavRecorder(const WavRecorder&) = delete;
+    WavRecorder& operator=(const WavRecorder&) = delete;
+
+    bool Open(const std::string& filePath) { return m_writer.Open(filePath, APU::m_SAMPLE_RATE, 2); }
+    bool Close() { return m_writer.Close(); }
+
+    void Drain();
+
+private:
+    APU::Output& m_output;
+    WavWriter m_writer;
+};
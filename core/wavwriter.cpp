@@ -0,0 +1,74 @@
+#include "wavwriter.h"
+
+namespace
+{
+    constexpr uint32_t s_HEADER_SIZE = 44;
+
+    void WriteLE(std::ofstream& file, uint32_t value, unsigned int nbBytes)
+    {
+        for(unsigned int i = 0; i < nbBytes; ++i)
+        {
+            file.put(static_cast<char>(value >> (i * 8)));
+        }
+    }
+}
+
+WavWriter::~WavWriter()
+{
+    Close();
+}
+
+bool WavWriter::Open(const std::string& filePath, unsigned int sampleRate, unsigned int nbChannels)
+{
+    Close();
+
+    m_file.open(filePath, std::ios::binary);
+    m_nbChannels = nbChannels;
+    m_dataSize = 0;
+
+    // The RIFF and data sizes are patched on Close
+    const unsigned int blockAlign = nbChannels * sizeof(int16_t);
+    m_file.write("RIFF", 4);
+    WriteLE(m_file, 0, 4);
+    m_file.write("WAVEfmt ", 8);
+    WriteLE(m_file, 16, 4);
+    WriteLE(m_file, 1, 2);
+    WriteLE(m_file, nbChannels, 2);
+    WriteLE(m_file, sampleRate, 4);
+    WriteLE(m_file, sampleRate * blockAlign, 4);
+    WriteLE(m_file, blockAlign, 2);
+    WriteLE(m_file, 16, 2);
+    m_file.write("data", 4);
+    WriteLE(m_file, 0, 4);
+
+    return static_cast<bool>(m_file);
+}
+
+bool WavWriter::Write(const int16_t* samples, size_t nbFrames)
+{
+    const size_t nbSamples = nbFrames * m_nbChannels;
+    for(size_t i = 0; i < nbSamples; ++i)
+    {
+        WriteLE(m_file, static_cast<uint16_t>(samples[i]), 2);
+    }
+
+    m_dataSize += static_cast<uint32_t>(nbSamples * sizeof(int16_t));
+    return static_cast<bool>(m_file);
+}
+
+bool WavWriter::Close()
+{
+    if(!m_file.is_open())
+    {
+        return true;
+    }
+
+    m_file.seekp(4);
+    WriteLE(m_file, s_HEADER_SIZE - 8 + m_dataSize, 4);
+    m_file.seekp(s_HEADER_SIZE - 4);
+    WriteLE(m_file, m_dataSize, 4);
+
+    const bool isWritten = static_cast<bool>(m_file);
+    m_file.close();
+    return isWritten;
+}
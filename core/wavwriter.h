@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+// Writes 16-bit PCM samples to a WAV file, the sizes in the header are filled in on Close.
+class WavWriter
+{
+public:
+    WavWriter() = default;
+    WavWriter(const WavWriter&) = delete;
+    WavWriter& operator=(const WavWriter&) = delete;
+    ~WavWriter();
+
+    bool Open(const std::string& filePath, unsigned int sampleRate, unsigned int nbChannels);
+
+    // Interleaved samples, nbFrames * nbChannels of them
+    bool Write(const int16_t* samples, size_t nbFrames);
+
+    bool Close();
+
+private:
+    std::ofstream m_file;
+    unsigned int m_nbChannels{};
+    uint32_t m_dataSize{};
+};
@@ -0,0 +1,141 @@
+#include "workstealingpool.h"
+
+#include <algorithm>
+
+WorkStealingPool::WorkStealingPool(unsigned int nbThreads)
+    : m_task{}
+    , m_batchIdx{}
+    , m_nbRemainingTasks{}
+    , m_nbBusyWorkers{}
+    , m_isStopRequested{}
+{
+    m_workers.resize(std::max(nbThreads, 1u));
+    for(std::unique_ptr<Worker>& worker : m_workers)
+    {
+        worker = std::make_unique<Worker>();
+    }
+
+    // Only started once every deque exists, workers steal from all of them
+    for(size_t i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->thread = std::thread{[this, i](){ RunWorker(i); }};
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock{m_mutex};
+        m_isStopRequested = true;
+    }
+
+    m_batchStarted.notify_all();
+    for(std::unique_ptr<Worker>& worker : m_workers)
+    {
+        worker->thread.join();
+    }
+}
+
+void WorkStealingPool::Run(size_t nbTasks, const Task& task)
+{
+    if(nbTasks == 0)
+    {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock{m_mutex};
+
+    // Tasks only sit in the deques while m_task is valid, a late worker cannot pick one up with the task of a previous batch
+    const size_t nbWorkers = m_workers.size();
+    for(size_t i = 0; i < nbWorkers; ++i)
+    {
+        std::lock_guard<std::mutex> workerLock{m_workers[i]->mutex};
+        for(size_t taskIdx = nbTasks * i / nbWorkers; taskIdx < nbTasks * (i + 1) / nbWorkers; ++taskIdx)
+        {
+            m_workers[i]->tasks.push_back(taskIdx);
+        }
+    }
+
+    m_task = &task;
+    m_nbRemainingTasks = nbTasks;
+    ++m_batchIdx;
+    m_batchStarted.notify_all();
+
+    // Workers may still be looking for tasks after the last one is done
+    m_batchDone.wait(lock, [this](){ return m_nbRemainingTasks == 0 && m_nbBusyWorkers == 0; });
+    m_task = nullptr;
+}
+
+void WorkStealingPool::RunWorker(size_t workerIdx)
+{
+    uint64_t lastBatchIdx{};
+    for(;;)
+    {
+        const Task* task;
+        {
+            std::unique_lock<std::mutex> lock{m_mutex};
+            m_batchStarted.wait(lock, [this, lastBatchIdx]()
+            {
+                return m_isStopRequested || (m_task != nullptr && m_batchIdx != lastBatchIdx);
+            });
+
+            if(m_isStopRequested)
+            {
+                return;
+            }
+
+            lastBatchIdx = m_batchIdx;
+            task = m_task;
+            ++m_nbBusyWorkers;
+        }
+
+        size_t nbTasksDone{};
+        size_t taskIdx;
+        while(PopTask(workerIdx, taskIdx) || StealTask(workerIdx, taskIdx))
+        {
+            (*task)(taskIdx);
+            ++nbTasksDone;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            m_nbRemainingTasks -= nbTasksDone;
+            --m_nbBusyWorkers;
+        }
+
+        m_batchDone.notify_one();
+    }
+}
+
+bool WorkStealingPool::PopTask(size_t workerIdx, size_t& taskIdx)
+{
+    Worker& worker = *m_workers[workerIdx];
+    std::lock_guard<std::mutex> lock{worker.mutex};
+    if(worker.tasks.empty())
+    {
+        return false;
+    }
+
+    taskIdx = worker.tasks.front();
+    worker.tasks.pop_front();
+    return true;
+}
+
+bool WorkStealingPool::StealTask(size_t workerIdx, size_t& taskIdx)
+{
+    // Victims in a different order for each worker, thieves do not all fall on the same one
+    const size_t nbWorkers = m_workers.size();
+    for(size_t i = 1; i < nbWorkers; ++i)
+    {
+        Worker& victim = *m_workers[(workerIdx + i) % nbWorkers];
+        std::lock_guard<std::mutex> lock{victim.mutex};
+        if(!victim.tasks.empty())
+        {
+            taskIdx = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
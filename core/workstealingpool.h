@@ -0,0 +1,62 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running batches of independent tasks.
+//
+// The tasks of a batch are split into one contiguous range per worker. A worker
+// takes its own tasks from the front of its deque and, once it runs out, steals
+// from the back of the others', so that the workers which got short tasks take
+// over the end of the long ones. Tasks are whole emulation runs: a mutex per
+// deque costs nothing next to them.
+class WorkStealingPool
+{
+public:
+    // Called with the index of the task in its batch, from any worker
+    using Task = std::function<void(size_t)>;
+
+public:
+    explicit WorkStealingPool(unsigned int nbThreads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    unsigned int GetNbThreads() const { return static_cast<unsigned int>(m_workers.size()); }
+
+    // Runs the task for every index in [0, nbTasks), returns once they are all done
+    void Run(size_t nbTasks, const Task& task);
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+        std::thread thread;
+    };
+
+    void RunWorker(size_t workerIdx);
+    bool PopTask(size_t workerIdx, size_t& taskIdx);
+    bool StealTask(size_t workerIdx, size_t& taskIdx);
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    // Batch in progress, set only while a Run is waiting for it
+    std::mutex m_mutex;
+    std::condition_variable m_batchStarted;
+    std::condition_variable m_batchDone;
+    const Task* m_task;
+    uint64_t m_batchIdx;
+    size_t m_nbRemainingTasks;
+    unsigned int m_nbBusyWorkers;
+    bool m_isStopRequested;
+};
@@ -0,0 +1,1027 @@
+#include "core/debugsession.h"
+#include "core/disassembler.h"
+#include "core/emulationthread.h"
+#include "core/emulator.h"
+#include "core/memoryfollower.h"
+#include "core/opcodes.h"
+#include "core/ppmwriter.h"
+#include "core/profiler.h"
+#include "core/rewindbuffer.h"
+#include "core/testresultwatcher.h"
+#include "core/utils.h"
+#include "core/wavrecorder.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Instructions run between two drains of the sound output when recording, well under its capacity
+    constexpr uint64_t s_RECORDING_SLICE_INSTRUCTIONS = 10000;
+
+    enum class RunMode
+    {
+        Instructions,
+        Cycles,
+        Frames,
+        Seconds
+    };
+
+    struct Options
+    {
+        RunMode mode = RunMode::Frames;
+        double amount = 600;
+        Emulator::ExecutionMode executionMode = Emulator::ExecutionMode::Interpreter;
+        bool isJITLockstepEnabled = false;
+        bool isJITPerfMapEnabled = false;
+        bool isStateDumpEnabled = false;
+        bool isSerialOutputEnabled = false;
+        bool isRealTime = false;
+        bool isReportEnabled = false;
+        bool isResultAwaited = false;
+        bool isPixelKernelsSet = false;
+        bool isDisassemblyFollowed = false;
+        bool isMemoryFollowed = false;
+        bool isOpcodeTablePrinted = false;
+        std::vector<uint16_t> breakpoints;
+        std::vector<Debugger::Watchpoint> watchpoints;
+        bool isStepping = false;
+        bool isSteppingOver = false;
+        bool isRunToSet = false;
+        uint16_t runToAddr = 0;
+        unsigned int fastForwardInterval = 0;
+        unsigned int rewindInterval = 0;
+        size_t rewindMemoryCap = RewindBuffer::m_DEFAULT_MEMORY_CAP;
+        bool isRewindFrameSet = false;
+        uint64_t rewindFrame = 0;
+        PixelKernels::InstructionSet pixelKernels = PixelKernels::InstructionSet::Scalar;
+        std::string screenshotFilePath;
+        std::string wavFilePath;
+        std::string loadStateFilePath;
+        std::string saveStateFilePath;
+        std::string profileFilePath;
+        std::string profileStacksFilePath;
+        std::string disassemblyFilePath;
+        std::string traceFilePath;
+        std::string romFilePath;
+    };
+
+    void PrintUsage()
+    {
+        std::cout << "Usage: gb-headless [options] [ROM file path]\n"
+                  << "Options:\n"
+                  << "  --instructions N   Run N guest instructions\n"
+                  << "  --cycles N         Run N clock cycles, 4194304 per second of the original hardware\n"
+                  << "  --frames N         Run N emulated frames (default: 600)\n"
+                  << "  --seconds S        Run for S seconds of wall-clock time\n"
+                  << "  --realtime         With --seconds, run on an emulation thread paced to the original hardware\n"
+                  << "  --fast-forward N   Only draw 1 of every N frames, with --realtime run as fast as possible\n"
+                  << "  --block-cache      Execute cached blocks of pre-decoded instructions\n"
+                  << "  --jit              Translate hot blocks to native code\n"
+                  << "  --jit-lockstep     With --jit, check every native block against the interpreter\n"
+                  << "  --perf-map         With --jit, write /tmp/perf-<pid>.map for perf\n"
+                  << "  --dump-state       Print the registers and a hash of memory when done\n"
+                  << "  --serial           Print what the ROM sends through the serial port\n"
+                  << "  --pixel-kernels K  Render with the scalar, sse2 or avx2 kernels (default: best supported)\n"
+                  << "  --screenshot FILE  Save the last frame as a PPM image when done\n"
+                  << "  --wav FILE         Record the sound to a WAV file\n"
+                  << "  --report           Print the result a test ROM left in cartridge RAM\n"
+                  << "  --until-result     With --frames or --cycles, stop as soon as a test ROM reports its result through\n"
+                  << "                     the serial port or in cartridge RAM, and fail unless it passed before the end\n"
+                  << "  --load-state FILE  Start from a save state instead of the boot state\n"
+                  << "  --save-state FILE  Save the state when done\n"
+                  << "  --profile FILE     Write the hottest opcodes, addresses, banks and functions (GB_PROFILER builds)\n"
+                  << "  --profile-stacks FILE\n"
+                  << "                     Write the call stacks in the collapsed format of flame graph tools (GB_PROFILER builds)\n"
+                  << "  --disassembly FILE Write the disassembly of the address space when done\n"
+                  << "  --trace FILE       Record the CPU state after every instruction, or every block with --block-cache and\n"
+                  << "                     --jit, compare traces with gb-tracediff\n"
+                  << "  --disassembly-follow\n"
+                  << "                     Keep the disassembly up to date as a debugger does, after every frame with --frames,\n"
+                  << "                     through debug snapshots with --realtime\n"
+                  << "  --memory-follow    With --frames, keep a copy of memory up to date from the dirty pages after every frame\n"
+                  << "                     as a debugger does, and count the pages it got wrong when done\n"
+                  << "  --break ADDR       With --frames, stop before the instruction at ADDR (hex) and go on, repeatable\n"
+                  << "  --watch SPEC       With --frames, stop after the accesses matching SPEC and go on, repeatable: r, w or rw,\n"
+                  << "                     a colon, an address or range (C000-C0FF), then =XX, !=XX, or ~ for writes changing\n"
+                  << "                     the value\n"
+                  << "  --step MODE        With --frames, run by steps into or over calls\n"
+                  << "  --run-to ADDR      With --frames, stop the first time PC gets to ADDR\n"
+                  << "  --rewind N         Keep a rewind history with a snapshot every N frames\n"
+                  << "  --rewind-memory MB Memory cap of the rewind history (default: 64)\n"
+                  << "  --rewind-to FRAME  With --rewind, go back to the given frame when done\n"
+                  << "  --opcode-table     Print the length, cycles, flags and idle loop use of every opcode instead of\n"
+                  << "                     running a ROM\n";
+    }
+
+    bool ParseAddress(const std::string& text, uint16_t& addr)
+    {
+        char* end{};
+        const unsigned long value = std::strtoul(text.c_str(), &end, 16);
+        addr = static_cast<uint16_t>(value);
+        return !text.empty() && *end == '\0' && value <= 0xFFFF;
+    }
+
+    // "rw:C000-C0FF", "w:FF40=91", "r:FF44!=90", "w:D000~"
+    bool ParseWatchpoint(const std::string& text, Debugger::Watchpoint& watchpoint)
+    {
+        const size_t colon = text.find(':');
+        const std::string access = text.substr(0, colon);
+        if(colon == std::string::npos || (access != "r" && access != "w" && access != "rw"))
+        {
+            return false;
+        }
+        watchpoint.access = access == "r" ? Debugger::Access::Read
+                          : access == "w" ? Debugger::Access::Write
+                                          : Debugger::Access::ReadWrite;
+
+        std::string range = text.substr(colon + 1);
+        watchpoint.condition = Debugger::Condition::Any;
+        watchpoint.value = 0;
+
+        const size_t conditionPos = range.find_first_of("=!~");
+        if(conditionPos != std::string::npos)
+        {
+            const std::string condition = range.substr(conditionPos);
+            range.resize(conditionPos);
+
+            uint16_t value{};
+            if(condition == "~")
+            {
+                watchpoint.condition = Debugger::Condition::Changed;
+            }
+            else if(condition[0] == '=' && ParseAddress(condition.substr(1), value) && value <= 0xFF)
+            {
+                watchpoint.condition = Debugger::Condition::Equal;
+            }
+            else if(condition.compare(0, 2, "!=") == 0 && ParseAddress(condition.substr(2), value) && value <= 0xFF)
+            {
+                watchpoint.condition = Debugger::Condition::NotEqual;
+            }
+            else
+            {
+                return false;
+            }
+            watchpoint.value = static_cast<uint8_t>(value);
+        }
+
+        const size_t dash = range.find('-');
+        if(!ParseAddress(range.substr(0, dash), watchpoint.firstAddr))
+        {
+            return false;
+        }
+        watchpoint.lastAddr = watchpoint.firstAddr;
+        return dash == std::string::npos ||
+               (ParseAddress(range.substr(dash + 1), watchpoint.lastAddr) && watchpoint.lastAddr >= watchpoint.firstAddr);
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& options)
+    {
+        for(int i = 1; i < argc; ++i)
+        {
+            const std::string arg{argv[i]};
+
+            if(arg == "--instructions" || arg == "--cycles" || arg == "--frames" || arg == "--seconds")
+            {
+                if(i + 1 >= argc)
+                {
+                    std::cout << "Missing value for " << arg << "\n";
+                    return false;
+                }
+
+                char* end{};
+                options.amount = std::strtod(argv[++i], &end);
+                if(*end != '\0' || options.amount <= 0)
+                {
+                    std::cout << "Invalid value for " << arg << ": " << argv[i] << "\n";
+                    return false;
+                }
+
+                options.mode = arg == "--instructions" ? RunMode::Instructions
+                             : arg == "--cycles"       ? RunMode::Cycles
+                             : arg == "--frames"       ? RunMode::Frames
+                                                       : RunMode::Seconds;
+            }
+            else if(arg == "--rewind" || arg == "--rewind-memory" || arg == "--rewind-to" || arg == "--fast-forward")
+            {
+                if(i + 1 >= argc)
+                {
+                    std::cout << "Missing value for " << arg << "\n";
+                    return false;
+                }
+
+                char* end{};
+                const unsigned long long value = std::strtoull(argv[++i], &end, 10);
+                if(*end != '\0' || (value == 0 && arg != "--rewind-to"))
+                {
+                    std::cout << "Invalid value for " << arg << ": " << argv[i] << "\n";
+                    return false;
+                }
+
+                if(arg == "--rewind")
+                {
+                    options.rewindInterval = static_cast<unsigned int>(value);
+                }
+                else if(arg == "--rewind-memory")
+                {
+                    options.rewindMemoryCap = static_cast<size_t>(value) << 20;
+                }
+                else if(arg == "--fast-forward")
+                {
+                    options.fastForwardInterval = static_cast<unsigned int>(value);
+                }
+                else
+                {
+                    options.isRewindFrameSet = true;
+                    options.rewindFrame = value;
+                }
+            }
+            else if(arg == "--realtime")
+            {
+                options.isRealTime = true;
+            }
+            else if(arg == "--block-cache")
+            {
+                options.executionMode = Emulator::ExecutionMode::BlockCache;
+            }
+            else if(arg == "--jit")
+            {
+                options.executionMode = Emulator::ExecutionMode::JIT;
+            }
+            else if(arg == "--jit-lockstep")
+            {
+                options.isJITLockstepEnabled = true;
+            }
+            else if(arg == "--perf-map")
+            {
+                options.isJITPerfMapEnabled = true;
+            }
+            else if(arg == "--dump-state")
+            {
+                options.isStateDumpEnabled = true;
+            }
+            else if(arg == "--serial")
+            {
+                options.isSerialOutputEnabled = true;
+            }
+            else if(arg == "--report")
+            {
+                options.isReportEnabled = true;
+            }
+            else if(arg == "--until-result")
+            {
+                options.isResultAwaited = true;
+            }
+            else if(arg == "--disassembly-follow")
+            {
+                options.isDisassemblyFollowed = true;
+            }
+            else if(arg == "--opcode-table")
+            {
+                options.isOpcodeTablePrinted = true;
+            }
+            else if(arg == "--memory-follow")
+            {
+                options.isMemoryFollowed = true;
+            }
+            else if(arg == "--break" || arg == "--watch" || arg == "--step" || arg == "--run-to")
+            {
+                if(i + 1 >= argc)
+                {
+                    std::cout << "Missing value for " << arg << "\n";
+                    return false;
+                }
+
+                const std::string value{argv[++i]};
+                uint16_t addr{};
+                Debugger::Watchpoint watchpoint{};
+                if(arg == "--break" && ParseAddress(value, addr))
+                {
+                    options.breakpoints.push_back(addr);
+                }
+                else if(arg == "--watch" && ParseWatchpoint(value, watchpoint))
+                {
+                    options.watchpoints.push_back(watchpoint);
+                }
+                else if(arg == "--step" && (value == "into" || value == "over"))
+                {
+                    options.isStepping = true;
+                    options.isSteppingOver = value == "over";
+                }
+                else if(arg == "--run-to" && ParseAddress(value, addr))
+                {
+                    options.isRunToSet = true;
+                    options.runToAddr = addr;
+                }
+                else
+                {
+                    std::cout << "Invalid value for " << arg << ": " << value << "\n";
+                    return false;
+                }
+            }
+            else if(arg == "--pixel-kernels" || arg == "--screenshot" || arg == "--wav" || arg == "--load-state" ||
+                    arg == "--save-state" || arg == "--profile" || arg == "--profile-stacks" || arg == "--disassembly" ||
+                    arg == "--trace")
+            {
+                if(i + 1 >= argc)
+                {
+                    std::cout << "Missing value for " << arg << "\n";
+                    return false;
+                }
+
+                const std::string value{argv[++i]};
+                if(arg == "--screenshot")
+                {
+                    options.screenshotFilePath = value;
+                }
+                else if(arg == "--wav")
+                {
+                    options.wavFilePath = value;
+                }
+                else if(arg == "--load-state")
+                {
+                    options.loadStateFilePath = value;
+                }
+                else if(arg == "--save-state")
+                {
+                    options.saveStateFilePath = value;
+                }
+                else if(arg == "--profile")
+                {
+                    options.profileFilePath = value;
+                }
+                else if(arg == "--profile-stacks")
+                {
+                    options.profileStacksFilePath = value;
+                }
+                else if(arg == "--disassembly")
+                {
+                    options.disassemblyFilePath = value;
+                }
+                else if(arg == "--trace")
+                {
+                    options.traceFilePath = value;
+                }
+                else if(value == "scalar" || value == "sse2" || value == "avx2")
+                {
+                    options.isPixelKernelsSet = true;
+                    options.pixelKernels = value == "scalar" ? PixelKernels::InstructionSet::Scalar
+                                         : value == "sse2"   ? PixelKernels::InstructionSet::SSE2
+                                                             : PixelKernels::InstructionSet::AVX2;
+                }
+                else
+                {
+                    std::cout << "Invalid value for " << arg << ": " << value << "\n";
+                    return false;
+                }
+            }
+            else if(!arg.empty() && arg[0] == '-')
+            {
+                std::cout << "Unknown option: " << arg << "\n";
+                return false;
+            }
+            else
+            {
+                options.romFilePath = arg;
+            }
+        }
+
+        if(options.isRealTime && options.mode != RunMode::Seconds)
+        {
+            std::cout << "--realtime needs --seconds\n";
+            return false;
+        }
+
+        // The history is made of whole frames, run on this thread
+        if(options.rewindInterval != 0 && (options.mode == RunMode::Instructions || options.isRealTime))
+        {
+            std::cout << "--rewind needs --frames or --seconds, without --realtime\n";
+            return false;
+        }
+
+        if(options.isRewindFrameSet && options.rewindInterval == 0)
+        {
+            std::cout << "--rewind-to needs --rewind\n";
+            return false;
+        }
+
+        // The emulation thread starts from the boot state
+        if(options.isRealTime && !options.loadStateFilePath.empty())
+        {
+            std::cout << "--load-state cannot be used with --realtime\n";
+            return false;
+        }
+
+        if(options.isDisassemblyFollowed && options.mode != RunMode::Frames && !options.isRealTime)
+        {
+            std::cout << "--disassembly-follow needs --frames or --realtime\n";
+            return false;
+        }
+
+        // The result is looked for between frames
+        if(options.isResultAwaited && options.mode != RunMode::Frames && options.mode != RunMode::Cycles)
+        {
+            std::cout << "--until-result needs --frames or --cycles\n";
+            return false;
+        }
+
+        if(options.isMemoryFollowed && options.mode != RunMode::Frames)
+        {
+            std::cout << "--memory-follow needs --frames\n";
+            return false;
+        }
+
+        const bool isDebugged = !options.breakpoints.empty() || !options.watchpoints.empty() || options.isStepping ||
+                                options.isRunToSet;
+        if(isDebugged && (options.mode != RunMode::Frames || options.rewindInterval != 0))
+        {
+            std::cout << "--break, --watch, --step and --run-to need --frames, without --rewind\n";
+            return false;
+        }
+
+        return options.isOpcodeTablePrinted || !options.romFilePath.empty();
+    }
+
+    // Flags in the order Z N H C, as the opcode tables write them
+    std::string FormatFlagEffects(const FlagEffects& flags)
+    {
+        std::string text;
+        for(unsigned int i = 0; i < 4; ++i)
+        {
+            const uint8_t mask = static_cast<uint8_t>(0x80 >> i);
+            text += (flags.computed & mask) != 0 ? "ZNHC"[i] : (flags.set & mask) != 0 ? '1' : (flags.reset & mask) != 0 ? '0' : '-';
+        }
+        return text;
+    }
+
+    // One line per opcode, the prefixed ones after the 0xCB prefix: "CB 7C  2   8   8  Z01-  BIT 7,H".
+    // The immediates of the instructions shown are zeros.
+    void PrintOpcodeTable()
+    {
+        std::cout << "Opcode Len Cyc Tkn Flags Idle Instruction\n" << std::hex << std::uppercase << std::setfill('0');
+        for(unsigned int prefix = 0; prefix < 2; ++prefix)
+        {
+            for(unsigned int opcode = 0; opcode < 256; ++opcode)
+            {
+                const OpcodeInfo& info = prefix != 0 ? Opcodes::GetCB(static_cast<uint8_t>(opcode))
+                                                     : Opcodes::Get(static_cast<uint8_t>(opcode));
+                const uint8_t bytes[]{prefix != 0 ? Opcodes::m_CB_PREFIX : static_cast<uint8_t>(opcode),
+                                      static_cast<uint8_t>(prefix != 0 ? opcode : 0), 0, 0};
+                const bool isPrefix = prefix == 0 && opcode == Opcodes::m_CB_PREFIX;
+                const std::string text = isPrefix ? info.mnemonic : Disassembler::Disassemble(0, bytes);
+
+                std::cout << (prefix != 0 ? "CB " : "   ") << std::setw(2) << opcode << std::dec << std::setfill(' ')
+                          << std::setw(4) << static_cast<unsigned int>(info.length)
+                          << std::setw(4) << static_cast<unsigned int>(info.cycles)
+                          << std::setw(4) << static_cast<unsigned int>(info.takenCycles)
+                          << "  " << FormatFlagEffects(info.flags)
+                          << (CPU::IsIdleLoopOpcode(static_cast<uint8_t>(opcode), prefix != 0) ? "  yes  " : "  -    ")
+                          << text << "\n"
+                          << std::hex << std::setfill('0');
+            }
+        }
+        std::cout << std::dec << std::nouppercase << std::setfill(' ');
+    }
+
+    bool WriteProfile(const Profiler& profiler, const std::string& filePath, bool isCollapsedStacks)
+    {
+        std::ofstream file{filePath};
+        if(!file)
+        {
+            return false;
+        }
+
+        if(isCollapsedStacks)
+        {
+            profiler.WriteCollapsedStacks(file);
+        }
+        else
+        {
+            profiler.WriteReport(file);
+        }
+
+        return file.good();
+    }
+
+    // One line per instruction: "BB:AAAA  bytes  instruction", addresses outside ROM have no bank
+    bool WriteDisassembly(Emulator& emu, const std::string& filePath)
+    {
+        std::ofstream file{filePath};
+        if(!file)
+        {
+            return false;
+        }
+
+        const Memory& mem = emu.GetMemory();
+        const std::vector<DisassemblyCache::Line>& lines = emu.GetDisassembly().GetLines(emu.GetCPUState().pc);
+
+        std::vector<uint8_t> memory(0x10000);
+        mem.Peek(0x0000, memory.data(), memory.size());
+
+        file << std::hex << std::uppercase << std::setfill('0');
+        for(const DisassemblyCache::Line& line : lines)
+        {
+            if(line.addr < 0x8000)
+            {
+                file << std::setw(2) << mem.GetROMBank(line.addr) << ":";
+            }
+            else
+            {
+                file << "   ";
+            }
+            file << std::setw(4) << line.addr << " ";
+
+            for(unsigned int i = 0; i < 3; ++i)
+            {
+                if(i < line.size)
+                {
+                    file << " " << std::setw(2) << static_cast<unsigned int>(memory[line.addr + i]);
+                }
+                else
+                {
+                    file << "   ";
+                }
+            }
+
+            file << "  " << (line.isData ? Disassembler::DisassembleData(memory[line.addr])
+                                         : Disassembler::Disassemble(line.addr, &memory[line.addr])) << "\n";
+        }
+
+        return file.good();
+    }
+
+    // Runs the emulator the way a frontend does, returns the number of frames the display received.
+    // With debug snapshots, counts those a debugger would receive.
+    uint64_t RunOnEmulationThread(Emulator& emu, std::chrono::nanoseconds duration, unsigned int fastForwardInterval,
+                                  const std::function<void()>& poll, bool isDebugEnabled, uint64_t& nbDebugSnapshots)
+    {
+        using Clock = std::chrono::steady_clock;
+
+        EmulationThread thread{emu};
+        thread.SetFastForward(fastForwardInterval != 0, fastForwardInterval);
+        thread.EnableDebugSnapshots(isDebugEnabled);
+        thread.Start();
+
+        uint64_t nbFramesReceived{};
+        const Clock::time_point deadline = Clock::now() + duration;
+        while(Clock::now() < deadline)
+        {
+            if(thread.GetFrames().Update())
+            {
+                ++nbFramesReceived;
+            }
+
+            // A snapshot lists the instruction at its PC
+            EmulationThread::DebugSnapshots& snapshots = thread.GetDebugSnapshots();
+            if(snapshots.Update())
+            {
+                const EmulationThread::DebugSnapshot& snapshot = snapshots.GetFrontBuffer();
+                const auto isPC = [&snapshot](const DisassemblyCache::Line& line){ return line.addr == snapshot.cpu.pc; };
+                if(std::any_of(snapshot.lines.begin(), snapshot.lines.end(), isPC))
+                {
+                    ++nbDebugSnapshots;
+                }
+            }
+
+            poll();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        thread.Stop();
+        return nbFramesReceived;
+    }
+
+    bool LoadState(Emulator& emu, const std::string& filePath)
+    {
+        std::ifstream file{filePath, std::ios::binary};
+        if(!file)
+        {
+            return false;
+        }
+
+        const std::vector<uint8_t> data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+        return emu.LoadState(data.data(), data.size());
+    }
+
+    bool SaveState(const Emulator& emu, const std::string& filePath)
+    {
+        std::vector<uint8_t> data;
+        emu.SaveState(data);
+
+        std::ofstream file{filePath, std::ios::binary};
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        return static_cast<bool>(file);
+    }
+
+    // Blargg's test ROMs without serial output leave a status code at $A000, then a signature and a text
+    void PrintReport(const Emulator& emu)
+    {
+        const std::array<uint8_t, 0x20000>& ram = emu.GetMemoryState().externalRAM;
+        if(ram[1] != 0xDE || ram[2] != 0xB0 || ram[3] != 0x61)
+        {
+            std::cout << "Test result:      none\n";
+            return;
+        }
+
+        std::string text;
+        for(size_t i = 4; i < ram.size() && ram[i] != 0; ++i)
+        {
+            text += static_cast<char>(ram[i]);
+        }
+
+        // 0x80 while still running
+        std::cout << "Test result:      " << static_cast<unsigned int>(ram[0]) << "\n"
+                  << text << (text.empty() || text.back() == '\n' ? "" : "\n");
+    }
+
+    void PrintState(const Emulator& emu, uint64_t framebufferHash)
+    {
+        const CPU::State cpuState = emu.GetCPUState();
+        const Memory::State& memState = emu.GetMemoryState();
+
+        uint64_t hash = HashBytes(memState.vram.data(), memState.vram.size());
+        hash = HashBytes(memState.wram.data(), memState.wram.size(), hash);
+        hash = HashBytes(memState.oam.data(), memState.oam.size(), hash);
+        hash = HashBytes(memState.io.data(), memState.io.size(), hash);
+        hash = HashBytes(memState.hram.data(), memState.hram.size(), hash);
+        hash = HashBytes(&memState.ie, 1, hash);
+        hash = HashBytes(memState.externalRAM.data(), memState.externalRAM.size(), hash);
+
+        auto pair = [&cpuState](unsigned int idx)
+        {
+            return (cpuState.regs[idx] << 8) | cpuState.regs[idx + 1];
+        };
+
+        std::cout << std::hex << std::setfill('0')
+                  << "Registers:        AF=" << std::setw(4) << pair(0) << " BC=" << std::setw(4) << pair(2)
+                  << " DE=" << std::setw(4) << pair(4) << " HL=" << std::setw(4) << pair(6)
+                  << " SP=" << std::setw(4) << cpuState.sp << " PC=" << std::setw(4) << cpuState.pc
+                  << " IME=" << cpuState.ime << "\n"
+                  << "Memory hash:      " << std::setw(16) << hash << "\n"
+                  << "Framebuffer hash: " << std::setw(16) << framebufferHash << "\n"
+                  << std::dec << std::setfill(' ');
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    if(options.isOpcodeTablePrinted)
+    {
+        PrintOpcodeTable();
+        return 0;
+    }
+
+    Emulator emu;
+    if(!emu.LoadCartridge(options.romFilePath))
+    {
+        std::cout << "Unable to load ROM: " << options.romFilePath << "\n";
+        return 1;
+    }
+
+    emu.Reset();
+    if(!options.loadStateFilePath.empty() && !LoadState(emu, options.loadStateFilePath))
+    {
+        std::cout << "Unable to load state: " << options.loadStateFilePath << "\n";
+        return 1;
+    }
+
+    emu.SetExecutionMode(options.executionMode);
+    emu.EnableJITLockstep(options.isJITLockstepEnabled);
+    emu.EnableJITPerfMap(options.isJITPerfMapEnabled);
+
+    const bool isProfilerEnabled = !options.profileFilePath.empty() || !options.profileStacksFilePath.empty();
+    if(isProfilerEnabled && !emu.EnableProfiler(true))
+    {
+        std::cout << "Profiler not available, build with GB_PROFILER\n";
+        return 1;
+    }
+
+    // Runs without --realtime are unthrottled already, fast-forwarding only skips drawing
+    emu.SetFrameSkip(std::max(options.fastForwardInterval, 1u));
+
+    // The watcher reads the serial output and prints it when asked to
+    std::unique_ptr<TestResultWatcher> resultWatcher;
+    if(options.isResultAwaited)
+    {
+        resultWatcher = std::make_unique<TestResultWatcher>(emu, options.isSerialOutputEnabled ? &std::cout : nullptr);
+    }
+    else if(options.isSerialOutputEnabled)
+    {
+        emu.SetSerialOutputHandler([](uint8_t byte){ std::cout << static_cast<char>(byte) << std::flush; });
+    }
+
+    if(options.isPixelKernelsSet && !emu.SetPixelKernels(options.pixelKernels))
+    {
+        std::cout << "Pixel kernels not supported by this host\n";
+        return 1;
+    }
+
+    // Every frame goes into the hash, not only the last one
+    uint64_t framebufferHash = HashBytes(nullptr, 0);
+    if(options.isStateDumpEnabled)
+    {
+        emu.SetFrameHandler([&framebufferHash](const PPU::Framebuffer& frame)
+        {
+            framebufferHash = HashBytes(reinterpret_cast<const uint8_t*>(frame.data()), sizeof(frame), framebufferHash);
+        });
+    }
+
+    const bool isRecording = !options.wavFilePath.empty();
+    WavRecorder wavRecorder{emu.GetAudioOutput()};
+    if(isRecording)
+    {
+        if(!wavRecorder.Open(options.wavFilePath))
+        {
+            std::cout << "Unable to open WAV file: " << options.wavFilePath << "\n";
+            return 1;
+        }
+
+        emu.EnableAudio(true);
+    }
+
+    if(!options.traceFilePath.empty() && !emu.StartTrace(options.traceFilePath))
+    {
+        std::cout << "Unable to write trace: " << options.traceFilePath << "\n";
+        return 1;
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    // While recording, the sound output is drained after each slice of emulation, before it can overflow
+    const auto drainAudio = [&wavRecorder, isRecording]()
+    {
+        if(isRecording)
+        {
+            wavRecorder.Drain();
+        }
+    };
+
+    std::unique_ptr<DebugSession> debugSession;
+    if(!options.breakpoints.empty() || !options.watchpoints.empty() || options.isStepping || options.isRunToSet)
+    {
+        Debugger& debugger = emu.GetDebugger();
+        for(uint16_t addr : options.breakpoints)
+        {
+            debugger.SetBreakpoint(addr, true);
+        }
+        for(const Debugger::Watchpoint& watchpoint : options.watchpoints)
+        {
+            debugger.AddWatchpoint(watchpoint);
+        }
+        if(options.isRunToSet)
+        {
+            debugger.RunTo(options.runToAddr);
+        }
+        debugSession = std::make_unique<DebugSession>(emu, options.isStepping, options.isSteppingOver);
+    }
+
+    const bool isRewindEnabled = options.rewindInterval != 0;
+    RewindBuffer rewindBuffer{emu, std::max(options.rewindInterval, 1u), options.rewindMemoryCap};
+    const auto runFrames = [&emu, &rewindBuffer, &debugSession, isRewindEnabled](uint64_t nbFrames)
+    {
+        if(isRewindEnabled)
+        {
+            rewindBuffer.RunFrames(nbFrames);
+        }
+        else if(debugSession != nullptr)
+        {
+            debugSession->RunFrames(nbFrames);
+        }
+        else
+        {
+            emu.RunFrames(nbFrames);
+        }
+    };
+
+    std::unique_ptr<MemoryFollower> memoryFollower;
+    if(options.isMemoryFollowed)
+    {
+        memoryFollower = std::make_unique<MemoryFollower>(emu);
+    }
+
+    uint64_t nbFramesReceived{};
+    uint64_t nbDebugSnapshots{};
+    switch(options.mode)
+    {
+        case RunMode::Instructions: 
+        {
+            const uint64_t nbInstructions = static_cast<uint64_t>(options.amount);
+            const uint64_t sliceSize = isRecording ? s_RECORDING_SLICE_INSTRUCTIONS : nbInstructions;
+            for(uint64_t nbDone = 0; nbDone < nbInstructions; nbDone += sliceSize)
+            {
+                emu.RunInstructions(std::min(sliceSize, nbInstructions - nbDone));
+                drainAudio();
+            }
+            break;
+        }
+        case RunMode::Cycles: 
+        {
+            const uint64_t nbCycles = static_cast<uint64_t>(options.amount);
+            const uint64_t sliceSize = isRecording || resultWatcher != nullptr ? Emulator::m_CYCLES_PER_FRAME : nbCycles;
+            for(uint64_t nbDone = 0; nbDone < nbCycles; nbDone += sliceSize)
+            {
+                emu.RunCycles(std::min(sliceSize, nbCycles - nbDone));
+                drainAudio();
+
+                if(resultWatcher != nullptr && resultWatcher->Update())
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        case RunMode::Frames: 
+        {
+            const uint64_t nbFrames = static_cast<uint64_t>(options.amount);
+            const bool isFollowed = options.isDisassemblyFollowed || options.isMemoryFollowed || resultWatcher != nullptr;
+            const uint64_t sliceSize = isRecording || isFollowed ? 1 : nbFrames;
+            for(uint64_t nbDone = 0; nbDone < nbFrames; nbDone += sliceSize)
+            {
+                runFrames(std::min(sliceSize, nbFrames - nbDone));
+                drainAudio();
+
+                if(options.isDisassemblyFollowed)
+                {
+                    emu.GetDisassembly().GetLines(emu.GetCPUState().pc);
+                }
+                if(memoryFollower != nullptr)
+                {
+                    memoryFollower->Update();
+                }
+                if(resultWatcher != nullptr && resultWatcher->Update())
+                {
+                    break;
+                }
+            }
+            break;
+        }
+        case RunMode::Seconds: 
+        {
+            const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::duration<double>(options.amount));
+            if(options.isRealTime)
+            {
+                nbFramesReceived = RunOnEmulationThread(emu, duration, options.fastForwardInterval, drainAudio,
+                                                        options.isDisassemblyFollowed, nbDebugSnapshots);
+            }
+            else if(isRecording || isRewindEnabled)
+            {
+                const Clock::time_point deadline = Clock::now() + duration;
+                while(Clock::now() < deadline)
+                {
+                    runFrames(1);
+                    drainAudio();
+                }
+            }
+            else
+            {
+                emu.RunFor(duration);
+            }
+            break;
+        }
+    }
+
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    const double seconds = elapsed.count();
+
+    // Before rewinding, the trace is of the run
+    if(!emu.StopTrace())
+    {
+        std::cout << "Unable to write trace: " << options.traceFilePath << "\n";
+        return 1;
+    }
+
+    if(options.isRewindFrameSet && !rewindBuffer.RewindTo(options.rewindFrame))
+    {
+        std::cout << "Unable to rewind to frame " << options.rewindFrame << ", the history covers frames "
+                  << rewindBuffer.GetOldestFrame() << " to " << emu.GetFrameCount() << "\n";
+        return 1;
+    }
+
+    if(isRecording)
+    {
+        emu.EnableAudio(false);
+        wavRecorder.Drain();
+        if(!wavRecorder.Close())
+        {
+            std::cout << "Unable to write WAV file: " << options.wavFilePath << "\n";
+            return 1;
+        }
+    }
+
+    const uint64_t nbInstructions = emu.GetInstructionCount();
+    const uint64_t nbCycles = emu.GetCycleCount();
+    const double emulatedSeconds = static_cast<double>(nbCycles) / Emulator::m_CLOCK_RATE;
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "ROM:              " << options.romFilePath << "\n"
+              << "Instructions:     " << nbInstructions << "\n"
+              << "Cycles:           " << nbCycles << "\n"
+              << "Frames:           " << emu.GetFrameCount() << "\n"
+              << "Wall time:        " << seconds << " s\n"
+              << "Instructions/sec: " << nbInstructions / seconds << "\n"
+              << "Cycles/sec:       " << nbCycles / seconds << "\n"
+              << "Speed:            " << emulatedSeconds / seconds << "x real hardware\n";
+
+    if(options.isRealTime)
+    {
+        std::cout << "Frames received:  " << nbFramesReceived << "\n";
+        if(options.isDisassemblyFollowed)
+        {
+            std::cout << "Debug snapshots:  " << nbDebugSnapshots << "\n";
+        }
+    }
+
+    if(isRewindEnabled)
+    {
+        const std::chrono::duration<double> snapshotTime = rewindBuffer.GetSnapshotTime();
+        std::cout << "Rewind history:   " << rewindBuffer.GetNbSnapshots() << " snapshots from frame "
+                  << rewindBuffer.GetOldestFrame() << ", " << rewindBuffer.GetMemoryUsage() / 1024 << " KB\n"
+                  << "Snapshot time:    " << snapshotTime.count() * 1000 << " ms, "
+                  << snapshotTime.count() / seconds * 100 << "% of the run\n";
+    }
+
+    if(memoryFollower != nullptr)
+    {
+        std::cout << "Stale pages:      " << memoryFollower->CountStalePages() << "\n";
+    }
+
+    if(debugSession != nullptr)
+    {
+        debugSession->WriteStops(std::cout);
+    }
+
+    if(options.isStateDumpEnabled)
+    {
+        PrintState(emu, framebufferHash);
+    }
+
+    if(options.isReportEnabled)
+    {
+        PrintReport(emu);
+    }
+
+    if(!options.saveStateFilePath.empty() && !SaveState(emu, options.saveStateFilePath))
+    {
+        std::cout << "Unable to save state: " << options.saveStateFilePath << "\n";
+        return 1;
+    }
+
+    if(!options.screenshotFilePath.empty() && !WritePPM(emu.GetFramebuffer(), options.screenshotFilePath))
+    {
+        std::cout << "Unable to save screenshot: " << options.screenshotFilePath << "\n";
+        return 1;
+    }
+
+    if(!options.profileFilePath.empty() && !WriteProfile(*emu.GetProfiler(), options.profileFilePath, false))
+    {
+        std::cout << "Unable to write profile: " << options.profileFilePath << "\n";
+        return 1;
+    }
+
+    if(!options.profileStacksFilePath.empty() && !WriteProfile(*emu.GetProfiler(), options.profileStacksFilePath, true))
+    {
+        std::cout << "Unable to write profile: " << options.profileStacksFilePath << "\n";
+        return 1;
+    }
+
+    if(!options.disassemblyFilePath.empty() && !WriteDisassembly(emu, options.disassemblyFilePath))
+    {
+        std::cout << "Unable to write disassembly: " << options.disassemblyFilePath << "\n";
+        return 1;
+    }
+
+    const bool isResultPassed = resultWatcher == nullptr || resultWatcher->GetStatus() == TestResultWatcher::Status::Passed;
+    if(resultWatcher != nullptr)
+    {
+        resultWatcher->WriteStatus(std::cout);
+    }
+
+    if(options.isJITLockstepEnabled)
+    {
+        const uint64_t nbMismatches = emu.GetJITMismatchCount();
+        std::cout << "JIT mismatches:   " << nbMismatches << "\n";
+        return nbMismatches == 0 && isResultPassed ? 0 : 1;
+    }
+
+    return isResultPassed ? 0 : 1;
+}
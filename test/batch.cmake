@@ -0,0 +1,23 @@
+# Runs gb-batch on a job list of test ROMs reporting through the serial port, and fails unless every
+# job passed.
+#
+# Expected variables: RUNNER, the gb-batch executable, JOBS, the job list, and WORK_DIR, where the
+# screenshots are written. OPTIONS is an optional list of gb-batch options such as --jit.
+
+execute_process(COMMAND ${RUNNER} ${OPTIONS} --output-dir ${WORK_DIR} ${JOBS}
+                OUTPUT_VARIABLE output
+                RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${RUNNER} failed:\n${output}")
+endif()
+
+# One line per job, the serial output is escaped on its own column
+file(STRINGS ${JOBS} jobs REGEX "^[0-9]")
+list(LENGTH jobs nb_jobs)
+string(REGEX MATCHALL "\n[0-9]+\tdone\t[^\n]*\\\\nPassed\\\\n\t" passed "${output}")
+list(LENGTH passed nb_passed)
+
+if(NOT nb_passed EQUAL nb_jobs)
+    message(FATAL_ERROR "${nb_passed} of ${nb_jobs} jobs passed:\n${output}")
+endif()
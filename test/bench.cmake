@@ -0,0 +1,48 @@
+# Runs the benchmarks of gb-bench briefly and checks its JSON results: every family of the CPU, every memory region,
+# rendering and save states must be reported, with a positive time per operation.
+#
+# Expected variables: RUNNER, the gb-bench executable, and OUTPUT, the JSON file to write.
+
+execute_process(COMMAND ${RUNNER} --quick --repeat 1 --output ${OUTPUT}
+                OUTPUT_VARIABLE output
+                ERROR_VARIABLE output
+                RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${RUNNER} failed:\n${output}")
+endif()
+
+file(READ ${OUTPUT} json)
+string(JSON tool ERROR_VARIABLE error GET "${json}" tool)
+if(error OR NOT tool STREQUAL "gb-bench")
+    message(FATAL_ERROR "Invalid results in ${OUTPUT}: ${error}\n${json}")
+endif()
+
+set(expected_names
+    cpu.load8 cpu.alu8 cpu.cb cpu.stack cpu.control
+    memory.read.rom0 memory.read.romx memory.write.mbc memory.read.vram memory.write.vram memory.read.sram
+    memory.write.sram memory.read.wram memory.write.wram memory.read.echo memory.write.echo memory.read.oam
+    memory.write.oam memory.read.io memory.read.hram memory.write.hram
+    render.frame.scalar render.frame.best render.frame.skipped
+    state.save state.load)
+
+string(JSON nb_results LENGTH "${json}" results)
+set(names "")
+math(EXPR last "${nb_results} - 1")
+foreach(i RANGE ${last})
+    string(JSON name GET "${json}" results ${i} name)
+    string(JSON ns_per_op GET "${json}" results ${i} ns_per_op)
+    if(NOT ns_per_op GREATER 0)
+        message(FATAL_ERROR "${name}: ${ns_per_op} ns per operation")
+    endif()
+    list(APPEND names ${name})
+endforeach()
+
+foreach(name IN LISTS expected_names)
+    list(FIND names ${name} index)
+    if(index EQUAL -1)
+        message(FATAL_ERROR "No ${name} in the results:\n${json}")
+    endif()
+endforeach()
+
+message(STATUS "${nb_results} benchmarks:\n${output}")
@@ -0,0 +1,11 @@
+# Check of headless_compare.cmake for a disassembly made at the end and one kept up to date: the listing given to
+# --disassembly covers the address space and shows the instruction at the PC.
+
+get_headless_option(disassembly_file "${RUN_A_ARGS}" --disassembly)
+
+string(REGEX MATCH "PC=([0-9a-f]+)" _ "${state_a}")
+string(TOUPPER ${CMAKE_MATCH_1} pc)
+file(STRINGS ${disassembly_file} pc_line REGEX "^(..:|   )${pc} ")
+if(NOT pc_line)
+    message(FATAL_ERROR "No line at PC=${pc} in ${disassembly_file}")
+endif()
@@ -0,0 +1,55 @@
+# Helpers of the scripts running gb-headless on a ROM and comparing the states it ends in, included by them.
+#
+# Expected variables: ROM, the ROM every run is given. STATE_FIELDS optionally lists the lines of the dumped state
+# compared, when some of the default ones do not cover the same thing in every run.
+
+# Only what does not depend on the host
+if(NOT STATE_FIELDS)
+    set(STATE_FIELDS Instructions Cycles Registers "Memory hash" "Framebuffer hash")
+endif()
+
+# Runs a gb-headless executable with the given options and --dump-state, fails when it does. Sets state_var to the
+# lines of the state in STATE_FIELDS and output_var to the whole output.
+function(run_headless state_var output_var runner)
+    execute_process(COMMAND ${runner} ${ARGN} --dump-state ${ROM}
+                    OUTPUT_VARIABLE output
+                    RESULT_VARIABLE result)
+
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${runner} ${ARGN} failed:\n${output}")
+    endif()
+
+    string(REPLACE ";" "|" fields "${STATE_FIELDS}")
+    string(REGEX MATCHALL "(${fields}):[^\n]*" state "${output}")
+    set(${state_var} "${state}" PARENT_SCOPE)
+    set(${output_var} "${output}" PARENT_SCOPE)
+endfunction()
+
+# Fails unless two runs, described by their names, ended in the same state
+function(compare_headless_states name_a state_a name_b state_b)
+    if(NOT state_a STREQUAL state_b)
+        string(REPLACE ";" "\n" state_a "${state_a}")
+        string(REPLACE ";" "\n" state_b "${state_b}")
+        message(FATAL_ERROR "States differ\n${name_a}:\n${state_a}\n${name_b}:\n${state_b}")
+    endif()
+endfunction()
+
+# Fails unless two files written by the runs, such as screenshots, are the same
+function(compare_headless_files file_a file_b)
+    file(SHA1 ${file_a} hash_a)
+    file(SHA1 ${file_b} hash_b)
+    if(NOT hash_a STREQUAL hash_b)
+        message(FATAL_ERROR "Files differ: ${file_a} ${file_b}")
+    endif()
+endfunction()
+
+# Value given to an option in a list of options, empty when the option is not there
+function(get_headless_option value_var options option)
+    list(FIND options ${option} index)
+    set(value "")
+    if(NOT index EQUAL -1)
+        math(EXPR index "${index} + 1")
+        list(GET options ${index} value)
+    endif()
+    set(${value_var} "${value}" PARENT_SCOPE)
+endfunction()
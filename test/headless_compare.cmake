@@ -0,0 +1,36 @@
+# Runs gb-headless on a ROM with two sets of options, and fails unless both runs end in the same state: what the
+# second set adds must not change the run.
+#
+# Expected variables: RUNNER_A and RUNNER_B, the executables of the runs, ROM, and RUN_A_ARGS and RUN_B_ARGS, the
+# options of each run. Optionally:
+# - STATE_FIELDS, see headless_common.cmake
+# - SETUP_ARGS, the options of a run of RUNNER_A made first, such as one saving a state the others load
+# - FILE_A and FILE_B, files written by the runs that must be the same
+# - OUTPUT_B_REGEX, a regular expression the output of the second run must match
+# - CHECK_SCRIPT, a script included last to check more, with the states and outputs of the runs in state_a,
+#   state_b, output_a and output_b
+
+include(${CMAKE_CURRENT_LIST_DIR}/headless_common.cmake)
+
+if(SETUP_ARGS)
+    run_headless(state_setup output_setup ${RUNNER_A} ${SETUP_ARGS})
+endif()
+
+run_headless(state_a output_a ${RUNNER_A} ${RUN_A_ARGS})
+run_headless(state_b output_b ${RUNNER_B} ${RUN_B_ARGS})
+
+string(REPLACE ";" " " name_a "${RUNNER_A} ${RUN_A_ARGS}")
+string(REPLACE ";" " " name_b "${RUNNER_B} ${RUN_B_ARGS}")
+compare_headless_states("${name_a}" "${state_a}" "${name_b}" "${state_b}")
+
+if(FILE_A OR FILE_B)
+    compare_headless_files(${FILE_A} ${FILE_B})
+endif()
+
+if(OUTPUT_B_REGEX AND NOT output_b MATCHES "${OUTPUT_B_REGEX}")
+    message(FATAL_ERROR "Unexpected output of ${name_b}, not matching ${OUTPUT_B_REGEX}:\n${output_b}")
+endif()
+
+if(CHECK_SCRIPT)
+    include(${CHECK_SCRIPT})
+endif()
@@ -0,0 +1,78 @@
+# Compares the opcodes idle loops may contain, as printed by gb-headless --opcode-table, to the instructions that
+# write nothing but A and F and only read memory at addresses that stay the same between iterations.
+#
+# Expected variables: RUNNER, the gb-headless executable.
+
+execute_process(COMMAND ${RUNNER} --opcode-table
+                OUTPUT_VARIABLE output
+                RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${RUNNER} --opcode-table failed:\n${output}")
+endif()
+
+set(digits 0 1 2 3 4 5 6 7 8 9 A B C D E F)
+
+# Every opcode of the table lines, as printed in the table, with the given prefix
+function(add_lines list_var prefix)
+    set(opcodes ${${list_var}})
+    foreach(line ${ARGN})
+        foreach(digit IN LISTS digits)
+            list(APPEND opcodes "${prefix}${line}${digit}")
+        endforeach()
+    endforeach()
+    set(${list_var} ${opcodes} PARENT_SCOPE)
+endfunction()
+
+# NOP, RLCA, LD A,(BC), RRCA, RLA, LD A,(DE), RRA, DAA, CPL, SCF, INC A, DEC A, LD A,d8 and CCF
+set(expected 00 07 0A 0F 17 1A 1F 27 2F 37 3C 3D 3E 3F)
+
+# LD A,r and the arithmetic on A, not LD r,A nor LD (HL),A
+list(APPEND expected 78 79 7A 7B 7C 7D 7E 7F)
+add_lines(expected "" 8 9 A B)
+
+# The arithmetic with an immediate, LDH A,(a8), LD A,(C) and LD A,(a16)
+list(APPEND expected C6 CE D6 DE E6 EE F0 F2 F6 FA FE)
+
+# The rotations and shifts of A, BIT, and RES and SET on A
+list(APPEND expected CB07 CB0F CB17 CB1F CB27 CB2F CB37 CB3F)
+add_lines(expected "CB" 4 5 6 7)
+foreach(line 8 9 A B C D E F)
+    list(APPEND expected "CB${line}7" "CB${line}F")
+endforeach()
+
+string(REGEX MATCHALL "\n(CB|  ) [0-9A-F][0-9A-F] +[0-9]+ +[0-9]+ +[0-9]+ +[-Z0-9HNC]+ +(yes|-)" rows "${output}")
+list(LENGTH rows nb_rows)
+if(NOT nb_rows EQUAL 512)
+    message(FATAL_ERROR "Expected 512 opcodes, got ${nb_rows}:\n${output}")
+endif()
+
+set(actual "")
+foreach(row IN LISTS rows)
+    string(REGEX MATCH "(CB|  ) ([0-9A-F][0-9A-F]) .* (yes|-)$" _ "${row}")
+    if(CMAKE_MATCH_3 STREQUAL "yes")
+        string(STRIP "${CMAKE_MATCH_1}" prefix)
+        list(APPEND actual "${prefix}${CMAKE_MATCH_2}")
+    endif()
+endforeach()
+
+set(errors "")
+foreach(opcode IN LISTS actual)
+    list(FIND expected ${opcode} index)
+    if(index EQUAL -1)
+        string(APPEND errors "${opcode} is allowed in idle loops\n")
+    endif()
+endforeach()
+foreach(opcode IN LISTS expected)
+    list(FIND actual ${opcode} index)
+    if(index EQUAL -1)
+        string(APPEND errors "${opcode} is not allowed in idle loops\n")
+    endif()
+endforeach()
+
+if(errors)
+    message(FATAL_ERROR "Idle loop opcodes differ:\n${errors}")
+endif()
+
+list(LENGTH actual nb_opcodes)
+message(STATUS "${nb_opcodes} idle loop opcodes as expected")
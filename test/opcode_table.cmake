@@ -0,0 +1,94 @@
+# Compares the opcode table of the core, as printed by gb-headless --opcode-table, to the tables instr_timing checks
+# the CPU against: instruction lengths, cycles with the conditional branches not taken and taken, and the cycles of
+# the prefixed instructions. The test ROM counts in M-cycles of 4 clock cycles, and leaves the opcodes it does not
+# time at 0.
+#
+# Expected variables: RUNNER, the gb-headless executable, and SOURCE, the instr_timing.s source of the test ROM.
+
+execute_process(COMMAND ${RUNNER} --opcode-table
+                OUTPUT_VARIABLE output
+                RESULT_VARIABLE result)
+
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${RUNNER} --opcode-table failed:\n${output}")
+endif()
+
+# The 16 lines of 16 values following a label of the source, as a list of 256 values
+function(read_rom_table label result_var)
+    file(READ ${SOURCE} source)
+    string(FIND "${source}" "\n${label}:" pos)
+    if(pos EQUAL -1)
+        message(FATAL_ERROR "No ${label} table in ${SOURCE}")
+    endif()
+    string(SUBSTRING "${source}" ${pos} -1 source)
+
+    string(REGEX MATCHALL "\\.byte [0-9,]+" lines "${source}")
+    list(SUBLIST lines 0 16 lines)
+    string(REPLACE ".byte " "" values "${lines}")
+    string(REPLACE "," ";" values "${values}")
+
+    list(LENGTH values nb_values)
+    if(NOT nb_values EQUAL 256)
+        message(FATAL_ERROR "${label} has ${nb_values} values in ${SOURCE}")
+    endif()
+    set(${result_var} "${values}" PARENT_SCOPE)
+endfunction()
+
+read_rom_table(op_lens rom_lengths)
+read_rom_table(op_times rom_cycles)
+read_rom_table(op_times_taken rom_taken_cycles)
+read_rom_table(cb_op_times rom_cb_cycles)
+
+string(REGEX MATCHALL "\n(CB|  ) [0-9A-F][0-9A-F] +[0-9]+ +[0-9]+ +[0-9]+" rows "${output}")
+list(LENGTH rows nb_rows)
+if(NOT nb_rows EQUAL 512)
+    message(FATAL_ERROR "Expected 512 opcodes, got ${nb_rows}:\n${output}")
+endif()
+
+set(errors "")
+set(nb_checks 0)
+
+# Compares a value of the table to the one of the test ROM in M-cycles, unless the ROM does not time the opcode
+function(check_value row what actual expected scale)
+    if(NOT expected EQUAL 0)
+        math(EXPR expected "${expected} * ${scale}")
+        if(NOT actual EQUAL expected)
+            set(errors "${errors}${row}: ${what} ${actual}, instr_timing expects ${expected}\n" PARENT_SCOPE)
+        endif()
+        math(EXPR nb_checks "${nb_checks} + 1")
+        set(nb_checks ${nb_checks} PARENT_SCOPE)
+    endif()
+endfunction()
+
+foreach(row IN LISTS rows)
+    string(REGEX MATCH "(CB|  ) ([0-9A-F][0-9A-F]) +([0-9]+) +([0-9]+) +([0-9]+)" _ "${row}")
+    set(prefix ${CMAKE_MATCH_1})
+    math(EXPR opcode "0x${CMAKE_MATCH_2}")
+    set(length ${CMAKE_MATCH_3})
+    set(cycles ${CMAKE_MATCH_4})
+    set(taken_cycles ${CMAKE_MATCH_5})
+    string(STRIP "${prefix} ${CMAKE_MATCH_2}" name)
+
+    if(prefix STREQUAL "CB")
+        list(GET rom_cb_cycles ${opcode} expected)
+        check_value(${name} cycles ${cycles} ${expected} 4)
+        check_value(${name} "taken cycles" ${taken_cycles} ${expected} 4)
+    else()
+        list(GET rom_lengths ${opcode} expected)
+        check_value(${name} length ${length} ${expected} 1)
+        list(GET rom_cycles ${opcode} expected)
+        check_value(${name} cycles ${cycles} ${expected} 4)
+        list(GET rom_taken_cycles ${opcode} expected)
+        check_value(${name} "taken cycles" ${taken_cycles} ${expected} 4)
+    endif()
+endforeach()
+
+if(errors)
+    message(FATAL_ERROR "Opcode table differs from instr_timing:\n${errors}")
+endif()
+
+# Every opcode the ROM times must have been compared
+if(nb_checks LESS 1200)
+    message(FATAL_ERROR "Only ${nb_checks} values compared to instr_timing")
+endif()
+message(STATUS "${nb_checks} values match instr_timing")
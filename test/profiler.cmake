@@ -0,0 +1,37 @@
+# Check of headless_compare.cmake for a run without and a run with the profiler: the profile must account for all
+# of the run, every instruction in the report given to --profile, every cycle in the call stacks given to
+# --profile-stacks.
+
+get_headless_option(report_file "${RUN_B_ARGS}" --profile)
+get_headless_option(stacks_file "${RUN_B_ARGS}" --profile-stacks)
+
+string(REGEX MATCH "Instructions: +([0-9]+)" _ "${state_a}")
+set(nb_instructions ${CMAKE_MATCH_1})
+string(REGEX MATCH "Cycles: +([0-9]+)" _ "${state_a}")
+set(nb_cycles ${CMAKE_MATCH_1})
+
+file(READ ${report_file} report)
+string(REGEX MATCH "Instructions: +([0-9]+)" _ "${report}")
+if(NOT CMAKE_MATCH_1 STREQUAL nb_instructions)
+    message(FATAL_ERROR "The report counts ${CMAKE_MATCH_1} instructions instead of ${nb_instructions}:\n${report}")
+endif()
+
+foreach(section "Opcodes" "Addresses" "Banks" "Functions")
+    if(NOT report MATCHES "\n${section}, [1-9][0-9]* ")
+        message(FATAL_ERROR "The report has no ${section}:\n${report}")
+    endif()
+endforeach()
+
+# Collapsed stacks: "reset;caller;callee cycles", summing up to the whole run
+file(STRINGS ${stacks_file} stacks)
+set(stacks_cycles 0)
+foreach(stack ${stacks})
+    if(NOT stack MATCHES "^reset(;[^; ]+)* ([0-9]+)$")
+        message(FATAL_ERROR "Invalid collapsed stack: ${stack}")
+    endif()
+    math(EXPR stacks_cycles "${stacks_cycles} + ${CMAKE_MATCH_2}")
+endforeach()
+
+if(NOT stacks_cycles EQUAL nb_cycles)
+    message(FATAL_ERROR "The call stacks add up to ${stacks_cycles} cycles instead of ${nb_cycles}")
+endif()
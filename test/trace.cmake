@@ -0,0 +1,38 @@
+# Records execution traces of a ROM with the interpreter, the block cache and native code, which gb-tracediff must
+# find identical where they have records, then checks that it finds where the trace of another ROM diverges.
+#
+# Expected variables: RUNNER, the gb-headless executable, DIFF, the gb-tracediff executable, ROM and OTHER_ROM, the
+# ROMs to trace, FRAMES, the number of frames to run, and OUTPUT_DIR, where to write the traces.
+
+function(record_trace name rom options)
+    execute_process(COMMAND ${RUNNER} --frames ${FRAMES} ${options} --trace ${OUTPUT_DIR}/${name}.trace ${rom}
+                    OUTPUT_VARIABLE output
+                    ERROR_VARIABLE output
+                    RESULT_VARIABLE result)
+    if(NOT result EQUAL 0 OR output MATCHES "Unable to write trace")
+        message(FATAL_ERROR "Unable to record the ${name} trace:\n${output}")
+    endif()
+endfunction()
+
+function(diff_traces a b expected_result expected_output)
+    execute_process(COMMAND ${DIFF} ${OUTPUT_DIR}/${a}.trace ${OUTPUT_DIR}/${b}.trace
+                    OUTPUT_VARIABLE output
+                    ERROR_VARIABLE output
+                    RESULT_VARIABLE result)
+    if(NOT result EQUAL expected_result OR NOT output MATCHES "${expected_output}")
+        message(FATAL_ERROR "Unexpected comparison of the ${a} and ${b} traces (${result}):\n${output}")
+    endif()
+    message(STATUS "${a} / ${b}:\n${output}")
+endfunction()
+
+record_trace(interpreter ${ROM} "")
+record_trace(block_cache ${ROM} "--block-cache")
+record_trace(jit ${ROM} "--jit")
+record_trace(other ${OTHER_ROM} "")
+
+diff_traces(interpreter interpreter 0 "No divergence\n")
+diff_traces(interpreter block_cache 0 "No divergence where both traces have a record")
+diff_traces(block_cache interpreter 0 "No divergence where both traces have a record")
+diff_traces(jit interpreter 0 "No divergence where both traces have a record")
+diff_traces(jit block_cache 0 "No divergence")
+diff_traces(interpreter other 1 "First divergence: instruction [0-9]+.*\n  A: .*\n  B: .*\nLast match: +instruction")
@@ -0,0 +1,303 @@
+#include "core/trace.h"
+
+#include <algorithm>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Records of the denser trace shown before a divergence
+    constexpr size_t s_NB_CONTEXT_RECORDS = 16;
+
+    constexpr size_t s_NO_BLOCK = std::numeric_limits<size_t>::max();
+
+    // A trace with the last block it decoded, binary searches go back to the same blocks
+    struct Trace
+    {
+        std::string filePath;
+        TraceReader reader;
+        size_t blockIdx = s_NO_BLOCK;
+        std::vector<TraceRecord> records;
+        bool isDamaged = false;
+
+        const std::vector<TraceRecord>& GetBlock(size_t idx)
+        {
+            if(idx != blockIdx)
+            {
+                blockIdx = idx;
+                if(!reader.ReadBlock(idx, records))
+                {
+                    std::cout << "Damaged block " << idx << " in " << filePath << "\n";
+                    isDamaged = true;
+                    records.clear();
+                }
+            }
+            return records;
+        }
+
+        // Returns false when there is no record of the given instruction
+        bool FindRecord(uint64_t instruction, TraceRecord& record)
+        {
+            const size_t idx = reader.FindBlock(instruction);
+            if(idx == reader.GetBlocks().size() || reader.GetBlocks()[idx].lastRecord.instruction < instruction)
+            {
+                return false;
+            }
+
+            const std::vector<TraceRecord>& block = GetBlock(idx);
+            auto isBefore = [](const TraceRecord& record, uint64_t instruction){ return record.instruction < instruction; };
+            const auto it = std::lower_bound(block.begin(), block.end(), instruction, isBefore);
+            if(it == block.end() || it->instruction != instruction)
+            {
+                return false;
+            }
+
+            record = *it;
+            return true;
+        }
+
+        uint64_t GetLastInstruction() const
+        {
+            return reader.GetBlocks().empty() ? 0 : reader.GetBlocks().back().lastRecord.instruction;
+        }
+    };
+
+    std::string FormatRecord(const TraceRecord& record)
+    {
+        auto pair = [&record](unsigned int idx){ return (record.regs[idx] << 8) | record.regs[idx + 1]; };
+
+        std::ostringstream text;
+        text << "instruction " << record.instruction << ", cycle " << record.cycle << std::hex << std::uppercase
+             << std::setfill('0') << ": PC=" << std::setw(4) << record.pc << " (" << std::setw(2)
+             << static_cast<unsigned int>(record.opcode) << ") AF=" << std::setw(4) << pair(0) << " BC=" << std::setw(4)
+             << pair(2) << " DE=" << std::setw(4) << pair(4) << " HL=" << std::setw(4) << pair(6) << " SP=" << std::setw(4)
+             << record.sp << " IME=" << record.ime;
+        return text.str();
+    }
+
+    std::string FormatDifferences(const TraceRecord& a, const TraceRecord& b)
+    {
+        static constexpr const char* s_REGISTER_NAMES[] = {"A", "F", "B", "C", "D", "E", "H", "L"};
+
+        std::string text;
+        auto add = [&text](const char* name, bool isDifferent)
+        {
+            if(isDifferent)
+            {
+                text += text.empty() ? name : std::string{", "} + name;
+            }
+        };
+
+        add("cycle", a.cycle != b.cycle);
+        add("PC", a.pc != b.pc);
+        add("opcode", a.opcode != b.opcode);
+        for(size_t i = 0; i < a.regs.size(); ++i)
+        {
+            add(s_REGISTER_NAMES[i], a.regs[i] != b.regs[i]);
+        }
+        add("SP", a.sp != b.sp);
+        add("IME", a.ime != b.ime);
+        return text;
+    }
+
+    // Last record of a block of the sparse trace that the dense one has too, returns false when there is none
+    bool FindLastCommonRecord(Trace& sparse, Trace& dense, size_t blockIdx, TraceRecord& sparseRecord,
+                              TraceRecord& denseRecord)
+    {
+        sparseRecord = sparse.reader.GetBlocks()[blockIdx].lastRecord;
+        if(dense.FindRecord(sparseRecord.instruction, denseRecord))
+        {
+            return true;
+        }
+
+        const std::vector<TraceRecord>& records = sparse.GetBlock(blockIdx);
+        for(auto it = records.rbegin(); it != records.rend(); ++it)
+        {
+            if(dense.FindRecord(it->instruction, denseRecord))
+            {
+                sparseRecord = *it;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void PrintTrace(const char* label, Trace& trace)
+    {
+        std::cout << label << trace.filePath << ", " << trace.reader.GetNbRecords() << " records in "
+                  << trace.reader.GetBlocks().size() << " blocks, up to instruction " << trace.GetLastInstruction() << "\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 3)
+    {
+        std::cout << "Usage: gb-tracediff TRACE_A TRACE_B\n"
+                  << "Finds the first instruction where two traces recorded by gb-headless --trace differ. Traces of\n"
+                  << "the block cache or native code only have the ends of blocks, they are compared where both\n"
+                  << "traces have a record.\n";
+        return 1;
+    }
+
+    Trace a;
+    Trace b;
+    a.filePath = argv[1];
+    b.filePath = argv[2];
+    for(Trace* trace : {&a, &b})
+    {
+        if(!trace->reader.Open(trace->filePath) || trace->reader.GetBlocks().empty())
+        {
+            std::cout << "Unable to read trace: " << trace->filePath << "\n";
+            return 1;
+        }
+    }
+
+    PrintTrace("Trace A:          ", a);
+    PrintTrace("Trace B:          ", b);
+
+    // The checksums of all the records up to the end of each block tell how many blocks are the same in both
+    // traces, without decoding any
+    const std::vector<TraceBlockInfo>& blocksA = a.reader.GetBlocks();
+    const std::vector<TraceBlockInfo>& blocksB = b.reader.GetBlocks();
+    const size_t nbCommonBlocks = std::min(blocksA.size(), blocksB.size());
+    size_t low = 0;
+    size_t high = nbCommonBlocks;
+    while(low < high)
+    {
+        const size_t mid = low + (high - low) / 2;
+        if(blocksA[mid].totalChecksum == blocksB[mid].totalChecksum)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    const size_t nbSameBlocks = low;
+    std::cout << "Same blocks:      " << nbSameBlocks << "\n";
+
+    if(nbSameBlocks == blocksA.size() && nbSameBlocks == blocksB.size())
+    {
+        std::cout << "No divergence\n";
+        return 0;
+    }
+
+    // The rest is compared at the records of the sparser trace that the denser one has too. Traces that diverged
+    // are taken to stay apart, the first block of the sparse one whose last common record differs is searched for.
+    const bool isASparse = a.reader.GetNbRecords() <= b.reader.GetNbRecords();
+    Trace& sparse = isASparse ? a : b;
+    Trace& dense = isASparse ? b : a;
+    const size_t nbSparseBlocks = sparse.reader.GetBlocks().size();
+
+    TraceRecord sparseRecord{};
+    TraceRecord denseRecord{};
+    low = std::min(nbSameBlocks, nbSparseBlocks);
+    high = nbSparseBlocks;
+    while(low < high)
+    {
+        const size_t mid = low + (high - low) / 2;
+        if(!FindLastCommonRecord(sparse, dense, mid, sparseRecord, denseRecord) || sparseRecord == denseRecord)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    if(sparse.isDamaged || dense.isDamaged)
+    {
+        return 1;
+    }
+
+    // The last common record before the block found, then the first one of the block that differs
+    bool hasLastMatch = low > 0 && FindLastCommonRecord(sparse, dense, low - 1, sparseRecord, denseRecord) &&
+                        sparseRecord == denseRecord;
+    TraceRecord lastMatch = sparseRecord;
+    bool isDiverged = false;
+    if(low < nbSparseBlocks)
+    {
+        const std::vector<TraceRecord>& records = sparse.GetBlock(low);
+        for(const TraceRecord& record : records)
+        {
+            if(!dense.FindRecord(record.instruction, denseRecord))
+            {
+                continue;
+            }
+
+            sparseRecord = record;
+            if(sparseRecord != denseRecord)
+            {
+                isDiverged = true;
+                break;
+            }
+            hasLastMatch = true;
+            lastMatch = record;
+        }
+    }
+
+    if(sparse.isDamaged || dense.isDamaged)
+    {
+        return 1;
+    }
+
+    if(!isDiverged)
+    {
+        std::cout << "No divergence where both traces have a record";
+        if(a.GetLastInstruction() != b.GetLastInstruction())
+        {
+            std::cout << ", trace " << (a.GetLastInstruction() < b.GetLastInstruction() ? "A" : "B") << " ends first";
+        }
+        std::cout << "\n";
+        return 0;
+    }
+
+    const TraceRecord& recordA = isASparse ? sparseRecord : denseRecord;
+    const TraceRecord& recordB = isASparse ? denseRecord : sparseRecord;
+    std::cout << "First divergence: instruction " << recordA.instruction << ", " << FormatDifferences(recordA, recordB)
+              << "\n"
+              << "  A: " << FormatRecord(recordA) << "\n"
+              << "  B: " << FormatRecord(recordB) << "\n";
+
+    if(!hasLastMatch)
+    {
+        std::cout << "Last match:       none\n";
+        return 1;
+    }
+    std::cout << "Last match:       instruction " << lastMatch.instruction << "\n";
+
+    // What the denser trace went through in between, down to every instruction when it is a trace of the interpreter
+    std::deque<TraceRecord> contextRecords;
+    bool isContextCut = false;
+    TraceRecord record{};
+    for(uint64_t instruction = lastMatch.instruction + 1; instruction < recordA.instruction; ++instruction)
+    {
+        if(dense.FindRecord(instruction, record))
+        {
+            if(contextRecords.size() == s_NB_CONTEXT_RECORDS)
+            {
+                contextRecords.pop_front();
+                isContextCut = true;
+            }
+            contextRecords.push_back(record);
+        }
+    }
+
+    if(!contextRecords.empty())
+    {
+        std::cout << "In between, " << (isASparse ? "B" : "A") << ":\n" << (isContextCut ? "  ...\n" : "");
+        for(const TraceRecord& contextRecord : contextRecords)
+        {
+            std::cout << "  " << FormatRecord(contextRecord) << "\n";
+        }
+    }
+    return 1;
+}
@@ -1,26 +1,174 @@
 #include "debugwindow.h"
 
+#include "disassemblymodel.h"
+#include "memorymodel.h"
+
+#include <QCheckBox>
+#include <QComboBox>
+#include <QFontDatabase>
+#include <QFontMetrics>
 #include <QGridLayout>
 #include <QGroupBox>
+#include <QHBoxLayout>
+#include <QHeaderView>
 #include <QLabel>
 #include <QLineEdit>
-#include <QTextEdit>
+#include <QListView>
+#include <QListWidget>
+#include <QPushButton>
+#include <QSpinBox>
+#include <QStringList>
+#include <QTableView>
 #include <QVBoxLayout>
 
 #include <memory>
 
-DebugWindow::DebugWindow(QWidget* parent) 
+namespace
+{
+    // "C000" or "C000-C0FF", hexadecimal
+    bool ParseRange(const QString& text, uint16_t& firstAddr, uint16_t& lastAddr)
+    {
+        const QStringList bounds = text.trimmed().split('-');
+        bool isFirstValid = false;
+        bool isLastValid = false;
+        const unsigned int first = bounds.front().trimmed().toUInt(&isFirstValid, 16);
+        const unsigned int last = bounds.back().trimmed().toUInt(&isLastValid, 16);
+        if(bounds.size() > 2 || !isFirstValid || !isLastValid || first > last || last > 0xFFFF)
+        {
+            return false;
+        }
+
+        firstAddr = static_cast<uint16_t>(first);
+        lastAddr = static_cast<uint16_t>(last);
+        return true;
+    }
+
+    QString FormatStop(const Debugger::Stop& stop)
+    {
+        const QString pc = QString{"%1"}.arg(stop.pc, 4, 16, QChar{'0'}).toUpper();
+        switch(stop.reason)
+        {
+            case Debugger::StopReason::Breakpoint:
+                return QObject::tr("Breakpoint at %1").arg(pc);
+            case Debugger::StopReason::Watchpoint:
+                return QObject::tr("%1 of %2 at %3, stopped at %4")
+                    .arg(stop.isWrite ? QObject::tr("Write") : QObject::tr("Read"))
+                    .arg(QString{"%1"}.arg(static_cast<unsigned int>(stop.value), 2, 16, QChar{'0'}).toUpper())
+                    .arg(QString{"%1"}.arg(stop.addr, 4, 16, QChar{'0'}).toUpper())
+                    .arg(pc);
+            case Debugger::StopReason::Step:
+                return QObject::tr("Stepped to %1").arg(pc);
+            case Debugger::StopReason::None:
+            case Debugger::StopReason::Count:
+                break;
+        }
+        return QString{};
+    }
+}
+
+DebugWindow::DebugWindow(EmulationThread& emulationThread, QWidget* parent) 
     : QWidget(parent)
+    , m_emulationThread{emulationThread}
+    , m_isAttached{true}
+    , m_cpuStateEdits{}
+    , m_disasmModel{nullptr}
+    , m_disasmView{nullptr}
+    , m_followPCBox{nullptr}
+    , m_stopLabel{nullptr}
+    , m_memoryModel{nullptr}
+    , m_watchRangeEdit{nullptr}
+    , m_watchAccessBox{nullptr}
+    , m_watchConditionBox{nullptr}
+    , m_watchValueEdit{nullptr}
+    , m_watchList{nullptr}
 {
     auto grid = std::make_unique<QGridLayout>();
-    grid->addWidget(CreateDisasmBox(), 0, 0, 2, 1);
+    grid->addWidget(CreateDisasmBox(), 0, 0, 3, 1);
     grid->addWidget(CreateCpuStateBox(), 0, 1);
     grid->addWidget(CreateMemoryDumpBox(), 1, 1);
+    grid->addWidget(CreateWatchpointsBox(), 2, 1);
 
     setLayout(grid.release());
+
+    // Never waits for the emulation thread, a snapshot not published yet is shown on the next refresh
+    m_emulationThread.EnableDebugSnapshots(true);
+    connect(&m_refreshTimer, &QTimer::timeout, this, [this]()
+    {
+        EmulationThread::DebugSnapshots& snapshots = m_emulationThread.GetDebugSnapshots();
+        if(snapshots.Update())
+        {
+            SetSnapshot(snapshots.GetFrontBuffer());
+        }
+    });
+    m_refreshTimer.start(1000 / 60);
 }
 
-QGroupBox* DebugWindow::CreateCpuStateBox() const
+DebugWindow::~DebugWindow()
+{
+    Detach();
+}
+
+void DebugWindow::closeEvent(QCloseEvent* event)
+{
+    // Closing only hides the window, nothing would show the snapshots nor resume from its breakpoints
+    Detach();
+    QWidget::closeEvent(event);
+}
+
+void DebugWindow::Detach()
+{
+    if(!m_isAttached)
+    {
+        return;
+    }
+    m_isAttached = false;
+    m_refreshTimer.stop();
+
+    // Nothing is left to stop the emulation thread without a way to resume it
+    for(uint16_t addr : m_disasmModel->GetBreakpoints())
+    {
+        m_emulationThread.SetBreakpoint(addr, false);
+    }
+    for(int i = 0; i < m_watchList->count(); ++i)
+    {
+        m_emulationThread.RemoveWatchpoint(0);
+    }
+
+    m_emulationThread.EnableDebugSnapshots(false);
+    m_emulationThread.SetDebugROMBank(-1);
+}
+
+void DebugWindow::SetSnapshot(const EmulationThread::DebugSnapshot& snapshot)
+{
+    const CPU::State& cpu = snapshot.cpu;
+    for(size_t i = 0; i < cpu.regs.size(); ++i)
+    {
+        m_cpuStateEdits[i]->setText(QString{"%1"}.arg(static_cast<unsigned int>(cpu.regs[i]), 2, 16, QChar{'0'}).toUpper());
+    }
+    m_cpuStateEdits[8]->setText(QString{"%1"}.arg(cpu.pc, 4, 16, QChar{'0'}).toUpper());
+    m_cpuStateEdits[9]->setText(QString{"%1"}.arg(cpu.sp, 4, 16, QChar{'0'}).toUpper());
+    m_stopLabel->setText(FormatStop(snapshot.stop));
+
+    // Resetting the model loses the scroll position, the view is put back on the same address
+    const QModelIndex topIndex = m_disasmView->indexAt(QPoint{0, 0});
+    const uint16_t topAddr = m_disasmModel->GetAddress(topIndex.row());
+
+    m_disasmModel->SetSnapshot(&snapshot);
+
+    const int pcRow = m_disasmModel->GetPCRow();
+    if(m_followPCBox->isChecked() && pcRow >= 0)
+    {
+        m_disasmView->scrollTo(m_disasmModel->index(pcRow), QAbstractItemView::EnsureVisible);
+    }
+    else if(topIndex.isValid() && m_disasmModel->GetRow(topAddr) != topIndex.row())
+    {
+        m_disasmView->scrollTo(m_disasmModel->index(m_disasmModel->GetRow(topAddr)), QAbstractItemView::PositionAtTop);
+    }
+
+    m_memoryModel->SetSnapshot(&snapshot);
+}
+
+QGroupBox* DebugWindow::CreateCpuStateBox()
 {
     auto layout = std::make_unique<QGridLayout>();
 
@@ -31,6 +179,7 @@ QGroupBox* DebugWindow::CreateCpuStateBox() const
         auto label = std::make_unique<QLabel>(tr(labels[i].c_str()));
         auto lineEdit = std::make_unique<QLineEdit>();
         lineEdit->setReadOnly(true);
+        m_cpuStateEdits[i] = lineEdit.get();
 
         const int rowIdx = i / 2;
         const bool isEven = (i % 2) == 0;
@@ -47,14 +196,83 @@ QGroupBox* DebugWindow::CreateCpuStateBox() const
     return cpuBox.release();
 }
 
-QGroupBox* DebugWindow::CreateDisasmBox() const
+QGroupBox* DebugWindow::CreateDisasmBox()
 {
-    auto disasmText = std::make_unique<QTextEdit>();
-    disasmText->setReadOnly(true);
-    disasmText->setPlaceholderText("Lorem ipsum");
+    m_disasmModel = new DisassemblyModel{this};
+
+    // Rows of a single height let the view place any of them without measuring the others
+    auto disasmView = std::make_unique<QListView>();
+    disasmView->setModel(m_disasmModel);
+    disasmView->setUniformItemSizes(true);
+    disasmView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    m_disasmView = disasmView.get();
+
+    auto followPCBox = std::make_unique<QCheckBox>(tr("Follow PC"));
+    followPCBox->setChecked(true);
+    m_followPCBox = followPCBox.get();
+
+    // Any bank of the ROM can be listed in the switchable area, not only the mapped one
+    auto romBankBox = std::make_unique<QSpinBox>();
+    romBankBox->setRange(-1, 0x1FF);
+    romBankBox->setSpecialValueText(tr("Mapped"));
+    romBankBox->setValue(-1);
+    connect(romBankBox.get(), QOverload<int>::of(&QSpinBox::valueChanged), this, [this](int bank)
+    {
+        m_emulationThread.SetDebugROMBank(bank);
+    });
+
+    auto romBankLabel = std::make_unique<QLabel>(tr("ROM bank"));
+
+    auto optionsLayout = std::make_unique<QHBoxLayout>();
+    optionsLayout->addWidget(followPCBox.release());
+    optionsLayout->addStretch();
+    optionsLayout->addWidget(romBankLabel.release());
+    optionsLayout->addWidget(romBankBox.release());
+
+    // Double-clicking a line sets or clears its breakpoint
+    connect(disasmView.get(), &QListView::doubleClicked, this, [this](const QModelIndex& index)
+    {
+        const bool isSet = m_disasmModel->ToggleBreakpoint(index.row());
+        m_emulationThread.SetBreakpoint(m_disasmModel->GetAddress(index.row()), isSet);
+    });
+
+    auto continueButton = std::make_unique<QPushButton>(tr("Continue"));
+    connect(continueButton.get(), &QPushButton::clicked, this, [this](){ m_emulationThread.Resume(); });
+
+    auto pauseButton = std::make_unique<QPushButton>(tr("Pause"));
+    connect(pauseButton.get(), &QPushButton::clicked, this, [this](){ m_emulationThread.Pause(); });
+
+    auto stepButton = std::make_unique<QPushButton>(tr("Step"));
+    connect(stepButton.get(), &QPushButton::clicked, this, [this](){ m_emulationThread.Step(); });
+
+    auto stepOverButton = std::make_unique<QPushButton>(tr("Step over"));
+    connect(stepOverButton.get(), &QPushButton::clicked, this, [this](){ m_emulationThread.StepOver(); });
+
+    auto runToButton = std::make_unique<QPushButton>(tr("Run to cursor"));
+    connect(runToButton.get(), &QPushButton::clicked, this, [this]()
+    {
+        const QModelIndex index = m_disasmView->currentIndex();
+        if(index.isValid())
+        {
+            m_emulationThread.RunTo(m_disasmModel->GetAddress(index.row()));
+        }
+    });
+
+    auto controlsLayout = std::make_unique<QHBoxLayout>();
+    controlsLayout->addWidget(continueButton.release());
+    controlsLayout->addWidget(pauseButton.release());
+    controlsLayout->addWidget(stepButton.release());
+    controlsLayout->addWidget(stepOverButton.release());
+    controlsLayout->addWidget(runToButton.release());
+
+    auto stopLabel = std::make_unique<QLabel>();
+    m_stopLabel = stopLabel.get();
 
     auto layout = std::make_unique<QVBoxLayout>();
-    layout->addWidget(disasmText.release());
+    layout->addLayout(controlsLayout.release());
+    layout->addWidget(stopLabel.release());
+    layout->addLayout(optionsLayout.release());
+    layout->addWidget(disasmView.release());
 
     auto disasmBox = std::make_unique<QGroupBox>(tr("Program Disassembly"));
     disasmBox->setLayout(layout.release());
@@ -62,17 +280,133 @@ QGroupBox* DebugWindow::CreateDisasmBox() const
     return disasmBox.release();
 }
 
-QGroupBox* DebugWindow::CreateMemoryDumpBox() const
-{   
-    auto memText = std::make_unique<QTextEdit>();
-    memText->setReadOnly(true);
-    memText->setPlaceholderText("Lorem ipsum");
+QGroupBox* DebugWindow::CreateMemoryDumpBox()
+{
+    m_memoryModel = new MemoryModel{this};
+
+    // Fixed row heights and column widths spare the view measuring 4096 rows, it only draws those on screen
+    auto memView = std::make_unique<QTableView>();
+    memView->setModel(m_memoryModel);
+    memView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    memView->setShowGrid(false);
+    memView->setSelectionMode(QAbstractItemView::NoSelection);
+
+    const QFontMetrics metrics{memView->font()};
+    QHeaderView* rowHeader = memView->verticalHeader();
+    rowHeader->setSectionResizeMode(QHeaderView::Fixed);
+    rowHeader->setDefaultSectionSize(metrics.height());
+    rowHeader->setFont(memView->font());
+
+    QHeaderView* columnHeader = memView->horizontalHeader();
+    columnHeader->setSectionResizeMode(QHeaderView::Fixed);
+    columnHeader->setDefaultSectionSize(metrics.averageCharWidth() * 3);
+    columnHeader->setStretchLastSection(true);
+    columnHeader->setFont(memView->font());
 
     auto layout = std::make_unique<QVBoxLayout>();
-    layout->addWidget(memText.release());
+    layout->addWidget(memView.release());
 
     auto memBox = std::make_unique<QGroupBox>(tr("Memory Dump"));
     memBox->setLayout(layout.release());
 
     return memBox.release();
 }
+
+QGroupBox* DebugWindow::CreateWatchpointsBox()
+{
+    auto rangeEdit = std::make_unique<QLineEdit>();
+    rangeEdit->setPlaceholderText(tr("C000-C0FF"));
+    m_watchRangeEdit = rangeEdit.get();
+
+    // In the order of Debugger::Access and Debugger::Condition
+    auto accessBox = std::make_unique<QComboBox>();
+    accessBox->addItem(tr("Read"), static_cast<int>(Debugger::Access::Read));
+    accessBox->addItem(tr("Write"), static_cast<int>(Debugger::Access::Write));
+    accessBox->addItem(tr("Read/write"), static_cast<int>(Debugger::Access::ReadWrite));
+    accessBox->setCurrentIndex(1);
+    m_watchAccessBox = accessBox.get();
+
+    auto conditionBox = std::make_unique<QComboBox>();
+    conditionBox->addItem(tr("Any value"), static_cast<int>(Debugger::Condition::Any));
+    conditionBox->addItem(tr("Equal to"), static_cast<int>(Debugger::Condition::Equal));
+    conditionBox->addItem(tr("Not equal to"), static_cast<int>(Debugger::Condition::NotEqual));
+    conditionBox->addItem(tr("Changed"), static_cast<int>(Debugger::Condition::Changed));
+    m_watchConditionBox = conditionBox.get();
+
+    auto valueEdit = std::make_unique<QLineEdit>();
+    valueEdit->setPlaceholderText(tr("00"));
+    valueEdit->setMaxLength(2);
+    m_watchValueEdit = valueEdit.get();
+
+    auto addButton = std::make_unique<QPushButton>(tr("Add"));
+    connect(addButton.get(), &QPushButton::clicked, this, [this](){ AddWatchpoint(); });
+
+    auto watchList = std::make_unique<QListWidget>();
+    m_watchList = watchList.get();
+
+    auto removeButton = std::make_unique<QPushButton>(tr("Remove"));
+    connect(removeButton.get(), &QPushButton::clicked, this, [this]()
+    {
+        const int row = m_watchList->currentRow();
+        if(row >= 0)
+        {
+            delete m_watchList->takeItem(row);
+            m_emulationThread.RemoveWatchpoint(static_cast<size_t>(row));
+        }
+    });
+
+    auto editLayout = std::make_unique<QHBoxLayout>();
+    editLayout->addWidget(rangeEdit.release());
+    editLayout->addWidget(accessBox.release());
+    editLayout->addWidget(conditionBox.release());
+    editLayout->addWidget(valueEdit.release());
+    editLayout->addWidget(addButton.release());
+
+    auto layout = std::make_unique<QVBoxLayout>();
+    layout->addLayout(editLayout.release());
+    layout->addWidget(watchList.release());
+    layout->addWidget(removeButton.release());
+
+    auto watchBox = std::make_unique<QGroupBox>(tr("Watchpoints"));
+    watchBox->setLayout(layout.release());
+
+    return watchBox.release();
+}
+
+void DebugWindow::AddWatchpoint()
+{
+    Debugger::Watchpoint watchpoint{};
+    if(!ParseRange(m_watchRangeEdit->text(), watchpoint.firstAddr, watchpoint.lastAddr))
+    {
+        return;
+    }
+
+    watchpoint.access = static_cast<Debugger::Access>(m_watchAccessBox->currentData().toInt());
+    watchpoint.condition = static_cast<Debugger::Condition>(m_watchConditionBox->currentData().toInt());
+
+    bool isValueValid = true;
+    const bool isValueUsed = watchpoint.condition == Debugger::Condition::Equal ||
+                             watchpoint.condition == Debugger::Condition::NotEqual;
+    if(isValueUsed)
+    {
+        watchpoint.value = static_cast<uint8_t>(m_watchValueEdit->text().toUInt(&isValueValid, 16));
+    }
+    if(!isValueValid)
+    {
+        return;
+    }
+
+    m_emulationThread.AddWatchpoint(watchpoint);
+
+    // "Write C000-C0FF Equal to 3C"
+    QString text = m_watchAccessBox->currentText() + " " + m_watchRangeEdit->text().trimmed().toUpper();
+    if(watchpoint.condition != Debugger::Condition::Any)
+    {
+        text += " " + m_watchConditionBox->currentText();
+    }
+    if(isValueUsed)
+    {
+        text += " " + QString{"%1"}.arg(static_cast<unsigned int>(watchpoint.value), 2, 16, QChar{'0'}).toUpper();
+    }
+    m_watchList->addItem(text);
+}
@@ -1,19 +1,69 @@
 #ifndef DEBUG_WINDOW_H
 #define DEBUG_WINDOW_H
 
+#include <emulationthread.h>
+
+#include <QTimer>
 #include <QWidget>
 
+#include <array>
+
+class DisassemblyModel;
+class MemoryModel;
+class QCheckBox;
+class QCloseEvent;
+class QComboBox;
 class QGroupBox;
+class QLabel;
+class QLineEdit;
+class QListView;
+class QListWidget;
 
+// Shows the debug snapshots of the emulation thread, picked up whenever the window refreshes
 class DebugWindow : public QWidget
 {
 public:
-    DebugWindow(QWidget* parent = nullptr);
+    DebugWindow(EmulationThread& emulationThread, QWidget* parent = nullptr);
+    virtual ~DebugWindow();
+
+public: // Qt interface
+    virtual void closeEvent(QCloseEvent* event);
 
 private:
-    QGroupBox* CreateCpuStateBox() const;
-    QGroupBox* CreateDisasmBox() const;
-    QGroupBox* CreateMemoryDumpBox() const;
+    void Detach();
+
+    QGroupBox* CreateCpuStateBox();
+    QGroupBox* CreateDisasmBox();
+    QGroupBox* CreateMemoryDumpBox();
+    QGroupBox* CreateWatchpointsBox();
+
+    void AddWatchpoint();
+
+    void SetSnapshot(const EmulationThread::DebugSnapshot& snapshot);
+
+private:
+    EmulationThread& m_emulationThread;
+    QTimer m_refreshTimer;
+
+    // Until the window closes, the emulation thread takes its snapshots and stops at its breakpoints and watchpoints
+    bool m_isAttached;
+
+    // In the order of the labels: A, F, B, C, D, E, H, L, PC, SP
+    std::array<QLineEdit*, 10> m_cpuStateEdits;
+
+    DisassemblyModel* m_disasmModel;
+    QListView* m_disasmView;
+    QCheckBox* m_followPCBox;
+    QLabel* m_stopLabel;
+
+    MemoryModel* m_memoryModel;
+
+    // In the order of the watchpoints of the debugger, the window is the only one adding or removing them
+    QLineEdit* m_watchRangeEdit;
+    QComboBox* m_watchAccessBox;
+    QComboBox* m_watchConditionBox;
+    QLineEdit* m_watchValueEdit;
+    QListWidget* m_watchList;
 };
 
-#endif // DEBUG_WINDOW_H
\ No newline at end of file
+#endif // DEBUG_WINDOW_H
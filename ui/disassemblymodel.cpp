@@ -0,0 +1,138 @@
+#include "disassemblymodel.h"
+
+#include <disassembler.h>
+
+#include <QBrush>
+#include <QColor>
+
+#include <algorithm>
+
+DisassemblyModel::DisassemblyModel(QObject* parent)
+    : QAbstractListModel(parent)
+    , m_snapshot{nullptr}
+    , m_linesVersion{}
+    , m_pcRow{-1}
+{
+}
+
+void DisassemblyModel::SetSnapshot(const EmulationThread::DebugSnapshot* snapshot)
+{
+    // Rows only come and go when the lines change, otherwise the rows on screen are redrawn
+    const bool isReset = snapshot == nullptr || m_snapshot == nullptr || snapshot->linesVersion != m_linesVersion;
+    if(isReset)
+    {
+        beginResetModel();
+    }
+
+    m_snapshot = snapshot;
+    m_linesVersion = snapshot != nullptr ? snapshot->linesVersion : 0;
+    m_pcRow = snapshot != nullptr ? GetRow(snapshot->cpu.pc) : -1;
+
+    if(isReset)
+    {
+        endResetModel();
+    }
+    else if(rowCount() > 0)
+    {
+        emit dataChanged(index(0), index(rowCount() - 1));
+    }
+}
+
+int DisassemblyModel::GetRow(uint16_t addr) const
+{
+    if(m_snapshot == nullptr || m_snapshot->lines.empty())
+    {
+        return -1;
+    }
+
+    const std::vector<DisassemblyCache::Line>& lines = m_snapshot->lines;
+    auto isBefore = [](uint16_t addr, const DisassemblyCache::Line& line){ return addr < line.addr; };
+    auto line = std::upper_bound(lines.begin(), lines.end(), addr, isBefore);
+    return static_cast<int>(std::max<ptrdiff_t>(line - lines.begin() - 1, 0));
+}
+
+uint16_t DisassemblyModel::GetAddress(int row) const
+{
+    if(m_snapshot == nullptr || row < 0 || row >= rowCount())
+    {
+        return 0;
+    }
+
+    return m_snapshot->lines[static_cast<size_t>(row)].addr;
+}
+
+bool DisassemblyModel::ToggleBreakpoint(int row)
+{
+    if(row < 0 || row >= rowCount())
+    {
+        return false;
+    }
+
+    const uint16_t addr = GetAddress(row);
+    const bool isSet = m_breakpoints.count(addr) == 0;
+    if(isSet)
+    {
+        m_breakpoints.insert(addr);
+    }
+    else
+    {
+        m_breakpoints.erase(addr);
+    }
+
+    emit dataChanged(index(row), index(row));
+    return isSet;
+}
+
+int DisassemblyModel::rowCount(const QModelIndex& parent) const
+{
+    return m_snapshot != nullptr && !parent.isValid() ? static_cast<int>(m_snapshot->lines.size()) : 0;
+}
+
+QVariant DisassemblyModel::data(const QModelIndex& index, int role) const
+{
+    if(m_snapshot == nullptr || !index.isValid() || index.row() >= rowCount())
+    {
+        return QVariant{};
+    }
+
+    // The PC shows over a breakpoint
+    const DisassemblyCache::Line& line = m_snapshot->lines[static_cast<size_t>(index.row())];
+    if(role == Qt::BackgroundRole)
+    {
+        if(index.row() == m_pcRow)
+        {
+            return QVariant{QBrush{QColor{0xFF, 0xF0, 0xA0}}};
+        }
+        return m_breakpoints.count(line.addr) != 0 ? QVariant{QBrush{QColor{0xFF, 0xC0, 0xC0}}} : QVariant{};
+    }
+    if(role != Qt::DisplayRole)
+    {
+        return QVariant{};
+    }
+
+    // "BB:AAAA  bytes  instruction", addresses outside ROM have no bank
+    const uint8_t* bytes = &m_snapshot->memory[line.addr];
+
+    QString text;
+    if(line.addr < 0x8000)
+    {
+        const uint16_t bank = line.addr < 0x4000 ? m_snapshot->lowROMBank : m_snapshot->highROMBank;
+        text += QString{"%1:"}.arg(bank, 2, 16, QChar{'0'});
+    }
+    else
+    {
+        text += "   ";
+    }
+    text += QString{"%1 "}.arg(line.addr, 4, 16, QChar{'0'});
+
+    for(unsigned int i = 0; i < 3; ++i)
+    {
+        text += i < line.size ? QString{" %1"}.arg(static_cast<unsigned int>(bytes[i]), 2, 16, QChar{'0'}) : QString{"   "};
+    }
+    text = text.toUpper();
+
+    const std::string instruction = line.isData ? Disassembler::DisassembleData(bytes[0])
+                                                : Disassembler::Disassemble(line.addr, bytes);
+    text += "  " + QString::fromStdString(instruction);
+    return text;
+}
@@ -0,0 +1,40 @@
+#ifndef DISASSEMBLY_MODEL_H
+#define DISASSEMBLY_MODEL_H
+
+#include <emulationthread.h>
+
+#include <QAbstractListModel>
+
+#include <set>
+
+// One row per line of the disassembly in a debug snapshot. Views only ask for the rows on screen, their text is
+// made when they are drawn, so the whole address space costs no more than a screenful.
+class DisassemblyModel final : public QAbstractListModel
+{
+public:
+    explicit DisassemblyModel(QObject* parent = nullptr);
+
+    // Shows a snapshot, which must stay valid until the next one is set
+    void SetSnapshot(const EmulationThread::DebugSnapshot* snapshot);
+
+    // Row of the line holding an address, -1 without a snapshot
+    int GetRow(uint16_t addr) const;
+    uint16_t GetAddress(int row) const;
+    int GetPCRow() const { return m_pcRow; }
+
+    // Breakpoints are shown on their lines, returns whether the line of a row has one now, false without a line
+    bool ToggleBreakpoint(int row);
+    const std::set<uint16_t>& GetBreakpoints() const { return m_breakpoints; }
+
+public: // Qt interface
+    virtual int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+private:
+    const EmulationThread::DebugSnapshot* m_snapshot;
+    uint64_t m_linesVersion;
+    int m_pcRow;
+    std::set<uint16_t> m_breakpoints;
+};
+
+#endif // DISASSEMBLY_MODEL_H
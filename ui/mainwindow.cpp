@@ -14,6 +14,8 @@ MainWindow::MainWindow(QWidget* parent)
 
     m_renderWidget = std::make_unique<RenderWidget>(this);
     setCentralWidget(m_renderWidget.get());
+
+    m_renderWidget->SetFrameSource(&m_emulationThread.GetFrames());
 }
 
 MainWindow::~MainWindow() = default;
@@ -26,6 +28,15 @@ void MainWindow::CreateMenus()
 
     QMenu* emulationMenu = menuBar()->addMenu(tr("&Emulation"));
     emulationMenu->addAction("Play", this, SLOT(Play()));
+    emulationMenu->addAction("Pause/Resume", this, SLOT(TogglePause()));
+    emulationMenu->addAction("Stop", this, SLOT(Stop()));
+
+    QAction* throttleAction = emulationMenu->addAction("Limit Speed", this, SLOT(SetThrottled(bool)));
+    throttleAction->setCheckable(true);
+    throttleAction->setChecked(true);
+
+    QAction* fastForwardAction = emulationMenu->addAction("Fast Forward", this, SLOT(SetFastForward(bool)), Qt::Key_Tab);
+    fastForwardAction->setCheckable(true);
 
     QMenu* toolsMenu = menuBar()->addMenu(tr("&Tools"));
     toolsMenu->addAction("Open Debug Window", this, SLOT(OpenDebugWindow()));
@@ -43,6 +54,8 @@ void MainWindow::About()
 void MainWindow::Open()
 {
     QString filename = QFileDialog::getOpenFileName(this);
+
+    m_emulationThread.Stop();
     if(!m_emu.LoadCartridge(filename.toStdString()))
     {
         QMessageBox::critical(this, tr("Error"),
@@ -52,11 +65,40 @@ void MainWindow::Open()
 
 void MainWindow::OpenDebugWindow()
 {
-    m_debugWindow.reset(new DebugWindow);
+    // The previous window detaches from the emulation thread before the new one attaches
+    m_debugWindow.reset();
+    m_debugWindow = std::make_unique<DebugWindow>(m_emulationThread);
     m_debugWindow->show();
 }
 
 void MainWindow::Play()
 {
-    m_emu.Play();
+    m_emulationThread.Start();
+}
+
+void MainWindow::TogglePause()
+{
+    if(m_emulationThread.IsPaused())
+    {
+        m_emulationThread.Resume();
+    }
+    else
+    {
+        m_emulationThread.Pause();
+    }
+}
+
+void MainWindow::Stop()
+{
+    m_emulationThread.Stop();
+}
+
+void MainWindow::SetThrottled(bool isThrottled)
+{
+    m_emulationThread.SetThrottled(isThrottled);
+}
+
+void MainWindow::SetFastForward(bool isEnabled)
+{
+    m_emulationThread.SetFastForward(isEnabled);
 }
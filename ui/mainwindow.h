@@ -1,6 +1,7 @@
 #ifndef MAIN_WINDOW_H
 #define MAIN_WINDOW_H
 
+#include <emulationthread.h>
 #include <emulator.h>
 
 #include <QMainWindow>
@@ -23,14 +24,23 @@ private slots:
     void Open();
     void OpenDebugWindow();
     void Play();
+    void TogglePause();
+    void Stop();
+    void SetThrottled(bool isThrottled);
+    void SetFastForward(bool isEnabled);
 
 private:
     void CreateMenus();
 
 private:
-    std::unique_ptr<DebugWindow> m_debugWindow;
     std::unique_ptr<RenderWidget> m_renderWidget;
     Emulator m_emu;
+
+    // Stopped before the emulator goes away
+    EmulationThread m_emulationThread{m_emu};
+
+    // Closed before the emulation thread it shows goes away
+    std::unique_ptr<DebugWindow> m_debugWindow;
 };
 
 #endif // MAIN_WINDOW_H
\ No newline at end of file
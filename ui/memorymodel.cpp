@@ -0,0 +1,94 @@
+#include "memorymodel.h"
+
+MemoryModel::MemoryModel(QObject* parent)
+    : QAbstractTableModel(parent)
+    , m_snapshot{nullptr}
+    , m_pageVersions{}
+{
+}
+
+void MemoryModel::SetSnapshot(const EmulationThread::DebugSnapshot* snapshot)
+{
+    // The rows are always the same, only the first snapshot and its removal change them
+    if(snapshot == nullptr || m_snapshot == nullptr)
+    {
+        beginResetModel();
+        m_snapshot = snapshot;
+        if(snapshot != nullptr)
+        {
+            m_pageVersions = snapshot->pageVersions;
+        }
+        endResetModel();
+        return;
+    }
+
+    m_snapshot = snapshot;
+
+    // Runs of changed pages are redrawn at once
+    for(unsigned int page = 0; page < Memory::m_NB_PAGES;)
+    {
+        if(snapshot->pageVersions[page] == m_pageVersions[page])
+        {
+            ++page;
+            continue;
+        }
+
+        const unsigned int firstPage = page;
+        while(page < Memory::m_NB_PAGES && snapshot->pageVersions[page] != m_pageVersions[page])
+        {
+            m_pageVersions[page] = snapshot->pageVersions[page];
+            ++page;
+        }
+
+        emit dataChanged(index(static_cast<int>(firstPage) * m_ROWS_PER_PAGE, 0),
+                         index(static_cast<int>(page) * m_ROWS_PER_PAGE - 1, m_ASCII_COLUMN));
+    }
+}
+
+int MemoryModel::rowCount(const QModelIndex& parent) const
+{
+    return m_snapshot != nullptr && !parent.isValid() ? static_cast<int>(m_snapshot->memory.size()) / m_BYTES_PER_ROW : 0;
+}
+
+int MemoryModel::columnCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : m_BYTES_PER_ROW + 1;
+}
+
+QVariant MemoryModel::data(const QModelIndex& index, int role) const
+{
+    if(m_snapshot == nullptr || !index.isValid() || role != Qt::DisplayRole || index.row() >= rowCount())
+    {
+        return QVariant{};
+    }
+
+    const size_t rowAddr = static_cast<size_t>(index.row()) * m_BYTES_PER_ROW;
+    if(index.column() != m_ASCII_COLUMN)
+    {
+        const unsigned int value = m_snapshot->memory[rowAddr + static_cast<size_t>(index.column())];
+        return QString{"%1"}.arg(value, 2, 16, QChar{'0'}).toUpper();
+    }
+
+    // Bytes that are not printable show as dots
+    QString text;
+    for(size_t i = 0; i < static_cast<size_t>(m_BYTES_PER_ROW); ++i)
+    {
+        const uint8_t value = m_snapshot->memory[rowAddr + i];
+        text += value >= 0x20 && value < 0x7F ? static_cast<char>(value) : '.';
+    }
+    return text;
+}
+
+QVariant MemoryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(role != Qt::DisplayRole)
+    {
+        return QVariant{};
+    }
+
+    if(orientation == Qt::Vertical)
+    {
+        return QString{"%1"}.arg(static_cast<unsigned int>(section * m_BYTES_PER_ROW), 4, 16, QChar{'0'}).toUpper();
+    }
+    return section == m_ASCII_COLUMN ? QString{} : QString{"%1"}.arg(section, 0, 16).toUpper();
+}
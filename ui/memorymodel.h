@@ -0,0 +1,37 @@
+#ifndef MEMORY_MODEL_H
+#define MEMORY_MODEL_H
+
+#include <emulationthread.h>
+
+#include <QAbstractTableModel>
+
+#include <array>
+
+// Hex dump of the address space in a debug snapshot, 16 bytes per row followed by their characters. Only the rows
+// of the pages that changed since the previous snapshot are redrawn, the others keep what the view drew already.
+class MemoryModel final : public QAbstractTableModel
+{
+public:
+    explicit MemoryModel(QObject* parent = nullptr);
+
+    // Shows a snapshot, which must stay valid until the next one is set
+    void SetSnapshot(const EmulationThread::DebugSnapshot* snapshot);
+
+public: // Qt interface
+    virtual int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    virtual int columnCount(const QModelIndex& parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+    virtual QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+private:
+    static constexpr int m_BYTES_PER_ROW = 16;
+    static constexpr int m_ROWS_PER_PAGE = Memory::m_PAGE_SIZE / m_BYTES_PER_ROW;
+    static constexpr int m_ASCII_COLUMN = m_BYTES_PER_ROW;
+
+    const EmulationThread::DebugSnapshot* m_snapshot;
+
+    // Versions of the pages shown, see DebugSnapshot
+    std::array<uint32_t, Memory::m_NB_PAGES> m_pageVersions;
+};
+
+#endif // MEMORY_MODEL_H
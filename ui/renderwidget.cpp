@@ -3,11 +3,44 @@
 #include <QApplication>
 #include <QPainter>
 
+#include <algorithm>
+
 RenderWidget::RenderWidget(QWidget* parent) :
     QWidget(parent)
+    , m_frames{nullptr}
     , m_logo{":/images/gameboy.png", "png"}
+    , m_frame{PPU::m_SCREEN_WIDTH, PPU::m_SCREEN_HEIGHT, QImage::Format_RGB32}
+    , m_hasFrame{false}
 {
     Q_INIT_RESOURCE(resources);
+
+    // Never waits for the emulation thread, a frame not published yet is shown on the next refresh
+    m_refreshTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_refreshTimer, &QTimer::timeout, this, [this]()
+    {
+        if(m_frames != nullptr && m_frames->Update())
+        {
+            SetFrame(m_frames->GetFrontBuffer());
+        }
+    });
+    m_refreshTimer.start(1000 / 60);
+}
+
+void RenderWidget::SetFrameSource(EmulationThread::Frames* frames)
+{
+    m_frames = frames;
+}
+
+void RenderWidget::SetFrame(const PPU::Framebuffer& frame)
+{
+    // The framebuffer already holds 0xAARRGGBB pixels, the layout of Format_RGB32
+    for(unsigned int y = 0; y < PPU::m_SCREEN_HEIGHT; ++y)
+    {
+        std::copy_n(&frame[y * PPU::m_SCREEN_WIDTH], PPU::m_SCREEN_WIDTH, reinterpret_cast<uint32_t*>(m_frame.scanLine(y)));
+    }
+
+    m_hasFrame = true;
+    update();
 }
 
 void RenderWidget::paintEvent(QPaintEvent* event)
@@ -18,12 +51,14 @@ void RenderWidget::paintEvent(QPaintEvent* event)
     const int rectHeight = rect().height();
     const int rectWidth = rect().width();
 
-    const QImage scaledLogo = m_logo.scaled(rectWidth, rectHeight, Qt::KeepAspectRatio);
+    // Keep the pixels sharp when scaling the screen up
+    const QImage scaledImage = m_hasFrame ? m_frame.scaled(rectWidth, rectHeight, Qt::KeepAspectRatio, Qt::FastTransformation)
+                                         : m_logo.scaled(rectWidth, rectHeight, Qt::KeepAspectRatio);
 
-    const int imgHeight = scaledLogo.height();
-    const int imgWidth = scaledLogo.width();
+    const int imgHeight = scaledImage.height();
+    const int imgWidth = scaledImage.width();
 
     painter.drawPixmap(
         QPoint{(rectWidth - imgWidth) / 2, (rectHeight - imgHeight) / 2}, 
-        QPixmap::fromImage(scaledLogo));
+        QPixmap::fromImage(scaledImage));
 }
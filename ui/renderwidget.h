@@ -1,6 +1,10 @@
 #ifndef RENDER_WIDGET_H
 #define RENDER_WIDGET_H
 
+#include <emulationthread.h>
+
+#include <QImage>
+#include <QTimer>
 #include <QWidget>
 
 #include <memory>
@@ -12,11 +16,22 @@ class RenderWidget final : public QWidget
 public:
     RenderWidget(QWidget* parent = nullptr);
 
+    // Shows the latest frame published by the emulation thread instead of the logo, checked on every refresh
+    void SetFrameSource(EmulationThread::Frames* frames);
+
 public: // Qt interface
     virtual void paintEvent(QPaintEvent* event);
 
 private:
+    void SetFrame(const PPU::Framebuffer& frame);
+
+private:
+    EmulationThread::Frames* m_frames;
+    QTimer m_refreshTimer;
+
     QImage m_logo;
+    QImage m_frame;
+    bool m_hasFrame;
 };
 
 #endif // RENDER_WIDGET_H
\ No newline at end of file